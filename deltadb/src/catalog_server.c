@@ -277,7 +277,12 @@ static void handle_update( const char *addr, int port, const char *raw_data, int
 		// then it is JX/JSON, otherwise it is the legacy nvpair format.
 
 		if(data[0]=='{') {
-			j = jx_parse_string(data);
+			/*
+			The update becomes the stored value of the object in the table,
+			so it is parsed onto the heap and not into a jx_arena, which would
+			only add a copy of every update.
+			*/
+			j = jx_parse_json_string(data);
 			if(!j) {
 				debug(D_DEBUG,"warning: %s:%d sent invalid JSON data (ignoring it)\n%s\n",addr,port,data);
 				return;
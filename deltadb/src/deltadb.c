@@ -100,7 +100,7 @@ static int checkpoint_read( struct deltadb *db, const char *filename )
 	if(!file) return 0;
 
 	/* Load the entire checkpoint into one json object */
-	struct jx *jcheckpoint = jx_parse_stream(file);
+	struct jx *jcheckpoint = jx_parse_json_stream(file);
 
 	fclose(file);
 
@@ -335,7 +335,7 @@ static int log_replay( struct deltadb *db, const char *filename, time_t snapshot
 				jvalue = nvpair_to_jx(nv);
 				hash_table_insert(db->table,key,jvalue);
 			} else if(n==2) {
-				jvalue = jx_parse_string(value);
+				jvalue = jx_parse_json_string(value);
 				if(jvalue) {
 					hash_table_insert(db->table,key,jvalue);
 				} else {
@@ -348,7 +348,7 @@ static int log_replay( struct deltadb *db, const char *filename, time_t snapshot
 		} else if(line[0]=='M') {
 			n = sscanf(line,"M %s %[^\n]",key,value);
 			if(n==2) {
-				jvalue = jx_parse_string(value);
+				jvalue = jx_parse_json_string(value);
 				if(jvalue) {
 					handle_merge(db,key,jvalue);
 				} else {
@@ -376,7 +376,7 @@ static int log_replay( struct deltadb *db, const char *filename, time_t snapshot
 				corrupt_data(filename,line);
 				continue;
 			}
-			jvalue = jx_parse_string(value);
+			jvalue = jx_parse_json_string(value);
 			if(!jvalue) jvalue = jx_string(value);
 
 			struct jx *jname = jx_string(name);
@@ -0,0 +1,510 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "deltadb_binary.h"
+
+#include "jx.h"
+#include "jx_binary.h"
+#include "jx_parse.h"
+#include "nvpair.h"
+#include "nvpair_jx.h"
+#include "hash_table.h"
+#include "debug.h"
+#include "xxmalloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_LINE_MAX 65536
+
+/*
+The layout of a binary log, with all integers in host byte order,
+as in jx_binary:
+
+	"DDB1"
+	records, each one of:
+		'C' key:u32 length:u32 value
+		'D' key:u32
+		'M' key:u32 length:u32 value
+		'U' key:u32 namelength:u16 name length:u32 value
+		'R' key:u32 namelength:u16 name
+		'T' time:i64
+	index:
+		nkeys:u32, then for each key: length:u16 key
+		ntimes:u32, then for each T record: time:i64 offset:u64
+	source_length:u64 index_offset:u64 "DDBI"
+
+The source length is the size of the text log that was converted,
+so that a reader can tell when more has been appended to it since.
+*/
+
+#define DELTADB_BINARY_MAGIC "DDB1"
+#define DELTADB_BINARY_INDEX_MAGIC "DDBI"
+#define DELTADB_BINARY_MAGIC_LENGTH 4
+#define DELTADB_BINARY_TRAILER_LENGTH (8 + 8 + DELTADB_BINARY_MAGIC_LENGTH)
+
+struct deltadb_binary_writer {
+	FILE *output;
+	struct hash_table *key_ids;
+	char **keys;
+	uint32_t nkeys;
+	uint32_t keys_size;
+	int64_t *times;
+	uint64_t *offsets;
+	uint32_t ntimes;
+	uint32_t times_size;
+};
+
+static int write_data( FILE *output, const void *data, size_t length )
+{
+	return fwrite(data, length, 1, output) == 1 || length == 0;
+}
+
+static uint32_t writer_key_id( struct deltadb_binary_writer *w, const char *key )
+{
+	uintptr_t id = (uintptr_t) hash_table_lookup(w->key_ids, key);
+	if(id) return id - 1;
+
+	if(w->nkeys == w->keys_size) {
+		w->keys_size = w->keys_size ? w->keys_size * 2 : 1024;
+		w->keys = xxrealloc(w->keys, w->keys_size * sizeof(char *));
+	}
+	w->keys[w->nkeys] = xxstrdup(key);
+	hash_table_insert(w->key_ids, key, (void *) (uintptr_t) (w->nkeys + 1));
+
+	return w->nkeys++;
+}
+
+static int writer_key( struct deltadb_binary_writer *w, char type, const char *key )
+{
+	uint32_t id = writer_key_id(w, key);
+	return write_data(w->output, &type, 1) && write_data(w->output, &id, sizeof(id));
+}
+
+static int writer_name( struct deltadb_binary_writer *w, const char *name )
+{
+	uint16_t length = strlen(name);
+	return write_data(w->output, &length, sizeof(length)) && write_data(w->output, name, length);
+}
+
+/* Write a value preceded by its length, which is known only after the value is written. */
+
+static int writer_value( struct deltadb_binary_writer *w, struct jx *j )
+{
+	uint32_t length = 0;
+	long start = ftell(w->output);
+
+	if(!write_data(w->output, &length, sizeof(length))) return 0;
+	if(!jx_binary_write(w->output, j)) return 0;
+
+	long end = ftell(w->output);
+	length = end - start - sizeof(length);
+
+	return fseek(w->output, start, SEEK_SET) == 0
+		&& write_data(w->output, &length, sizeof(length))
+		&& fseek(w->output, end, SEEK_SET) == 0;
+}
+
+static int writer_time( struct deltadb_binary_writer *w, int64_t current )
+{
+	if(w->ntimes == w->times_size) {
+		w->times_size = w->times_size ? w->times_size * 2 : 1024;
+		w->times = xxrealloc(w->times, w->times_size * sizeof(int64_t));
+		w->offsets = xxrealloc(w->offsets, w->times_size * sizeof(uint64_t));
+	}
+	w->times[w->ntimes] = current;
+	w->offsets[w->ntimes] = ftell(w->output);
+	w->ntimes++;
+
+	char type = 'T';
+	return write_data(w->output, &type, 1) && write_data(w->output, &current, sizeof(current));
+}
+
+static int writer_index( struct deltadb_binary_writer *w, uint64_t source_length )
+{
+	uint64_t index_offset = ftell(w->output);
+	uint32_t i;
+
+	if(!write_data(w->output, &w->nkeys, sizeof(w->nkeys))) return 0;
+	for(i = 0; i < w->nkeys; i++) {
+		if(!writer_name(w, w->keys[i])) return 0;
+	}
+
+	if(!write_data(w->output, &w->ntimes, sizeof(w->ntimes))) return 0;
+	for(i = 0; i < w->ntimes; i++) {
+		if(!write_data(w->output, &w->times[i], sizeof(int64_t))) return 0;
+		if(!write_data(w->output, &w->offsets[i], sizeof(uint64_t))) return 0;
+	}
+
+	return write_data(w->output, &source_length, sizeof(source_length))
+		&& write_data(w->output, &index_offset, sizeof(index_offset))
+		&& write_data(w->output, DELTADB_BINARY_INDEX_MAGIC, DELTADB_BINARY_MAGIC_LENGTH);
+}
+
+static void writer_delete( struct deltadb_binary_writer *w )
+{
+	uint32_t i;
+	for(i = 0; i < w->nkeys; i++) free(w->keys[i]);
+	free(w->keys);
+	free(w->times);
+	free(w->offsets);
+	hash_table_delete(w->key_ids);
+}
+
+static void corrupt_data( const char *line )
+{
+	fprintf(stderr,"corrupt data: %s\n",line);
+}
+
+/*
+Read the text log with the same rules as deltadb_process_stream,
+so that playing either form of the log has the same result.
+*/
+
+int deltadb_binary_convert( FILE *input, FILE *output )
+{
+	char whole_line[LOG_LINE_MAX];
+	char value[LOG_LINE_MAX];
+	char name[LOG_LINE_MAX];
+	char key[LOG_LINE_MAX];
+	long long current = 0;
+	struct jx *jvalue;
+	int ok = 1;
+	int n;
+
+	struct deltadb_binary_writer w;
+	memset(&w, 0, sizeof(w));
+	w.output = output;
+	w.key_ids = hash_table_create(0, 0);
+
+	jx_parse_set_static_mode(true);
+
+	if(!write_data(output, DELTADB_BINARY_MAGIC, DELTADB_BINARY_MAGIC_LENGTH)) ok = 0;
+
+	while(ok && fgets(whole_line,sizeof(whole_line),input)) {
+		char *line = whole_line;
+
+		reconsider:
+
+		if(line[0]=='C') {
+			n = sscanf(line,"C %s %[^\n]",key,value);
+			if(n==1) {
+				/* backwards compatibility with old log format */
+				struct nvpair *nv = nvpair_create();
+				nvpair_parse_stream(nv,input);
+				jvalue = nvpair_to_jx(nv);
+				nvpair_delete(nv);
+			} else if(n==2) {
+				jvalue = jx_parse_json_string(value);
+				if(!jvalue) jvalue = jx_string(value);
+			} else {
+				corrupt_data(line);
+				continue;
+			}
+
+			ok = writer_key(&w,'C',key) && writer_value(&w,jvalue);
+			jx_delete(jvalue);
+
+		} else if(line[0]=='D') {
+			n = sscanf(line,"D %s\n",key);
+			if(n!=1) {
+				corrupt_data(line);
+				continue;
+			}
+
+			ok = writer_key(&w,'D',key);
+
+		} else if(line[0]=='M') {
+			n = sscanf(line,"M %s %[^\n]",key,value);
+			if(n!=2 || !(jvalue = jx_parse_json_string(value))) {
+				corrupt_data(line);
+				continue;
+			}
+
+			ok = writer_key(&w,'M',key) && writer_value(&w,jvalue);
+			jx_delete(jvalue);
+
+		} else if(line[0]=='U') {
+			n = sscanf(line,"U %s %s %[^\n],",key,name,value);
+			if(n!=3) {
+				corrupt_data(line);
+				continue;
+			}
+
+			jvalue = jx_parse_json_string(value);
+			if(!jvalue) continue;
+
+			ok = writer_key(&w,'U',key) && writer_name(&w,name) && writer_value(&w,jvalue);
+			jx_delete(jvalue);
+
+		} else if(line[0]=='R') {
+			/* See deltadb_process_stream for the repair of R records missing a newline. */
+			n = sscanf(line,"R %s %s %s",key,name,value);
+			if(n==3) {
+				char type = name[strlen(name)-1];
+
+				if(strchr("CDUMRTt",type)) {
+					name[strlen(name)-1] = 0;
+					ok = writer_key(&w,'R',key) && writer_name(&w,name);
+					name[strlen(name)] = type;
+
+					int position = strlen(key) + strlen(name) + 2;
+					line = (line + position);
+					if(ok) goto reconsider;
+				} else {
+					corrupt_data(line);
+					continue;
+				}
+			} else if(n==2) {
+				ok = writer_key(&w,'R',key) && writer_name(&w,name);
+			} else {
+				corrupt_data(line);
+				continue;
+			}
+
+		} else if(line[0]=='T') {
+			if(sscanf(line,"T %lld",&current)!=1) {
+				corrupt_data(line);
+				continue;
+			}
+
+			ok = writer_time(&w,current);
+
+		} else if(line[0]=='t') {
+			long long change;
+			if(sscanf(line,"t %lld",&change)!=1) {
+				corrupt_data(line);
+				continue;
+			}
+
+			current += change;
+			ok = writer_time(&w,current);
+
+		} else if(line[0]=='\n') {
+			continue;
+		} else {
+			corrupt_data(line);
+		}
+	}
+
+	jx_parse_set_static_mode(false);
+
+	long source_length = ftell(input);
+	if(source_length < 0) source_length = 0;
+
+	if(ok) ok = writer_index(&w, source_length);
+
+	writer_delete(&w);
+
+	return ok;
+}
+
+struct deltadb_binary_reader {
+	FILE *stream;
+	char **keys;
+	signed char *wanted;	/* for each key, 1 if wanted, 0 if not, -1 if not yet known */
+	uint32_t nkeys;
+	uint64_t source_length;
+	uint64_t index_offset;
+};
+
+static int read_data( FILE *stream, void *data, size_t length )
+{
+	return fread(data, length, 1, stream) == 1 || length == 0;
+}
+
+static char *read_name( FILE *stream, char *name )
+{
+	uint16_t length;
+	if(!read_data(stream, &length, sizeof(length))) return 0;
+	if(!read_data(stream, name, length)) return 0;
+	name[length] = 0;
+	return name;
+}
+
+static void reader_delete( struct deltadb_binary_reader *r )
+{
+	uint32_t i;
+	for(i = 0; i < r->nkeys; i++) free(r->keys[i]);
+	free(r->keys);
+	free(r->wanted);
+}
+
+/*
+Load the keys of the index from the end of the file, and leave the stream
+at the first record.  The log is always played from the beginning, so the
+times of the index are not needed: they are skipped, checking only that
+they end where the trailer begins.
+*/
+
+static int reader_load_index( struct deltadb_binary_reader *r )
+{
+	char magic[DELTADB_BINARY_MAGIC_LENGTH];
+	char name[LOG_LINE_MAX];
+	uint32_t ntimes;
+	uint32_t i;
+
+	if(fseek(r->stream, -DELTADB_BINARY_TRAILER_LENGTH, SEEK_END) != 0) return 0;
+	long trailer_offset = ftell(r->stream);
+	if(!read_data(r->stream, &r->source_length, sizeof(r->source_length))) return 0;
+	if(!read_data(r->stream, &r->index_offset, sizeof(r->index_offset))) return 0;
+	if(!read_data(r->stream, magic, sizeof(magic))) return 0;
+	if(memcmp(magic, DELTADB_BINARY_INDEX_MAGIC, sizeof(magic))) return 0;
+
+	if(fseek(r->stream, r->index_offset, SEEK_SET) != 0) return 0;
+
+	if(!read_data(r->stream, &r->nkeys, sizeof(r->nkeys))) return 0;
+	r->keys = xxcalloc(r->nkeys + 1, sizeof(char *));
+	r->wanted = xxmalloc(r->nkeys + 1);
+	memset(r->wanted, -1, r->nkeys + 1);
+	for(i = 0; i < r->nkeys; i++) {
+		if(!read_name(r->stream, name)) {
+			r->nkeys = i;
+			return 0;
+		}
+		r->keys[i] = xxstrdup(name);
+	}
+
+	if(!read_data(r->stream, &ntimes, sizeof(ntimes))) return 0;
+	if(ftell(r->stream) + ntimes * (long) (sizeof(int64_t) + sizeof(uint64_t)) != trailer_offset) return 0;
+
+	if(fseek(r->stream, 0, SEEK_SET) != 0) return 0;
+	if(!read_data(r->stream, magic, sizeof(magic))) return 0;
+	if(memcmp(magic, DELTADB_BINARY_MAGIC, sizeof(magic))) return 0;
+
+	return 1;
+}
+
+static const char *reader_key( struct deltadb_binary_reader *r, uint32_t *id )
+{
+	if(!read_data(r->stream, id, sizeof(*id)) || *id >= r->nkeys) return 0;
+	return r->keys[*id];
+}
+
+/*
+Records that change an object which is not in the table have no effect,
+so their values need not be decoded.  Whether a key is in the table can
+change only when it is created or deleted, so the answer is kept until then.
+*/
+
+static int reader_wanted( struct deltadb_binary_reader *r, struct deltadb_query *query, struct deltadb_event_handlers *handlers, uint32_t id )
+{
+	if(!handlers->deltadb_key_wanted) return 1;
+	if(r->wanted[id] < 0) r->wanted[id] = handlers->deltadb_key_wanted(query, r->keys[id]);
+	return r->wanted[id];
+}
+
+static struct jx *reader_value( struct deltadb_binary_reader *r, int wanted )
+{
+	uint32_t length;
+
+	if(!read_data(r->stream, &length, sizeof(length))) return 0;
+
+	if(!wanted) {
+		fseek(r->stream, length, SEEK_CUR);
+		return 0;
+	}
+
+	return jx_binary_read(r->stream);
+}
+
+int64_t deltadb_binary_source_length( FILE *stream )
+{
+	char magic[DELTADB_BINARY_MAGIC_LENGTH];
+	uint64_t source_length;
+
+	if(fseek(stream, -DELTADB_BINARY_TRAILER_LENGTH, SEEK_END) != 0) return -1;
+	if(!read_data(stream, &source_length, sizeof(source_length))) return -1;
+	if(fseek(stream, sizeof(uint64_t), SEEK_CUR) != 0) return -1;
+	if(!read_data(stream, magic, sizeof(magic))) return -1;
+	if(memcmp(magic, DELTADB_BINARY_INDEX_MAGIC, sizeof(magic))) return -1;
+
+	rewind(stream);
+
+	return source_length;
+}
+
+int deltadb_process_binary( struct deltadb_query *query, struct deltadb_event_handlers *handlers, FILE *stream, time_t starttime, time_t stoptime )
+{
+	struct deltadb_binary_reader r;
+	char name[LOG_LINE_MAX];
+	struct jx *jvalue;
+	const char *key;
+	uint32_t id;
+	int64_t current;
+	int result = 1;
+
+	memset(&r, 0, sizeof(r));
+	r.stream = stream;
+
+	if(!reader_load_index(&r)) {
+		debug(D_NOTICE, "binary log is corrupt or incomplete");
+		reader_delete(&r);
+		return 1;
+	}
+
+	/*
+	The state of the table at the start time depends on every record before it,
+	so the log is always played from the beginning, as with the text log.
+	*/
+
+	while((uint64_t) ftell(stream) < r.index_offset) {
+		int type = fgetc(stream);
+		if(type == EOF) break;
+
+		if(type == 'T') {
+			if(!read_data(stream, &current, sizeof(current))) break;
+			if(!handlers->deltadb_time_event(query,starttime,stoptime,current)) break;
+			if(stoptime && current>stoptime) {
+				result = 0;
+				break;
+			}
+			continue;
+		}
+
+		if(!(key = reader_key(&r, &id))) break;
+
+		if(type == 'C') {
+			if(!(jvalue = reader_value(&r, 1))) break;
+			r.wanted[id] = -1;
+			if(!handlers->deltadb_create_event(query,key,jvalue)) break;
+		} else if(type == 'D') {
+			r.wanted[id] = -1;
+			if(!handlers->deltadb_delete_event(query,key)) break;
+		} else if(type == 'M') {
+			int wanted = reader_wanted(&r, query, handlers, id);
+			jvalue = reader_value(&r, wanted);
+			if(wanted) {
+				if(!jvalue) break;
+				if(!handlers->deltadb_merge_event(query,key,jvalue)) break;
+			}
+		} else if(type == 'U') {
+			if(!read_name(stream, name)) break;
+			int wanted = reader_wanted(&r, query, handlers, id);
+			jvalue = reader_value(&r, wanted);
+			if(wanted) {
+				if(!jvalue) break;
+				if(!handlers->deltadb_update_event(query,key,name,jvalue)) break;
+			}
+		} else if(type == 'R') {
+			if(!read_name(stream, name)) break;
+			if(reader_wanted(&r, query, handlers, id)) {
+				if(!handlers->deltadb_remove_event(query,key,name)) break;
+			}
+		} else {
+			debug(D_NOTICE, "binary log has invalid record type %d", type);
+			break;
+		}
+	}
+
+	reader_delete(&r);
+
+	return result;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,49 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef DELTADB_BINARY_H
+#define DELTADB_BINARY_H
+
+/*
+A compact binary encoding of the deltadb log, which carries the same
+C/D/M/U/R/T records as the text log of one day (DIR/YEAR/DAY.log),
+and is stored beside it as DIR/YEAR/DAY.bin.
+
+Each record is a type byte followed by fixed size fields, and each value
+is stored in the jx_binary format, preceded by its length.  Keys are
+replaced by small integers, and the key strings are kept once in an
+index at the end of the file, along with the time and offset of each
+T record.  A reader can then tell, before decoding a value, whether
+the record concerns an object of interest, and skip it if not.
+*/
+
+#include "deltadb_stream.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/** Convert a text log to the binary encoding.
+@param input A stream of text log records.
+@param output A seekable stream to receive the binary log.
+@return True on success, false on failure.
+*/
+int deltadb_binary_convert( FILE *input, FILE *output );
+
+/** Return the size of the text log from which a binary log was converted.
+A binary log whose source length differs from the present size of the
+text log is out of date, and should not be used in its place.
+@param stream A binary log.
+@return The length of the text log in bytes, or -1 if the stream is not a binary log.
+*/
+int64_t deltadb_binary_source_length( FILE *stream );
+
+/** Play a binary log, in the same manner as @ref deltadb_process_stream.
+@return False if the stop time was reached, true otherwise.
+*/
+int deltadb_process_binary( struct deltadb_query *query, struct deltadb_event_handlers *handlers, FILE *stream, time_t starttime, time_t stoptime );
+
+#endif
@@ -0,0 +1,54 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Convert a text log file (DIR/YEAR/DAY.log) into the binary form
+(DIR/YEAR/DAY.bin) which deltadb_query reads in preference to the text.
+*/
+
+#include "deltadb_binary.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+int main( int argc, char *argv[] )
+{
+	if(argc!=3) {
+		fprintf(stderr,"use: %s <infile.log> <outfile.bin>\n",argv[0]);
+		return 1;
+	}
+
+	FILE *input = fopen(argv[1],"r");
+	if(!input) {
+		fprintf(stderr,"couldn't open %s: %s\n",argv[1],strerror(errno));
+		return 1;
+	}
+
+	FILE *output = fopen(argv[2],"w");
+	if(!output) {
+		fprintf(stderr,"couldn't open %s: %s\n",argv[2],strerror(errno));
+		fclose(input);
+		return 1;
+	}
+
+	int ok = deltadb_binary_convert(input,output);
+
+	fclose(input);
+	if(fclose(output)!=0) ok = 0;
+
+	if(!ok) {
+		/* Do not leave behind a partial file that a query would prefer to the log. */
+		fprintf(stderr,"couldn't convert %s to %s\n",argv[1],argv[2]);
+		unlink(argv[2]);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
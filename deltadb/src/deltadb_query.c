@@ -5,6 +5,7 @@ See the file COPYING for details.
 */
 
 #include "deltadb_stream.h"
+#include "deltadb_binary.h"
 #include "deltadb_reduction.h"
 #include "deltadb_query.h"
 
@@ -28,6 +29,8 @@ See the file COPYING for details.
 #include <sys/types.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
 
 struct deltadb_query {
 	struct hash_table *table;
@@ -42,6 +45,17 @@ struct deltadb_query {
 	time_t deferred_time;
 	time_t last_output_time;
 	deltadb_display_mode_t display_mode;
+	int threads;
+
+	/* State kept by one part of a parallel replay. */
+	int hold_first;
+	struct list *first_reductions;
+	time_t first_time;
+	int early_pending;
+	int early_valid;
+	struct list *early_reductions;
+	FILE *early_stream;
+	time_t early_time;
 };
 
 struct deltadb_query * deltadb_query_create()
@@ -52,9 +66,21 @@ struct deltadb_query * deltadb_query_create()
 	query->output_stream = stdout;
 	query->output_exprs = list_create();
 	query->reduce_exprs = list_create();
+	query->threads = 1;
 	return query;
 }
 
+static void delete_reductions( struct list *reductions )
+{
+	if(!reductions) return;
+
+	list_first_item(reductions);
+	for(struct deltadb_reduction *r; (r = list_next_item(reductions));) {
+		deltadb_reduction_delete(r);
+	}
+	list_delete(reductions);
+}
+
 void deltadb_query_delete( struct deltadb_query *query )
 {
 	if(!query) return;
@@ -76,11 +102,11 @@ void deltadb_query_delete( struct deltadb_query *query )
 	}
 	list_delete(query->output_exprs);
 
-	list_first_item(query->reduce_exprs);
-	for(struct deltadb_reduction *r; (r = list_next_item(query->reduce_exprs));) {
-		deltadb_reduction_delete(r);
-	}
-	list_delete(query->reduce_exprs);
+	delete_reductions(query->reduce_exprs);
+	delete_reductions(query->first_reductions);
+	delete_reductions(query->early_reductions);
+
+	if(query->early_stream) fclose(query->early_stream);
 
 	free(query);
 }
@@ -115,6 +141,11 @@ void deltadb_query_set_interval( struct deltadb_query *query, int interval )
 	query->display_every = interval;
 }
 
+void deltadb_query_set_threads( struct deltadb_query *query, int threads )
+{
+	query->threads = threads>1 ? threads : 1;
+}
+
 void deltadb_query_add_output( struct deltadb_query *query, struct jx *expr )
 {
 	list_push_tail(query->output_exprs,expr);
@@ -178,7 +209,7 @@ static int checkpoint_read( struct deltadb_query *query, const char *filename )
 	if(!file) return 0;
 
 	/* Load the entire checkpoint into one json object */
-	struct jx *jcheckpoint = jx_parse_stream(file);
+	struct jx *jcheckpoint = jx_parse_json_stream(file);
 
 	fclose(file);
 
@@ -230,7 +261,45 @@ static void update_reductions( struct deltadb_query *query, const char *key, str
 	}
 }
 
-static void display_reduce_exprs( struct deltadb_query *query, time_t current )
+/* Create empty reductions of the same kind as those in a list. */
+
+static struct list *copy_reductions( struct list *reductions )
+{
+	struct list *copy = list_create();
+
+	list_first_item(reductions);
+	for(struct deltadb_reduction *r; (r = list_next_item(reductions));) {
+		list_push_tail(copy,deltadb_reduction_create_type(r->type,jx_copy(r->expr),r->scope));
+	}
+
+	return copy;
+}
+
+/*
+Replace the reductions of the query with empty ones of the same kind,
+returning the old ones so that their values can be displayed later.
+*/
+
+static struct list *take_reductions( struct deltadb_query *query )
+{
+	struct list *taken = query->reduce_exprs;
+	query->reduce_exprs = copy_reductions(taken);
+	return taken;
+}
+
+static void display_time( struct deltadb_query *query, time_t current )
+{
+	if(query->epoch_mode) {
+		fprintf(query->output_stream,"%lld\t",(long long) current);
+	} else {
+		char str[32];
+		struct tm tm;
+		strftime(str,sizeof(str),"%F %T",localtime_r(&current,&tm));
+		fprintf(query->output_stream,"%s\t",str);
+	}
+}
+
+static void compute_spatial_reductions( struct deltadb_query *query )
 {
 	/* Reset all spatial reductions. */
 	reset_reductions(query,DELTADB_SCOPE_SPATIAL);
@@ -244,20 +313,17 @@ static void display_reduce_exprs( struct deltadb_query *query, time_t current )
 		/* Update each local reduction with its value. */
 		update_reductions(query,key,jobject,DELTADB_SCOPE_SPATIAL);
 	}
+}
 
+static void display_reductions( struct deltadb_query *query, struct list *reductions, time_t current )
+{
 	/* Emit the current time */
 
-	if(query->epoch_mode) {
-		fprintf(query->output_stream,"%lld\t",(long long) current);
-	} else {
-		char str[32];
-		strftime(str,sizeof(str),"%F %T",localtime(&current));
-		fprintf(query->output_stream,"%s\t",str);
-	}
+	display_time(query,current);
 
 	/* For each reduction, display the final value. */
-	list_first_item(query->reduce_exprs);
-	for(struct deltadb_reduction *r; (r = list_next_item(query->reduce_exprs));) {
+	list_first_item(reductions);
+	for(struct deltadb_reduction *r; (r = list_next_item(reductions));) {
 		if (r->scope == DELTADB_SCOPE_TEMPORAL) {
 			struct jx *column = jx_object(0);
 			char *key;
@@ -282,6 +348,24 @@ static void display_reduce_exprs( struct deltadb_query *query, time_t current )
 	}
 
 	fprintf(query->output_stream,"\n");
+}
+
+static void display_reduce_exprs( struct deltadb_query *query, time_t current )
+{
+	compute_spatial_reductions(query);
+
+	/*
+	The first row of a part of a parallel replay is missing whatever
+	happened in the previous part, so keep it aside to be completed later.
+	*/
+
+	if(query->hold_first && !query->first_reductions) {
+		query->first_reductions = take_reductions(query);
+		query->first_time = current;
+		return;
+	}
+
+	display_reductions(query,query->reduce_exprs,current);
 
 	/* Reset temporal and global reductions to compute new values. */
 	reset_reductions(query,DELTADB_SCOPE_TEMPORAL);
@@ -303,13 +387,7 @@ static void display_output_exprs( struct deltadb_query *query, time_t current )
 
 		/* Emit the current time */
 
-		if(query->epoch_mode) {
-			fprintf(query->output_stream,"%lld\t",(long long) current);
-		} else {
-			char str[32];
-			strftime(str,sizeof(str),"%F %T",localtime(&current));
-			fprintf(query->output_stream,"%s\t",str);
-		}
+		display_time(query,current);
 
 		/* For each output expression, compute the value and print. */
 
@@ -508,10 +586,41 @@ int deltadb_remove_event( struct deltadb_query *query, const char *key, const ch
 	return 1;
 }
 
+/*
+Capture the output that would be displayed at the first time record
+of a part of a parallel replay, in case the previous part turns out
+not to have displayed it.
+*/
+
+static void display_early( struct deltadb_query *query, time_t current )
+{
+	query->early_time = current;
+	query->early_valid = 1;
+
+	if(query->display_mode==DELTADB_DISPLAY_REDUCE) {
+		compute_spatial_reductions(query);
+		query->early_reductions = take_reductions(query);
+	} else {
+		FILE *output = query->output_stream;
+		query->output_stream = query->early_stream;
+		if(query->display_mode==DELTADB_DISPLAY_EXPRS) {
+			display_output_exprs(query,current);
+		} else if(query->display_mode==DELTADB_DISPLAY_OBJECTS) {
+			display_output_objects(query,current);
+		}
+		query->output_stream = output;
+	}
+}
+
 int deltadb_time_event( struct deltadb_query *query, time_t starttime, time_t stoptime, time_t current )
 {
 	if(current>stoptime) return 0;
 
+	if(query->early_pending) {
+		query->early_pending = 0;
+		display_early(query,current);
+	}
+
 	if(current < (query->display_next)) return 1;
 
 	query->display_next += query->display_every;
@@ -536,6 +645,16 @@ int deltadb_raw_event( struct deltadb_query *query, const char *line )
 	return 1;
 }
 
+/*
+Changes to an object that is not in the table are ignored,
+so a reader that can skip them cheaply need not decode them.
+*/
+
+int deltadb_key_wanted( struct deltadb_query *query, const char *key )
+{
+	return hash_table_lookup(query->table,key)!=0;
+}
+
 static int is_leap_year( int y )
 {
 	return (y%400==0) || ( (y%4==0) && (y%100!=0) );
@@ -562,7 +681,8 @@ static struct deltadb_event_handlers handlers = {
   deltadb_merge_event,
   deltadb_remove_event,
   deltadb_time_event,
-  deltadb_raw_event
+  deltadb_raw_event,
+  deltadb_key_wanted
 };
 
 /*
@@ -579,38 +699,81 @@ int deltadb_query_execute_stream( struct deltadb_query *query, FILE *stream, tim
 	}
 }
 
-/*
-Execute a query on a directory structure.
-Play the log from starttime to stoptime by opening the appropriate
-checkpoint file and working ahead in the various log files.
-*/
+static void next_day( int *year, int *day )
+{
+	(*day)++;
+	if(*day>=days_in_year(*year)) {
+		(*year)++;
+		*day = 0;
+	}
+}
 
-int deltadb_query_execute_dir( struct deltadb_query *query, const char *logdir, time_t starttime, time_t stoptime )
+/* Return the local time at which a given day of the log begins. */
+
+static time_t day_start( int year, int day )
 {
-	int file_errors = 0;
+	struct tm tm;
+	memset(&tm,0,sizeof(tm));
+	tm.tm_year = year - 1900;
+	tm.tm_mday = day + 1;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
 
-	query->display_next = starttime;
+static char *checkpoint_name( const char *logdir, int year, int day )
+{
+	return string_format("%s/%d/%d.ckpt",logdir,year,day);
+}
 
-	struct tm *starttm = localtime(&starttime);
+/*
+Open the log of one day, preferring the binary form if it has been
+converted, unless the text log has grown since then, as today's log does.
+*/
 
-	int year = starttm->tm_year + 1900;
-	int day = starttm->tm_yday;
+static FILE *open_day_log( const char *logdir, int year, int day, int *binary, char **filename )
+{
+	char *logname = string_format("%s/%d/%d.log",logdir,year,day);
+	char *binname = string_format("%s/%d/%d.bin",logdir,year,day);
+
+	FILE *file = fopen(binname,"r");
+	if(file) {
+		struct stat info;
+		int64_t length = deltadb_binary_source_length(file);
+		if(length>=0 && (stat(logname,&info)!=0 || info.st_size==length)) {
+			free(logname);
+			*binary = 1;
+			*filename = binname;
+			return file;
+		}
+		fclose(file);
+	}
 
-	struct tm *stoptm = localtime(&stoptime);
+	free(binname);
+	*binary = 0;
+	*filename = logname;
+	return fopen(logname,"r");
+}
 
-	int stopyear = stoptm->tm_year + 1900;
-	int stopday = stoptm->tm_yday;
+/*
+Play ndays of the log, starting from the checkpoint of the given day.
+*/
+
+static int deltadb_query_replay( struct deltadb_query *query, const char *logdir, int year, int day, int ndays, time_t starttime, time_t stoptime )
+{
+	int file_errors = 0;
 
-	char *filename = string_format("%s/%d/%d.ckpt",logdir,year,day);
+	char *filename = checkpoint_name(logdir,year,day);
 	int ret = checkpoint_read(query,filename);
 	free(filename);
 	if (!ret) {
 		return 0;
 	}
 
-	while(1) {
-		char *filename = string_format("%s/%d/%d.log",logdir,year,day);
-		FILE *file = fopen(filename,"r");
+	for(;ndays>0;ndays--) {
+		int binary;
+		char *filename;
+		FILE *file = open_day_log(logdir,year,day,&binary,&filename);
+
 		if(!file) {
 			file_errors += 1;
 			fprintf(stderr,"couldn't open %s: %s\n",filename,strerror(errno));
@@ -622,7 +785,9 @@ int deltadb_query_execute_dir( struct deltadb_query *query, const char *logdir,
 		} else {
 			free(filename);
 			int keepgoing;
-			if(is_fast_query(query)) {
+			if(binary) {
+				keepgoing = deltadb_process_binary(query,&handlers,file,starttime,stoptime);
+			} else if(is_fast_query(query)) {
 				keepgoing = deltadb_process_stream_fast(query,&handlers,file,starttime,stoptime);
 			} else {
 				keepgoing = deltadb_process_stream(query,&handlers,file,starttime,stoptime);
@@ -635,17 +800,297 @@ int deltadb_query_execute_dir( struct deltadb_query *query, const char *logdir,
 			if(!keepgoing) break;
 		}
 
-		day++;
-		if(day>=days_in_year(year)) {
-			year++;
-			day = 0;
+		next_day(&year,&day);
+	}
+
+	return 1;
+}
+
+/*
+A parallel replay divides the days of the query into consecutive parts,
+each played by its own thread into its own query, starting from the
+checkpoint of its first day and writing into a temporary file.
+*/
+
+struct deltadb_part {
+	struct deltadb_query *query;
+	const char *logdir;
+	int year;
+	int day;
+	int ndays;
+	time_t starttime;
+	time_t stoptime;
+	time_t grid;
+	int result;
+	int running;
+	pthread_t thread;
+};
+
+static struct deltadb_query *deltadb_query_create_part( struct deltadb_query *query )
+{
+	struct deltadb_query *part = deltadb_query_create();
+
+	part->epoch_mode = query->epoch_mode;
+	part->display_every = query->display_every;
+	part->display_mode = query->display_mode;
+	part->filter_expr = jx_copy(query->filter_expr);
+	part->where_expr = jx_copy(query->where_expr);
+
+	list_first_item(query->output_exprs);
+	for(struct jx *j; (j = list_next_item(query->output_exprs));) {
+		list_push_tail(part->output_exprs,jx_copy(j));
+	}
+
+	delete_reductions(part->reduce_exprs);
+	part->reduce_exprs = copy_reductions(query->reduce_exprs);
+
+	part->hold_first = 1;
+
+	part->output_stream = tmpfile();
+	if(!part->output_stream) {
+		deltadb_query_delete(part);
+		return 0;
+	}
+
+	return part;
+}
+
+static void deltadb_query_delete_part( struct deltadb_query *part )
+{
+	if(!part) return;
+	if(part->output_stream) fclose(part->output_stream);
+	deltadb_query_delete(part);
+}
+
+static void *deltadb_part_run( void *arg )
+{
+	struct deltadb_part *p = arg;
+	p->result = deltadb_query_replay(p->query,p->logdir,p->year,p->day,p->ndays,p->starttime,p->stoptime);
+	return 0;
+}
+
+static void copy_stream( FILE *input, FILE *output )
+{
+	char buffer[65536];
+	size_t n;
+
+	fflush(input);
+	rewind(input);
+	while((n=fread(buffer,1,sizeof(buffer),input))>0) {
+		fwrite(buffer,1,n,output);
+	}
+}
+
+/* Fold the reductions of prior, which come just before later, into later. */
+
+static void merge_reductions( struct list *later, struct list *prior )
+{
+	list_first_item(later);
+	list_first_item(prior);
+	for(struct deltadb_reduction *r; (r = list_next_item(later));) {
+		deltadb_reduction_merge(r,list_next_item(prior));
+	}
+}
+
+static struct list *carry_reductions( struct list *later, struct list *carry )
+{
+	if(carry) {
+		merge_reductions(later,carry);
+		delete_reductions(carry);
+	}
+	return later;
+}
+
+/*
+Write out the parts in order, joining them as a single sequential replay
+would have.  Each part but the first begins with the display time set
+to the next display after the start of its first day, and keeps aside
+what it would have displayed at its first time record.  That row is
+used if the previous part ended without displaying the display time
+just before the boundary.  In a reduction, the first row of each part
+is completed with the temporal and global values left over at the end
+of the previous part.
+
+This reproduces the sequential output as long as time records are more
+frequent than the display interval, as they are in catalog logs.  Within
+one display time, objects (and the fields of objects) may be listed in a
+different order, just as when a query begins at a later checkpoint.
+*/
+
+static int deltadb_query_join_parts( struct deltadb_query *query, struct deltadb_part *parts, int nparts )
+{
+	int reduce = query->display_mode==DELTADB_DISPLAY_REDUCE;
+	struct list *carry = 0;
+	int result = 1;
+
+	for(int i=0;i<nparts;i++) {
+		struct deltadb_query *part = parts[i].query;
+
+		if(i>0 && part->early_valid) {
+			int shown = parts[i-1].query->display_next > parts[i].grid;
+			if(reduce) {
+				carry = carry_reductions(part->early_reductions,carry);
+				part->early_reductions = 0;
+				if(!shown) {
+					display_reductions(query,carry,part->early_time);
+					delete_reductions(carry);
+					carry = 0;
+				}
+			} else if(!shown) {
+				copy_stream(part->early_stream,query->output_stream);
+			}
+		}
+
+		if(reduce) {
+			if(part->first_reductions) {
+				carry = carry_reductions(part->first_reductions,carry);
+				part->first_reductions = 0;
+				display_reductions(query,carry,part->first_time);
+				delete_reductions(carry);
+				carry = 0;
+			}
+			carry = carry_reductions(part->reduce_exprs,carry);
+			part->reduce_exprs = list_create();
 		}
 
-		// If we have passed the file, stop.
-		if(year>=stopyear && day>stopday) break;
+		copy_stream(part->output_stream,query->output_stream);
+
+		if(!parts[i].result) {
+			result = 0;
+			break;
+		}
 	}
 
-	return 1;
+	delete_reductions(carry);
+
+	return result;
 }
 
+static int deltadb_query_execute_parallel( struct deltadb_query *query, const char *logdir, int year, int day, int ndays, time_t starttime, time_t stoptime )
+{
+	int nparts = query->threads<ndays ? query->threads : ndays;
+	int per_part = (ndays+nparts-1)/nparts;
+
+	struct deltadb_part *parts = calloc(nparts,sizeof(*parts));
+
+	/*
+	Start a new part every per_part days, but only on a day that has a
+	checkpoint; otherwise the day is added to the part before it.
+	*/
+
+	int first_year = year;
+	int first_day = day;
+
+	int n = 0;
+	for(int i=0;i<ndays;i++) {
+		int start = i==0;
+		if(!start && i>=n*per_part && n<nparts) {
+			char *filename = checkpoint_name(logdir,year,day);
+			start = access(filename,R_OK)==0;
+			free(filename);
+		}
+
+		if(start) {
+			struct deltadb_part *p = &parts[n++];
+			p->query = deltadb_query_create_part(query);
+			if(!p->query) goto failure;
+			p->logdir = logdir;
+			p->year = year;
+			p->day = day;
+			p->stoptime = stoptime;
+
+			if(i==0) {
+				p->starttime = starttime;
+				p->query->display_next = starttime;
+			} else if(query->display_every>0) {
+				time_t begin = day_start(year,day);
+				p->grid = starttime + (begin-starttime)/query->display_every*query->display_every;
+				if(p->grid==begin) {
+					p->query->display_next = begin;
+				} else {
+					p->query->display_next = p->grid + query->display_every;
+					p->query->early_pending = 1;
+					if(query->display_mode!=DELTADB_DISPLAY_REDUCE) {
+						p->query->early_stream = tmpfile();
+						if(!p->query->early_stream) goto failure;
+					}
+				}
+			} else {
+				p->query->display_next = starttime;
+			}
+		}
+
+		parts[n-1].ndays++;
+		next_day(&year,&day);
+	}
+
+	/* If a thread cannot be started, play that part here instead. */
+
+	for(int i=0;i<n;i++) {
+		parts[i].running = pthread_create(&parts[i].thread,0,deltadb_part_run,&parts[i])==0;
+		if(!parts[i].running) deltadb_part_run(&parts[i]);
+	}
+
+	for(int i=0;i<n;i++) {
+		if(parts[i].running) pthread_join(parts[i].thread,0);
+	}
+
+	int result = deltadb_query_join_parts(query,parts,n);
+
+	for(int i=0;i<n;i++) {
+		deltadb_query_delete_part(parts[i].query);
+	}
+	free(parts);
+
+	return result;
+
+	/* Without room for the temporary output, play the whole query in this thread. */
+
+	failure:
+	fprintf(stderr,"couldn't create a temporary file: %s\n",strerror(errno));
+	for(int i=0;i<n;i++) {
+		deltadb_query_delete_part(parts[i].query);
+	}
+	free(parts);
 
+	return deltadb_query_replay(query,logdir,first_year,first_day,ndays,starttime,stoptime);
+}
+
+/*
+Execute a query on a directory structure.
+Play the log from starttime to stoptime by opening the appropriate
+checkpoint file and working ahead in the various log files.
+*/
+
+int deltadb_query_execute_dir( struct deltadb_query *query, const char *logdir, time_t starttime, time_t stoptime )
+{
+	query->display_next = starttime;
+
+	struct tm *starttm = localtime(&starttime);
+
+	int year = starttm->tm_year + 1900;
+	int day = starttm->tm_yday;
+
+	struct tm *stoptm = localtime(&stoptime);
+
+	int stopyear = stoptm->tm_year + 1900;
+	int stopday = stoptm->tm_yday;
+
+	/* Count the days to play, up to and including the stop day. */
+
+	int ndays = 0;
+	int y = year;
+	int d = day;
+	do {
+		ndays++;
+		next_day(&y,&d);
+	} while(y<stopyear || (y==stopyear && d<=stopday));
+
+	/* A stream of changes is cheap to produce and must be emitted in one piece. */
+
+	if(query->threads>1 && ndays>1 && query->display_mode!=DELTADB_DISPLAY_STREAM) {
+		return deltadb_query_execute_parallel(query,logdir,year,day,ndays,starttime,stoptime);
+	} else {
+		return deltadb_query_replay(query,logdir,year,day,ndays,starttime,stoptime);
+	}
+}
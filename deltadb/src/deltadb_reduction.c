@@ -85,6 +85,19 @@ void deltadb_reduction_reset( struct deltadb_reduction *r, deltadb_scope_t scope
 	r->unique_value = jx_array(0);
 }
 
+/* UNIQUE: keep a value in a hash table, keyed by the string representation. */
+
+static void unique_insert( struct deltadb_reduction *r, struct jx *value )
+{
+	char *str = jx_print_string(value);
+	if(!hash_table_lookup(r->unique_table,str)) {
+		struct jx *value_copy = jx_copy(value);
+		hash_table_insert(r->unique_table,str,value_copy);
+		jx_array_append(r->unique_value,value_copy);
+	}
+	free(str);
+}
+
 void deltadb_reduction_update( struct deltadb_reduction *r, const char *key, struct jx * value, deltadb_scope_t scope )
 {
 	if(r->scope!=scope) return;
@@ -98,16 +111,8 @@ void deltadb_reduction_update( struct deltadb_reduction *r, const char *key, str
 		}
 	}
 
-	/* UNIQUE: keep a value in a hash table, keyed by the string representation. */
-
 	if(r->type==UNIQUE) {
-		char *str = jx_print_string(value);
-		if(!hash_table_lookup(r->unique_table,str)) {
-			struct jx *value_copy = jx_copy(value);
-			hash_table_insert(r->unique_table,str,value_copy);
-			jx_array_append(r->unique_value,value_copy);
-		}
-		free(str);
+		unique_insert(r,value);
 		return;
 	}
 
@@ -136,6 +141,70 @@ void deltadb_reduction_update( struct deltadb_reduction *r, const char *key, str
 	r->count++;
 };
 
+static void deltadb_reduction_merge_values( struct deltadb_reduction *r, struct deltadb_reduction *prior )
+{
+	if(r->type==UNIQUE) {
+		/* Rebuild the set so that the values of the prior interval come first. */
+		struct jx *unique_value = r->unique_value;
+		struct hash_table *unique_table = r->unique_table;
+
+		r->unique_value = jx_array(0);
+		r->unique_table = hash_table_create(0,0);
+
+		struct jx_item *i;
+		for(i=prior->unique_value->u.items;i;i=i->next) unique_insert(r,i->value);
+		for(i=unique_value->u.items;i;i=i->next) unique_insert(r,i->value);
+
+		jx_delete(unique_value);
+		hash_table_delete(unique_table);
+		return;
+	}
+
+	if(prior->count==0) return;
+
+	if(r->count==0) {
+		r->min = prior->min;
+		r->max = prior->max;
+		r->last = prior->last;
+	} else {
+		if(prior->min < r->min) r->min = prior->min;
+		if(prior->max > r->max) r->max = prior->max;
+	}
+
+	r->first = prior->first;
+	r->sum += prior->sum;
+	r->count += prior->count;
+}
+
+/*
+Fold into r the values that prior accumulated over the interval
+just before the one covered by r, as if both intervals had been
+played into r in order.  Spatial reductions describe a single moment,
+and so are left alone.
+*/
+
+void deltadb_reduction_merge( struct deltadb_reduction *r, struct deltadb_reduction *prior )
+{
+	if(r->scope==DELTADB_SCOPE_SPATIAL) return;
+
+	if(r->scope==DELTADB_SCOPE_TEMPORAL) {
+		char *key;
+		void *value;
+
+		hash_table_firstkey(prior->temporal_table);
+		while(hash_table_nextkey(prior->temporal_table,&key,&value)) {
+			struct deltadb_reduction *t = hash_table_lookup(r->temporal_table,key);
+			if(!t) {
+				t = deltadb_reduction_create_type(r->type,jx_copy(r->expr),r->scope);
+				hash_table_insert(r->temporal_table,key,t);
+			}
+			deltadb_reduction_merge_values(t,value);
+		}
+	} else {
+		deltadb_reduction_merge_values(r,prior);
+	}
+}
+
 char * deltadb_reduction_string( struct deltadb_reduction *r )
 {
 	double value = 0;
@@ -50,7 +50,7 @@ int deltadb_process_stream( struct deltadb_query *query, struct deltadb_event_ha
 				jvalue = nvpair_to_jx(nv);
 				nvpair_delete(nv);
 			} else if(n==2) {
-				jvalue = jx_parse_string(value);
+				jvalue = jx_parse_json_string(value);
 				if(!jvalue) jvalue = jx_string(value);
 			} else {
 				corrupt_data(filename,line);
@@ -71,7 +71,7 @@ int deltadb_process_stream( struct deltadb_query *query, struct deltadb_event_ha
 		} else if(line[0]=='M') {
 			n = sscanf(line,"M %s %[^\n]",key,value);
 			if(n==2) {
-				jvalue = jx_parse_string(value);
+				jvalue = jx_parse_json_string(value);
 				if(!jvalue) {
 					corrupt_data(filename,line);
 					continue;
@@ -90,7 +90,7 @@ int deltadb_process_stream( struct deltadb_query *query, struct deltadb_event_ha
 				continue;
 			}
 
-			jvalue = jx_parse_string(value);
+			jvalue = jx_parse_json_string(value);
 			if(!jvalue) {
 				/* backwards compatibility with old format */
 				jvalue = jx_string(value);
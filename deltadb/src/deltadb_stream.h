@@ -22,6 +22,7 @@ struct deltadb_event_handlers {
 	int (*deltadb_remove_event) ( struct deltadb_query *query, const char *key, const char *name );
 	int (*deltadb_time_event) ( struct deltadb_query *query, time_t starttime, time_t stoptime, time_t current );
 	int (*deltadb_raw_event) ( struct deltadb_query *query, const char *line );
+	int (*deltadb_key_wanted) ( struct deltadb_query *query, const char *key );
 };
 
 int deltadb_process_stream( struct deltadb_query *query, struct deltadb_event_handlers *handlers, FILE *stream, time_t starttime, time_t stoptime );
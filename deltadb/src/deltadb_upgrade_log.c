@@ -83,7 +83,7 @@ int main( int argc, char *argv[] )
 
 				// Add the current update to the merge.
 				if(!merge) merge = jx_object(0);
-				struct jx *jvalue = jx_parse_string(value);
+				struct jx *jvalue = jx_parse_json_string(value);
 				jx_insert(merge,jx_string(name),jvalue);
 
 				// Remember the current key
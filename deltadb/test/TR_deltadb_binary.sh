@@ -0,0 +1,81 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+# The database is laid out by local time, so fix the time zone.
+TZ=UTC
+export TZ
+
+# 2022-03-01 is day 59 (counting from zero) of 2022.
+dbdir=deltadb_binary.db
+logfile=$dbdir/2022/59.log
+start=1646092800
+
+prepare()
+{
+	mkdir -p $dbdir/2022
+
+	echo '{"a":{"type":"x","load":1,"name":"a"},"b":{"type":"y","load":2,"name":"b"}}' > $dbdir/2022/59.ckpt
+
+	cat > $logfile <<EOF2
+T $((start+60))
+U a load 3
+U b load 4
+C c {"type":"x","load":5,"name":"c"}
+t 60
+U a load 6
+R b load
+M c {"type":"x","load":7,"name":"c"}
+t 60
+D a
+U c load 8
+T $((start+300))
+U b load 9
+EOF2
+	return 0
+}
+
+query()
+{
+	../src/deltadb_query --db $dbdir --from "2022-03-01 00:00:00" --to "2022-03-01 23:00:00" --filter 'type=="x"' --output name --output load --epoch
+}
+
+run()
+{
+	query > text.out || return 1
+
+	../src/deltadb_binary_log $logfile $dbdir/2022/59.bin || return 1
+
+	query > binary.out || return 1
+
+	echo "text log:"
+	cat text.out
+	echo "binary log:"
+	cat binary.out
+
+	test -s text.out && cmp text.out binary.out || return 1
+
+	echo "appending to the log after conversion"
+	echo "U c load 10" >> $logfile
+	echo "T $((start+360))" >> $logfile
+
+	query > appended.out || return 1
+
+	echo "log with appended records:"
+	cat appended.out
+
+	# The binary log is now out of date, and must not be used.
+	mv $dbdir/2022/59.bin $dbdir/2022/59.bin.old
+	query > text.out || return 1
+	cmp text.out appended.out && ! cmp -s binary.out appended.out
+}
+
+clean()
+{
+	rm -rf $dbdir text.out binary.out appended.out
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,90 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+# The database is laid out by local time, so fix the time zone.
+TZ=UTC
+export TZ
+
+# Four days beginning with 2022-03-01, which is day 59 (counting from zero) of 2022.
+dbdir=deltadb_parallel.db
+start=1646092800
+
+prepare()
+{
+	mkdir -p $dbdir/2022
+
+	# Three objects, whose load changes every ten minutes and whose owner
+	# changes every hour.  Each checkpoint holds the state at the end of
+	# the day before: the last loads written, and the owners of hours 21-23.
+	for i in 0 1 2 3
+	do
+		day=$((59+i))
+		begin=$((start+i*86400))
+		awk -v begin=$begin 'BEGIN {
+			printf("{")
+			for(k=0;k<3;k++) printf("%s\"h%d\":{\"name\":\"h%d\",\"owner\":\"u%d\",\"load\":%d}", k ? "," : "", k, k, (21+k)%4, ((begin-600)/600+k)%17)
+			printf("}\n")
+		}' > $dbdir/2022/$day.ckpt
+		awk -v begin=$begin 'BEGIN {
+			for(t=begin+600;t<begin+86400;t+=600) {
+				printf("T %d\n",t)
+				for(k=0;k<3;k++) printf("U h%d load %d\n",k,(t/600+k)%17)
+				if(t%3600==0) {
+					hour = (t/3600)%24
+					printf("U h%d owner \"u%d\"\n",hour%3,hour%4)
+				}
+			}
+		}' > $dbdir/2022/$day.log
+	done
+
+	return 0
+}
+
+query()
+{
+	../src/deltadb_query --db $dbdir --from "2022-03-01 03:00:00" --to "2022-03-04 21:00:00" --epoch "$@"
+}
+
+compare()
+{
+	query "$@" > sequential.out || return 1
+	query "$@" --threads 3 > parallel.out || return 1
+
+	if ! test -s sequential.out
+	then
+		echo "no output from: $@"
+		return 1
+	fi
+
+	if ! cmp sequential.out parallel.out
+	then
+		echo "parallel output differs for: $@"
+		diff sequential.out parallel.out | head
+		return 1
+	fi
+
+	echo "same output for: $@"
+	return 0
+}
+
+run()
+{
+	compare --output 'COUNT(name)' --output 'MAX(load)' --every 1h || return 1
+	compare --output 'GLOBAL_SUM(load)' --output 'GLOBAL_INC(load)' --every 1h || return 1
+	compare --output 'GLOBAL_UNIQUE(owner)' --every 5h || return 1
+	compare --output 'COUNT(name)' --output 'GLOBAL_MIN(load)' --every 25m || return 1
+	compare --output 'GLOBAL_AVERAGE(load)' || return 1
+	compare --output name --output load --where 'name=="h1"' --every 2h || return 1
+	return 0
+}
+
+clean()
+{
+	rm -rf $dbdir sequential.out parallel.out
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
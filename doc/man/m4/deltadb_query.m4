@@ -30,6 +30,7 @@ OPTION_FLAG_LONG(--epoch), Causes the output to be expressed in integer Unix epo
 OPTION_ARG_LONG(--filter, expr) (multiple) If given, only records matching this expression will be processed.  Use --filter to apply expressions that do not change over time, such as the name or type of a record.
 OPTION_ARG_LONG(--where, expr)  (multiple) If given, only records matching this expression will be displayed.  Use --where to apply expressions that may change over time, such as load average or storage space consumed.
 OPTION_ARG_LONG(--output, expr) (multiple) Display this expression on the output.
+OPTION_ARG_LONG(--threads, n) Divide a query over many days of a database directory into n parts, and play them in parallel, each starting from the checkpoint of its first day.  The output is the same as that of a sequential query, except that objects displayed at the same time may be listed in a different order.
 OPTIONS_END
 
 SECTION(JX EXPRESSION LANGUAGE)
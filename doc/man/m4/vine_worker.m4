@@ -67,6 +67,10 @@ OPTION_ARG_LONG(feature, feature)Specifies a user-defined feature the worker pro
 OPTION_ARG_LONG(volatility, chance)Set the percent chance per minute that the worker will shut down (simulates worker failures, for testing only).
 OPTION_ARG_LONG(connection-mode, mode)When using -M, override manager preference to resolve its address. One of by_ip, by_hostname, or by_apparent_ip. Default is set by manager.
 OPTION_ARG_LONG(transfer-port,port) Listening port for worker-worker transfers.  (default: any))
+OPTION_ARG_LONG(transfer-threads,n) Maximum number of workers served at once by worker-worker transfers. (default: 64)
+OPTION_ARG_LONG(cache-eviction,policy) Policy to evict files when the cache fills the disk: lru, lfu, gdsf, or none. (default: lru)
+OPTION_ARG_LONG(cache-watermarks,percents) Percents of the disk at which cache eviction starts and stops, given as high,low. (default: 90,75)
+OPTION_ARG_LONG(cache-transfers,n) Maximum number of files fetched from other workers at once. (default: 16)
 
 OPTIONS_END
 
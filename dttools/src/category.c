@@ -839,17 +839,48 @@ category_allocation_t category_next_label(struct category *c, category_allocatio
 }
 
 
+/* Reset an internal summary to all fields unset, reusing its memory.
+ * These summaries are computed for every task considered by a scheduler,
+ * thus we avoid a malloc/free pair on each call. Anything the summary owns
+ * (e.g. limits_exceeded and peak_times merged in from other summaries) is
+ * freed before the fields are reset. */
+static struct rmsummary *category_reset_internal_summary(struct rmsummary *internal) {
+	static struct rmsummary *unset = NULL;
+
+	if(!unset) {
+		unset = rmsummary_create(-1);
+	}
+
+	if(!internal) {
+		return rmsummary_create(-1);
+	}
+
+	free(internal->command);
+	free(internal->category);
+	free(internal->exit_type);
+	free(internal->taskid);
+	free(internal->snapshot_name);
+
+	rmsummary_delete(internal->limits_exceeded);
+	rmsummary_delete(internal->peak_times);
+
+	size_t i;
+	for(i = 0; i < internal->snapshots_count; i++) {
+		rmsummary_delete(internal->snapshots[i]);
+	}
+	free(internal->snapshots);
+
+	*internal = *unset;
+	return internal;
+}
+
 //taskid >=0 means real task needs prediction, -1 means function called for other purposes
 const struct rmsummary *category_task_max_resources(struct category *c, struct rmsummary *user, category_allocation_t request, int taskid) {
 	/* we keep an internal label so that the caller does not have to worry
 	 * about memory leaks. */
 	static struct rmsummary *internal = NULL;
 
-	if(internal) {
-		rmsummary_delete(internal);
-	}
-
-	internal = rmsummary_create(-1);
+	internal = category_reset_internal_summary(internal);
 
     if(c->allocation_mode != CATEGORY_ALLOCATION_MODE_FIXED &&
         c->allocation_mode != CATEGORY_ALLOCATION_MODE_MAX) {
@@ -893,11 +924,7 @@ const struct rmsummary *category_task_min_resources(struct category *c, struct r
 	static struct rmsummary *internal = NULL;
 	const struct rmsummary *allocation = category_task_max_resources(c, user, request, taskid);
 
-	if(internal) {
-		rmsummary_delete(internal);
-	}
-
-	internal = rmsummary_create(-1);
+	internal = category_reset_internal_summary(internal);
 
 	/* load seen values */
 	struct rmsummary *seen = c->max_resources_seen;
@@ -15,6 +15,11 @@ See the file COPYING for details.
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#ifdef CCTOOLS_OPSYS_LINUX
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
 #include <errno.h>
 #include <limits.h>
 #include <signal.h>
@@ -98,6 +103,15 @@ int64_t copy_file_to_file(const char *input, const char *output)
 		return -1;
 	}
 
+#if defined(CCTOOLS_OPSYS_LINUX) && defined(FICLONE)
+	/* Where the filesystem supports it, share the blocks of the input until either is modified. */
+	if (ioctl(out, FICLONE, in) == 0) {
+		close(in);
+		close(out);
+		return info.st_size;
+	}
+#endif
+
 	int64_t total = copy_fd_to_fd(in, out);
 
 	close(in);
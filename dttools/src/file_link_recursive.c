@@ -1,6 +1,7 @@
 #include "file_link_recursive.h"
 #include "stringtools.h"
 #include "path.h"
+#include "xxmalloc.h"
 
 #include <sys/stat.h>
 #include <sys/fcntl.h>
@@ -56,13 +57,18 @@ int file_link_recursive( const char *source, const char *target, int allow_symli
 			be accidentally relative to the current directory.
 			*/
 
-			char *cwd = path_getcwd();
-			char *absolute_source = string_format("%s/%s", cwd, source);
+			char *absolute_source;
+			if(source[0]=='/') {
+				absolute_source = xxstrdup(source);
+			} else {
+				char *cwd = path_getcwd();
+				absolute_source = string_format("%s/%s", cwd, source);
+				free(cwd);
+			}
 
 			int result = symlink(absolute_source, target);
 
 			free(absolute_source);
-			free(cwd);
 
 			if(result==0) return 1;
 		}
@@ -10,10 +10,16 @@ See the file COPYING for details.
 #include <stdlib.h>
 #include <string.h>
 
+/* If configured with --hash-table open, the table itself is in hash_table_open.c */
+#ifndef CCTOOLS_HASH_TABLE_OPEN
+
 #define DEFAULT_SIZE 127
 #define DEFAULT_LOAD 0.75
 #define DEFAULT_FUNC hash_string
 
+/* Number of buckets moved to the new array by each insert while the table grows. */
+#define MIGRATE_BUCKETS 4
+
 struct entry {
 	char *key;
 	void *value;
@@ -21,11 +27,22 @@ struct entry {
 	struct entry *next;
 };
 
+/*
+When the table grows, the entries are not rehashed all at once.
+Instead, a new array of buckets is allocated, and each insert moves
+a few of the buckets of the old array into it, so that no single
+operation pays for the whole table.  Until the move is complete,
+lookups and removals search both arrays.
+*/
+
 struct hash_table {
 	hash_func_t hash_func;
 	int bucket_count;
 	int size;
 	struct entry **buckets;
+	struct entry **old_buckets;
+	int old_bucket_count;
+	int migrate_bucket;
 	int ibucket;
 	struct entry *ientry;
 };
@@ -52,16 +69,20 @@ struct hash_table *hash_table_create(int bucket_count, hash_func_t func)
 		return 0;
 	}
 
+	h->old_buckets = 0;
+	h->old_bucket_count = 0;
+	h->migrate_bucket = 0;
+
 	return h;
 }
 
-void hash_table_clear(struct hash_table *h, void (*delete_func) ( void *) )
+static void hash_table_clear_buckets(struct entry **buckets, int bucket_count, void (*delete_func) ( void *) )
 {
 	struct entry *e, *f;
 	int i;
 
-	for(i = 0; i < h->bucket_count; i++) {
-		e = h->buckets[i];
+	for(i = 0; i < bucket_count; i++) {
+		e = buckets[i];
 		while(e) {
 			f = e->next;
 			if(delete_func) delete_func(e->value);
@@ -69,11 +90,22 @@ void hash_table_clear(struct hash_table *h, void (*delete_func) ( void *) )
 			free(e);
 			e = f;
 		}
+		buckets[i] = 0;
 	}
+}
 
-	for(i = 0; i < h->bucket_count; i++) {
-		h->buckets[i] = 0;
+void hash_table_clear(struct hash_table *h, void (*delete_func) ( void *) )
+{
+	if(h->old_buckets) {
+		hash_table_clear_buckets(h->old_buckets, h->old_bucket_count, delete_func);
+		free(h->old_buckets);
+		h->old_buckets = 0;
+		h->old_bucket_count = 0;
+		h->migrate_bucket = 0;
 	}
+
+	hash_table_clear_buckets(h->buckets, h->bucket_count, delete_func);
+	h->size = 0;
 }
 
 
@@ -84,69 +116,96 @@ void hash_table_delete(struct hash_table *h)
 	free(h);
 }
 
-void *hash_table_lookup(struct hash_table *h, const char *key)
+/*
+Return the address of the link pointing to the entry with this key,
+in whichever array of buckets holds it, or null if not found.
+*/
+
+static struct entry **hash_table_find(struct hash_table *h, const char *key, unsigned hash)
 {
-	struct entry *e;
-	unsigned hash, index;
+	struct entry **e;
 
-	hash = h->hash_func(key);
-	index = hash % h->bucket_count;
-	e = h->buckets[index];
+	for(e = &h->buckets[hash % h->bucket_count]; *e; e = &(*e)->next) {
+		if(hash == (*e)->hash && !strcmp(key, (*e)->key))
+			return e;
+	}
 
-	while(e) {
-		if(hash == e->hash && !strcmp(key, e->key)) {
-			return e->value;
+	if(h->old_buckets) {
+		for(e = &h->old_buckets[hash % h->old_bucket_count]; *e; e = &(*e)->next) {
+			if(hash == (*e)->hash && !strcmp(key, (*e)->key))
+				return e;
 		}
-		e = e->next;
 	}
 
 	return 0;
 }
 
-int hash_table_size(struct hash_table *h)
+void *hash_table_lookup(struct hash_table *h, const char *key)
 {
-	return h->size;
+	struct entry **e = hash_table_find(h, key, h->hash_func(key));
+	if(e)
+		return (*e)->value;
+	return 0;
 }
 
-static int hash_table_double_buckets(struct hash_table *h)
+int hash_table_size(struct hash_table *h)
 {
-	struct hash_table *hn = hash_table_create(2 * h->bucket_count, h->hash_func);
+	return h->size;
+}
 
-	if(!hn)
-		return 0;
+/*
+Move up to n non-empty buckets of the old array into the new one,
+using the hashes stored in the entries.  Once the old array is empty, release it.
+*/
 
-	/* Move pairs to new hash */
-	char *key;
-	void *value;
-	hash_table_firstkey(h);
-	while(hash_table_nextkey(h, &key, &value))
-		if(!hash_table_insert(hn, key, value))
-		{
-			hash_table_delete(hn);
-			return 0;
+static void hash_table_migrate(struct hash_table *h, int n)
+{
+	int visited = 0;
+
+	while(n > 0 && h->migrate_bucket < h->old_bucket_count) {
+		struct entry *e = h->old_buckets[h->migrate_bucket];
+		h->old_buckets[h->migrate_bucket] = 0;
+		h->migrate_bucket++;
+
+		if(e) {
+			while(e) {
+				struct entry *f = e->next;
+				unsigned index = e->hash % h->bucket_count;
+				e->next = h->buckets[index];
+				h->buckets[index] = e;
+				e = f;
+			}
+			n--;
+		} else if(++visited > 10 * MIGRATE_BUCKETS) {
+			/* Bound the time spent skipping over empty buckets. */
+			break;
 		}
+	}
 
-	/* Delete all old pairs */
-	struct entry *e, *f;
-	int i;
-	for(i = 0; i < h->bucket_count; i++) {
-		e = h->buckets[i];
-		while(e) {
-			f = e->next;
-			free(e->key);
-			free(e);
-			e = f;
-		}
+	if(h->migrate_bucket >= h->old_bucket_count) {
+		free(h->old_buckets);
+		h->old_buckets = 0;
+		h->old_bucket_count = 0;
+		h->migrate_bucket = 0;
 	}
+}
 
-	/* Make the old point to the new */
-	free(h->buckets);
-	h->buckets      = hn->buckets;
-	h->bucket_count = hn->bucket_count;
-	h->size         = hn->size;
+static int hash_table_double_buckets(struct hash_table *h)
+{
+	/* A move still in progress must complete before another can begin. */
+	while(h->old_buckets)
+		hash_table_migrate(h, MIGRATE_BUCKETS);
+
+	struct entry **buckets = (struct entry **) calloc(2 * h->bucket_count, sizeof(struct entry *));
+	if(!buckets)
+		return 0;
+
+	h->old_buckets = h->buckets;
+	h->old_bucket_count = h->bucket_count;
+	h->migrate_bucket = 0;
 
-	/* Delete reference to new, so old is safe */
-	free(hn);
+	h->buckets = buckets;
+	h->bucket_count = 2 * h->bucket_count;
 
 	return 1;
 }
@@ -156,17 +215,15 @@ int hash_table_insert(struct hash_table *h, const char *key, const void *value)
 	struct entry *e;
 	unsigned hash, index;
 
-	if( ((float) h->size / h->bucket_count) > DEFAULT_LOAD )
-		hash_table_double_buckets(h);
-
 	hash = h->hash_func(key);
-	index = hash % h->bucket_count;
-	e = h->buckets[index];
 
-	while(e) {
-		if(hash == e->hash && !strcmp(key, e->key))
-			return 0;
-		e = e->next;
+	if(hash_table_find(h, key, hash))
+		return 0;
+
+	if(h->old_buckets) {
+		hash_table_migrate(h, MIGRATE_BUCKETS);
+	} else if( ((float) h->size / h->bucket_count) > DEFAULT_LOAD ) {
+		hash_table_double_buckets(h);
 	}
 
 	e = (struct entry *) malloc(sizeof(struct entry));
@@ -179,6 +236,7 @@ int hash_table_insert(struct hash_table *h, const char *key, const void *value)
 		return 0;
 	}
 
+	index = hash % h->bucket_count;
 	e->value = (void *) value;
 	e->hash = hash;
 	e->next = h->buckets[index];
@@ -190,40 +248,44 @@ int hash_table_insert(struct hash_table *h, const char *key, const void *value)
 
 void *hash_table_remove(struct hash_table *h, const char *key)
 {
-	struct entry *e, *f;
+	struct entry **e, *f;
 	void *value;
-	unsigned hash, index;
 
-	hash = h->hash_func(key);
-	index = hash % h->bucket_count;
-	e = h->buckets[index];
-	f = 0;
-
-	while(e) {
-		if(hash == e->hash && !strcmp(key, e->key)) {
-			if(f) {
-				f->next = e->next;
-			} else {
-				h->buckets[index] = e->next;
-			}
-			value = e->value;
-			free(e->key);
-			free(e);
-			h->size--;
-			return value;
-		}
-		f = e;
-		e = e->next;
-	}
+	e = hash_table_find(h, key, h->hash_func(key));
+	if(!e)
+		return 0;
 
-	return 0;
+	f = *e;
+	*e = f->next;
+
+	value = f->value;
+	free(f->key);
+	free(f);
+	h->size--;
+
+	return value;
+}
+
+/*
+Iteration visits the old array of buckets, if any, and then the new one.
+Entries move only when inserting, so removing the current entry
+while iterating is safe, as before.
+*/
+
+static struct entry *hash_table_bucket(struct hash_table *h, int i)
+{
+	if(i < h->old_bucket_count)
+		return h->old_buckets[i];
+	return h->buckets[i - h->old_bucket_count];
 }
 
 void hash_table_firstkey(struct hash_table *h)
 {
+	int total = h->old_bucket_count + h->bucket_count;
+
 	h->ientry = 0;
-	for(h->ibucket = 0; h->ibucket < h->bucket_count; h->ibucket++) {
-		h->ientry = h->buckets[h->ibucket];
+	for(h->ibucket = 0; h->ibucket < total; h->ibucket++) {
+		h->ientry = hash_table_bucket(h, h->ibucket);
 		if(h->ientry)
 			break;
 	}
@@ -232,14 +294,16 @@ void hash_table_firstkey(struct hash_table *h)
 int hash_table_nextkey(struct hash_table *h, char **key, void **value)
 {
 	if(h->ientry) {
+		int total = h->old_bucket_count + h->bucket_count;
+
 		*key = h->ientry->key;
 		*value = h->ientry->value;
 
 		h->ientry = h->ientry->next;
 		if(!h->ientry) {
 			h->ibucket++;
-			for(; h->ibucket < h->bucket_count; h->ibucket++) {
-				h->ientry = h->buckets[h->ibucket];
+			for(; h->ibucket < total; h->ibucket++) {
+				h->ientry = hash_table_bucket(h, h->ibucket);
 				if(h->ientry)
 					break;
 			}
@@ -250,6 +314,8 @@ int hash_table_nextkey(struct hash_table *h, char **key, void **value)
 	}
 }
 
+#endif
+
 typedef unsigned long int ub4;	/* unsigned 4-byte quantities */
 typedef unsigned char ub1;	/* unsigned 1-byte quantities */
 
@@ -0,0 +1,122 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Measure the time to insert, look up, iterate over, and remove entries
+in a hash_table.  Build once with each implementation of the table
+(./configure --hash-table chain or --hash-table open) to compare them.
+*/
+
+#include "hash_table.h"
+#include "timestamp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEY_MAX 64
+
+static void show_help(const char *cmd)
+{
+	printf("Use: %s [entries] [rounds]\n", cmd);
+}
+
+static void report(const char *op, long n, timestamp_t elapsed)
+{
+	printf("%-8s %10ld ops %10.3f s %8.1f ns/op\n", op, n, elapsed / 1000000.0, elapsed * 1000.0 / n);
+}
+
+int main(int argc, char *argv[])
+{
+	long entries = 1000000;
+	int rounds = 3;
+	long i;
+	int r;
+
+	if(argc > 1) {
+		if(!strcmp(argv[1], "-h")) {
+			show_help(argv[0]);
+			return 0;
+		}
+		entries = atol(argv[1]);
+	}
+	if(argc > 2)
+		rounds = atoi(argv[2]);
+
+	if(entries < 1 || rounds < 1) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	/* Keys shaped like the cache names used by taskvine, made in advance so only the table is timed. */
+	char *keys = malloc(entries * KEY_MAX);
+	for(i = 0; i < entries; i++)
+		snprintf(&keys[i * KEY_MAX], KEY_MAX, "file-rnd-%08lx%08lx-input.%ld.dat", i * 2654435761UL, i, i);
+
+	printf("%ld entries, %d rounds\n", entries, rounds);
+
+	for(r = 0; r < rounds; r++) {
+		timestamp_t start;
+		char *key;
+		void *value;
+		long found = 0;
+
+		struct hash_table *h = hash_table_create(0, 0);
+
+		/* Also track the slowest single insert, which includes any growth of the table. */
+		timestamp_t worst = 0;
+		start = timestamp_get();
+		for(i = 0; i < entries; i++) {
+			timestamp_t t = timestamp_get();
+			hash_table_insert(h, &keys[i * KEY_MAX], &keys[i * KEY_MAX]);
+			t = timestamp_get() - t;
+			if(t > worst)
+				worst = t;
+		}
+		report("insert", entries, timestamp_get() - start);
+		printf("%-8s %10.3f ms\n", "worst", worst / 1000.0);
+
+		start = timestamp_get();
+		for(i = 0; i < entries; i++) {
+			if(hash_table_lookup(h, &keys[i * KEY_MAX]))
+				found++;
+		}
+		report("lookup", entries, timestamp_get() - start);
+
+		start = timestamp_get();
+		for(i = 0; i < entries; i++) {
+			char missing[KEY_MAX];
+			snprintf(missing, KEY_MAX, "missing.%ld", i);
+			if(hash_table_lookup(h, missing))
+				found++;
+		}
+		report("miss", entries, timestamp_get() - start);
+
+		start = timestamp_get();
+		long n = 0;
+		HASH_TABLE_ITERATE(h, key, value)
+		{
+			n++;
+		}
+		report("iterate", n, timestamp_get() - start);
+
+		start = timestamp_get();
+		for(i = 0; i < entries; i++)
+			hash_table_remove(h, &keys[i * KEY_MAX]);
+		report("remove", entries, timestamp_get() - start);
+
+		if(found != entries || n != entries) {
+			fprintf(stderr, "hash_table_benchmark: found %ld entries of %ld\n", found, entries);
+			return 1;
+		}
+
+		hash_table_delete(h);
+	}
+
+	free(keys);
+
+	return 0;
+}
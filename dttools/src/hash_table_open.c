@@ -0,0 +1,368 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+An alternate implementation of the hash_table interface, using open
+addressing in the style of a "Swiss table".  It is selected at build time
+with ./configure --hash-table open, which defines CCTOOLS_HASH_TABLE_OPEN.
+
+Entries live in one flat array of slots, so an insert allocates only the
+copy of the key.  Alongside the slots is an array of control bytes, one
+per slot: EMPTY, DELETED, or seven bits of the hash of a full slot.
+A lookup examines a group of sixteen control bytes at once (with SSE2 if
+available), and compares keys only in the slots whose seven bits match.
+The full hash of each key is stored in its slot, so that growing the
+table never hashes a key again.
+*/
+
+#ifdef CCTOOLS_HASH_TABLE_OPEN
+
+#include "hash_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define DEFAULT_SIZE 127
+#define DEFAULT_FUNC hash_string
+
+#define GROUP_SIZE 16
+
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xfe
+
+/* A control byte with the high bit clear marks a full slot. */
+#define CTRL_IS_FULL(c) (!((c) & 0x80))
+
+struct slot {
+	char *key;
+	void *value;
+	unsigned hash;
+};
+
+struct hash_table {
+	hash_func_t hash_func;
+	int capacity;
+	int size;
+	int deleted;
+	unsigned char *ctrl;
+	struct slot *slots;
+	int islot;
+};
+
+/*
+Callers may supply weak hash functions, so spread the bits of the hash
+before splitting it into the group index and the seven bit tag.
+*/
+
+static unsigned mix_hash(unsigned h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+}
+
+#define HASH_TAG(h)   ((h) & 0x7f)
+#define HASH_GROUP(h) ((h) >> 7)
+
+/* Return a bitmask of the slots in the group starting at ctrl whose control byte is c. */
+
+static unsigned group_match(const unsigned char *ctrl, unsigned char c)
+{
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) c)));
+#else
+	unsigned mask = 0;
+	int i;
+	for(i = 0; i < GROUP_SIZE; i++) {
+		if(ctrl[i] == c)
+			mask |= 1U << i;
+	}
+	return mask;
+#endif
+}
+
+/* Return a bitmask of the slots in the group starting at ctrl that are empty or deleted. */
+
+static unsigned group_match_free(const unsigned char *ctrl)
+{
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+	return _mm_movemask_epi8(group);
+#else
+	unsigned mask = 0;
+	int i;
+	for(i = 0; i < GROUP_SIZE; i++) {
+		if(!CTRL_IS_FULL(ctrl[i]))
+			mask |= 1U << i;
+	}
+	return mask;
+#endif
+}
+
+static int lowest_bit(unsigned mask)
+{
+	return __builtin_ctz(mask);
+}
+
+static int hash_table_allocate(struct hash_table *h, int capacity)
+{
+	h->ctrl = malloc(capacity);
+	h->slots = malloc(capacity * sizeof(struct slot));
+	if(!h->ctrl || !h->slots) {
+		free(h->ctrl);
+		free(h->slots);
+		return 0;
+	}
+
+	memset(h->ctrl, CTRL_EMPTY, capacity);
+	h->capacity = capacity;
+	h->deleted = 0;
+
+	return 1;
+}
+
+struct hash_table *hash_table_create(int bucket_count, hash_func_t func)
+{
+	struct hash_table *h;
+	int capacity;
+
+	h = (struct hash_table *) malloc(sizeof(struct hash_table));
+	if(!h)
+		return 0;
+
+	if(bucket_count < 1)
+		bucket_count = DEFAULT_SIZE;
+	if(!func)
+		func = DEFAULT_FUNC;
+
+	/* The capacity is a power of two, and a whole number of groups. */
+	capacity = GROUP_SIZE;
+	while(capacity < bucket_count)
+		capacity *= 2;
+
+	h->size = 0;
+	h->hash_func = func;
+	h->islot = 0;
+
+	if(!hash_table_allocate(h, capacity)) {
+		free(h);
+		return 0;
+	}
+
+	return h;
+}
+
+void hash_table_clear(struct hash_table *h, void (*delete_func) ( void *) )
+{
+	int i;
+
+	for(i = 0; i < h->capacity; i++) {
+		if(CTRL_IS_FULL(h->ctrl[i])) {
+			if(delete_func) delete_func(h->slots[i].value);
+			free(h->slots[i].key);
+		}
+	}
+
+	memset(h->ctrl, CTRL_EMPTY, h->capacity);
+	h->size = 0;
+	h->deleted = 0;
+}
+
+void hash_table_delete(struct hash_table *h)
+{
+	hash_table_clear(h,0);
+	free(h->ctrl);
+	free(h->slots);
+	free(h);
+}
+
+/*
+Visit the groups of the table in the order probed for a hash.
+Stepping by one more group each time visits every group,
+because the number of groups is a power of two.
+*/
+
+#define PROBE_FIRST(h, hash) (HASH_GROUP(hash) & ((h)->capacity / GROUP_SIZE - 1))
+#define PROBE_NEXT(h, group, step) (((group) + (step)) & ((h)->capacity / GROUP_SIZE - 1))
+
+static int hash_table_find(struct hash_table *h, const char *key, unsigned hash)
+{
+	unsigned group = PROBE_FIRST(h, hash);
+	unsigned step = 0;
+
+	while(1) {
+		const unsigned char *ctrl = &h->ctrl[group * GROUP_SIZE];
+		unsigned mask = group_match(ctrl, HASH_TAG(hash));
+
+		while(mask) {
+			int i = group * GROUP_SIZE + lowest_bit(mask);
+			if(h->slots[i].hash == hash && !strcmp(key, h->slots[i].key))
+				return i;
+			mask &= mask - 1;
+		}
+
+		/* An empty slot ends the probe sequence: the key was never placed beyond it. */
+		if(group_match(ctrl, CTRL_EMPTY))
+			return -1;
+
+		step++;
+		group = PROBE_NEXT(h, group, step);
+	}
+}
+
+/* Return the first empty or deleted slot in the probe sequence of a hash. */
+
+static int hash_table_find_free(struct hash_table *h, unsigned hash)
+{
+	unsigned group = PROBE_FIRST(h, hash);
+	unsigned step = 0;
+
+	while(1) {
+		unsigned mask = group_match_free(&h->ctrl[group * GROUP_SIZE]);
+		if(mask)
+			return group * GROUP_SIZE + lowest_bit(mask);
+
+		step++;
+		group = PROBE_NEXT(h, group, step);
+	}
+}
+
+void *hash_table_lookup(struct hash_table *h, const char *key)
+{
+	int i = hash_table_find(h, key, mix_hash(h->hash_func(key)));
+	if(i < 0)
+		return 0;
+	return h->slots[i].value;
+}
+
+int hash_table_size(struct hash_table *h)
+{
+	return h->size;
+}
+
+/*
+Move all entries into a new array of slots of the given capacity,
+which also discards deleted slots.  Keys are moved, not copied,
+and the stored hashes are used to place them.
+*/
+
+static int hash_table_resize(struct hash_table *h, int capacity)
+{
+	unsigned char *old_ctrl = h->ctrl;
+	struct slot *old_slots = h->slots;
+	int old_capacity = h->capacity;
+	int i;
+
+	if(!hash_table_allocate(h, capacity)) {
+		h->ctrl = old_ctrl;
+		h->slots = old_slots;
+		return 0;
+	}
+
+	for(i = 0; i < old_capacity; i++) {
+		if(CTRL_IS_FULL(old_ctrl[i])) {
+			int j = hash_table_find_free(h, old_slots[i].hash);
+			h->ctrl[j] = old_ctrl[i];
+			h->slots[j] = old_slots[i];
+		}
+	}
+
+	free(old_ctrl);
+	free(old_slots);
+
+	return 1;
+}
+
+int hash_table_insert(struct hash_table *h, const char *key, const void *value)
+{
+	unsigned hash = mix_hash(h->hash_func(key));
+
+	if(hash_table_find(h, key, hash) >= 0)
+		return 0;
+
+	/*
+	Keep at least one slot in eight empty, so that every probe sequence ends.
+	If mostly deleted slots fill the table, rebuild it at the same size.
+	*/
+	if((h->size + h->deleted + 1) * 8 > h->capacity * 7) {
+		int capacity = h->capacity;
+		if(h->size >= h->capacity / 2)
+			capacity *= 2;
+		if(!hash_table_resize(h, capacity) && h->size + h->deleted + 1 >= h->capacity)
+			return 0;
+	}
+
+	char *k = strdup(key);
+	if(!k)
+		return 0;
+
+	int i = hash_table_find_free(h, hash);
+	if(h->ctrl[i] == CTRL_DELETED)
+		h->deleted--;
+
+	h->ctrl[i] = HASH_TAG(hash);
+	h->slots[i].key = k;
+	h->slots[i].value = (void *) value;
+	h->slots[i].hash = hash;
+	h->size++;
+
+	return 1;
+}
+
+void *hash_table_remove(struct hash_table *h, const char *key)
+{
+	int i = hash_table_find(h, key, mix_hash(h->hash_func(key)));
+	if(i < 0)
+		return 0;
+
+	void *value = h->slots[i].value;
+	free(h->slots[i].key);
+
+	/*
+	A group that still has an empty slot has never been full,
+	so no probe sequence continues past it, and the slot can become empty.
+	Otherwise the slot may be in the middle of another probe sequence.
+	*/
+	if(group_match(&h->ctrl[i / GROUP_SIZE * GROUP_SIZE], CTRL_EMPTY)) {
+		h->ctrl[i] = CTRL_EMPTY;
+	} else {
+		h->ctrl[i] = CTRL_DELETED;
+		h->deleted++;
+	}
+	h->size--;
+
+	return value;
+}
+
+void hash_table_firstkey(struct hash_table *h)
+{
+	h->islot = 0;
+}
+
+int hash_table_nextkey(struct hash_table *h, char **key, void **value)
+{
+	for(; h->islot < h->capacity; h->islot++) {
+		if(CTRL_IS_FULL(h->ctrl[h->islot])) {
+			*key = h->slots[h->islot].key;
+			*value = h->slots[h->islot].value;
+			h->islot++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+#endif
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,95 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash_table.h"
+
+#define NKEYS 100000
+
+/* A deliberately poor hash function, to exercise long probe sequences and chains. */
+static unsigned weak_hash(const char *s)
+{
+	return strlen(s);
+}
+
+static void check_table(hash_func_t func)
+{
+	char key[32];
+	char *k;
+	void *v;
+	long i;
+
+	struct hash_table *h = hash_table_create(0, func);
+	assert(h);
+
+	int nkeys = func ? NKEYS / 100 : NKEYS;
+
+	for(i = 0; i < nkeys; i++) {
+		sprintf(key, "key.%ld", i);
+		assert(hash_table_insert(h, key, (void *) (i + 1)));
+	}
+	assert(hash_table_size(h) == nkeys);
+
+	/* Duplicate keys are refused. */
+	assert(!hash_table_insert(h, "key.0", (void *) 1));
+
+	for(i = 0; i < nkeys; i++) {
+		sprintf(key, "key.%ld", i);
+		assert(hash_table_lookup(h, key) == (void *) (i + 1));
+	}
+	assert(!hash_table_lookup(h, "missing"));
+
+	/* Remove the even keys, while the odd keys remain reachable. */
+	for(i = 0; i < nkeys; i += 2) {
+		sprintf(key, "key.%ld", i);
+		assert(hash_table_remove(h, key) == (void *) (i + 1));
+	}
+	assert(!hash_table_remove(h, "key.0"));
+	assert(hash_table_size(h) == nkeys / 2);
+
+	for(i = 0; i < nkeys; i++) {
+		sprintf(key, "key.%ld", i);
+		assert(hash_table_lookup(h, key) == ((i % 2) ? (void *) (i + 1) : 0));
+	}
+
+	/* Reinsert into the space left by removed keys. */
+	for(i = 0; i < nkeys; i += 2) {
+		sprintf(key, "key.%ld", i);
+		assert(hash_table_insert(h, key, (void *) (i + 1)));
+	}
+	assert(hash_table_size(h) == nkeys);
+
+	/* Iteration visits every entry exactly once. */
+	long count = 0;
+	long sum = 0;
+	HASH_TABLE_ITERATE(h, k, v)
+	{
+		assert(!strncmp(k, "key.", 4));
+		assert((long) v == atol(k + 4) + 1);
+		count++;
+		sum += (long) v;
+	}
+	assert(count == nkeys);
+	assert(sum == (long) nkeys * (nkeys + 1) / 2);
+
+	/* Removing the current entry during iteration is allowed. */
+	HASH_TABLE_ITERATE(h, k, v)
+	{
+		if((long) v % 3 == 0) {
+			assert(hash_table_remove(h, k) == v);
+		}
+	}
+	assert(hash_table_size(h) == nkeys - nkeys / 3);
+
+	hash_table_delete(h);
+}
+
+int main(int argc, char *argv[])
+{
+	check_table(0);
+	check_table(weak_hash);
+
+	printf("hash_table tests passed\n");
+	return 0;
+}
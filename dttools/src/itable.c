@@ -13,16 +13,28 @@ See the file COPYING for details.
 #define DEFAULT_SIZE 127
 #define DEFAULT_LOAD 0.75
 
+/* Number of buckets moved to the new array by each insert while the table grows. */
+#define MIGRATE_BUCKETS 4
+
 struct entry {
 	UINT64_T key;
 	void *value;
 	struct entry *next;
 };
 
+/*
+As in hash_table, growing the table moves the entries into the new
+array of buckets a few buckets per insert, rather than all at once.
+Until the move is complete, lookups and removals search both arrays.
+*/
+
 struct itable {
 	int size;
 	int bucket_count;
 	struct entry **buckets;
+	struct entry **old_buckets;
+	int old_bucket_count;
+	int migrate_bucket;
 	int ibucket;
 	struct entry *ientry;
 };
@@ -45,29 +57,44 @@ struct itable *itable_create(int bucket_count)
 		return 0;
 	}
 
+	h->old_buckets = 0;
+	h->old_bucket_count = 0;
+	h->migrate_bucket = 0;
+
 	h->size = 0;
 
 	return h;
 }
 
-void itable_clear( struct itable *h, void (*delete_func)( void *) )
+static void itable_clear_buckets( struct entry **buckets, int bucket_count, void (*delete_func)( void *) )
 {
 	struct entry *e, *f;
 	int i;
 
-	for(i = 0; i < h->bucket_count; i++) {
-		e = h->buckets[i];
+	for(i = 0; i < bucket_count; i++) {
+		e = buckets[i];
 		while(e) {
 			if(delete_func) delete_func(e->value);
 			f = e->next;
 			free(e);
 			e = f;
 		}
+		buckets[i] = 0;
 	}
+}
 
-	for(i = 0; i < h->bucket_count; i++) {
-		h->buckets[i] = 0;
+void itable_clear( struct itable *h, void (*delete_func)( void *) )
+{
+	if(h->old_buckets) {
+		itable_clear_buckets(h->old_buckets, h->old_bucket_count, delete_func);
+		free(h->old_buckets);
+		h->old_buckets = 0;
+		h->old_bucket_count = 0;
+		h->migrate_bucket = 0;
 	}
+
+	itable_clear_buckets(h->buckets, h->bucket_count, delete_func);
+	h->size = 0;
 }
 
 void itable_delete(struct itable *h)
@@ -82,89 +109,117 @@ int itable_size(struct itable *h)
 	return h->size;
 }
 
-void *itable_lookup(struct itable *h, UINT64_T key)
+/*
+Return the address of the link pointing to the entry with this key,
+in whichever array of buckets holds it, or null if not found.
+*/
+
+static struct entry **itable_find(struct itable *h, UINT64_T key)
 {
-	struct entry *e;
-	UINT64_T index;
+	struct entry **e;
 
-	index = key % h->bucket_count;
-	e = h->buckets[index];
+	for(e = &h->buckets[key % h->bucket_count]; *e; e = &(*e)->next) {
+		if(key == (*e)->key)
+			return e;
+	}
 
-	while(e) {
-		if(key == e->key) {
-			return e->value;
+	if(h->old_buckets) {
+		for(e = &h->old_buckets[key % h->old_bucket_count]; *e; e = &(*e)->next) {
+			if(key == (*e)->key)
+				return e;
 		}
-		e = e->next;
 	}
 
 	return 0;
 }
 
-static int itable_double_buckets(struct itable *h)
+void *itable_lookup(struct itable *h, UINT64_T key)
 {
-	struct itable *hn = itable_create(2 * h->bucket_count);
+	struct entry **e = itable_find(h, key);
+	if(e)
+		return (*e)->value;
+	return 0;
+}
 
-	if(!hn)
-		return 0;
+/*
+Move up to n non-empty buckets of the old array into the new one.
+Once the old array is empty, release it.
+*/
 
-	/* Move pairs to new hash */
-	uint64_t key;
-	void *value;
-	itable_firstkey(h);
-	while(itable_nextkey(h, &key, &value))
-		if(!itable_insert(hn, key, value))
-		{
-			itable_delete(hn);
-			return 0;
+static void itable_migrate(struct itable *h, int n)
+{
+	int visited = 0;
+
+	while(n > 0 && h->migrate_bucket < h->old_bucket_count) {
+		struct entry *e = h->old_buckets[h->migrate_bucket];
+		h->old_buckets[h->migrate_bucket] = 0;
+		h->migrate_bucket++;
+
+		if(e) {
+			while(e) {
+				struct entry *f = e->next;
+				UINT64_T index = e->key % h->bucket_count;
+				e->next = h->buckets[index];
+				h->buckets[index] = e;
+				e = f;
+			}
+			n--;
+		} else if(++visited > 10 * MIGRATE_BUCKETS) {
+			/* Bound the time spent skipping over empty buckets. */
+			break;
 		}
+	}
 
-	/* Delete all old pairs */
-	struct entry *e, *f;
-	int i;
-	for(i = 0; i < h->bucket_count; i++) {
-		e = h->buckets[i];
-		while(e) {
-			f = e->next;
-			free(e);
-			e = f;
-		}
+	if(h->migrate_bucket >= h->old_bucket_count) {
+		free(h->old_buckets);
+		h->old_buckets = 0;
+		h->old_bucket_count = 0;
+		h->migrate_bucket = 0;
 	}
+}
 
-	/* Make the old point to the new */
-	free(h->buckets);
-	h->buckets      = hn->buckets;
-	h->bucket_count = hn->bucket_count;
-	h->size         = hn->size;
+static int itable_double_buckets(struct itable *h)
+{
+	/* A move still in progress must complete before another can begin. */
+	while(h->old_buckets)
+		itable_migrate(h, MIGRATE_BUCKETS);
 
-	/* Delete reference to new, so old is safe */
-	free(hn);
+	struct entry **buckets = (struct entry **) calloc(2 * h->bucket_count, sizeof(struct entry *));
+	if(!buckets)
+		return 0;
+
+	h->old_buckets = h->buckets;
+	h->old_bucket_count = h->bucket_count;
+	h->migrate_bucket = 0;
+
+	h->buckets = buckets;
+	h->bucket_count = 2 * h->bucket_count;
 
 	return 1;
 }
 
 int itable_insert(struct itable *h, UINT64_T key, const void *value)
 {
-	struct entry *e;
+	struct entry **f, *e;
 	UINT64_T index;
 
-	if( ((float) h->size / h->bucket_count) > DEFAULT_LOAD )
-		itable_double_buckets(h);
-
-	index = key % h->bucket_count;
-	e = h->buckets[index];
+	f = itable_find(h, key);
+	if(f) {
+		(*f)->value = (void *) value;
+		return 1;
+	}
 
-	while(e) {
-		if(key == e->key) {
-			e->value = (void *) value;
-			return 1;
-		}
-		e = e->next;
+	if(h->old_buckets) {
+		itable_migrate(h, MIGRATE_BUCKETS);
+	} else if( ((float) h->size / h->bucket_count) > DEFAULT_LOAD ) {
+		itable_double_buckets(h);
 	}
 
 	e = (struct entry *) malloc(sizeof(struct entry));
 	if(!e)
 		return 0;
 
+	index = key % h->bucket_count;
 	e->key = key;
 	e->value = (void *) value;
 	e->next = h->buckets[index];
@@ -176,31 +231,21 @@ int itable_insert(struct itable *h, UINT64_T key, const void *value)
 
 void *itable_remove(struct itable *h, UINT64_T key)
 {
-	struct entry *e, *f;
+	struct entry **e, *f;
 	void *value;
-	UINT64_T index;
 
-	index = key % h->bucket_count;
-	e = h->buckets[index];
-	f = 0;
-
-	while(e) {
-		if(key == e->key) {
-			if(f) {
-				f->next = e->next;
-			} else {
-				h->buckets[index] = e->next;
-			}
-			value = e->value;
-			free(e);
-			h->size--;
-			return value;
-		}
-		f = e;
-		e = e->next;
-	}
+	e = itable_find(h, key);
+	if(!e)
+		return 0;
 
-	return 0;
+	f = *e;
+	*e = f->next;
+
+	value = f->value;
+	free(f);
+	h->size--;
+
+	return value;
 }
 
 void * itable_pop( struct itable *t )
@@ -216,11 +261,26 @@ void * itable_pop( struct itable *t )
 	}
 }
 
+/*
+Iteration visits the old array of buckets, if any, and then the new one.
+Entries move only when inserting, so removing the current entry
+while iterating is safe, as before.
+*/
+
+static struct entry *itable_bucket(struct itable *h, int i)
+{
+	if(i < h->old_bucket_count)
+		return h->old_buckets[i];
+	return h->buckets[i - h->old_bucket_count];
+}
+
 void itable_firstkey(struct itable *h)
 {
+	int total = h->old_bucket_count + h->bucket_count;
+
 	h->ientry = 0;
-	for(h->ibucket = 0; h->ibucket < h->bucket_count; h->ibucket++) {
-		h->ientry = h->buckets[h->ibucket];
+	for(h->ibucket = 0; h->ibucket < total; h->ibucket++) {
+		h->ientry = itable_bucket(h, h->ibucket);
 		if(h->ientry)
 			break;
 	}
@@ -235,9 +295,10 @@ int itable_nextkey(struct itable *h, UINT64_T * key, void **value)
 
 		h->ientry = h->ientry->next;
 		if(!h->ientry) {
+			int total = h->old_bucket_count + h->bucket_count;
 			h->ibucket++;
-			for(; h->ibucket < h->bucket_count; h->ibucket++) {
-				h->ientry = h->buckets[h->ibucket];
+			for(; h->ibucket < total; h->ibucket++) {
+				h->ientry = itable_bucket(h, h->ibucket);
 				if(h->ientry)
 					break;
 			}
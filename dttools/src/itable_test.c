@@ -0,0 +1,61 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "itable.h"
+
+#define NKEYS 100000
+
+int main(int argc, char *argv[])
+{
+	UINT64_T key;
+	void *value;
+	UINT64_T i;
+
+	struct itable *t = itable_create(0);
+	assert(t);
+
+	/* Grow the table many times, checking lookups while entries move between arrays. */
+	for(i = 0; i < NKEYS; i++) {
+		assert(itable_insert(t, i * 7, (void *) (i + 1)));
+		assert(itable_lookup(t, i * 7) == (void *) (i + 1));
+		assert(itable_lookup(t, i / 2 * 7) == (void *) (i / 2 + 1));
+	}
+	assert(itable_size(t) == NKEYS);
+
+	/* Inserting an existing key replaces its value. */
+	assert(itable_insert(t, 0, (void *) 5));
+	assert(itable_lookup(t, 0) == (void *) 5);
+	assert(itable_insert(t, 0, (void *) 1));
+	assert(itable_size(t) == NKEYS);
+
+	for(i = 0; i < NKEYS; i += 2) {
+		assert(itable_remove(t, i * 7) == (void *) (i + 1));
+	}
+	assert(!itable_remove(t, 0));
+	assert(itable_size(t) == NKEYS / 2);
+
+	/* Iteration visits every entry exactly once, and may remove the current entry. */
+	UINT64_T count = 0;
+	ITABLE_ITERATE(t, key, value)
+	{
+		assert(key % 14 == 7);
+		assert((UINT64_T) value == key / 7 + 1);
+		count++;
+		if(count % 2)
+			assert(itable_remove(t, key) == value);
+	}
+	assert(count == NKEYS / 2);
+	assert(itable_size(t) == NKEYS / 4);
+
+	count = 0;
+	while(itable_pop(t))
+		count++;
+	assert(count == NKEYS / 4);
+	assert(itable_size(t) == 0);
+
+	itable_delete(t);
+
+	printf("itable tests passed\n");
+	return 0;
+}
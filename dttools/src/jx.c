@@ -5,8 +5,10 @@ See the file COPYING for details.
 */
 
 #include "jx.h"
+#include "jx_arena.h"
 #include "stringtools.h"
 #include "buffer.h"
+#include "hash_table.h"
 #include "xxmalloc.h"
 
 #include <assert.h>
@@ -15,9 +17,45 @@ See the file COPYING for details.
 #include <stdlib.h>
 #include <string.h>
 
+/*
+All memory for JX values goes through these three functions,
+so that values are built in the selected arena, if there is one.
+Memory that belongs to the selected arena is never freed one piece at a time,
+so deleting a value with errors during a parse is harmless.
+*/
+
+static void *jx_alloc( size_t size )
+{
+	struct jx_arena *a = jx_arena_selected();
+	if(a) return jx_arena_alloc(a, size);
+	return xxcalloc(1, size);
+}
+
+static char *jx_strdup( const char *str )
+{
+	struct jx_arena *a = jx_arena_selected();
+	if(a) return jx_arena_strdup(a, str);
+	return xxstrdup(str);
+}
+
+static void jx_free( void *ptr )
+{
+	struct jx_arena *a = jx_arena_selected();
+	if(a && jx_arena_owns(a, ptr)) return;
+	free(ptr);
+}
+
+/*
+An object built in an arena carries this in place of an index,
+as an index would be allocated on the heap and never freed.
+*/
+
+static char jx_index_never_marker;
+#define JX_INDEX_NEVER ((struct jx_index *) &jx_index_never_marker)
+
 struct jx_pair * jx_pair( struct jx *key, struct jx *value, struct jx_pair *next )
 {
-	struct jx_pair *pair = calloc(1, sizeof(*pair));
+	struct jx_pair *pair = jx_alloc(sizeof(*pair));
 	pair->key = key;
 	pair->value = value;
 	pair->next = next;
@@ -26,7 +64,7 @@ struct jx_pair * jx_pair( struct jx *key, struct jx *value, struct jx_pair *next
 
 struct jx_item * jx_item( struct jx *value, struct jx_item *next )
 {
-	struct jx_item *item = calloc(1, sizeof(*item));
+	struct jx_item *item = jx_alloc(sizeof(*item));
 	item->value = value;
 	item->next = next;
 	return item;
@@ -35,8 +73,8 @@ struct jx_item * jx_item( struct jx *value, struct jx_item *next )
 struct jx_comprehension *jx_comprehension(const char *variable, struct jx *elements, struct jx *condition, struct jx_comprehension *next) {
 	assert(variable);
 	assert(elements);
-	struct jx_comprehension *comp = calloc(1, sizeof(*comp));
-	comp->variable = strdup(variable);
+	struct jx_comprehension *comp = jx_alloc(sizeof(*comp));
+	comp->variable = jx_strdup(variable);
 	comp->elements = elements;
 	comp->condition = condition;
 	comp->next = next;
@@ -45,8 +83,9 @@ struct jx_comprehension *jx_comprehension(const char *variable, struct jx *eleme
 
 static struct jx * jx_create( jx_type_t type )
 {
-	struct jx *j = xxcalloc(1, sizeof(*j));
+	struct jx *j = jx_alloc(sizeof(*j));
 	j->type = type;
+	if(jx_arena_selected()) j->index = JX_INDEX_NEVER;
 	return j;
 }
 
@@ -58,18 +97,26 @@ struct jx * jx_null()
 struct jx * jx_symbol( const char *symbol_name )
 {
 	struct jx *j = jx_create(JX_SYMBOL);
-	j->u.symbol_name = strdup(symbol_name);
+	j->u.symbol_name = jx_strdup(symbol_name);
 	return j;
 }
 
 struct jx * jx_string( const char *string_value )
 {
 	assert(string_value);
-	return jx_string_nocopy(strdup(string_value));
+	struct jx *j = jx_create(JX_STRING);
+	j->u.string_value = jx_strdup(string_value);
+	return j;
 }
 
 struct jx * jx_string_nocopy( char *string_value )
 {
+	if(jx_arena_selected()) {
+		struct jx *j = jx_string(string_value);
+		free(string_value);
+		return j;
+	}
+
 	struct jx *j = jx_create(JX_STRING);
 	j->u.string_value = string_value;
 	return j;
@@ -90,8 +137,7 @@ struct jx * jx_format( const char *fmt, ... )
 	buffer_dup(B, &str);
 	buffer_free(B);
 
-	j = jx_create(JX_STRING);
-	j->u.string_value = str;
+	j = jx_string_nocopy(str);
 
 	return j;
 }
@@ -180,6 +226,158 @@ struct jx * jx_arrayv( struct jx *value, ... )
 	return array;
 }
 
+/*
+Objects with at least this many pairs are given an index once searched.
+Below it, walking the list is as fast as hashing the key.
+*/
+
+#define JX_INDEX_THRESHOLD 16
+
+/*
+An open addressing table (with linear probing) of the pairs of an object
+that have string keys.  When a key appears more than once, the first
+pair in the list is indexed, as that is the one found by a list walk.
+*/
+
+struct jx_index {
+	struct jx_pair *head;	/* first pair of the object when the index was last updated */
+	int duplicates;		/* true if some key appears more than once in the object */
+	int count;
+	int capacity;		/* always a power of two */
+	struct jx_pair **slots;
+};
+
+static const char *jx_pair_string_key( struct jx_pair *p )
+{
+	if(p->key && p->key->type==JX_STRING) {
+		return p->key->u.string_value;
+	} else {
+		return 0;
+	}
+}
+
+static void jx_index_delete( struct jx_index *index )
+{
+	if(!index || index==JX_INDEX_NEVER) return;
+	free(index->slots);
+	free(index);
+}
+
+/* Return the slot holding the pair with this key, or the empty slot where it would be placed. */
+
+static unsigned jx_index_find_slot( struct jx_index *index, const char *key )
+{
+	unsigned mask = index->capacity - 1;
+	unsigned i = hash_string(key) & mask;
+
+	while(index->slots[i] && strcmp(jx_pair_string_key(index->slots[i]), key)) {
+		i = (i + 1) & mask;
+	}
+
+	return i;
+}
+
+/*
+Add a pair to the index.  If the key is already present, the pair
+replaces it only if it is now ahead of the other in the list.
+*/
+
+static void jx_index_add( struct jx_index *index, struct jx_pair *p, int at_head )
+{
+	const char *key = jx_pair_string_key(p);
+	if(!key) return;
+
+	if((index->count + 1) * 2 > index->capacity) {
+		struct jx_pair **old_slots = index->slots;
+		int old_capacity = index->capacity;
+		int i;
+
+		index->capacity *= 2;
+		index->slots = xxcalloc(index->capacity, sizeof(struct jx_pair *));
+		for(i = 0; i < old_capacity; i++) {
+			if(old_slots[i]) {
+				index->slots[jx_index_find_slot(index, jx_pair_string_key(old_slots[i]))] = old_slots[i];
+			}
+		}
+		free(old_slots);
+	}
+
+	unsigned i = jx_index_find_slot(index, key);
+	if(index->slots[i]) {
+		index->duplicates = 1;
+		if(at_head) index->slots[i] = p;
+	} else {
+		index->slots[i] = p;
+		index->count++;
+	}
+}
+
+/* Remove the pair from the index, shifting back the pairs that probed past its slot. */
+
+static void jx_index_remove( struct jx_index *index, struct jx_pair *p )
+{
+	const char *key = jx_pair_string_key(p);
+	if(!key) return;
+
+	unsigned mask = index->capacity - 1;
+	unsigned i = jx_index_find_slot(index, key);
+	if(index->slots[i] != p) return;
+
+	index->slots[i] = 0;
+	index->count--;
+
+	unsigned j = i;
+	while(1) {
+		j = (j + 1) & mask;
+		if(!index->slots[j]) break;
+
+		/* Move the pair at j into the hole at i, unless its home lies cyclically in (i,j]. */
+		unsigned home = hash_string(jx_pair_string_key(index->slots[j])) & mask;
+		if((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+			index->slots[i] = index->slots[j];
+			index->slots[j] = 0;
+			i = j;
+		}
+	}
+}
+
+/*
+Return the index of a large object, building it if needed.
+If the list of pairs has changed at its head outside of jx_insert or jx_remove,
+the old index cannot be trusted, and is rebuilt.
+Returns null if the object is small enough to search directly.
+*/
+
+static struct jx_index *jx_index_get( struct jx *j )
+{
+	if(j->index==JX_INDEX_NEVER) return 0;
+
+	if(j->index) {
+		if(j->index->head == j->u.pairs) return j->index;
+		jx_index_delete(j->index);
+		j->index = 0;
+	}
+
+	struct jx_pair *p;
+	int n = 0;
+	for(p=j->u.pairs;p;p=p->next) {
+		if(++n >= JX_INDEX_THRESHOLD) break;
+	}
+	if(n < JX_INDEX_THRESHOLD) return 0;
+
+	struct jx_index *index = xxcalloc(1, sizeof(*index));
+	index->capacity = JX_INDEX_THRESHOLD * 4;
+	index->slots = xxcalloc(index->capacity, sizeof(struct jx_pair *));
+	index->head = j->u.pairs;
+
+	for(p=j->u.pairs;p;p=p->next) {
+		jx_index_add(index, p, 0);
+	}
+
+	j->index = index;
+	return index;
+}
+
 struct jx * jx_lookup_guard( struct jx *j, const char *key, int *found )
 {
 	struct jx_pair *p;
@@ -189,6 +387,17 @@ struct jx * jx_lookup_guard( struct jx *j, const char *key, int *found )
 
 	if(!j || j->type!=JX_OBJECT) return 0;
 
+	struct jx_index *index = jx_index_get(j);
+	if(index) {
+		p = index->slots[jx_index_find_slot(index, key)];
+		if(p) {
+			if(found)
+				*found = 1;
+			return p->value;
+		}
+		return 0;
+	}
+
 	for(p=j->u.pairs;p;p=p->next) {
 		if(p && p->key && p->key->type==JX_STRING) {
 			if(!strcmp(p->key->u.string_value,key)) {
@@ -267,11 +476,21 @@ struct jx * jx_remove( struct jx *object, struct jx *key )
 	for(p=object->u.pairs;p;p=p->next) {
 		if(jx_equals(key,p->key)) {
 			struct jx *value = p->value;
+			struct jx_index *index = object->index==JX_INDEX_NEVER ? 0 : object->index;
+			if(index && (index->duplicates || index->head != object->u.pairs)) {
+				/* Another pair with the same key may need to take its place, so start over. */
+				jx_index_delete(index);
+				object->index = index = 0;
+			}
 			if(last) {
 				last->next = p->next;
 			} else {
 				object->u.pairs = p->next;
 			}
+			if(index) {
+				jx_index_remove(index, p);
+				index->head = object->u.pairs;
+			}
 			p->value = 0;
 			p->next = 0;
 			jx_pair_delete(p);
@@ -286,7 +505,16 @@ struct jx * jx_remove( struct jx *object, struct jx *key )
 int jx_insert( struct jx *j, struct jx *key, struct jx *value )
 {
 	if(!j || j->type!=JX_OBJECT) return 0;
+	struct jx_index *index = j->index==JX_INDEX_NEVER ? 0 : j->index;
+	if(index && index->head != j->u.pairs) {
+		jx_index_delete(index);
+		j->index = index = 0;
+	}
 	j->u.pairs = jx_pair(key,value,j->u.pairs);
+	if(index) {
+		jx_index_add(index, j->u.pairs, 1);
+		index->head = j->u.pairs;
+	}
 	return 1;
 }
 
@@ -374,7 +602,7 @@ struct jx *jx_array_concat( struct jx *array, ...) {
 		}
 		*tail = a->u.items;
 		while(*tail) tail = &(*tail)->next;
-		free(a);
+		jx_free(a);
 	}
 	va_end(ap);
 	return result;
@@ -387,7 +615,7 @@ struct jx *jx_array_shift(struct jx *array) {
 	if (i) {
 		result = i->value;
 		array->u.items = i->next;
-		free(i);
+		jx_free(i);
 	}
 	return result;
 
@@ -400,7 +628,7 @@ void jx_pair_delete( struct jx_pair *pair )
 	jx_delete(pair->value);
 	jx_comprehension_delete(pair->comp);
 	jx_pair_delete(pair->next);
-	free(pair);
+	jx_free(pair);
 }
 
 void jx_item_delete( struct jx_item *item )
@@ -409,16 +637,16 @@ void jx_item_delete( struct jx_item *item )
 	jx_delete(item->value);
 	jx_comprehension_delete(item->comp);
 	jx_item_delete(item->next);
-	free(item);
+	jx_free(item);
 }
 
 void jx_comprehension_delete(struct jx_comprehension *comp) {
 	if (!comp) return;
-	free(comp->variable);
+	jx_free(comp->variable);
 	jx_delete(comp->elements);
 	jx_delete(comp->condition);
 	jx_comprehension_delete(comp->next);
-	free(comp);
+	jx_free(comp);
 }
 
 void jx_delete( struct jx *j )
@@ -432,16 +660,17 @@ void jx_delete( struct jx *j )
 		case JX_NULL:
 			break;
 		case JX_SYMBOL:
-			free(j->u.symbol_name);
+			jx_free(j->u.symbol_name);
 			break;
 		case JX_STRING:
-			free(j->u.string_value);
+			jx_free(j->u.string_value);
 			break;
 		case JX_ARRAY:
 			jx_item_delete(j->u.items);
 			break;
 		case JX_OBJECT:
 			jx_pair_delete(j->u.pairs);
+			jx_index_delete(j->index);
 			break;
 		case JX_OPERATOR:
 			jx_delete(j->u.oper.left);
@@ -451,7 +680,7 @@ void jx_delete( struct jx *j )
 			jx_delete(j->u.err);
 			break;
 	}
-	free(j);
+	jx_free(j);
 }
 
 int jx_isatomic( struct jx *j )
@@ -551,9 +780,9 @@ struct jx_comprehension *jx_comprehension_copy(struct jx_comprehension *c)
 	struct jx_comprehension **nc = &head;
 
 	while(c) {
-		*nc = calloc(1, sizeof(struct jx_comprehension));
+		*nc = jx_alloc(sizeof(struct jx_comprehension));
 		(*nc)->line = c->line;
-		(*nc)->variable = strdup(c->variable);
+		(*nc)->variable = jx_strdup(c->variable);
 		(*nc)->elements = jx_copy(c->elements);
 		(*nc)->condition = jx_copy(c->condition);
 
@@ -570,7 +799,7 @@ struct jx_pair * jx_pair_copy( struct jx_pair *p )
 	struct jx_pair **np = &head;
 
 	while(p) {
-		*np = calloc(1, sizeof(struct jx_pair));
+		*np = jx_alloc(sizeof(struct jx_pair));
 		(*np)->line = p->line;
 		(*np)->key = jx_copy(p->key);
 		(*np)->value = jx_copy(p->value);
@@ -589,7 +818,7 @@ struct jx_item * jx_item_copy( struct jx_item *i )
 	struct jx_item **ni = &head;
 
 	while(i) {
-		*ni = calloc(1, sizeof(struct jx_item));
+		*ni = jx_alloc(sizeof(struct jx_item));
 		(*ni)->line = i->line;
 		(*ni)->value = jx_copy(i->value);
 		(*ni)->comp = jx_comprehension_copy(i->comp);
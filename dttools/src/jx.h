@@ -112,6 +112,15 @@ struct jx_operator {
 	struct jx *right;
 };
 
+/** Index of the pairs of a large object by key, maintained by @ref jx_lookup, @ref jx_insert, and @ref jx_remove.
+An object is indexed lazily, once it is searched and has enough pairs.
+The index is discarded whenever the list of pairs is found to have changed at its head
+outside of those functions, so code that edits @ref jx.pairs directly should only add or remove
+pairs at the head of the list, or use @ref jx_insert and @ref jx_remove instead.
+*/
+
+struct jx_index;
+
 /** JX value representing any expression type. */
 
 struct jx {
@@ -128,6 +137,7 @@ struct jx {
 		struct jx_operator oper; /**< value of @ref JX_OPERATOR */
 		struct jx *err;  /**< error value of @ref JX_ERROR */
 	} u;
+	struct jx_index *index; /**< if a large @ref JX_OBJECT, an index of its pairs by key */
 };
 
 /** Create a JX null value. @return A JX expression. */
@@ -0,0 +1,162 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "jx_arena.h"
+#include "xxmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_BLOCK_SIZE 65536
+#define MAX_BLOCK_SIZE (16*1024*1024)
+
+/* Every allocation is aligned well enough for any member of a JX node. */
+#define ALIGNMENT 16
+#define ALIGN(n) (((n) + ALIGNMENT - 1) & ~((size_t) ALIGNMENT - 1))
+
+/*
+Memory is carved from the front of the newest block.
+When it runs out, a new block twice as large is added at the head of the list,
+so that a tree of any size needs only a logarithmic number of blocks.
+*/
+
+struct jx_arena_block {
+	struct jx_arena_block *next;
+	size_t size;
+	size_t used;
+	char *data;
+};
+
+struct jx_arena {
+	struct jx_arena_block *blocks;
+	size_t block_size;
+	size_t total;
+};
+
+/* Each thread selects its own arena, so that threads building values at once do not share one. */
+static __thread struct jx_arena *selected = 0;
+
+static struct jx_arena_block *jx_arena_block_create( size_t size )
+{
+	struct jx_arena_block *b = xxmalloc(sizeof(*b));
+	b->data = xxmalloc(size);
+	b->size = size;
+	b->used = 0;
+	b->next = 0;
+	return b;
+}
+
+static void jx_arena_block_delete( struct jx_arena_block *b )
+{
+	free(b->data);
+	free(b);
+}
+
+struct jx_arena *jx_arena_create( size_t block_size )
+{
+	struct jx_arena *a = xxmalloc(sizeof(*a));
+	if(block_size < ALIGNMENT) block_size = DEFAULT_BLOCK_SIZE;
+	a->block_size = ALIGN(block_size);
+	a->blocks = jx_arena_block_create(a->block_size);
+	a->total = 0;
+	return a;
+}
+
+void *jx_arena_alloc( struct jx_arena *a, size_t size )
+{
+	struct jx_arena_block *b = a->blocks;
+
+	size = ALIGN(size ? size : 1);
+
+	if(b->used + size > b->size) {
+		size_t block_size = b->size * 2;
+		if(block_size > MAX_BLOCK_SIZE) block_size = MAX_BLOCK_SIZE;
+		if(block_size < size) block_size = size;
+
+		b = jx_arena_block_create(block_size);
+		b->next = a->blocks;
+		a->blocks = b;
+	}
+
+	void *ptr = b->data + b->used;
+	b->used += size;
+	a->total += size;
+
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+char *jx_arena_strdup( struct jx_arena *a, const char *str )
+{
+	size_t length = strlen(str) + 1;
+	char *s = jx_arena_alloc(a, length);
+	memcpy(s, str, length);
+	return s;
+}
+
+int jx_arena_owns( struct jx_arena *a, const void *ptr )
+{
+	struct jx_arena_block *b;
+	const char *p = ptr;
+
+	for(b = a->blocks; b; b = b->next) {
+		if(p >= b->data && p < b->data + b->used) return 1;
+	}
+
+	return 0;
+}
+
+size_t jx_arena_size( struct jx_arena *a )
+{
+	return a->total;
+}
+
+void jx_arena_reset( struct jx_arena *a )
+{
+	struct jx_arena_block *largest = a->blocks;
+	struct jx_arena_block *b, *next;
+
+	/* Blocks grow as they are added, so the newest is kept as the largest. */
+	for(b = largest->next; b; b = next) {
+		next = b->next;
+		jx_arena_block_delete(b);
+	}
+
+	largest->next = 0;
+	largest->used = 0;
+	a->blocks = largest;
+	a->total = 0;
+}
+
+void jx_arena_delete( struct jx_arena *a )
+{
+	struct jx_arena_block *b, *next;
+
+	if(!a) return;
+
+	if(selected == a) selected = 0;
+
+	for(b = a->blocks; b; b = next) {
+		next = b->next;
+		jx_arena_block_delete(b);
+	}
+
+	free(a);
+}
+
+struct jx_arena *jx_arena_select( struct jx_arena *a )
+{
+	struct jx_arena *previous = selected;
+	selected = a;
+	return previous;
+}
+
+struct jx_arena *jx_arena_selected()
+{
+	return selected;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,99 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef JX_ARENA_H
+#define JX_ARENA_H
+
+/** @file jx_arena.h Region allocation of JX expressions.
+An arena holds JX values in a few large blocks of memory,
+so that a whole tree is built without calling malloc for each node,
+and is discarded all at once by @ref jx_arena_reset or @ref jx_arena_delete.
+This suits programs that parse a value, examine it, and throw it away,
+over and over again.
+
+While an arena is selected with @ref jx_arena_select, every JX value
+created by the constructors in @ref jx.h (and by the parser) is placed
+in that arena.  The simplest way to use an arena is to attach it to a parser:
+
+<pre>
+struct jx_arena *a = jx_arena_create(0);
+
+while(fgets(line,sizeof(line),file)) {
+	struct jx *j = jx_parse_string_arena(line,a);
+	... examine j ...
+	jx_arena_reset(a);
+}
+
+jx_arena_delete(a);
+</pre>
+
+A value in an arena must be treated as read-only once built:
+it must not be passed to @ref jx_delete, nor changed by @ref jx_insert,
+@ref jx_remove, and the like.  To keep any part of it beyond the life
+of the arena, make a copy with @ref jx_copy while no arena is selected.
+*/
+
+#include <stddef.h>
+
+struct jx_arena;
+
+/** Create an arena.
+@param block_size The size of the first block of memory, or zero for a default.
+@return A new arena, to be deleted with @ref jx_arena_delete.
+*/
+struct jx_arena *jx_arena_create( size_t block_size );
+
+/** Allocate zeroed memory from an arena.
+@param a The arena.
+@param size The number of bytes needed.
+@return A pointer to the memory, which lives until the arena is reset or deleted.
+*/
+void *jx_arena_alloc( struct jx_arena *a, size_t size );
+
+/** Copy a string into an arena.
+@param a The arena.
+@param str The string to copy.
+@return The copy of the string.
+*/
+char *jx_arena_strdup( struct jx_arena *a, const char *str );
+
+/** Test whether memory belongs to an arena.
+@param a The arena.
+@param ptr A pointer to test.
+@return True if ptr was returned by @ref jx_arena_alloc on this arena.
+*/
+int jx_arena_owns( struct jx_arena *a, const void *ptr );
+
+/** Return the number of bytes allocated from an arena since it was last reset.
+@param a The arena.
+@return The number of bytes allocated.
+*/
+size_t jx_arena_size( struct jx_arena *a );
+
+/** Discard everything allocated from an arena.
+The largest block of memory is kept for reuse.
+@param a The arena.
+*/
+void jx_arena_reset( struct jx_arena *a );
+
+/** Delete an arena and everything allocated from it.
+@param a The arena.
+*/
+void jx_arena_delete( struct jx_arena *a );
+
+/** Select the arena in which new JX values are created by the calling thread.
+Other threads are not affected, and continue to use their own selection.
+@param a The arena to use, or null to return to the ordinary heap.
+@return The arena previously selected, so that it can be restored.
+*/
+struct jx_arena *jx_arena_select( struct jx_arena *a );
+
+/** Return the arena in which new JX values are created.
+@return The selected arena, or null if values are created on the heap.
+*/
+struct jx_arena *jx_arena_selected();
+
+#endif
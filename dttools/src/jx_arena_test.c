@@ -0,0 +1,105 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jx.h"
+#include "jx_arena.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+
+#define NFIELDS 100
+
+/* Another thread does not see the arena selected by main, and builds on the heap. */
+static void *other_thread(void *arg)
+{
+	struct jx_arena *a = arg;
+	assert(!jx_arena_selected());
+	struct jx *j = jx_parse_string("{\"t\":[1,2,3]}");
+	assert(j && !jx_arena_owns(a, j));
+	jx_delete(j);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char text[4096];
+	char key[32];
+	int i, r;
+
+	struct jx_arena *a = jx_arena_create(256);
+
+	/* Objects large enough to be indexed, parsed over and over into the same arena. */
+	strcpy(text, "{");
+	for(i = 0; i < NFIELDS; i++) {
+		sprintf(&text[strlen(text)], "%s\"key%d\":[%d,\"value%d\",{\"x\":%d.5}]", i ? "," : "", i, i, i, i);
+	}
+	strcat(text, "}");
+
+	for(r = 0; r < 10; r++) {
+		struct jx *j = jx_parse_string_arena(text, a);
+		assert(j && jx_istype(j, JX_OBJECT));
+		assert(jx_arena_owns(a, j));
+		assert(jx_arena_size(a) > 0);
+
+		for(i = 0; i < NFIELDS; i++) {
+			sprintf(key, "key%d", i);
+			struct jx *v = jx_lookup(j, key);
+			assert(v && jx_istype(v, JX_ARRAY));
+			assert(jx_array_index(v, 0)->u.integer_value == i);
+			assert(jx_arena_owns(a, jx_array_index(v, 1)->u.string_value));
+		}
+		assert(!jx_lookup(j, "missing"));
+
+		/* A copy made outside the arena survives a reset, and prints the same. */
+		struct jx *c = jx_copy(j);
+		assert(!jx_arena_owns(a, c));
+		assert(jx_equals(c, j));
+		char *s1 = jx_print_string(j);
+
+		jx_arena_reset(a);
+		assert(jx_arena_size(a) == 0);
+
+		char *s2 = jx_print_string(c);
+		assert(!strcmp(s1, s2));
+		assert(jx_lookup(c, "key7"));
+
+		free(s1);
+		free(s2);
+		jx_delete(c);
+	}
+
+	/* A parse error leaves nothing to free but the arena. */
+	assert(!jx_parse_string_arena("{\"a\":[1,2,", a));
+	assert(!jx_parse_string_arena("{\"a\" 1}", a));
+
+	/* The parser restores the heap when it is done, even when used directly. */
+	struct jx_parser *p = jx_parser_create(false);
+	jx_parser_read_string(p, "[1,2,3] {\"b\":true}");
+	jx_parser_set_arena(p, a);
+	struct jx *x = jx_parser_yield(p);
+	struct jx *y = jx_parser_yield(p);
+	assert(x && y && jx_arena_owns(a, x) && jx_arena_owns(a, y));
+	assert(jx_lookup_boolean(y, "b"));
+	assert(!jx_arena_selected());
+	jx_parser_delete(p);
+
+	struct jx *h = jx_string("heap");
+	assert(!jx_arena_owns(a, h));
+	jx_delete(h);
+
+	pthread_t thread;
+	jx_arena_select(a);
+	assert(pthread_create(&thread, 0, other_thread, a) == 0);
+	pthread_join(thread, 0);
+	assert(jx_arena_selected() == a);
+	jx_arena_select(0);
+
+	jx_arena_delete(a);
+
+	printf("jx_arena_test: ok\n");
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,77 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jx.h"
+
+#define NKEYS 1000
+
+static void check_all(struct jx *j, int n, int removed_step)
+{
+	char key[32];
+	int i;
+
+	for(i = 0; i < n; i++) {
+		sprintf(key, "key%d", i);
+		int found;
+		struct jx *v = jx_lookup_guard(j, key, &found);
+		if(removed_step && i % removed_step == 0) {
+			assert(!found && !v);
+		} else {
+			assert(found && v && v->u.integer_value == i);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	char key[32];
+	int i;
+
+	struct jx *j = jx_object(0);
+
+	/* Lookups must agree with a list walk as the object grows past the index threshold. */
+	for(i = 0; i < NKEYS; i++) {
+		sprintf(key, "key%d", i);
+		jx_insert(j, jx_string(key), jx_integer(i));
+		assert(jx_lookup_integer(j, key) == i);
+		assert(!jx_lookup(j, "missing"));
+	}
+	check_all(j, NKEYS, 0);
+
+	/* A key inserted again shadows the earlier pair, and removing it reveals the earlier one. */
+	jx_insert(j, jx_string("key5"), jx_integer(-5));
+	assert(jx_lookup_integer(j, "key5") == -5);
+	struct jx *k = jx_string("key5");
+	jx_delete(jx_remove(j, k));
+	assert(jx_lookup_integer(j, "key5") == 5);
+
+	/* Removals keep the index in step. */
+	for(i = 0; i < NKEYS; i += 3) {
+		sprintf(key, "key%d", i);
+		struct jx *kk = jx_string(key);
+		struct jx *v = jx_remove(j, kk);
+		assert(v && v->u.integer_value == i);
+		jx_delete(v);
+		jx_delete(kk);
+	}
+	check_all(j, NKEYS, 3);
+
+	/* A pair pushed directly on the head of the list is still found. */
+	j->u.pairs = jx_pair(jx_string("direct"), jx_integer(7), j->u.pairs);
+	assert(jx_lookup_integer(j, "direct") == 7);
+	check_all(j, NKEYS, 3);
+
+	/* A copy of an indexed object behaves the same. */
+	struct jx *c = jx_copy(j);
+	assert(jx_equals(c, j));
+	check_all(c, NKEYS, 3);
+
+	jx_delete(k);
+	jx_delete(c);
+	jx_delete(j);
+
+	printf("jx index tests passed\n");
+	return 0;
+}
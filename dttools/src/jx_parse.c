@@ -7,6 +7,7 @@ See the file COPYING for details.
 #include "jx_parse.h"
 #include "jx_print.h"
 #include "jx_eval.h"
+#include "jx_arena.h"
 
 #include "stringtools.h"
 #include "debug.h"
@@ -78,9 +79,11 @@ struct jx_parser {
 	jx_token_t putback_token;
 	jx_int_t integer_value;
 	double double_value;
+	struct jx_arena *arena;
 };
 
-static bool static_mode = false;
+/* Kept per thread, so that threads replaying logs side by side do not disturb each other. */
+static __thread bool static_mode = false;
 
 void jx_parse_set_static_mode( bool mode ) {
 	static_mode = mode;
@@ -110,6 +113,11 @@ void jx_parser_read_link( struct jx_parser *p, struct link *l, time_t stoptime )
 	p->stoptime = stoptime;
 }
 
+void jx_parser_set_arena( struct jx_parser *p, struct jx_arena *a )
+{
+	p->arena = a;
+}
+
 int jx_parser_errors( struct jx_parser *p )
 {
 	return p->errors;
@@ -1061,28 +1069,43 @@ static struct jx * jx_parse_binary( struct jx_parser *s, int precedence )
 struct jx * jx_parse( struct jx_parser *s )
 {
 	struct jx *j = NULL;
+	struct jx_arena *previous = 0;
+
+	if(s->arena) previous = jx_arena_select(s->arena);
+
 	if (static_mode) {
 		j = jx_parse_unary(s);
 	} else {
 		j = jx_parse_binary(s,JX_PRECEDENCE_MAX);
 	}
 
-	if (!j)
-		return NULL;
+	if (j) {
+		jx_token_t t = jx_scan(s);
+		if(t!=JX_TOKEN_SEMI) jx_unscan(s,t);
+	}
 
-	jx_token_t t = jx_scan(s);
-	if(t!=JX_TOKEN_SEMI) jx_unscan(s,t);
+	if(s->arena) jx_arena_select(previous);
 
 	return j;
 }
 
+/*
+Discard a partial result after a parse error.
+A value in an arena is reclaimed along with the arena.
+*/
+
+static void jx_parser_discard( struct jx_parser *p, struct jx *j )
+{
+	if(!p->arena) jx_delete(j);
+}
+
 static struct jx * jx_parse_finish( struct jx_parser *p )
 {
 	struct jx * j = jx_parse(p);
 	if(jx_parser_errors(p)) {
 		debug(D_JX|D_NOTICE, "parse error: %s", jx_parser_error_string(p));
+		jx_parser_discard(p,j);
 		jx_parser_delete(p);
-		jx_delete(j);
 		return NULL;
 	}
 	jx_parser_delete(p);
@@ -1094,7 +1117,7 @@ struct jx * jx_parser_yield( struct jx_parser *p )
 	struct jx * j = jx_parse(p);
 	if(jx_parser_errors(p)) {
 		debug(D_JX|D_NOTICE, "parse error: %s", jx_parser_error_string(p));
-		jx_delete(j);
+		jx_parser_discard(p,j);
 		return NULL;
 	}
 	return j;
@@ -1107,6 +1130,14 @@ struct jx * jx_parse_string( const char *str )
 	return jx_parse_finish(p);
 }
 
+struct jx * jx_parse_string_arena( const char *str, struct jx_arena *a )
+{
+	struct jx_parser *p = jx_parser_create(false);
+	jx_parser_read_string(p,str);
+	jx_parser_set_arena(p,a);
+	return jx_parse_finish(p);
+}
+
 struct jx * jx_parse_link( struct link *l, time_t stoptime )
 {
 	struct jx_parser *p = jx_parser_create(false);
@@ -18,6 +18,7 @@ with the following exceptions:
 */
 
 #include "jx.h"
+#include "jx_arena.h"
 #include "link.h"
 
 #include <stdbool.h>
@@ -25,12 +26,31 @@ with the following exceptions:
 
 struct jx_parser;
 
-/* Sets module-wide flag for static parse mode */
+/* Sets the flag for static parse mode, in the calling thread */
 void jx_parse_set_static_mode( bool mode );
 
 /** Parse a JSON string to a JX expression.  @param str A C string containing JSON data.  @return A JX expression which must be deleted with @ref jx_delete. If the parse fails or no JSON value is present, null is returned. */
 struct jx * jx_parse_string( const char *str );
 
+/** Parse a JSON string to a JX expression in an arena.  @param str A C string containing JSON data.  @param a The arena in which to build the expression.  @return A JX expression which lives until the arena is reset or deleted, and must not be passed to @ref jx_delete. If the parse fails or no JSON value is present, null is returned. @see jx_arena.h */
+struct jx * jx_parse_string_arena( const char *str, struct jx_arena *a );
+
+/** Parse a JSON string that is expected to hold only data.
+Plain JSON is read by a fast scanner, and anything else is handed to @ref jx_parse_string,
+so the result is the same, except that values do not carry line numbers,
+and strings are not limited in length.
+@param str A C string containing JSON data.
+@return A JX expression which must be deleted with @ref jx_delete. If the parse fails or no JSON value is present, null is returned.
+*/
+struct jx * jx_parse_json_string( const char *str );
+
+/** Parse a standard IO stream that is expected to hold only JSON data.
+The whole of the remaining stream is read, and parsed as by @ref jx_parse_json_string.
+@param file A stream containing JSON data.
+@return A JX expression which must be deleted with @ref jx_delete. If the parse fails or no JSON value is present, null is returned.
+*/
+struct jx * jx_parse_json_stream( FILE *file );
+
 /** Parse a standard IO stream to a JX expression.  @param file A stream containing JSON data.  @return A JX expression which must be deleted with @ref jx_delete. If the parse fails or no JSON value is present, null is returned. */
 struct jx * jx_parse_stream( FILE *file );
 
@@ -69,6 +89,9 @@ void jx_parser_read_string( struct jx_parser *p, const char *str );
 /** Attach parser to a link.  @param p A parser object.  @param l A link object.  @param stoptime The absolute time at which to stop. */
 void jx_parser_read_link( struct jx_parser *p, struct link *l, time_t stoptime );
 
+/** Build parsed values in an arena instead of on the heap. Values returned by the parser then live until the arena is reset or deleted, and must not be passed to @ref jx_delete.  @param p A parser object.  @param a The arena to use, or null for the heap.  @see jx_arena.h */
+void jx_parser_set_arena( struct jx_parser *p, struct jx_arena *a );
+
 /** Parse and return a single value. This function is useful for streaming multiple independent values from a single source. @param p A parser object @return A JX expression which must be deleted with @ref jx_delete. If the parse fails or no JSON value is present, null is returned. */
 struct jx * jx_parser_yield( struct jx_parser *p );
 
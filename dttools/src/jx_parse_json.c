@@ -0,0 +1,538 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+A fast path for parsing plain JSON data into JX values.
+
+The general parser in jx_parse.c reads one character at a time and
+handles the whole JX expression language.  Most of the JSON read by
+cctools (catalog updates, deltadb logs and checkpoints, task descriptions,
+resource summaries) is only data, and is parsed here in two stages,
+in the manner of simdjson:
+
+1 - The whole text is scanned in blocks of 64 bytes, each classified with
+vector instructions (SSE2 or AVX2, with a scalar fallback) into bitmasks
+of quotes, backslashes, punctuation, and whitespace.  A few bitwise steps
+over each block find which characters are inside of strings, and produce
+an index of the positions of all structural characters: punctuation outside
+of strings, the opening quote of each string, and the first character
+of each number or literal.
+
+2 - The index is walked by a small recursive descent parser, which never
+has to look at the characters between one structural position and the next,
+except to decode strings and numbers.
+
+Anything that is not strict JSON (expressions, comments, trailing commas,
+or a plain error) is handed to the general parser, so that the result is
+always the same as that of jx_parse_string.
+*/
+
+#include "jx_parse.h"
+#include "debug.h"
+#include "xxmalloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* Deeper nesting than this is left to the general parser. */
+#define JSON_DEPTH_MAX 1024
+
+/* No number in JSON data is longer than this. */
+#define JSON_NUMBER_MAX 64
+
+struct json_scanner {
+	const char *data;
+	uint32_t *index;	/* positions of structural characters, in order */
+	size_t count;
+	size_t next;
+	int depth;
+	char *buffer;		/* space to decode a string with escapes */
+	size_t buffer_size;
+};
+
+/* Bitmasks classifying each of the 64 characters of a block. */
+
+struct json_block {
+	uint64_t quote;
+	uint64_t backslash;
+	uint64_t punct;
+	uint64_t space;
+};
+
+#if defined(__AVX2__)
+
+static void json_classify( const unsigned char *data, struct json_block *b )
+{
+	int i;
+
+	memset(b, 0, sizeof(*b));
+
+	for(i = 0; i < 64; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (data + i));
+		/* Setting bit 5 maps [ and ] onto { and }. */
+		__m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+		__m256i punct = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('}'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+		__m256i space = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+
+		b->quote |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << i;
+		b->backslash |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << i;
+		b->punct |= (uint64_t) (uint32_t) _mm256_movemask_epi8(punct) << i;
+		b->space |= (uint64_t) (uint32_t) _mm256_movemask_epi8(space) << i;
+	}
+}
+
+#elif defined(__SSE2__)
+
+static void json_classify( const unsigned char *data, struct json_block *b )
+{
+	int i;
+
+	memset(b, 0, sizeof(*b));
+
+	for(i = 0; i < 64; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+		/* Setting bit 5 maps [ and ] onto { and }. */
+		__m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+		__m128i punct = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')), _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+		__m128i space = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+
+		b->quote |= (uint64_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << i;
+		b->backslash |= (uint64_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << i;
+		b->punct |= (uint64_t) _mm_movemask_epi8(punct) << i;
+		b->space |= (uint64_t) _mm_movemask_epi8(space) << i;
+	}
+}
+
+#else
+
+static void json_classify( const unsigned char *data, struct json_block *b )
+{
+	int i;
+
+	memset(b, 0, sizeof(*b));
+
+	for(i = 0; i < 64; i++) {
+		uint64_t bit = 1ULL << i;
+		switch(data[i]) {
+			case '"':  b->quote |= bit; break;
+			case '\\': b->backslash |= bit; break;
+			case '{': case '}': case '[': case ']': case ':': case ',':
+				b->punct |= bit; break;
+			case ' ': case '\t': case '\n': case '\r':
+				b->space |= bit; break;
+		}
+	}
+}
+
+#endif
+
+/*
+Return a mask with each bit set to the parity of the bits at or below it,
+which turns the positions of quotes into the spans between them.
+*/
+
+static uint64_t json_prefix_xor( uint64_t x )
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+/*
+Return a mask of the characters escaped by a backslash.
+A backslash escapes the character after it, unless it is itself escaped.
+Backslashes are rare, so they are simply visited in turn.
+*carry is set if the last character of the block escapes the first of the next.
+*/
+
+static uint64_t json_escaped( uint64_t backslash, uint64_t *carry )
+{
+	uint64_t escaped = *carry;
+
+	backslash &= ~escaped;
+	*carry = 0;
+
+	while(backslash) {
+		int i = __builtin_ctzll(backslash);
+		if(i == 63) {
+			*carry = 1;
+			break;
+		}
+		escaped |= 2ULL << i;
+		backslash &= ~(3ULL << i);
+	}
+
+	return escaped;
+}
+
+/*
+Stage one: fill index with the positions of the structural characters
+of data, and return how many there are, or -1 if a string is not closed.
+*/
+
+static long json_build_index( const char *data, size_t length, uint32_t *index )
+{
+	uint64_t in_string_carry = 0;
+	uint64_t escape_carry = 0;
+	uint64_t scalar_carry = 0;
+	size_t count = 0;
+	size_t pos;
+
+	for(pos = 0; pos < length; pos += 64) {
+		const unsigned char *block = (const unsigned char *) data + pos;
+		unsigned char tail[64];
+		struct json_block b;
+
+		if(length - pos < 64) {
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, block, length - pos);
+			block = tail;
+		}
+
+		json_classify(block, &b);
+
+		uint64_t quote = b.quote & ~json_escaped(b.backslash, &escape_carry);
+
+		/* From each opening quote up to, but not including, its closing quote. */
+		uint64_t in_string = json_prefix_xor(quote) ^ in_string_carry;
+		in_string_carry = (uint64_t) ((int64_t) in_string >> 63);
+
+		/* Numbers and literals are runs of anything else outside of strings. */
+		uint64_t scalar = ~(b.punct | b.space | quote | in_string);
+		uint64_t scalar_start = scalar & ~((scalar << 1) | scalar_carry);
+		scalar_carry = scalar >> 63;
+
+		uint64_t structural = (b.punct & ~in_string) | (quote & in_string) | scalar_start;
+
+		while(structural) {
+			index[count++] = pos + __builtin_ctzll(structural);
+			structural &= structural - 1;
+		}
+	}
+
+	if(in_string_carry) return -1;
+
+	return count;
+}
+
+static int json_is_terminator( char c )
+{
+	return !c || strchr(" \t\r\n{}[]:,", c);
+}
+
+static char json_peek( struct json_scanner *s )
+{
+	if(s->next >= s->count) return 0;
+	return s->data[s->index[s->next]];
+}
+
+static struct jx * json_parse_value( struct json_scanner *s );
+
+/* Make room for at least size more bytes after the first used bytes of the buffer. */
+
+static void json_reserve( struct json_scanner *s, size_t used, size_t size )
+{
+	if(used + size <= s->buffer_size) return;
+
+	s->buffer_size = 2 * (used + size);
+	s->buffer = xxrealloc(s->buffer, s->buffer_size);
+}
+
+/*
+Decode the string that opens at str, with the same escapes as the general parser.
+Only escapes of basic ASCII characters are accepted with \u.
+*/
+
+static struct jx * json_parse_string( struct json_scanner *s, const char *str )
+{
+	const char *in = str + 1;
+	size_t used = 0;
+
+	while(1) {
+		size_t n = strcspn(in, "\"\\");
+		json_reserve(s, used, n + 1);
+		memcpy(&s->buffer[used], in, n);
+		used += n;
+		in += n;
+
+		if(*in == '"') break;
+		if(*in != '\\') return 0;
+
+		in++;
+		switch(*in) {
+			case 'b': s->buffer[used++] = '\b'; break;
+			case 'f': s->buffer[used++] = '\f'; break;
+			case 'n': s->buffer[used++] = '\n'; break;
+			case 'r': s->buffer[used++] = '\r'; break;
+			case 't': s->buffer[used++] = '\t'; break;
+			case 'u': {
+				char hex[5];
+				unsigned uc;
+				int i;
+				for(i = 0; i < 4; i++) {
+					if(!in[i + 1]) return 0;
+					hex[i] = in[i + 1];
+				}
+				hex[4] = 0;
+				/* A null character would end the string early. */
+				if(sscanf(hex, "%x", &uc) != 1 || uc == 0 || uc > 0x7f) return 0;
+				s->buffer[used++] = uc;
+				in += 4;
+				break;
+			}
+			case 0:
+				return 0;
+			default:
+				s->buffer[used++] = *in;
+				break;
+		}
+		in++;
+	}
+
+	s->buffer[used] = 0;
+
+	return jx_string(s->buffer);
+}
+
+/*
+Decode a number in the way of the general parser: a negative sign is
+applied to the value of the digits after it, which is an integer if
+the whole of the digits can be read as one, and a double otherwise.
+*/
+
+static struct jx * json_parse_number( const char *str )
+{
+	char token[JSON_NUMBER_MAX];
+	int negative = 0;
+	int i = 0;
+
+	if(*str == '-') {
+		negative = 1;
+		str++;
+	}
+
+	while(i < JSON_NUMBER_MAX - 1) {
+		char c = str[i];
+		if((c >= '0' && c <= '9') || c == '.') {
+			token[i++] = c;
+		} else if(c == 'e' || c == 'E') {
+			token[i++] = c;
+			if((str[i] == '-' || str[i] == '+') && i < JSON_NUMBER_MAX - 1) {
+				token[i] = str[i];
+				i++;
+			}
+		} else {
+			break;
+		}
+	}
+
+	if(i == 0 || !json_is_terminator(str[i])) return 0;
+	token[i] = 0;
+
+	/* Most numbers are small integers, which need not go through strtoll. */
+	if(i < 19) {
+		jx_int_t integer_value = 0;
+		int k;
+		for(k = 0; k < i && token[k] >= '0' && token[k] <= '9'; k++) {
+			integer_value = integer_value * 10 + token[k] - '0';
+		}
+		if(k == i) return jx_integer(negative ? -integer_value : integer_value);
+	}
+
+	char *endptr;
+
+	jx_int_t integer_value = strtoll(token, &endptr, 10);
+	if(!*endptr) return jx_integer(negative ? -integer_value : integer_value);
+
+	double double_value = strtod(token, &endptr);
+	if(!*endptr) return jx_double(negative ? -double_value : double_value);
+
+	return 0;
+}
+
+static struct jx * json_parse_literal( const char *str )
+{
+	if(!strncmp(str, "true", 4) && json_is_terminator(str[4])) {
+		return jx_boolean(1);
+	} else if(!strncmp(str, "false", 5) && json_is_terminator(str[5])) {
+		return jx_boolean(0);
+	} else if(!strncmp(str, "null", 4) && json_is_terminator(str[4])) {
+		return jx_null();
+	} else {
+		return 0;
+	}
+}
+
+static struct jx * json_parse_object( struct json_scanner *s )
+{
+	struct jx *j = jx_object(0);
+	struct jx_pair **tail = &j->u.pairs;
+
+	if(json_peek(s) == '}') {
+		s->next++;
+		return j;
+	}
+
+	while(1) {
+		if(json_peek(s) != '"') break;
+
+		struct jx *key = json_parse_value(s);
+		if(!key) break;
+
+		*tail = jx_pair(key, 0, 0);
+
+		if(json_peek(s) != ':') break;
+		s->next++;
+
+		(*tail)->value = json_parse_value(s);
+		if(!(*tail)->value) break;
+		tail = &(*tail)->next;
+
+		char c = json_peek(s);
+		s->next++;
+		if(c == '}') return j;
+		if(c != ',') break;
+	}
+
+	jx_delete(j);
+	return 0;
+}
+
+static struct jx * json_parse_array( struct json_scanner *s )
+{
+	struct jx *j = jx_array(0);
+	struct jx_item **tail = &j->u.items;
+
+	if(json_peek(s) == ']') {
+		s->next++;
+		return j;
+	}
+
+	while(1) {
+		struct jx *value = json_parse_value(s);
+		if(!value) break;
+
+		*tail = jx_item(value, 0);
+		tail = &(*tail)->next;
+
+		char c = json_peek(s);
+		s->next++;
+		if(c == ']') return j;
+		if(c != ',') break;
+	}
+
+	jx_delete(j);
+	return 0;
+}
+
+/* Stage two: parse the value at the next structural position. */
+
+static struct jx * json_parse_value( struct json_scanner *s )
+{
+	struct jx *j;
+
+	if(s->next >= s->count) return 0;
+
+	const char *str = &s->data[s->index[s->next++]];
+
+	switch(*str) {
+		case '{':
+		case '[':
+			if(++s->depth > JSON_DEPTH_MAX) return 0;
+			j = *str == '{' ? json_parse_object(s) : json_parse_array(s);
+			s->depth--;
+			return j;
+		case '"':
+			return json_parse_string(s, str);
+		case 't':
+		case 'f':
+		case 'n':
+			return json_parse_literal(str);
+		default:
+			return json_parse_number(str);
+	}
+}
+
+static struct jx * json_parse( const char *str, size_t length )
+{
+	struct json_scanner s;
+	struct jx *j = 0;
+
+	if(length >= UINT32_MAX) return 0;
+
+	memset(&s, 0, sizeof(s));
+	s.data = str;
+
+	/* There can be no more structural characters than characters. */
+	s.index = malloc((length + 1) * sizeof(uint32_t));
+	if(!s.index) return 0;
+
+	long count = json_build_index(str, length, s.index);
+	if(count > 0) {
+		s.count = count;
+		j = json_parse_value(&s);
+		if(j && s.next != s.count) {
+			jx_delete(j);
+			j = 0;
+		}
+	}
+
+	free(s.index);
+	free(s.buffer);
+
+	return j;
+}
+
+struct jx * jx_parse_json_string( const char *str )
+{
+	struct jx *j = json_parse(str, strlen(str));
+	if(j) return j;
+
+	debug(D_JX, "not plain JSON data, using the general parser");
+	return jx_parse_string(str);
+}
+
+struct jx * jx_parse_json_stream( FILE *file )
+{
+	size_t size = 65536;
+	size_t length = 0;
+	char *data = xxmalloc(size);
+	size_t n;
+
+	while((n = fread(&data[length], 1, size - length - 1, file)) > 0) {
+		length += n;
+		if(size - length - 1 == 0) {
+			size *= 2;
+			data = xxrealloc(data, size);
+		}
+	}
+	data[length] = 0;
+
+	struct jx *j = jx_parse_json_string(data);
+	free(data);
+
+	return j;
+}
+
+/* vim: set noexpandtab tabstop=8: */
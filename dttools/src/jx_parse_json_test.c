@@ -0,0 +1,157 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+
+/* The fast parser must agree with the general parser on everything. */
+
+static const char *cases[] = {
+	"{}",
+	"[]",
+	" { \"a\" : 1 , \"b\" : [ true , false , null ] } ",
+	"{\"a\":-5,\"b\":-0.25,\"c\":1e3,\"d\":1.5E-3,\"e\":12345678901234}",
+	"[\"\\\"quoted\\\"\",\"back\\\\slash\",\"tab\\tnew\\nline\",\"\\u0041\\/\"]",
+	"[\"\\\\\",\"\\\\\\\\\",\"\\\\\\\"\"]",
+	"{\"a\":{\"b\":{\"c\":[[[]]]}}}",
+	"\"just a string\"",
+	"42",
+	"-7",
+	"true",
+	"{\"a\":1,\"a\":2}",
+	"[1,2,]",
+	"{\"a\":1,}",
+	"[1 2]",
+	"{\"a\" 1}",
+	"{\"a\":1}}",
+	"[1,2",
+	"\"unterminated",
+	"[\"\\u00e9\"]",
+	"[\"\\u0000\"]",
+	"{\"a\":1+2}",
+	"{\"a\":x}",
+	"[1-2]",
+	"[- 1]",
+	"[1.2.3]",
+	"[tru]",
+	"[truex]",
+	"# comment\n{\"a\":1}",
+	"{\"a\":1};",
+	"",
+	"   ",
+	0,
+};
+
+static void compare(const char *str)
+{
+	struct jx *a = jx_parse_json_string(str);
+	struct jx *b = jx_parse_string(str);
+
+	if(!a || !b) {
+		assert(!a && !b);
+		return;
+	}
+
+	char *sa = jx_print_string(a);
+	char *sb = jx_print_string(b);
+	if(jx_is_constant(a)) assert(jx_equals(a, b));
+	assert(!strcmp(sa, sb));
+
+	free(sa);
+	free(sb);
+	jx_delete(a);
+	jx_delete(b);
+}
+
+static struct jx *random_value(int depth)
+{
+	int i, n;
+	char str[256];
+
+	switch(rand() % (depth > 4 ? 4 : 6)) {
+		case 0:
+			return jx_integer(rand() - RAND_MAX / 2);
+		case 1:
+			return jx_double((2 * (rand() % 1000) + 1 - 1000) / 8.0);
+		case 2:
+			return rand() % 2 ? jx_boolean(rand() % 2) : jx_null();
+		case 3:
+			/* Runs of quotes and backslashes fall across the 64 byte blocks of the scanner. */
+			n = rand() % 100;
+			for(i = 0; i < n; i++) {
+				const char *chars = "ab \"\\\\\\\n\t{}[]:,";
+				str[i] = chars[rand() % strlen(chars)];
+			}
+			str[n] = 0;
+			return jx_string(str);
+		case 4: {
+			struct jx *j = jx_object(0);
+			n = rand() % 8;
+			for(i = 0; i < n; i++) {
+				sprintf(str, "key%d", rand() % 1000);
+				jx_insert(j, jx_string(str), random_value(depth + 1));
+			}
+			return j;
+		}
+		default: {
+			struct jx *j = jx_array(0);
+			n = rand() % 8;
+			for(i = 0; i < n; i++) {
+				jx_array_append(j, random_value(depth + 1));
+			}
+			return j;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	for(i = 0; cases[i]; i++) {
+		compare(cases[i]);
+	}
+
+	srand(1);
+	for(i = 0; i < 2000; i++) {
+		struct jx *j = random_value(0);
+		char *str = jx_print_string(j);
+
+		struct jx *a = jx_parse_json_string(str);
+		assert(a && jx_equals(a, j));
+		compare(str);
+
+		free(str);
+		jx_delete(a);
+		jx_delete(j);
+	}
+
+	/* Strings longer than the limit of the general parser are left to the fast one. */
+	size_t length = 100000;
+	char *big = malloc(length + 3);
+	big[0] = '"';
+	memset(&big[1], 'x', length);
+	big[length + 1] = '"';
+	big[length + 2] = 0;
+	struct jx *j = jx_parse_json_string(big);
+	assert(j && jx_istype(j, JX_STRING) && strlen(j->u.string_value) == length);
+	jx_delete(j);
+	free(big);
+
+	/* A stream is read to the end. */
+	FILE *file = tmpfile();
+	fprintf(file, "{\"a\":[1,2,3],\n\"b\":\"c\"}\n");
+	rewind(file);
+	j = jx_parse_json_stream(file);
+	assert(j && jx_lookup_string(j, "b") && !strcmp(jx_lookup_string(j, "b"), "c"));
+	jx_delete(j);
+	fclose(file);
+
+	printf("jx_parse_json_test: ok\n");
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
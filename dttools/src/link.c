@@ -25,6 +25,11 @@ See the file COPYING for details.
 #include <sys/un.h>
 #include <sys/utsname.h>
 
+#ifdef CCTOOLS_OPSYS_LINUX
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#endif
+
 #include <fcntl.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -73,12 +78,33 @@ struct link {
 	char raddr[LINK_ADDRESS_MAX];
 	int rport;
 
+	struct link_set *set;           /* Link set this link belongs to, if any. */
+	int set_index;                  /* Position of this link in set->links. */
+	int set_buffered;               /* True if this link is in set->buffered. */
+	struct link *set_buffered_next; /* Next link in set->buffered. */
+	unsigned set_wait_count;        /* Value of set->wait_count when this link was last reported ready. */
+
 #ifdef HAS_OPENSSL
 	SSL_CTX *ctx;
 	SSL     *ssl;
 #endif
 };
 
+struct link_set {
+	int epoll_fd;              /* Descriptor of the epoll instance, or -1 to fall back to link_poll. */
+	struct link_info *links;   /* All the links in the set, with the events of interest. */
+	int size;
+	int capacity;
+	struct link *buffered;     /* Links that may have data already read into their buffers. */
+	unsigned wait_count;       /* Number of calls to link_set_wait, to detect duplicate ready links. */
+#ifdef CCTOOLS_OPSYS_LINUX
+	struct epoll_event *events;
+	int events_capacity;
+#endif
+};
+
+static void link_set_note_buffered(struct link *link);
+
 static int link_send_window = 65536;
 static int link_recv_window = 65536;
 static int link_override_window = 0;
@@ -307,6 +333,12 @@ static struct link *link_create()
 	link->rport = 0;
 	link->type = LINK_TYPE_STANDARD;
 
+	link->set = 0;
+	link->set_index = -1;
+	link->set_buffered = 0;
+	link->set_buffered_next = 0;
+	link->set_wait_count = 0;
+
 #ifdef HAS_OPENSSL
 	link->ctx = 0;
 	link->ssl = 0;
@@ -800,6 +832,7 @@ static ssize_t fill_buffer(struct link *link, time_t stoptime)
 			link->read += chunk;
 			link->buffer_start = link->buffer;
 			link->buffer_length = chunk;
+			link_set_note_buffered(link);
 			return chunk;
 		} else if(chunk == 0) {
 			link->buffer_start = link->buffer;
@@ -909,7 +942,9 @@ ssize_t link_read_avail(struct link *link, char *data, size_t count, time_t stop
 		if(chunk < 0) {
 			/* ONLY BLOCK IF NOTHING HAS BEEN READ */
 			if(errno_is_temporary(errno) && total == 0) {
-				if(link_sleep(link, stoptime, 1, 0)) {
+				if(stoptime == LINK_NOWAIT) {
+					break;
+				} else if(link_sleep(link, stoptime, 1, 0)) {
 					continue;
 				} else {
 					break;
@@ -1006,6 +1041,35 @@ ssize_t link_write(struct link *link, const char *data, size_t count, time_t sto
 	}
 }
 
+ssize_t link_write_avail(struct link *link, const char *data, size_t count)
+{
+	ssize_t total = 0;
+
+	if (!link)
+		return errno = EINVAL, -1;
+
+	while(count > 0) {
+		ssize_t chunk = write_aux(link, data, count);
+		if(chunk < 0) {
+			/* Report errors only if nothing was written, the next call will find them again. */
+			if(errno_is_temporary(errno) || total > 0) {
+				break;
+			} else {
+				return -1;
+			}
+		} else if(chunk == 0) {
+			break;
+		} else {
+			link->written += chunk;
+			total += chunk;
+			count -= chunk;
+			data += chunk;
+		}
+	}
+
+	return total;
+}
+
 ssize_t link_putlstring(struct link *link, const char *data, size_t count, time_t stoptime)
 {
 	ssize_t total = 0;
@@ -1026,6 +1090,75 @@ ssize_t link_putlstring(struct link *link, const char *data, size_t count, time_
 	return total;
 }
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+ssize_t link_writev(struct link *link, const struct iovec *iov, int iovcnt, time_t stoptime)
+{
+	ssize_t total = 0;
+	int i;
+
+	if (!link)
+		return errno = EINVAL, -1;
+
+	/* Anything queued by link_printf must go out ahead of this message. */
+	if (link_flush_output(link) < 0)
+		return -1;
+
+#ifdef HAS_OPENSSL
+	if (link->ssl) {
+		for (i = 0; i < iovcnt; i++) {
+			if (link_putlstring(link, iov[i].iov_base, iov[i].iov_len, stoptime) < 0)
+				return -1;
+			total += iov[i].iov_len;
+		}
+		return total;
+	}
+#endif
+
+	/* Keep a private copy of the vector, which is advanced past partial writes. */
+	struct iovec *v = malloc(iovcnt * sizeof(*v));
+	if (!v)
+		return -1;
+	memcpy(v, iov, iovcnt * sizeof(*v));
+
+	i = 0;
+	while (i < iovcnt) {
+		if (v[i].iov_len == 0) {
+			i++;
+			continue;
+		}
+
+		ssize_t chunk = writev(link->fd, &v[i], MIN(iovcnt - i, IOV_MAX));
+		if (chunk < 0) {
+			if (errno_is_temporary(errno) && link_sleep(link, stoptime, 0, 1)) {
+				continue;
+			}
+			total = -1;
+			break;
+		} else if (chunk == 0) {
+			total = -1;
+			break;
+		}
+
+		link->written += chunk;
+		total += chunk;
+
+		while (chunk > 0) {
+			size_t n = MIN((size_t)chunk, v[i].iov_len);
+			v[i].iov_base = (char *)v[i].iov_base + n;
+			v[i].iov_len -= n;
+			chunk -= n;
+			if (v[i].iov_len == 0)
+				i++;
+		}
+	}
+
+	free(v);
+	return total;
+}
+
 int link_buffer_output( struct link *link, size_t size )
 {
 	link->output_buffer_size = size;
@@ -1074,6 +1207,9 @@ ssize_t link_printf(struct link *link, time_t stoptime, const char *fmt, ...)
 void link_close(struct link *link)
 {
 	if(link) {
+		if(link->set)
+			link_set_remove(link->set, link);
+
 		link_flush_output(link);
 		buffer_free(&link->output_buffer);
 
@@ -1104,6 +1240,8 @@ void link_close(struct link *link)
 void link_detach(struct link *link)
 {
 	if(link) {
+		if(link->set)
+			link_set_remove(link->set, link);
 		free(link);
 	}
 }
@@ -1113,6 +1251,16 @@ int link_fd(struct link *link)
 	return link->fd;
 }
 
+int64_t link_bytes_read(struct link *link)
+{
+	return link->read;
+}
+
+int64_t link_bytes_written(struct link *link)
+{
+	return link->written;
+}
+
 int link_using_ssl(struct link *link)
 {
 #ifdef HAS_OPENSSL
@@ -1178,6 +1326,161 @@ int link_address_remote(struct link *link, char *addr, int *port)
 	}
 }
 
+#ifdef CCTOOLS_OPSYS_LINUX
+
+/* Largest amount of data moved by a single sendfile or splice call. */
+#define LINK_ZERO_COPY_CHUNK (1<<20)
+
+/*
+Data can be moved within the kernel only if it does not need to be
+encrypted or decrypted by the process.
+*/
+
+static int link_zero_copy_ok(struct link *link)
+{
+#ifdef HAS_OPENSSL
+	if(link->ssl)
+		return 0;
+#endif
+	return 1;
+}
+
+/*
+Send up to length bytes from fd to the link with sendfile.
+Returns the number of bytes sent, or -1 on a write failure.
+If the kernel cannot send from fd, *fallback is set and the
+caller should copy whatever remains.
+*/
+
+static int64_t link_sendfile(struct link *link, int fd, int64_t length, time_t stoptime, int *fallback)
+{
+	int64_t total = 0;
+
+	while(length > 0) {
+		ssize_t chunk = sendfile(link->fd, fd, NULL, MIN(length, LINK_ZERO_COPY_CHUNK));
+		if(chunk > 0) {
+			link->written += chunk;
+			total += chunk;
+			length -= chunk;
+		} else if(chunk == 0) {
+			break;
+		} else if(errno_is_temporary(errno)) {
+			if(!link_sleep(link, stoptime, 0, 1))
+				break;
+		} else if(errno == EINVAL || errno == ENOSYS) {
+			*fallback = 1;
+			break;
+		} else {
+			return -1;
+		}
+	}
+
+	return total;
+}
+
+/* Write out everything left in the pipe, when fd does not accept splice. */
+
+static int link_splice_drain(int pipefd, int fd, size_t count)
+{
+	char buffer[1<<16];
+
+	while(count > 0) {
+		ssize_t ractual = full_read(pipefd, buffer, MIN(sizeof(buffer), count));
+		if(ractual <= 0)
+			return 0;
+		if(full_write(fd, buffer, ractual) != ractual)
+			return 0;
+		count -= ractual;
+	}
+
+	return 1;
+}
+
+/*
+Receive up to length bytes from the link into fd, through a pipe
+with splice. Returns the number of bytes written to fd, or -1 on a
+write failure. If the kernel cannot splice into fd, *fallback is
+set and the caller should copy whatever remains.
+*/
+
+static int64_t link_splice(struct link *link, int fd, int64_t length, time_t stoptime, int *fallback)
+{
+	int64_t total = 0;
+	int p[2];
+
+	/* Data already read into the link buffer must go first. */
+	if(link->buffer_length > 0) {
+		size_t chunk = MIN(link->buffer_length, (size_t)length);
+		if(full_write(fd, link->buffer_start, chunk) != (ssize_t)chunk)
+			return -1;
+		link->buffer_start += chunk;
+		link->buffer_length -= chunk;
+		total += chunk;
+		length -= chunk;
+	}
+
+	if(length == 0)
+		return total;
+
+	if(pipe2(p, O_CLOEXEC) < 0) {
+		*fallback = 1;
+		return total;
+	}
+
+	/* A larger pipe means fewer calls; keep the default if the system does not allow it. */
+	fcntl(p[1], F_SETPIPE_SZ, LINK_ZERO_COPY_CHUNK);
+	int pipe_size = fcntl(p[1], F_GETPIPE_SZ);
+	if(pipe_size <= 0)
+		pipe_size = 1<<16;
+
+	while(length > 0) {
+		ssize_t ractual = splice(link->fd, NULL, p[1], NULL, MIN(length, pipe_size), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if(ractual == 0) {
+			break;
+		} else if(ractual < 0) {
+			if(errno_is_temporary(errno) && link_sleep(link, stoptime, 1, 0))
+				continue;
+			if(errno == EINVAL || errno == ENOSYS)
+				*fallback = 1;
+			break;
+		}
+
+		link->read += ractual;
+
+		ssize_t pending = ractual;
+		while(pending > 0) {
+			ssize_t wactual = splice(p[0], NULL, fd, NULL, pending, SPLICE_F_MOVE);
+			if(wactual > 0) {
+				pending -= wactual;
+			} else if(wactual < 0 && errno == EINTR) {
+				continue;
+			} else if(wactual < 0 && (errno == EINVAL || errno == ENOSYS) && link_splice_drain(p[0], fd, pending)) {
+				*fallback = 1;
+				pending = 0;
+			} else {
+				total = -1;
+				break;
+			}
+		}
+
+		if(total < 0)
+			break;
+
+		total += ractual;
+		length -= ractual;
+
+		if(*fallback)
+			break;
+	}
+
+	close(p[0]);
+	close(p[1]);
+
+	return total;
+}
+
+#endif
+
 ssize_t link_stream_to_buffer(struct link * link, char **buffer, time_t stoptime)
 {
 	ssize_t total = 0;
@@ -1207,6 +1510,16 @@ int64_t link_stream_to_fd(struct link * link, int fd, int64_t length, time_t sto
 {
 	int64_t total = 0;
 
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(link_zero_copy_ok(link)) {
+		int fallback = 0;
+		total = link_splice(link, fd, length, stoptime, &fallback);
+		if(!fallback)
+			return total;
+		length -= total;
+	}
+#endif
+
 	while(length > 0) {
 		char buffer[1<<16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
@@ -1257,6 +1570,16 @@ int64_t link_stream_from_fd(struct link * link, int fd, int64_t length, time_t s
 {
 	int64_t total = 0;
 
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(link_zero_copy_ok(link)) {
+		int fallback = 0;
+		total = link_sendfile(link, fd, length, stoptime, &fallback);
+		if(!fallback)
+			return total;
+		length -= total;
+	}
+#endif
+
 	while(length > 0) {
 		char buffer[1<<16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
@@ -1404,4 +1727,278 @@ int link_poll(struct link_info *links, int nlinks, int msec)
 	return result;
 }
 
+
+struct link_set *link_set_create()
+{
+	struct link_set *s = malloc(sizeof(*s));
+	if(!s)
+		return 0;
+
+	s->epoll_fd = -1;
+	s->links = 0;
+	s->size = 0;
+	s->capacity = 0;
+	s->buffered = 0;
+	s->wait_count = 0;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	s->events = 0;
+	s->events_capacity = 0;
+
+	s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(s->epoll_fd < 0) {
+		debug(D_TCP, "couldn't create epoll instance, falling back to poll: %s", strerror(errno));
+	}
+#endif
+
+	return s;
+}
+
+void link_set_delete(struct link_set *s)
+{
+	if(!s)
+		return;
+
+	while(s->size > 0) {
+		link_set_remove(s, s->links[s->size - 1].link);
+	}
+
+	if(s->epoll_fd >= 0)
+		close(s->epoll_fd);
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	free(s->events);
+#endif
+	free(s->links);
+	free(s);
+}
+
+#ifdef CCTOOLS_OPSYS_LINUX
+static uint32_t link_to_epoll(int events)
+{
+	uint32_t r = 0;
+	if(events & LINK_READ)
+		r |= EPOLLIN | EPOLLRDHUP;
+	if(events & LINK_WRITE)
+		r |= EPOLLOUT;
+	return r;
+}
+
+static int epoll_to_link(uint32_t events)
+{
+	int r = 0;
+	/* Errors and hangups are reported as readable, so that the next read returns the failure. */
+	if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+		r |= LINK_READ;
+	if(events & EPOLLOUT)
+		r |= LINK_WRITE;
+	return r;
+}
+#endif
+
+int link_set_add(struct link_set *s, struct link *link, int events)
+{
+	if(link->set) {
+		return 0;
+	}
+
+	if(s->size >= s->capacity) {
+		int capacity = s->capacity > 0 ? 2 * s->capacity : 8;
+		struct link_info *links = realloc(s->links, capacity * sizeof(*links));
+		if(!links)
+			return 0;
+		s->links = links;
+		s->capacity = capacity;
+	}
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(s->epoll_fd >= 0) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = link_to_epoll(events);
+		ev.data.ptr = link;
+		if(epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, link->fd, &ev) < 0) {
+			debug(D_TCP, "couldn't add fd %d to epoll instance: %s", link->fd, strerror(errno));
+			return 0;
+		}
+	}
+#endif
+
+	s->links[s->size].link = link;
+	s->links[s->size].events = events;
+	s->links[s->size].revents = 0;
+
+	link->set = s;
+	link->set_index = s->size;
+	link->set_wait_count = s->wait_count;
+	s->size++;
+
+	/* Data may have been read into the buffer before the link was added. */
+	link_set_note_buffered(link);
+
+	return 1;
+}
+
+void link_set_remove(struct link_set *s, struct link *link)
+{
+	if(link->set != s) {
+		return;
+	}
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(s->epoll_fd >= 0 && link->fd >= 0) {
+		epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, link->fd, 0);
+	}
+#endif
+
+	/* Fill the hole with the last link of the array. */
+	struct link_info *last = &s->links[s->size - 1];
+	s->links[link->set_index] = *last;
+	last->link->set_index = link->set_index;
+	s->size--;
+
+	if(link->set_buffered) {
+		struct link **l = &s->buffered;
+		while(*l != link) {
+			l = &(*l)->set_buffered_next;
+		}
+		*l = link->set_buffered_next;
+	}
+
+	link->set = 0;
+	link->set_index = -1;
+	link->set_buffered = 0;
+	link->set_buffered_next = 0;
+}
+
+int link_set_update(struct link_set *s, struct link *link, int events)
+{
+	if(link->set != s) {
+		return 0;
+	}
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(s->epoll_fd >= 0) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = link_to_epoll(events);
+		ev.data.ptr = link;
+		if(epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, link->fd, &ev) < 0) {
+			debug(D_TCP, "couldn't modify fd %d in epoll instance: %s", link->fd, strerror(errno));
+			return 0;
+		}
+	}
+#endif
+
+	s->links[link->set_index].events = events;
+
+	return 1;
+}
+
+int link_set_size(struct link_set *s)
+{
+	return s->size;
+}
+
+/* Called when data is read into the buffer of a link, so that link_set_wait does not need to look at every link. */
+
+static void link_set_note_buffered(struct link *link)
+{
+	if(link->set && !link->set_buffered && link->buffer_length > 0) {
+		link->set_buffered = 1;
+		link->set_buffered_next = link->set->buffered;
+		link->set->buffered = link;
+	}
+}
+
+/* Append a ready link to the results, merging its events if it was already reported by this call. */
+
+static int link_set_report(struct link_set *s, struct link_info *ready, int n, struct link *link, int revents)
+{
+	if(link->set_wait_count == s->wait_count) {
+		int i;
+		for(i = 0; i < n; i++) {
+			if(ready[i].link == link) {
+				ready[i].revents |= revents;
+				return n;
+			}
+		}
+	}
+
+	link->set_wait_count = s->wait_count;
+	ready[n].link = link;
+	ready[n].events = s->links[link->set_index].events;
+	ready[n].revents = revents;
+
+	return n + 1;
+}
+
+int link_set_wait(struct link_set *s, struct link_info *ready, int nready, int msec)
+{
+	int n = 0;
+	int i;
+
+	s->wait_count++;
+
+	/* Links with data waiting in their buffers are ready right away. */
+	struct link **l = &s->buffered;
+	while(*l) {
+		struct link *link = *l;
+		if(link->buffer_length > 0) {
+			if(n < nready && (s->links[link->set_index].events & LINK_READ)) {
+				n = link_set_report(s, ready, n, link, LINK_READ);
+			}
+			l = &link->set_buffered_next;
+		} else {
+			*l = link->set_buffered_next;
+			link->set_buffered = 0;
+			link->set_buffered_next = 0;
+		}
+	}
+
+	if(n >= nready) {
+		return n;
+	}
+
+	if(n > 0) {
+		msec = 0;
+	}
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(s->epoll_fd >= 0) {
+		int max_events = nready - n;
+		if(max_events > s->events_capacity) {
+			struct epoll_event *events = realloc(s->events, max_events * sizeof(*events));
+			if(!events)
+				return -1;
+			s->events = events;
+			s->events_capacity = max_events;
+		}
+
+		int result = epoll_wait(s->epoll_fd, s->events, max_events, msec);
+		if(result < 0) {
+			return errno == EINTR ? n : -1;
+		}
+
+		for(i = 0; i < result; i++) {
+			n = link_set_report(s, ready, n, s->events[i].data.ptr, epoll_to_link(s->events[i].events));
+		}
+
+		return n;
+	}
+#endif
+
+	if(link_poll(s->links, s->size, msec) < 0) {
+		return errno == EINTR ? n : -1;
+	}
+
+	for(i = 0; i < s->size && n < nready; i++) {
+		if(s->links[i].revents) {
+			n = link_set_report(s, ready, n, s->links[i].link, s->links[i].revents);
+		}
+	}
+
+	return n;
+}
+
 /* vim: set noexpandtab tabstop=8: */
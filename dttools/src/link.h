@@ -42,6 +42,7 @@ link_close(link);
 */
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <limits.h>
 #include <signal.h>
@@ -155,8 +156,9 @@ return without blocking.
 @param link The link from which to read.
 @param data A buffer to hold the data.
 @param length The number of bytes to read.
-@param stoptime The time at which to abort.
+@param stoptime The time at which to abort, or LINK_NOWAIT to return at once if nothing is available.
 @return The number of bytes actually read, or zero if the connection is closed, or less than zero on error.
+If nothing was available on a non-blocking link with LINK_NOWAIT, errno is set to a temporary error such as EAGAIN.
 */
 ssize_t link_read_avail(struct link *link, char *data, size_t length, time_t stoptime);
 
@@ -169,6 +171,17 @@ ssize_t link_read_avail(struct link *link, char *data, size_t length, time_t sto
 */
 ssize_t link_write(struct link *link, const char *data, size_t length, time_t stoptime);
 
+/** Write data to a connection without blocking.
+This call will write as much data as the connection accepts immediately,
+and then return without waiting for the rest. Note that writes to links
+using ssl may still block until the data is written.
+@param link The link to write.
+@param data A pointer to the data.
+@param length The number of bytes to write.
+@return The number of bytes actually written, which may be zero, or less than zero on error.
+*/
+ssize_t link_write_avail(struct link *link, const char *data, size_t length);
+
 /* Write a string of length len to a connection. All data is written until
  * finished or an error is encountered.
 @param link The link to write.
@@ -179,6 +192,18 @@ ssize_t link_write(struct link *link, const char *data, size_t length, time_t st
 */
 ssize_t link_putlstring(struct link *link, const char *str, size_t len, time_t stoptime);
 
+/** Write several buffers to a connection as one message.
+The buffers are gathered by the kernel with writev, so a message assembled
+from many pieces costs one system call and goes out in as few segments as possible.
+All data is written until finished or an error is encountered.
+@param link The link to write.
+@param iov The buffers to write, in order.
+@param iovcnt The number of buffers.
+@param stoptime The time at which to abort.
+@return The number of bytes actually written, or less than zero on error.
+*/
+ssize_t link_writev(struct link *link, const struct iovec *iov, int iovcnt, time_t stoptime);
+
 /* Write a C string to a connection. All data is written until finished or an
    error is encountered. It is defined as a macro.
 @param link The link to write.
@@ -290,6 +315,18 @@ int link_readline(struct link *link, char *line, size_t length, time_t stoptime)
 */
 int link_fd(struct link *link);
 
+/** Get the number of bytes read from a link since it was created.
+@param link The link to examine.
+@return The number of bytes read.
+*/
+int64_t link_bytes_read(struct link *link);
+
+/** Get the number of bytes written to a link since it was created.
+@param link The link to examine.
+@return The number of bytes written.
+*/
+int64_t link_bytes_written(struct link *link);
+
 /** Enable output buffering for link_printf.
 @param link The link to modify.
 @param size The number of bytes to buffer.  Zero disables buffering and flushes pending output.
@@ -381,6 +418,64 @@ Wait for a activity on a an array of links.
 
 int link_poll(struct link_info *array, int nlinks, int msec);
 
+/** A persistent set of links to be polled together.
+Unlike @ref link_poll, the cost of waiting on a set depends only on
+the number of links that are ready, not on the number of links in the set.
+On Linux the set is backed by epoll, elsewhere it falls back to @ref link_poll.
+A link may belong to at most one set, and is removed from it automatically by @ref link_close or @ref link_detach.
+*/
+struct link_set;
+
+/** Create an empty link set.
+@return A pointer to a new link set, or null on failure.
+*/
+struct link_set *link_set_create();
+
+/** Delete a link set. The links in the set are not closed.
+@param s The link set to delete.
+*/
+void link_set_delete(struct link_set *s);
+
+/** Add a link to a link set.
+@param s The link set.
+@param link The link to add.
+@param events The events to wait for (@ref LINK_READ or @ref LINK_WRITE).
+@return True on success, false on failure, e.g. if the link already belongs to a set.
+*/
+int link_set_add(struct link_set *s, struct link *link, int events);
+
+/** Remove a link from a link set.
+@param s The link set.
+@param link The link to remove.
+*/
+void link_set_remove(struct link_set *s, struct link *link);
+
+/** Change the events waited for on a link of a link set.
+@param s The link set.
+@param link The link, which must belong to the set.
+@param events The events to wait for (@ref LINK_READ or @ref LINK_WRITE).
+@return True on success, false on failure.
+*/
+int link_set_update(struct link_set *s, struct link *link, int events);
+
+/** Return the number of links in a link set.
+@param s The link set.
+@return The number of links in the set.
+*/
+int link_set_size(struct link_set *s);
+
+/**
+Wait for activity on the links of a link set.
+Links with data already buffered by @ref link_read or @ref link_readline are reported as ready without waiting.
+Links that are ready but do not fit in the array are reported by the following calls.
+@param s The link set.
+@param ready Pointer to an array of @ref link_info structures, filled with the links that are ready and their events.
+@param nready The length of the ready array.
+@param msec The number of milliseconds to wait for activity.  Zero indicates do not wait at all, while -1 indicates wait forever.
+@return The number of entries filled in the ready array, or -1 on error.
+*/
+int link_set_wait(struct link_set *s, struct link_info *ready, int nready, int msec);
+
 int errno_is_temporary(int e);
 
 #endif
@@ -0,0 +1,174 @@
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#include "link.h"
+
+static struct link *find_ready(struct link_info *ready, int n, struct link *l)
+{
+	int i;
+	for(i = 0; i < n; i++) {
+		if(ready[i].link == l)
+			return l;
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	char addr[LINK_ADDRESS_MAX];
+	char line[1024];
+	int port;
+	int rc;
+
+	struct link_info ready[8];
+
+	struct link *server = link_serve_address("127.0.0.1", 0);
+	assert(server);
+	rc = link_address_local(server, addr, &port);
+	assert(rc);
+
+	struct link_set *s = link_set_create();
+	assert(s);
+
+	rc = link_set_add(s, server, LINK_READ);
+	assert(rc);
+
+	/* A link belongs to at most one set. */
+	rc = link_set_add(s, server, LINK_READ);
+	assert(!rc);
+
+	rc = link_set_wait(s, ready, 8, 0);
+	assert(rc == 0);
+
+	struct link *client1 = link_connect("127.0.0.1", port, time(0) + 5);
+	assert(client1);
+
+	rc = link_set_wait(s, ready, 8, 5000);
+	assert(rc == 1);
+	assert(ready[0].link == server);
+	assert(ready[0].revents & LINK_READ);
+
+	struct link *conn1 = link_accept(server, time(0) + 5);
+	assert(conn1);
+
+	struct link *client2 = link_connect("127.0.0.1", port, time(0) + 5);
+	assert(client2);
+	struct link *conn2 = link_accept(server, time(0) + 5);
+	assert(conn2);
+
+	rc = link_set_add(s, conn1, LINK_READ);
+	assert(rc);
+	rc = link_set_add(s, conn2, LINK_READ);
+	assert(rc);
+	assert(link_set_size(s) == 3);
+
+	rc = link_set_wait(s, ready, 8, 0);
+	assert(rc == 0);
+
+	/* Two messages in a single write: the second one stays in the buffer of the link. */
+	rc = link_printf(client1, time(0) + 5, "first\nsecond\n");
+	assert(rc > 0);
+
+	rc = link_set_wait(s, ready, 8, 5000);
+	assert(rc == 1);
+	assert(ready[0].link == conn1);
+
+	rc = link_readline(conn1, line, sizeof(line), time(0) + 5);
+	assert(rc);
+	assert(!strcmp(line, "first"));
+
+	/* Nothing is left in the kernel, but the link is still ready. */
+	rc = link_set_wait(s, ready, 8, 0);
+	assert(rc == 1);
+	assert(ready[0].link == conn1);
+
+	rc = link_readline(conn1, line, sizeof(line), time(0) + 5);
+	assert(rc);
+	assert(!strcmp(line, "second"));
+
+	rc = link_set_wait(s, ready, 8, 0);
+	assert(rc == 0);
+
+	/* Links that do not fit in the ready array are reported by the next wait. */
+	rc = link_printf(client1, time(0) + 5, "third\n");
+	assert(rc > 0);
+	rc = link_printf(client2, time(0) + 5, "fourth\n");
+	assert(rc > 0);
+
+	int i;
+	for(i = 0; i < 50; i++) {
+		rc = link_set_wait(s, ready, 8, 100);
+		if(rc == 2)
+			break;
+	}
+	assert(rc == 2);
+	assert(find_ready(ready, rc, conn1));
+	assert(find_ready(ready, rc, conn2));
+
+	rc = link_set_wait(s, ready, 1, 0);
+	assert(rc == 1);
+
+	rc = link_readline(conn1, line, sizeof(line), time(0) + 5);
+	assert(rc);
+	assert(!strcmp(line, "third"));
+
+	rc = link_set_wait(s, ready, 1, 0);
+	assert(rc == 1);
+	assert(ready[0].link == conn2);
+
+	/* Removed links are not reported. */
+	link_set_remove(s, conn2);
+	assert(link_set_size(s) == 2);
+
+	rc = link_set_wait(s, ready, 8, 0);
+	assert(rc == 0);
+
+	/* Links waiting to write are reported as soon as they can write. */
+	rc = link_set_update(s, conn1, LINK_READ | LINK_WRITE);
+	assert(rc);
+
+	rc = link_set_wait(s, ready, 8, 5000);
+	assert(rc == 1);
+	assert(ready[0].link == conn1);
+	assert(ready[0].revents & LINK_WRITE);
+
+	/* Writing without blocking stops when the connection is full. */
+	char block[65536];
+	memset(block, 'x', sizeof(block));
+	ssize_t written;
+	do {
+		written = link_write_avail(conn1, block, sizeof(block));
+		assert(written >= 0);
+	} while(written > 0);
+
+	rc = link_set_wait(s, ready, 8, 0);
+	assert(rc == 0);
+
+	rc = link_set_update(s, conn1, LINK_READ);
+	assert(rc);
+
+	/* A hangup is reported as readable. */
+	link_close(client1);
+
+	rc = link_set_wait(s, ready, 8, 5000);
+	assert(rc == 1);
+	assert(ready[0].link == conn1);
+
+	rc = link_readline(conn1, line, sizeof(line), time(0) + 5);
+	assert(!rc);
+
+	/* Closing a link removes it from its set. */
+	link_close(conn1);
+	assert(link_set_size(s) == 1);
+
+	link_set_delete(s);
+
+	link_close(conn2);
+	link_close(client2);
+	link_close(server);
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
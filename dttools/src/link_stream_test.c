@@ -0,0 +1,131 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "full_io.h"
+#include "link.h"
+
+#define TEST_LENGTH ((4 << 20) + 123)
+
+static int make_temp(char *name)
+{
+	strcpy(name, "link_stream_test.XXXXXX");
+	int fd = mkstemp(name);
+	assert(fd >= 0);
+	return fd;
+}
+
+static void check_contents(const char *name, const char *expected)
+{
+	char *data = malloc(TEST_LENGTH + 1);
+
+	int fd = open(name, O_RDONLY);
+	assert(fd >= 0);
+	ssize_t actual = full_read(fd, data, TEST_LENGTH + 1);
+	assert(actual == TEST_LENGTH);
+	assert(!memcmp(data, expected, TEST_LENGTH));
+	close(fd);
+
+	free(data);
+}
+
+int main(int argc, char *argv[])
+{
+	char addr[LINK_ADDRESS_MAX];
+	char line[1024];
+	char source[32], plain[32], append[32];
+	int port;
+	int rc;
+	int i;
+
+	char *data = malloc(TEST_LENGTH);
+	for(i = 0; i < TEST_LENGTH; i++)
+		data[i] = i % 251;
+
+	int fd = make_temp(source);
+	rc = full_write(fd, data, TEST_LENGTH);
+	assert(rc == TEST_LENGTH);
+	close(fd);
+
+	struct link *server = link_serve_address("127.0.0.1", 0);
+	assert(server);
+	rc = link_address_local(server, addr, &port);
+	assert(rc);
+
+	pid_t pid = fork();
+	assert(pid >= 0);
+
+	if(pid == 0) {
+		struct link *client = link_connect("127.0.0.1", port, time(0) + 5);
+		if(!client)
+			_exit(1);
+
+		/* Send the file twice, each after a header line. */
+		for(i = 0; i < 2; i++) {
+			link_printf(client, time(0) + 5, "%d\n", TEST_LENGTH);
+			fd = open(source, O_RDONLY);
+			if(fd < 0 || link_stream_from_fd(client, fd, TEST_LENGTH, time(0) + 30) != TEST_LENGTH)
+				_exit(1);
+			close(fd);
+		}
+
+		link_close(client);
+		_exit(0);
+	}
+
+	struct link *conn = link_accept(server, time(0) + 5);
+	assert(conn);
+
+	/* The header and the start of the file arrive together: the buffered data must come first. */
+	rc = link_readline(conn, line, sizeof(line), time(0) + 30);
+	assert(rc);
+	assert(atoi(line) == TEST_LENGTH);
+
+	fd = make_temp(plain);
+	int64_t total = link_stream_to_fd(conn, fd, TEST_LENGTH, time(0) + 30);
+	assert(total == TEST_LENGTH);
+	close(fd);
+
+	check_contents(plain, data);
+
+	/* Files open for appending cannot be spliced into, and must fall back to copying. */
+	rc = link_readline(conn, line, sizeof(line), time(0) + 30);
+	assert(rc);
+	assert(atoi(line) == TEST_LENGTH);
+
+	fd = make_temp(append);
+	close(fd);
+	fd = open(append, O_WRONLY | O_APPEND);
+	assert(fd >= 0);
+	total = link_stream_to_fd(conn, fd, TEST_LENGTH, time(0) + 30);
+	assert(total == TEST_LENGTH);
+	close(fd);
+
+	check_contents(append, data);
+
+	/* Nothing else was sent. */
+	total = link_stream_to_fd(conn, -1, 1, time(0) + 5);
+	assert(total == 0);
+
+	int status;
+	rc = waitpid(pid, &status, 0);
+	assert(rc == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	link_close(conn);
+	link_close(server);
+
+	unlink(source);
+	unlink(plain);
+	unlink(append);
+	free(data);
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -458,7 +458,7 @@ struct rmsummary *rmsummary_parse_file_single(const char *filename)
 		return NULL;
 	}
 
-	struct jx *j = jx_parse_stream(stream);
+	struct jx *j = jx_parse_json_stream(stream);
 	fclose(stream);
 
 	if(!j)
@@ -474,7 +474,7 @@ struct rmsummary *rmsummary_parse_string(const char *str) {
 	if(!str)
 		return NULL;
 
-	struct jx *j = jx_parse_string(str);
+	struct jx *j = jx_parse_json_string(str);
 
 	if(!j)
 		return NULL;
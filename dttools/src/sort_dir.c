@@ -13,6 +13,15 @@ See the file COPYING for details.
 #include <stdlib.h>
 #include <dirent.h>
 
+/* qsort passes pointers to the entries, not the entries themselves. */
+
+static int (*sort_dir_compare) (const char *a, const char *b) = 0;
+
+static int sort_dir_compare_entries(const void *a, const void *b)
+{
+	return sort_dir_compare(*(char *const *) a, *(char *const *) b);
+}
+
 int sort_dir(const char *dirname, char ***list, int (*sort) (const char *a, const char *b))
 {
 	DIR *dir;
@@ -35,7 +44,8 @@ int sort_dir(const char *dirname, char ***list, int (*sort) (const char *a, cons
 
 
 	if(sort) {
-		qsort(*list, n, sizeof(char *), (int (*)(const void *, const void *)) sort);
+		sort_dir_compare = sort;
+		qsort(*list, n, sizeof(char *), sort_dir_compare_entries);
 	}
 
 	return 1;
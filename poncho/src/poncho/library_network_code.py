@@ -10,6 +10,9 @@ def library_network_code():
     import os
     import sys
     import argparse
+    import select
+    import struct
+    from collections import deque
 
     def remote_execute(func):
         def remote_wrapper(event):
@@ -28,13 +31,45 @@ def library_network_code():
             return response
         return remote_wrapper
 
-    read, write = os.pipe()
+    # Messages between the vine_worker and the library are framed in binary.
+    # A request carries the invocation id, the lengths of the function name,
+    # the sandbox directory, and the event, followed by those three fields.
+    # A response carries the invocation id and the length of the result,
+    # followed by the result itself. The startup message is a response with id 0.
+    # Several invocations may be in flight, and results are sent as they complete.
+    request_header = struct.Struct("!QIIQ")
+    response_header = struct.Struct("!QQ")
 
-    def send_configuration(config, out_pipe):
-        config_string = json.dumps(config)
-        config_cmd = f"{len(config_string) + 1}\n{config_string}\n"
-        out_pipe.write(config_cmd)
-        out_pipe.flush()
+    def read_exactly(in_fd, length):
+        chunks = []
+        while length > 0:
+            chunk = os.read(in_fd, min(length, 1 << 20))
+            if not chunk:
+                raise EOFError("the worker closed the pipe")
+            chunks.append(chunk)
+            length -= len(chunk)
+        return b"".join(chunks)
+
+    def queue_message(outgoing, invocation_id, data):
+        outgoing.append(memoryview(response_header.pack(invocation_id, len(data))))
+        outgoing.append(memoryview(data))
+
+    # write as much of the queued messages as the pipe accepts without blocking,
+    # so that requests from the worker are never held back by a large result.
+    def send_messages(out_fd, outgoing):
+        while outgoing:
+            try:
+                written = os.write(out_fd, outgoing[0])
+            except BlockingIOError:
+                return
+            if written < len(outgoing[0]):
+                outgoing[0] = outgoing[0][written:]
+                return
+            outgoing.popleft()
+
+    def send_configuration(config, out_fd):
+        message = json.dumps(config).encode("utf-8")
+        os.write(out_fd, response_header.pack(0, len(message)) + message)
 
     def main():
         parser = argparse.ArgumentParser('Parse input and output file descriptors this process should use. The relevant fds should already be prepared by the vine_worker.')
@@ -42,75 +77,90 @@ def library_network_code():
         parser.add_argument('--output-fd', required=True, type=int, help='output fd to send messages to the vine_worker via a pipe')
         args = parser.parse_args()
 
-        # Open communication pipes to vine_worker.
-        # The file descriptors should already be open for reads and writes.
-        # Below lines only convert file descriptors into native Python file objects.
-        in_pipe = os.fdopen(args.input_fd, 'r')
-        out_pipe = os.fdopen(args.output_fd, 'w')
+        # The file descriptors to talk to the vine_worker should already be open for reads and writes.
+        in_fd = args.input_fd
+        out_fd = args.output_fd
 
         config = {
             "name": name(),
         }
-        send_configuration(config, out_pipe)
+        send_configuration(config, out_fd)
+        os.set_blocking(out_fd, False)
+
+        # results being read from forked function calls, indexed by the read end of their pipes.
+        running = {}
+        outgoing = deque()
 
         while True:
-            while True:
-                # wait for message from worker about what function to execute
+            # wait for a message from the worker about what function to execute,
+            # the results of running functions, or room to send the results already complete.
+            readable, writable, _ = select.select([in_fd] + list(running), [out_fd] if outgoing else [], [])
+
+            if writable:
+                send_messages(out_fd, outgoing)
+
+            for fd in readable:
+                if fd != in_fd:
+                    invocation_id, p, chunks = running[fd]
+                    chunk = os.read(fd, 1 << 20)
+                    if chunk:
+                        chunks.append(chunk)
+                    else:
+                        # the result is complete when the child closes its end of the pipe
+                        os.close(fd)
+                        os.waitpid(p, 0)
+                        del running[fd]
+                        queue_message(outgoing, invocation_id, b"".join(chunks))
+                    continue
+
                 try:
-                    # remove trailing \n
-                    line = in_pipe.readline()[:-1]
+                    header = read_exactly(in_fd, request_header.size)
+                    invocation_id, name_size, sandbox_size, event_size = request_header.unpack(header)
+                    function_name = read_exactly(in_fd, name_size).decode("utf-8")
+                    function_sandbox = read_exactly(in_fd, sandbox_size).decode("utf-8")
+                    event_bytes = read_exactly(in_fd, event_size)
                 # if the worker closed the pipe connected to the input of this process, we should just exit
                 except Exception as e:
                     print("Cannot read message from the manager, exiting. ", e, file=sys.stderr)
                     sys.exit(1)
 
-                function_name, event_size, function_sandbox = line.split(" ", maxsplit=2)
-                if event_size:
-                    # receive the bytes containing the event and turn it into a string
-                    event_str = in_pipe.readline()[:-1]
-                    if len(event_str) != int(event_size):
-                        print(event_str, len(event_str), event_size, file=sys.stderr)
-                        print("Size of event does not match what was sent: exiting", file=sys.stderr)
-                        sys.exit(1)
+                # turn the event into a python dictionary
+                event = json.loads(event_bytes)
 
-                    # turn the event into a python dictionary
-                    event = json.loads(event_str)
-
-                    # see if the user specified an execution method
-                    exec_method = event.get("remote_task_exec_method", None)
-
-                    if exec_method == "direct":
-                        library_sandbox = os.getcwd()
-                        try:
-                            os.chdir(function_sandbox)
-                            response = json.dumps(globals()[function_name](event))
-                        except Exception as e:
-                            print(f'Library code: Function call failed due to {e}', file=sys.stderr)
-                            sys.exit(1)
-                        finally:
-                            os.chdir(library_sandbox)
+                # see if the user specified an execution method
+                exec_method = event.get("remote_task_exec_method", None)
+
+                if exec_method == "direct":
+                    library_sandbox = os.getcwd()
+                    try:
+                        os.chdir(function_sandbox)
+                        response = json.dumps(globals()[function_name](event)).encode("utf-8")
+                    except Exception as e:
+                        print(f'Library code: Function call failed due to {e}', file=sys.stderr)
+                        sys.exit(1)
+                    finally:
+                        os.chdir(library_sandbox)
+                    queue_message(outgoing, invocation_id, response)
+                else:
+                    read, write = os.pipe()
+                    p = os.fork()
+                    if p == 0:
+                        os.close(read)
+                        os.chdir(function_sandbox)
+                        response = globals()[function_name](event)
+                        with os.fdopen(write, 'wb') as result_pipe:
+                            result_pipe.write(json.dumps(response).encode("utf-8"))
+                        os._exit(0)
+                    elif p < 0:
+                        print(f'Library code: unable to fork to execute {function_name}', file=sys.stderr)
+                        response = json.dumps({
+                            "Result": "unable to fork",
+                            "StatusCode": 500
+                        }).encode("utf-8")
+                        queue_message(outgoing, invocation_id, response)
                     else:
-                        p = os.fork()
-                        if p == 0:
-                            os.chdir(function_sandbox)
-                            response = globals()[function_name](event)
-                            os.write(write, json.dumps(response).encode("utf-8"))
-                            os._exit(0)
-                        elif p < 0:
-                            print(f'Library code: unable to fork to execute {function_name}', file=sys.stderr)
-                            response = {
-                                "Result": "unable to fork",
-                                "StatusCode": 500
-                            }
-                        else:
-                            max_read = 65536
-                            chunk = os.read(read, max_read).decode("utf-8")
-                            all_chunks = [chunk]
-                            while (len(chunk) >= max_read):
-                                chunk = os.read(read, max_read).decode("utf-8")
-                                all_chunks.append(chunk)
-                            response = "".join(all_chunks)
-                            os.waitpid(p, 0)
-                    out_pipe.write(response+'\n')
-                    out_pipe.flush()
+                        os.close(write)
+                        running[read] = (invocation_id, p, [])
+
+            send_messages(out_fd, outgoing)
         return 0
@@ -125,7 +125,7 @@ class Task(object):
         self._task = None
 
     @staticmethod
-    def _determine_mount_flags(watch=False, failure_only=False, success_only=False, strict_input=False):
+    def _determine_mount_flags(watch=False, failure_only=False, success_only=False, strict_input=False, read_only=False, writable=False):
         flags = cvine.VINE_TRANSFER_ALWAYS
         if watch:
             flags |= cvine.VINE_WATCH
@@ -135,6 +135,10 @@ class Task(object):
             flags |= cvine.VINE_SUCCESS_ONLY
         if strict_input:
             flags |= cvine.VINE_FIXED_LOCATION
+        if read_only:
+            flags |= cvine.VINE_READ_ONLY
+        if writable:
+            flags |= cvine.VINE_WRITABLE
         return flags
 
     @staticmethod
@@ -250,6 +254,10 @@ class Task(object):
     # @param strict_input  Whether the file should be transfered to the worker
     #                      for execution. If no worker has all the input files already cached marked
     #                      as strict inputs for the task, the task fails.
+    # @param read_only     Whether the task leaves the input unmodified, so that it can be linked
+    #                      into the sandbox with a single symlink. Default is False.
+    # @param writable      Whether the task may modify the input, so that it gets a private copy.
+    #                      Default is False.
     #
     # For example:
     # @code
@@ -257,12 +265,12 @@ class Task(object):
     # >>> f = m.declare_untar(url)
     # >>> task.add_input(f,"data")
     # @endcode
-    def add_input(self, file, remote_name, strict_input=False):
+    def add_input(self, file, remote_name, strict_input=False, read_only=False, writable=False):
         # SWIG expects strings
         if not isinstance(remote_name, str):
             raise TypeError(f"remote_name {remote_name} is not a str")
 
-        flags = Task._determine_mount_flags(strict_input=strict_input)
+        flags = Task._determine_mount_flags(strict_input=strict_input, read_only=read_only, writable=writable)
 
         if cvine.vine_task_add_input(self._task, file._file, remote_name, flags)==0:
             raise ValueError("invalid file description")
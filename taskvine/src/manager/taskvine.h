@@ -46,6 +46,8 @@ typedef enum {
 	VINE_WATCH = 2,           /**< Watch the output file and send back changes as the task runs. */
 	VINE_FAILURE_ONLY = 4,    /**< Only return this output file if the task failed.  (Useful for returning large log files.) */
 	VINE_SUCCESS_ONLY = 8,    /**< Only return this output file if the task succeeded. */
+	VINE_READ_ONLY = 16,      /**< The task does not modify this input, so it may be linked into the sandbox with a single symlink. */
+	VINE_WRITABLE = 32,       /**< The task may modify this input, so it gets a private copy, sharing blocks with the cache where the filesystem supports it. */
 } vine_mount_flags_t;
 
 /** Control caching and sharing behavior of file objects.
@@ -184,7 +184,7 @@ static struct vine_task *create_task(const char *str)
 	struct jx *environment = NULL;
 	int cores = 0, memory = 0, disk = 0;
 
-	struct jx *json = jx_parse_string(str);
+	struct jx *json = jx_parse_json_string(str);
 	if(!json) {
 		return NULL;
 	}
@@ -270,7 +270,7 @@ struct vine_manager *vine_json_create(const char *str)
 	int port = -1, priority = 0;
 	char *name = NULL;
 
-	struct jx *json = jx_parse_string(str);
+	struct jx *json = jx_parse_json_string(str);
 	if(!json) {
 		return NULL;
 	}
@@ -27,6 +27,8 @@ void vine_blocklist_unblock(struct vine_manager *q, const char *host)
 	info = hash_table_remove(q->worker_blocklist, host);
 	if (info)
 		vine_blocklist_info_delete(info);
+
+	q->worker_eligibility_epoch++;
 }
 
 struct jx *vine_blocklist_to_jx(struct vine_manager *q)
@@ -89,6 +91,7 @@ void vine_blocklist_block(struct vine_manager *q, const char *hostname, time_t t
 		info->times_blocked++;
 
 	info->blocked = 1;
+	q->worker_eligibility_epoch++;
 
 	if (timeout > 0) {
 		debug(D_VINE,
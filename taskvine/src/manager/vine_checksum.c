@@ -6,16 +6,248 @@ See the file COPYING for details.
 
 #include "vine_checksum.h"
 
+#include "debug.h"
+#include "hash_table.h"
+#include "list.h"
+#include "load_average.h"
+#include "macros.h"
 #include "md5.h"
 #include "sort_dir.h"
 #include "string_array.h"
 #include "stringtools.h"
 #include "xxmalloc.h"
 
-#include <debug.h>
 #include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+The checksums of regular files are kept in a table indexed by absolute
+path, and reused while the device, inode, size, mtime and ctime of the
+file are unchanged. The table can be loaded from and saved to a file,
+so that unchanged files are not read again by later runs.
+
+Checksums are not remembered for files modified during the second in
+which they were read, since a later change within that same second
+would not be noticed.
+*/
+
+struct vine_checksum_entry {
+	dev_t device;
+	ino_t inode;
+	off_t size;
+	time_t mtime;
+	time_t ctime;
+	char hash[MD5_DIGEST_LENGTH_HEX + 1];
+};
+
+static struct hash_table *checksum_table = 0;
+static char *checksum_cache_path = 0;
+static int checksum_cache_dirty = 0;
+
+/* A regular file to be read by the checksum threads. */
+
+struct vine_checksum_job {
+	char *path;
+	char *key;
+	struct stat info;
+	time_t start;
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	int ok;
+};
+
+struct vine_checksum_jobs {
+	struct vine_checksum_job *jobs;
+	int count;
+	int next;
+	pthread_mutex_t mutex;
+};
+
+static char *checksum_any(const char *path, ssize_t *totalsize);
+
+static char *checksum_key(const char *path)
+{
+	char cwd[PATH_MAX];
+
+	if (path[0] == '/' || !getcwd(cwd, sizeof(cwd)))
+		return xxstrdup(path);
+
+	return string_format("%s/%s", cwd, path);
+}
+
+static struct hash_table *checksum_table_get()
+{
+	if (!checksum_table)
+		checksum_table = hash_table_create(0, 0);
+	return checksum_table;
+}
+
+static const char *checksum_lookup(const char *key, struct stat *info)
+{
+	struct vine_checksum_entry *e = hash_table_lookup(checksum_table_get(), key);
+	if (!e)
+		return 0;
+
+	if (e->device != info->st_dev || e->inode != info->st_ino || e->size != info->st_size ||
+			e->mtime != info->st_mtime || e->ctime != info->st_ctime) {
+		return 0;
+	}
+
+	return e->hash;
+}
+
+static void checksum_insert(const char *key, struct stat *info, time_t start, const char *hash)
+{
+	if (info->st_mtime >= start || info->st_ctime >= start)
+		return;
+
+	struct hash_table *table = checksum_table_get();
+	struct vine_checksum_entry *e = hash_table_lookup(table, key);
+	if (!e) {
+		e = xxmalloc(sizeof(*e));
+		hash_table_insert(table, key, e);
+	}
+
+	e->device = info->st_dev;
+	e->inode = info->st_ino;
+	e->size = info->st_size;
+	e->mtime = info->st_mtime;
+	e->ctime = info->st_ctime;
+	snprintf(e->hash, sizeof(e->hash), "%s", hash);
+
+	checksum_cache_dirty = 1;
+}
+
+/*
+Find all regular files under path that are not in the table,
+so that they can be read concurrently.
+*/
+
+static void checksum_find_missing(const char *path, struct list *missing)
+{
+	DIR *dir = opendir(path);
+	if (!dir)
+		return;
+
+	struct dirent *d;
+	while ((d = readdir(dir))) {
+		if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+			continue;
+
+		char *subpath = string_format("%s/%s", path, d->d_name);
+		struct stat info;
+
+		if (lstat(subpath, &info)) {
+			free(subpath);
+		} else if (S_ISDIR(info.st_mode)) {
+			checksum_find_missing(subpath, missing);
+			free(subpath);
+		} else if (S_ISREG(info.st_mode)) {
+			char *key = checksum_key(subpath);
+			if (checksum_lookup(key, &info)) {
+				free(subpath);
+				free(key);
+			} else {
+				struct vine_checksum_job *job = xxcalloc(1, sizeof(*job));
+				job->path = subpath;
+				job->key = key;
+				job->info = info;
+				list_push_tail(missing, job);
+			}
+		} else {
+			free(subpath);
+		}
+	}
+
+	closedir(dir);
+}
+
+static void *checksum_thread(void *arg)
+{
+	struct vine_checksum_jobs *j = arg;
+
+	while (1) {
+		pthread_mutex_lock(&j->mutex);
+		int i = j->next++;
+		pthread_mutex_unlock(&j->mutex);
+
+		if (i >= j->count)
+			break;
+
+		struct vine_checksum_job *job = &j->jobs[i];
+		job->start = time(0);
+		job->ok = md5_file(job->path, job->digest);
+	}
+
+	return 0;
+}
+
+/*
+Read the regular files under path missing from the table with one
+thread per core, and add their checksums to the table.
+*/
+
+static void checksum_prefetch(const char *path)
+{
+	struct list *missing = list_create();
+	checksum_find_missing(path, missing);
+
+	struct vine_checksum_jobs j;
+	j.count = list_size(missing);
+	j.next = 0;
+
+	if (j.count < 2) {
+		list_clear(missing, free);
+		list_delete(missing);
+		return;
+	}
+
+	j.jobs = xxmalloc(j.count * sizeof(*j.jobs));
+	pthread_mutex_init(&j.mutex, 0);
+
+	int i = 0;
+	struct vine_checksum_job *job;
+	while ((job = list_pop_head(missing))) {
+		j.jobs[i++] = *job;
+		free(job);
+	}
+	list_delete(missing);
+
+	int nthreads = MIN(MIN(load_average_get_cpus(), VINE_CHECKSUM_MAX_THREADS), j.count);
+	pthread_t *threads = xxmalloc(nthreads * sizeof(*threads));
+
+	int started;
+	for (started = 0; started < nthreads; started++) {
+		if (pthread_create(&threads[started], 0, checksum_thread, &j))
+			break;
+	}
+
+	debug(D_VINE, "computing checksums of %d files under %s with %d threads", j.count, path, started);
+
+	/* If no thread could be started, read the files here. */
+	if (started == 0)
+		checksum_thread(&j);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], 0);
+
+	for (i = 0; i < j.count; i++) {
+		if (j.jobs[i].ok)
+			checksum_insert(j.jobs[i].key, &j.jobs[i].info, j.jobs[i].start, md5_to_string(j.jobs[i].digest));
+		free(j.jobs[i].path);
+		free(j.jobs[i].key);
+	}
+
+	pthread_mutex_destroy(&j.mutex);
+	free(threads);
+	free(j.jobs);
+}
 
 /*
 Compute the recursive hash of a directory by building up a string like this:
@@ -24,11 +256,9 @@ Compute the recursive hash of a directory by building up a string like this:
 	fileb:hash-of-fileb
 	dirc:hash-of-dirc
 
-And then compute the hash of that string.
+And then compute the hash of that string, with the entries sorted by name.
 
 Returns an allocated string that must be freed.
-
-XXX For consistency, this should sort the directory entries before hashing.
 */
 
 static char *vine_checksum_dir(const char *path, ssize_t *totalsize)
@@ -50,7 +280,7 @@ static char *vine_checksum_dir(const char *path, ssize_t *totalsize)
 		if (stat(subpath, &info))
 			return 0;
 
-		char *subhash = vine_checksum_any(subpath, totalsize);
+		char *subhash = checksum_any(subpath, totalsize);
 		char *line = string_format("%s:%o:%s:%s:\n", entries[i], info.st_mode, ctime(&info.st_mtime), subhash);
 
 		dirstring = string_combine(dirstring, line);
@@ -68,10 +298,22 @@ static char *vine_checksum_dir(const char *path, ssize_t *totalsize)
 	return result;
 }
 
-static char *vine_checksum_file(const char *path)
+static char *vine_checksum_file(const char *path, struct stat *info)
 {
 	unsigned char digest[MD5_DIGEST_LENGTH];
-	md5_file(path, digest);
+
+	char *key = checksum_key(path);
+	const char *hash = checksum_lookup(key, info);
+	if (hash) {
+		free(key);
+		return xxstrdup(hash);
+	}
+
+	time_t start = time(0);
+	if (md5_file(path, digest))
+		checksum_insert(key, info, start, md5_to_string(digest));
+
+	free(key);
 	return xxstrdup(md5_to_string(digest));
 }
 
@@ -90,7 +332,7 @@ static char *vine_checksum_symlink(const char *path, ssize_t linklength)
 	}
 }
 
-char *vine_checksum_any(const char *path, ssize_t *totalsize)
+static char *checksum_any(const char *path, ssize_t *totalsize)
 {
 	struct stat info;
 
@@ -101,7 +343,7 @@ char *vine_checksum_any(const char *path, ssize_t *totalsize)
 		return vine_checksum_dir(path, totalsize);
 	} else if (S_ISREG(info.st_mode)) {
 		*totalsize += info.st_size;
-		return vine_checksum_file(path);
+		return vine_checksum_file(path, &info);
 	} else if (S_ISLNK(info.st_mode)) {
 		return vine_checksum_symlink(path, info.st_size);
 	} else {
@@ -109,3 +351,160 @@ char *vine_checksum_any(const char *path, ssize_t *totalsize)
 		return 0;
 	}
 }
+
+char *vine_checksum_any(const char *path, ssize_t *totalsize)
+{
+	struct stat info;
+
+	if (!lstat(path, &info) && S_ISDIR(info.st_mode))
+		checksum_prefetch(path);
+
+	return checksum_any(path, totalsize);
+}
+
+/*
+The cache file has one line per file:
+
+	hash device inode size mtime ctime path
+
+Later lines replace earlier ones for the same path.
+*/
+
+int vine_checksum_cache_load(const char *path)
+{
+	if (checksum_cache_path) {
+		if (!strcmp(checksum_cache_path, path))
+			return 1;
+		vine_checksum_cache_save();
+		free(checksum_cache_path);
+	}
+
+	checksum_cache_path = xxstrdup(path);
+
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		if (errno == ENOENT)
+			return 1;
+		debug(D_NOTICE, "could not open checksum cache %s: %s", path, strerror(errno));
+		return 0;
+	}
+
+	struct hash_table *table = checksum_table_get();
+	char line[PATH_MAX + 256];
+	int count = 0;
+
+	while (fgets(line, sizeof(line), file)) {
+		struct vine_checksum_entry e;
+		long long device, inode, size, modify_time, change_time;
+		int n = 0;
+
+		string_chomp(line);
+		if (sscanf(line, "%32s %lld %lld %lld %lld %lld %n", e.hash, &device, &inode, &size, &modify_time, &change_time, &n) != 6 ||
+				!line[n]) {
+			continue;
+		}
+
+		e.device = device;
+		e.inode = inode;
+		e.size = size;
+		e.mtime = modify_time;
+		e.ctime = change_time;
+
+		struct vine_checksum_entry *old = hash_table_remove(table, &line[n]);
+		free(old);
+
+		struct vine_checksum_entry *copy = xxmalloc(sizeof(e));
+		*copy = e;
+		hash_table_insert(table, &line[n], copy);
+		count++;
+	}
+
+	fclose(file);
+
+	debug(D_VINE, "loaded %d checksums from %s", count, path);
+
+	return 1;
+}
+
+/*
+Drop the entries of files that no longer exist or have changed since
+their checksum was computed, as they can never be used again.
+*/
+
+static void checksum_cache_prune()
+{
+	if (!checksum_table)
+		return;
+
+	struct list *stale = list_create();
+
+	char *key;
+	struct vine_checksum_entry *e;
+	HASH_TABLE_ITERATE(checksum_table, key, e)
+	{
+		struct stat info;
+		if (lstat(key, &info) || !S_ISREG(info.st_mode) || !checksum_lookup(key, &info))
+			list_push_tail(stale, xxstrdup(key));
+	}
+
+	while ((key = list_pop_head(stale))) {
+		free(hash_table_remove(checksum_table, key));
+		free(key);
+		checksum_cache_dirty = 1;
+	}
+
+	list_delete(stale);
+}
+
+int vine_checksum_cache_save()
+{
+	if (!checksum_cache_path)
+		return 1;
+
+	checksum_cache_prune();
+
+	if (!checksum_cache_dirty)
+		return 1;
+
+	/* Write to a temporary file first, so that readers never see a partial cache. */
+	char *tmppath = string_format("%s.%d", checksum_cache_path, (int)getpid());
+
+	FILE *file = fopen(tmppath, "w");
+	if (!file) {
+		debug(D_NOTICE, "could not write checksum cache %s: %s", tmppath, strerror(errno));
+		free(tmppath);
+		return 0;
+	}
+
+	char *key;
+	struct vine_checksum_entry *e;
+	HASH_TABLE_ITERATE(checksum_table, key, e)
+	{
+		if (strchr(key, '\n'))
+			continue;
+		fprintf(file,
+				"%s %lld %lld %lld %lld %lld %s\n",
+				e->hash,
+				(long long)e->device,
+				(long long)e->inode,
+				(long long)e->size,
+				(long long)e->mtime,
+				(long long)e->ctime,
+				key);
+	}
+
+	int ok = !ferror(file);
+	ok = !fclose(file) && ok;
+
+	if (ok && rename(tmppath, checksum_cache_path) == 0) {
+		checksum_cache_dirty = 0;
+	} else {
+		debug(D_NOTICE, "could not write checksum cache %s: %s", checksum_cache_path, strerror(errno));
+		unlink(tmppath);
+		ok = 0;
+	}
+
+	free(tmppath);
+
+	return ok;
+}
@@ -9,6 +9,15 @@ See the file COPYING for details.
 
 #include <sys/types.h>
 
+/* Maximum number of threads used to compute the checksums of the files in a directory. */
+#define VINE_CHECKSUM_MAX_THREADS 16
+
 char *vine_checksum_any( const char *path, ssize_t *totalsize );
 
+/* Load the checksums of files saved at path, and save them back there on vine_checksum_cache_save. */
+int vine_checksum_cache_load( const char *path );
+
+/* Save the checksums computed since the cache was loaded, if any, dropping those of files since removed or changed. */
+int vine_checksum_cache_save();
+
 #endif
@@ -11,21 +11,40 @@ See the file COPYING for details.
 #include "vine_manager.h"
 #include "vine_worker_info.h"
 
+#include "set.h"
 #include "stringtools.h"
 
 #include "debug.h"
 
 // add a file to the remote file table.
-int vine_file_replica_table_insert(
+int vine_file_replica_table_insert(struct vine_manager *q,
 		struct vine_worker_info *w, const char *cachename, struct vine_file_replica *remote_info)
 {
 	hash_table_insert(w->current_files, cachename, remote_info);
+
+	struct set *workers = hash_table_lookup(q->file_worker_table, cachename);
+	if (!workers) {
+		workers = set_create(4);
+		hash_table_insert(q->file_worker_table, cachename, workers);
+	}
+	set_insert(workers, w);
+
 	return 1;
 }
 
 // remove a file from the remote file table.
-struct vine_file_replica *vine_file_replica_table_remove(struct vine_worker_info *w, const char *cachename)
+struct vine_file_replica *vine_file_replica_table_remove(
+		struct vine_manager *q, struct vine_worker_info *w, const char *cachename)
 {
+	struct set *workers = hash_table_lookup(q->file_worker_table, cachename);
+	if (workers) {
+		set_remove(workers, w);
+		if (set_size(workers) < 1) {
+			hash_table_remove(q->file_worker_table, cachename);
+			set_delete(workers);
+		}
+	}
+
 	return hash_table_remove(w->current_files, cachename);
 }
 
@@ -39,41 +58,59 @@ struct vine_file_replica *vine_file_replica_table_lookup(struct vine_worker_info
 // find a worker in posession of a specific file, and is ready to transfer it.
 struct vine_worker_info *vine_file_replica_table_find_worker(struct vine_manager *q, const char *cachename)
 {
-	char *id;
+	struct set *workers = hash_table_lookup(q->file_worker_table, cachename);
+	if (!workers)
+		return 0;
+
 	struct vine_worker_info *peer;
 	struct vine_file_replica *remote_info;
-	HASH_TABLE_ITERATE(q->worker_table, id, peer)
-	{
-		// generate a peer address stub as it would appear in the transfer table
-		char *peer_addr = string_format("worker://%s:%d", peer->transfer_addr, peer->transfer_port);
+
+	set_first_element(workers);
+	while ((peer = set_next_element(workers))) {
 		if ((remote_info = hash_table_lookup(peer->current_files, cachename)) && remote_info->in_cache) {
-			if (vine_current_transfers_worker_in_use(q, peer_addr) < q->worker_source_max_transfers) {
-				free(peer_addr);
+			// generate a peer address stub as it would appear in the transfer table
+			char *peer_addr = string_format("worker://%s:%d", peer->transfer_addr, peer->transfer_port);
+			int in_use = vine_current_transfers_worker_in_use(q, peer_addr);
+			free(peer_addr);
+			if (in_use < q->worker_source_max_transfers) {
 				return peer;
 			}
 		}
-		free(peer_addr);
 	}
 	return 0;
 }
 
 /*
 Determine if this file is cached *anywhere* in the system.
-XXX Note that this implementation is another inefficient linear search.
+The reverse index only holds entries with at least one replica.
 */
 
 int vine_file_replica_table_exists_somewhere(struct vine_manager *q, const char *cachename)
 {
-	char *key;
-	struct vine_worker_info *w;
-	struct vine_file_replica *r;
+	return hash_table_lookup(q->file_worker_table, cachename) != 0;
+}
 
-	HASH_TABLE_ITERATE(q->worker_table, key, w)
+// forget all replicas held by a worker that is about to be removed.
+void vine_file_replica_table_remove_worker(struct vine_manager *q, struct vine_worker_info *w)
+{
+	char *cachename;
+	struct vine_file_replica *remote_info;
+
+	HASH_TABLE_ITERATE(w->current_files, cachename, remote_info)
 	{
-		r = hash_table_lookup(w->current_files, cachename);
-		if (r)
-			return 1;
+		struct set *workers = hash_table_lookup(q->file_worker_table, cachename);
+		if (workers) {
+			set_remove(workers, w);
+			if (set_size(workers) < 1) {
+				hash_table_remove(q->file_worker_table, cachename);
+				set_delete(workers);
+			}
+		}
 	}
+}
 
-	return 0;
+// delete the reverse index of replicas, without touching the replicas themselves.
+void vine_file_replica_table_clear(struct vine_manager *q)
+{
+	hash_table_clear(q->file_worker_table, (void *)set_delete);
 }
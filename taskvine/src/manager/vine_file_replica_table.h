@@ -17,9 +17,9 @@ See the file COPYING for details.
 #include "vine_file_replica.h"
 #include "vine_worker_info.h"
 
-int vine_file_replica_table_insert(struct vine_worker_info *w, const char *cachename, struct vine_file_replica *remote_info);
+int vine_file_replica_table_insert(struct vine_manager *q, struct vine_worker_info *w, const char *cachename, struct vine_file_replica *remote_info);
 
-struct vine_file_replica *vine_file_replica_table_remove(struct vine_worker_info *w, const char *cachename);
+struct vine_file_replica *vine_file_replica_table_remove(struct vine_manager *q, struct vine_worker_info *w, const char *cachename);
 
 struct vine_file_replica *vine_file_replica_table_lookup(struct vine_worker_info *w, const char *cachename);
 
@@ -27,6 +27,10 @@ struct vine_worker_info *vine_file_replica_table_find_worker(struct vine_manager
 
 int vine_file_replica_table_exists_somewhere( struct vine_manager *q, const char *cachename );
 
+void vine_file_replica_table_remove_worker( struct vine_manager *q, struct vine_worker_info *w );
+
+void vine_file_replica_table_clear( struct vine_manager *q );
+
 
 #endif
 
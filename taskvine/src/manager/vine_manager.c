@@ -6,6 +6,7 @@ See the file COPYING for details.
 
 #include "vine_manager.h"
 #include "vine_blocklist.h"
+#include "vine_checksum.h"
 #include "vine_current_transfers.h"
 #include "vine_factory_info.h"
 #include "vine_fair.h"
@@ -23,8 +24,10 @@ See the file COPYING for details.
 #include "vine_schedule.h"
 #include "vine_task.h"
 #include "vine_task_info.h"
+#include "vine_task_shape.h"
 #include "vine_taskgraph_log.h"
 #include "vine_txn_log.h"
+#include "vine_worker_index.h"
 #include "vine_worker_info.h"
 
 #include "buffer.h"
@@ -64,6 +67,7 @@ See the file COPYING for details.
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stddef.h>
@@ -215,7 +219,6 @@ __attribute__((format(printf, 3, 4))) int vine_manager_send(
 		struct vine_manager *q, struct vine_worker_info *w, const char *fmt, ...)
 {
 	va_list va;
-	time_t stoptime;
 	buffer_t B[1];
 	buffer_init(B);
 	buffer_abortonfailure(B, 1);
@@ -227,9 +230,7 @@ __attribute__((format(printf, 3, 4))) int vine_manager_send(
 
 	debug(D_VINE, "tx to %s (%s): %s", w->hostname, w->addrport, buffer_tostring(B));
 
-	stoptime = time(0) + q->short_timeout;
-
-	int result = link_putlstring(w->link, buffer_tostring(B), buffer_pos(B), stoptime);
+	int result = vine_manager_put_bytes(q, w, buffer_tostring(B), buffer_pos(B));
 
 	buffer_free(B);
 
@@ -282,6 +283,8 @@ static vine_msg_code_t handle_info(struct vine_manager *q, struct vine_worker_in
 		remove_worker(q, w, VINE_WORKER_DISCONNECT_IDLE_OUT);
 		q->stats->workers_idled_out++;
 	} else if (string_prefix_is(field, "end_of_resource_update")) {
+		/* A new or resized worker may fit tasks that did not fit before. */
+		q->worker_capacity_epoch++;
 		count_worker_resources(q, w);
 		vine_txn_log_write_worker_resources(q, w);
 	} else if (string_prefix_is(field, "worker-id")) {
@@ -290,9 +293,11 @@ static vine_msg_code_t handle_info(struct vine_manager *q, struct vine_worker_in
 		vine_txn_log_write_worker(q, w, 0, 0);
 	} else if (string_prefix_is(field, "worker-end-time")) {
 		w->end_time = MAX(0, atoll(value));
+		q->worker_capacity_epoch++;
 	} else if (string_prefix_is(field, "from-factory")) {
 		q->fetch_factory = 1;
 		w->factory_name = xxstrdup(value);
+		q->worker_eligibility_epoch++;
 
 		struct vine_factory_info *f = vine_factory_info_lookup(q, w->factory_name);
 		if (f->connected_workers + 1 > f->max_workers) {
@@ -330,7 +335,7 @@ static int handle_cache_update(struct vine_manager *q, struct vine_worker_info *
 			- The file was created as an output of a task.
 			*/
 			remote_info = vine_file_replica_create(size, 0);
-			vine_file_replica_table_insert(w, cachename, remote_info);
+			vine_file_replica_table_insert(q, w, cachename, remote_info);
 		}
 
 		remote_info->size = size;
@@ -351,8 +356,9 @@ static int handle_cache_update(struct vine_manager *q, struct vine_worker_info *
 /*
 A cache-invalid message coming from the worker means that a requested
 remote transfer or command did not succeed, and the intended file is
-not in the cache.  It is accompanied by a (presumably short) string
-message that further explains the failure.
+not in the cache, or that the worker evicted the file to free space.
+It is accompanied by a (presumably short) string message that further
+explains the failure.
 So, we remove the corresponding note for that worker and log the error.
 We should expect to soon receive some failed tasks that were unable
 set up their own input sandboxes.
@@ -387,7 +393,7 @@ static int handle_cache_invalid(struct vine_manager *q, struct vine_worker_info
 		debug(D_VINE, "%s (%s) invalidated %s with error: %s", w->hostname, w->addrport, cachename, message);
 		free(message);
 
-		struct vine_file_replica *remote_info = vine_file_replica_table_remove(w, cachename);
+		struct vine_file_replica *remote_info = vine_file_replica_table_remove(q, w, cachename);
 		vine_current_transfers_remove(q, id);
 		if (remote_info)
 			vine_file_replica_delete(remote_info);
@@ -405,6 +411,10 @@ static int handle_cache_invalid(struct vine_manager *q, struct vine_worker_info
 		message[length] = 0;
 		debug(D_VINE, "%s (%s) invalidated %s with error: %s", w->hostname, w->addrport, cachename, message);
 		free(message);
+
+		struct vine_file_replica *remote_info = vine_file_replica_table_remove(q, w, cachename);
+		if (remote_info)
+			vine_file_replica_delete(remote_info);
 	}
 	return VINE_MSG_PROCESSED;
 }
@@ -431,7 +441,7 @@ This function receives a message from worker and records the time a message is s
 received. This timestamp is used in keepalive timeout computations.
 */
 
-static vine_msg_code_t vine_manager_recv_no_retry(
+vine_msg_code_t vine_manager_recv_no_retry(
 		struct vine_manager *q, struct vine_worker_info *w, char *line, size_t length)
 {
 	time_t stoptime;
@@ -649,6 +659,7 @@ static void update_factory(struct vine_manager *q, struct jx *j)
 	if (found) {
 		int old_max_workers = f->max_workers;
 		f->max_workers = m->u.integer_value;
+		q->worker_eligibility_epoch++;
 		// Trim workers if max_workers reduced.
 		if (f->max_workers < old_max_workers) {
 			factory_trim_workers(q, f);
@@ -861,21 +872,34 @@ static void remove_worker(struct vine_manager *q, struct vine_worker_info *w, vi
 
 	cleanup_worker(q, w);
 
+	if (q->task_batch_worker == w) {
+		vine_manager_discard_task_batch(q);
+	}
+
+	vine_worker_index_remove(q, w);
+	link_set_remove(q->poll_set, w->link);
 	hash_table_remove(q->worker_table, w->hashkey);
 	hash_table_remove(q->workers_with_available_results, w->hashkey);
+	hash_table_remove(q->workers_retrieving, w->hashkey);
+	vine_manager_get_outputs_delete(w);
+	vine_manager_put_delete(w);
 
 	record_removed_worker_stats(q, w);
 
+	vine_file_replica_table_remove_worker(q, w);
+
 	if (w->factory_name) {
 		struct vine_factory_info *f = vine_factory_info_lookup(q, w->factory_name);
 		if (f)
 			f->connected_workers--;
+		q->worker_eligibility_epoch++;
 	}
 
 	vine_worker_delete(w);
 
 	/* update the largest worker seen */
 	find_max_worker(q);
+	q->worker_capacity_epoch++;
 
 	debug(D_VINE, "%d workers connected in total now", count_workers(q, VINE_WORKER_TYPE_WORKER));
 }
@@ -950,6 +974,7 @@ static void add_worker(struct vine_manager *q)
 	w->addrport = string_format("%s:%d", addr, port);
 
 	hash_table_insert(q->worker_table, w->hashkey, w);
+	link_set_add(q->poll_set, link, LINK_READ);
 }
 
 /* Delete a single file on a remote worker. */
@@ -960,7 +985,7 @@ static void delete_worker_file(
 	if (!(flags & except_flags)) {
 		vine_manager_send(q, w, "unlink %s\n", filename);
 		struct vine_file_replica *remote_info;
-		remote_info = vine_file_replica_table_remove(w, filename);
+		remote_info = vine_file_replica_table_remove(q, w, filename);
 		vine_file_replica_delete(remote_info);
 	}
 }
@@ -1068,40 +1093,21 @@ static void resource_monitor_compress_logs(struct vine_manager *q, struct vine_t
 }
 
 /*
-Get all the relevant output data from a completed task, then clean up unneeded items.
-Return true if task was retrieved from worker (regardless of whether the task is successful.)
-Return false if the worker failed.
+Complete a task once all its output data has been received, then clean up unneeded items.
+Return true if the task was retrieved from worker (regardless of whether the task is successful.)
+Return false if the outputs could not be stored, in which case the worker is removed.
 */
 
-static int fetch_output_from_worker(struct vine_manager *q, struct vine_worker_info *w, int task_id)
+static int finish_output_retrieval(
+		struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, vine_result_code_t result)
 {
-	struct vine_task *t;
-	vine_result_code_t result = VINE_SUCCESS;
-
-	t = itable_lookup(w->current_tasks, task_id);
-	if (!t) {
-		debug(D_VINE, "Failed to find task %d at worker %s (%s).", task_id, w->hostname, w->addrport);
-		handle_failure(q, w, t, VINE_WORKER_FAILURE);
-		return 0;
-	}
-
-	// Start receiving output...
-	t->time_when_retrieval = timestamp_get();
-
-	if (t->result == VINE_RESULT_RESOURCE_EXHAUSTION) {
-		result = vine_manager_get_monitor_output_file(q, w, t);
-	} else {
-		result = vine_manager_get_output_files(q, w, t);
-	}
-
 	if (result != VINE_SUCCESS) {
 		debug(D_VINE, "Failed to receive output from worker %s (%s).", w->hostname, w->addrport);
 		handle_failure(q, w, t, result);
-	}
-
-	if (result == VINE_WORKER_FAILURE) {
-		t->time_when_done = timestamp_get();
-		return 0;
+		if (result != VINE_APP_FAILURE) {
+			t->time_when_done = timestamp_get();
+			return 0;
+		}
 	}
 
 	delete_uncacheable_files(q, w, t);
@@ -1365,6 +1371,7 @@ static vine_msg_code_t handle_taskvine(struct vine_manager *q, struct vine_worke
 		free(w->version);
 
 	w->hostname = strdup(items[0]);
+	w->eligibility_epoch = -1;
 	w->os = strdup(items[1]);
 	w->arch = strdup(items[2]);
 	w->version = strdup(items[3]);
@@ -2391,6 +2398,22 @@ static vine_result_code_t handle_worker(struct vine_manager *q, struct link *l)
 	w = hash_table_lookup(q->worker_table, key);
 	free(key);
 
+	// The worker may have been removed while handling other ready links.
+	if (!w) {
+		return VINE_SUCCESS;
+	}
+
+	// Replies to output requests take precedence, as they arrive in order.
+	if (vine_manager_get_outputs_busy(w)) {
+		vine_result_code_t result = vine_manager_get_outputs_advance(q, w);
+		if (result != VINE_SUCCESS) {
+			debug(D_VINE, "Failed to receive output from worker %s (%s).", w->hostname, w->addrport);
+			handle_worker_failure(q, w);
+			return VINE_WORKER_FAILURE;
+		}
+		return VINE_SUCCESS;
+	}
+
 	vine_msg_code_t mcode;
 	mcode = vine_manager_recv_no_retry(q, w, line, sizeof(line));
 
@@ -2425,71 +2448,70 @@ static vine_result_code_t handle_worker(struct vine_manager *q, struct link *l)
 }
 
 /*
-Construct the table of network links to be considered,
-including the manager's accepting link, and one for
-each active worker.
+Send more of the data queued for a worker whose link is ready for writing.
 */
 
-static int build_poll_table(struct vine_manager *q)
+static vine_result_code_t handle_worker_upload(struct vine_manager *q, struct link *l)
 {
-	int n = 0;
-	char *key;
-	struct vine_worker_info *w;
+	char *key = link_to_hash_key(l);
+	struct vine_worker_info *w = hash_table_lookup(q->worker_table, key);
+	free(key);
 
-	// Allocate a small table, if it hasn't been done yet.
-	if (!q->poll_table) {
-		q->poll_table = malloc(sizeof(*q->poll_table) * q->poll_table_size);
-		if (!q->poll_table) {
-			// if we can't allocate a poll table, we can't do anything else.
-			fatal("allocating memory for poll table failed.");
-		}
+	if (!w) {
+		return VINE_SUCCESS;
 	}
 
-	// The first item in the poll table is the manager link, which accepts new connections.
-	q->poll_table[0].link = q->manager_link;
-	q->poll_table[0].events = LINK_READ;
-	q->poll_table[0].revents = 0;
-	n = 1;
+	vine_result_code_t result = vine_manager_put_advance(q, w);
 
-	// For every worker in the hash table, add an item to the poll table
-	HASH_TABLE_ITERATE(q->worker_table, key, w)
-	{
-		// If poll table is not large enough, reallocate it
-		if (n >= q->poll_table_size) {
-			q->poll_table_size *= 2;
-			q->poll_table = realloc(q->poll_table, sizeof(*q->poll_table) * q->poll_table_size);
-			if (q->poll_table == NULL) {
-				// if we can't allocate a poll table, we can't do anything else.
-				fatal("reallocating memory for poll table failed.");
-			}
-		}
+	if (result != VINE_SUCCESS) {
+		debug(D_VINE, "Failed to send data to worker %s (%s).", w->hostname, w->addrport);
+		handle_worker_failure(q, w);
+	}
+
+	return result;
+}
 
-		q->poll_table[n].link = w->link;
-		q->poll_table[n].events = LINK_READ;
-		q->poll_table[n].revents = 0;
-		n++;
+/*
+Make room in the poll table for all the links of the poll set,
+so that every ready link can be reported by a single wait.
+*/
+
+static void resize_poll_table(struct vine_manager *q)
+{
+	int size = link_set_size(q->poll_set);
+	if (q->poll_table && size <= q->poll_table_size) {
+		return;
 	}
 
-	return n;
+	while (q->poll_table_size < size) {
+		q->poll_table_size *= 2;
+	}
+
+	q->poll_table = realloc(q->poll_table, sizeof(*q->poll_table) * q->poll_table_size);
+	if (!q->poll_table) {
+		// if we can't allocate a poll table, we can't do anything else.
+		fatal("allocating memory for poll table failed.");
+	}
 }
 
 /*
- * Determine the resources to allocate for a given task when assigned to a specific worker.
+ * Determine the cores, memory, disk, and gpus to allocate for a task when assigned to a specific worker.
+ * This is the allocation-free core of @ref vine_manager_choose_resources_for_task, used by the scheduler
+ * to evaluate many candidate workers for the same task.
  * @param q The manager structure.
  * @param w The worker info structure.
- * @param t The task structure.
- * @return A pointer to a struct rmsummary describing the chosen resources for the given task.
+ * @param min The minimum resources of the task, with -1 for unspecified.
+ * @param max The maximum resources of the task, with -1 for unspecified.
+ * @param limits Output: the resources chosen for the task at this worker.
  */
 
-struct rmsummary *vine_manager_choose_resources_for_task(
-		struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t)
+void vine_manager_choose_resource_box(struct vine_manager *q,
+		struct vine_worker_info *w,
+		const struct vine_resource_box *min,
+		const struct vine_resource_box *max,
+		struct vine_resource_box *limits)
 {
-	/* Compute the minimum and maximum resources for this task. */
-	const struct rmsummary *min = vine_manager_task_resources_min(q, t);
-	const struct rmsummary *max = vine_manager_task_resources_max(q, t);
-
-	struct rmsummary *limits = rmsummary_create(-1);
-	rmsummary_merge_override_basic(limits, max);
+	*limits = *max;
 
 	int use_whole_worker = 1;
 
@@ -2591,12 +2613,61 @@ struct rmsummary *vine_manager_choose_resources_for_task(
 		}
 	}
 
+	/* never go below specified min resources. */
+	limits->cores = MAX(limits->cores, min->cores);
+	limits->memory = MAX(limits->memory, min->memory);
+	limits->disk = MAX(limits->disk, min->disk);
+	limits->gpus = MAX(limits->gpus, min->gpus);
+}
+
+/* Extract the resources used for scheduling, leaving unset (-1) those not specified. */
+
+void vine_resource_box_from_rmsummary(struct vine_resource_box *box, const struct rmsummary *s)
+{
+	box->cores = s->cores > -1 ? s->cores : -1;
+	box->memory = s->memory > -1 ? s->memory : -1;
+	box->disk = s->disk > -1 ? s->disk : -1;
+	box->gpus = s->gpus > -1 ? s->gpus : -1;
+}
+
+/*
+ * Determine the resources to allocate for a given task when assigned to a specific worker.
+ * @param q The manager structure.
+ * @param w The worker info structure.
+ * @param t The task structure.
+ * @return A pointer to a struct rmsummary describing the chosen resources for the given task.
+ */
+
+struct rmsummary *vine_manager_choose_resources_for_task(
+		struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t)
+{
+	/* Compute the minimum and maximum resources for this task. */
+	const struct rmsummary *min = vine_manager_task_resources_min(q, t);
+	const struct rmsummary *max = vine_manager_task_resources_max(q, t);
+
+	struct vine_resource_box min_box;
+	struct vine_resource_box max_box;
+	struct vine_resource_box box;
+
+	vine_resource_box_from_rmsummary(&min_box, min);
+	vine_resource_box_from_rmsummary(&max_box, max);
+	vine_manager_choose_resource_box(q, w, &min_box, &max_box, &box);
+
+	struct rmsummary *limits = rmsummary_create(-1);
+	rmsummary_merge_override_basic(limits, max);
+
+	limits->cores = box.cores;
+	limits->memory = box.memory;
+	limits->disk = box.disk;
+	limits->gpus = box.gpus;
+
 	/* never go below specified min resources. */
 	rmsummary_merge_max(limits, min);
 
 	return limits;
 }
 
+
 /*
 Start one task on a given worker by specializing the task to the worker,
 sending the appropriate input files, and then sending the details of the task.
@@ -2657,6 +2728,7 @@ static void count_worker_resources(struct vine_manager *q, struct vine_worker_in
 	update_max_worker(q, w);
 
 	if (w->resources->workers.total < 1) {
+		vine_worker_index_update(q, w);
 		return;
 	}
 
@@ -2673,6 +2745,8 @@ static void count_worker_resources(struct vine_manager *q, struct vine_worker_in
 		w->resources->disk.inuse += box->disk;
 		w->resources->gpus.inuse += box->gpus;
 	}
+
+	vine_worker_index_update(q, w);
 }
 
 static void update_max_worker(struct vine_manager *q, struct vine_worker_info *w)
@@ -2778,6 +2852,8 @@ static void reap_task_from_worker(
 	/* Make sure the task and worker agree before changing anything. */
 	assert(t->worker == w);
 
+	vine_manager_get_outputs_forget(w, t);
+
 	w->total_task_time += t->time_workers_execute_last;
 
 	rmsummary_delete(t->current_resource_box);
@@ -2830,6 +2906,8 @@ static void reap_task_from_worker(
 		return;
 	}
 
+	/* The resources freed by this task may fit tasks that did not fit before. */
+	q->worker_capacity_epoch++;
 	count_worker_resources(q, w);
 }
 
@@ -3019,17 +3097,38 @@ to run, finding the best worker for that task, and then committing
 the task to the worker.
 */
 
-static int send_one_task(struct vine_manager *q)
+/*
+Send ready tasks to workers. The first task that can run is sent to the
+worker chosen by the scheduler. The following ready tasks are considered
+in order, and while the scheduler chooses the same worker for them and
+their inputs are already cached there, they are sent together with the
+first task in a single message. Returns the number of tasks sent.
+*/
+
+static int send_tasks(struct vine_manager *q)
 {
 	struct vine_task *t;
 	struct vine_worker_info *w = NULL;
+	struct vine_worker_info *batch_worker = NULL;
 
+	int tasks_sent = 0;
 	int tasks_considered = 0;
+	int tasks_skipped = 0;
+	int ready_tasks = list_size(q->ready_list);
 	timestamp_t now = timestamp_get();
 
 	while ((t = list_rotate(q->ready_list))) {
+		// Skip the whole class of tasks known not to fit any worker,
+		// without counting them against the scheduling depth.
+		if (vine_task_shape_is_unfit(q, t)) {
+			if (++tasks_skipped >= ready_tasks) {
+				break;
+			}
+			continue;
+		}
+
 		if (tasks_considered++ > q->attempt_schedule_depth) {
-			return 0;
+			break;
 		}
 
 		// Skip task if min requested start time not met.
@@ -3048,25 +3147,63 @@ static int send_one_task(struct vine_manager *q)
 		w = vine_schedule_task_to_worker(q, t);
 
 		if (!w) {
+			vine_task_shape_mark_unfit(q, t);
+			if (batch_worker) {
+				break;
+			}
 			continue;
 		}
 
 		q->stats->time_scheduling += timestamp_get() - q->stats_measure->time_scheduling;
 
+		// A worker sending back outputs does not read its link until done.
+		if (vine_manager_get_outputs_busy(w)) {
+			if (batch_worker) {
+				break;
+			}
+			continue;
+		}
+
+		// Further tasks join the batch only if they go to the same worker without transfers.
+		if (batch_worker && (w != batch_worker || !vine_manager_task_inputs_cached(q, w, t))) {
+			break;
+		}
+
 		// Check if there is transfer capacity available.
 		if (q->peer_transfers_enabled) {
-			if (!vine_manager_transfer_capacity_available(q, w, t))
+			if (!vine_manager_transfer_capacity_available(q, w, t)) {
+				if (batch_worker) {
+					break;
+				}
 				continue;
+			}
+		}
+
+		if (!batch_worker) {
+			batch_worker = w;
+			vine_manager_begin_task_batch(q, w);
 		}
 
 		// Otherwise, remove it from the ready list and start it:
 		list_pop_tail(q->ready_list);
 		commit_task_to_worker(q, w, t);
-		return 1;
+		tasks_sent++;
+
+		// The worker was removed if sending the inputs of the task failed.
+		if (!q->task_batch_worker || tasks_sent >= VINE_TASK_BATCH_MAX) {
+			break;
+		}
 	}
 
-	// if we made it here we reached the end of the list
-	return 0;
+	if (q->task_batch_worker) {
+		w = q->task_batch_worker;
+		if (vine_manager_end_task_batch(q) != VINE_SUCCESS) {
+			debug(D_VINE, "Failed to send tasks to worker %s (%s).", w->hostname, w->addrport);
+			handle_worker_failure(q, w);
+		}
+	}
+
+	return tasks_sent;
 }
 
 static int prune_worker(struct vine_manager *q, struct vine_worker_info *w)
@@ -3085,84 +3222,101 @@ static int prune_worker(struct vine_manager *q, struct vine_worker_info *w)
 }
 
 /*
-Finding a worker that has tasks waiting to be retrieved, then fetch the outputs
-of those tasks. Returns the number of tasks received.
+Ask the workers with available results for the tasks they have completed,
+and start retrieving the outputs of those tasks. Workers still sending
+back outputs, or still receiving inputs, are asked again once they are done.
 */
-static int receive_tasks_from_worker(struct vine_manager *q, struct vine_worker_info *w, int count_received_so_far)
-{
-	struct vine_task *t;
-	uint64_t task_id;
-
-	int tasks_received = 0;
 
-	/* if the function was called, receive at least one task */
-	int max_to_receive = MAX(1, q->max_retrievals - count_received_so_far);
+static void start_retrievals(struct vine_manager *q)
+{
+	char *key;
+	struct vine_worker_info *w;
 
-	/* if appropriate, receive all the tasks from the worker */
-	if (q->worker_retrievals) {
-		max_to_receive = itable_size(w->current_tasks);
-	}
+	while (1) {
+		struct vine_worker_info *ready = 0;
+		HASH_TABLE_ITERATE(q->workers_with_available_results, key, w)
+		{
+			if (!vine_manager_get_outputs_busy(w) && !vine_manager_put_busy(w)) {
+				ready = w;
+				break;
+			}
+		}
 
-	/* get available results from the worker, bail out if that also fails. */
-	vine_result_code_t r = get_available_results(q, w);
-	if (r != VINE_SUCCESS) {
-		handle_worker_failure(q, w);
-		return 0;
-	}
+		if (!ready) {
+			break;
+		}
 
-	/* Reset the available results table now that the worker is removed */
-	hash_table_remove(q->workers_with_available_results, w->hashkey);
-	hash_table_firstkey(q->workers_with_available_results);
+		w = ready;
+		hash_table_remove(q->workers_with_available_results, w->hashkey);
 
-	/* Now consider all tasks assigned to that worker .*/
-	ITABLE_ITERATE(w->current_tasks, task_id, t)
-	{
-		/* If the task is waiting to be retrieved... */
-		if (t->state == VINE_TASK_WAITING_RETRIEVAL) {
-			/* Attempt to fetch it. */
-			if (fetch_output_from_worker(q, w, task_id)) {
-				/* If it was fetched, update stats and keep going. */
-				compute_manager_load(q, 1);
-				tasks_received++;
+		/* get available results from the worker, bail out if that also fails. */
+		vine_result_code_t r = get_available_results(q, w);
+		if (r != VINE_SUCCESS) {
+			handle_worker_failure(q, w);
+			continue;
+		}
 
-				if (tasks_received >= max_to_receive) {
-					break;
-				}
-			} else {
-				/* But if the fetch failed, the worker is no longer vaild, bail out. */
-				return tasks_received;
+		struct vine_task *t;
+		uint64_t task_id;
+		ITABLE_ITERATE(w->current_tasks, task_id, t)
+		{
+			if (t->state == VINE_TASK_WAITING_RETRIEVAL) {
+				vine_manager_get_outputs_queue(q, w, t);
 			}
 		}
-	}
 
-	prune_worker(q, w);
-
-	return tasks_received;
+		hash_table_insert(q->workers_retrieving, w->hashkey, w);
+	}
 }
 
 /*
-Advance the state of the system by finding any task that is
-waiting to be retrieved, then fetch the outputs of that task,
-and mark it as done.
+Complete the tasks whose outputs have been received, up to q->max_retrievals
+unless q->worker_retrievals is set, and remove the workers that stopped
+sending back outputs for too long. Returns the number of tasks received.
 */
 
-static int receive_one_task(struct vine_manager *q)
+static int collect_retrievals(struct vine_manager *q)
 {
+	char *key;
+	struct vine_worker_info *w;
 	struct vine_task *t;
+	vine_result_code_t result;
 
-	if ((t = list_peek_head(q->waiting_retrieval_list))) {
-		struct vine_worker_info *w = t->worker;
-		/* Attempt to fetch from this worker. */
-		if (fetch_output_from_worker(q, w, t->task_id)) {
-			/* If we got one, then we are done. */
+	int received = 0;
+	int max_to_receive = (q->max_retrievals > 0 && !q->worker_retrievals) ? q->max_retrievals : INT_MAX;
+
+	while (received < max_to_receive) {
+		struct vine_worker_info *found = 0;
+		t = 0;
+		HASH_TABLE_ITERATE(q->workers_retrieving, key, w)
+		{
+			t = vine_manager_get_outputs_next(w, &result);
+			if (t || !vine_manager_get_outputs_pending(w) || vine_manager_get_outputs_expired(w)) {
+				found = w;
+				break;
+			}
+		}
+
+		if (!found) {
+			break;
+		}
+
+		w = found;
+		if (t) {
+			if (finish_output_retrieval(q, w, t, result)) {
+				received++;
+				compute_manager_load(q, 1);
+			}
+		} else if (!vine_manager_get_outputs_pending(w)) {
+			hash_table_remove(q->workers_retrieving, w->hashkey);
 			prune_worker(q, w);
-			return 1;
 		} else {
-			/* But if not, the worker pointer is no longer valid. */
+			debug(D_VINE, "Timed out receiving output from worker %s (%s).", w->hostname, w->addrport);
+			handle_worker_failure(q, w);
 		}
 	}
 
-	return 0;
+	return received;
 }
 
 /*
@@ -3178,6 +3332,11 @@ static void ask_for_workers_updates(struct vine_manager *q)
 
 	HASH_TABLE_ITERATE(q->worker_table, key, w)
 	{
+		if (vine_manager_put_expired(w)) {
+			debug(D_VINE, "Removing worker %s (%s): timed out receiving data.", w->hostname, w->addrport);
+			handle_worker_failure(q, w);
+			continue;
+		}
 
 		if (q->keepalive_interval > 0) {
 
@@ -3510,6 +3669,15 @@ struct vine_manager *vine_ssl_create(int port, const char *key, const char *cert
 
 	q->runtime_directory = runtime_dir;
 
+	char *checksum_cache = getenv("VINE_CHECKSUM_CACHE");
+	if (checksum_cache) {
+		vine_checksum_cache_load(checksum_cache);
+	} else {
+		checksum_cache = vine_get_runtime_path_caching(q, "checksums");
+		vine_checksum_cache_load(checksum_cache);
+		free(checksum_cache);
+	}
+
 	q->ssl_key = key ? strdup(key) : 0;
 	q->ssl_cert = cert ? strdup(cert) : 0;
 
@@ -3521,6 +3689,10 @@ struct vine_manager *vine_ssl_create(int port, const char *key, const char *cert
 	q->next_task_id = 1;
 
 	q->ready_list = list_create();
+	q->unfit_shapes = list_create();
+	q->task_batch = malloc(sizeof(*q->task_batch));
+	buffer_init(q->task_batch);
+	buffer_abortonfailure(q->task_batch, 1);
 	q->running_table = itable_create(0);
 	q->waiting_retrieval_list = list_create();
 	q->retrieved_list = list_create();
@@ -3529,9 +3701,11 @@ struct vine_manager *vine_ssl_create(int port, const char *key, const char *cert
 	q->libraries = hash_table_create(0, 0);
 
 	q->worker_table = hash_table_create(0, 0);
+	vine_worker_index_create(q);
 	q->worker_blocklist = hash_table_create(0, 0);
 
 	q->file_table = hash_table_create(0, 0);
+	q->file_worker_table = hash_table_create(0, 0);
 
 	q->factory_table = hash_table_create(0, 0);
 	q->current_transfer_table = hash_table_create(0, 0);
@@ -3546,9 +3720,15 @@ struct vine_manager *vine_ssl_create(int port, const char *key, const char *cert
 	q->stats_measure = calloc(1, sizeof(struct vine_stats));
 
 	q->workers_with_available_results = hash_table_create(0, 0);
+	q->workers_retrieving = hash_table_create(0, 0);
+
+	// The manager link is polled together with the links of the workers,
+	// which are added and removed as workers connect and disconnect.
+	q->poll_set = link_set_create();
+	link_set_add(q->poll_set, q->manager_link, LINK_READ);
 
 	// The poll table is initially null, and will be created
-	// (and resized) as needed by build_poll_table.
+	// (and resized) as needed by resize_poll_table.
 	q->poll_table_size = 8;
 
 	q->worker_selection_algorithm = VINE_SCHEDULE_FILES;
@@ -3787,6 +3967,8 @@ void vine_delete(struct vine_manager *q)
 
 	release_all_workers(q);
 
+	vine_checksum_cache_save();
+
 	vine_perf_log_write_update(q, 1);
 
 	if (q->name)
@@ -3798,9 +3980,13 @@ void vine_delete(struct vine_manager *q)
 	if (q->catalog_hosts)
 		free(q->catalog_hosts);
 
+	vine_worker_index_delete(q);
 	hash_table_clear(q->worker_table, (void *)vine_worker_delete);
 	hash_table_delete(q->worker_table);
 
+	vine_file_replica_table_clear(q);
+	hash_table_delete(q->file_worker_table);
+
 	hash_table_clear(q->factory_table, (void *)vine_factory_info_delete);
 	hash_table_delete(q->factory_table);
 
@@ -3822,11 +4008,16 @@ void vine_delete(struct vine_manager *q)
 	hash_table_delete(q->categories);
 
 	list_delete(q->ready_list);
+	vine_task_shape_clear(q);
+	list_delete(q->unfit_shapes);
+	buffer_free(q->task_batch);
+	free(q->task_batch);
 	itable_delete(q->running_table);
 	list_delete(q->waiting_retrieval_list);
 	list_delete(q->retrieved_list);
 	hash_table_delete(q->libraries);
 	hash_table_delete(q->workers_with_available_results);
+	hash_table_delete(q->workers_retrieving);
 
 	list_clear(q->task_info_list, (void *)vine_task_info_delete);
 	list_delete(q->task_info_list);
@@ -3841,6 +4032,7 @@ void vine_delete(struct vine_manager *q)
 	free(q->name);
 	free(q->manager_preferred_connection);
 
+	link_set_delete(q->poll_set);
 	free(q->poll_table);
 	free(q->ssl_cert);
 	free(q->ssl_key);
@@ -4229,6 +4421,7 @@ static int vine_manager_send_library_to_worker(struct vine_manager *q, struct vi
 	struct vine_task *t = vine_task_copy(original);
 
 	/* Check if this library task can fit in this worker. */
+	vine_schedule_prepare_task(q, t);
 	if (!check_worker_against_task(q, w, t)) {
 		vine_task_delete(t);
 		return 0;
@@ -4437,8 +4630,7 @@ static int poll_active_workers(struct vine_manager *q, int stoptime)
 {
 	BEGIN_ACCUM_TIME(q, time_polling);
 
-	int n = build_poll_table(q);
-	debug(D_VINE, "Jin: n is %d", n);
+	resize_poll_table(q);
 
 	// We poll in at most small time segments (of a second). This lets
 	// promptly dispatch tasks, while avoiding busy waiting.
@@ -4455,19 +4647,28 @@ static int poll_active_workers(struct vine_manager *q, int stoptime)
 
 	BEGIN_ACCUM_TIME(q, time_polling);
 
-	// Poll all links for activity.
-	link_poll(q->poll_table, n, msec);
+	// Poll all links for activity, and only consider the ones that are ready.
+	int n = link_set_wait(q->poll_set, q->poll_table, q->poll_table_size, msec);
 	q->link_poll_end = timestamp_get();
 
 	END_ACCUM_TIME(q, time_polling);
 
 	BEGIN_ACCUM_TIME(q, time_status_msgs);
 
-	int i, j = 1;
+	int i;
 	int workers_failed = 0;
-	// Then consider all existing active workers
-	for (i = j; i < n; i++) {
-		if (q->poll_table[i].revents) {
+	for (i = 0; i < n; i++) {
+		// New connections on the manager link are accepted by connect_new_workers.
+		if (q->poll_table[i].link == q->manager_link) {
+			continue;
+		}
+		if (q->poll_table[i].revents & LINK_WRITE) {
+			if (handle_worker_upload(q, q->poll_table[i].link) == VINE_WORKER_FAILURE) {
+				workers_failed++;
+				continue;
+			}
+		}
+		if (q->poll_table[i].revents & LINK_READ) {
 			if (handle_worker(q, q->poll_table[i].link) == VINE_WORKER_FAILURE) {
 				workers_failed++;
 			}
@@ -4483,10 +4684,8 @@ static int connect_new_workers(struct vine_manager *q, int stoptime, int max_new
 {
 	int new_workers = 0;
 
-	// If the manager link was awake, then accept at most max_new_workers.
-	// Note we are using the information gathered in poll_active_workers, which
-	// is a little ugly.
-	if (q->poll_table[0].revents) {
+	// If the manager link is awake, then accept at most max_new_workers.
+	if (link_usleep(q->manager_link, 0, 1, 0)) {
 		do {
 			add_worker(q);
 			new_workers++;
@@ -4605,42 +4804,14 @@ static struct vine_task *vine_wait_internal(struct vine_manager *q, int timeout,
 		q->busy_waiting_flag = 0;
 
 		// retrieve results from workers
-		// if worker_retrievals, then all the tasks from a worker
-		// are retrieved. (this is the default)
-		// otherwise, retrieve at most q->max_retrievals (default is 1)
-		int received = 0;
-		int no_ready_tasks = list_size(q->ready_list);
+		// the outputs of completed tasks are requested from all workers with
+		// results, and received as they arrive when polling the workers.
+		// if worker_retrievals, then all the tasks with their outputs received
+		// are completed. (this is the default)
+		// otherwise, complete at most q->max_retrievals (default is 1)
 		BEGIN_ACCUM_TIME(q, time_receive);
-		do {
-			int received_at_least_one = 0;
-			char *key;
-			struct vine_worker_info *w;
-
-			HASH_TABLE_ITERATE(q->workers_with_available_results, key, w)
-			{
-				received += receive_tasks_from_worker(q, w, received);
-				events += received;
-				compute_manager_load(q, 1);
-				received_at_least_one = 1;
-				break; // do one worker at a time
-			}
-
-			// tasks waiting to be retrieved?
-			if (!received_at_least_one) {
-				if (receive_one_task(q)) {
-					// retrieved at least one task
-					received++;
-					events++;
-					compute_manager_load(q, 1);
-					received_at_least_one = 1;
-				} else {
-					// didn't received a task this cycle, thus there are no
-					// task to be received
-					break;
-				}
-			}
-
-		} while (q->max_retrievals < 0 || received < q->max_retrievals || no_ready_tasks);
+		start_retrievals(q);
+		events += collect_retrievals(q);
 		END_ACCUM_TIME(q, time_receive);
 
 		// expired tasks
@@ -4665,7 +4836,7 @@ static struct vine_task *vine_wait_internal(struct vine_manager *q, int timeout,
 			}
 			// tasks waiting to be dispatched?
 			BEGIN_ACCUM_TIME(q, time_send);
-			result = send_one_task(q);
+			result = send_tasks(q);
 			END_ACCUM_TIME(q, time_send);
 			if (result) {
 				// sent at least one task
@@ -4873,6 +5044,9 @@ int vine_set_draining_by_hostname(struct vine_manager *q, const char *hostname,
 	HASH_TABLE_ITERATE(q->worker_table, worker_hashkey, w)
 	{
 		if (!strcmp(w->hostname, hostname)) {
+			if (w->draining && !drain_flag) {
+				q->worker_capacity_epoch++;
+			}
 			w->draining = drain_flag;
 			workers_updated++;
 		}
@@ -5019,6 +5193,8 @@ int vine_tune(struct vine_manager *q, const char *name, double value)
 
 	if (!strcmp(name, "resource-submit-multiplier") || !strcmp(name, "asynchrony-multiplier")) {
 		q->resource_submit_multiplier = MAX(value, 1.0);
+		vine_worker_index_rebuild(q);
+		q->worker_capacity_epoch++;
 
 	} else if (!strcmp(name, "min-transfer-timeout")) {
 		q->minimum_transfer_timeout = (int)value;
@@ -5392,18 +5568,21 @@ void vine_set_category_resources_max(struct vine_manager *q, const char *categor
 {
 	struct category *c = vine_category_lookup_or_create(q, category);
 	category_specify_max_allocation(c, rm);
+	q->worker_capacity_epoch++;
 }
 
 void vine_set_category_resources_min(struct vine_manager *q, const char *category, const struct rmsummary *rm)
 {
 	struct category *c = vine_category_lookup_or_create(q, category);
 	category_specify_min_allocation(c, rm);
+	q->worker_capacity_epoch++;
 }
 
 void vine_set_category_first_allocation_guess(struct vine_manager *q, const char *category, const struct rmsummary *rm)
 {
 	struct category *c = vine_category_lookup_or_create(q, category);
 	category_specify_first_allocation_guess(c, rm);
+	q->worker_capacity_epoch++;
 }
 
 int vine_set_category_mode(struct vine_manager *q, const char *category, vine_category_mode_t mode)
@@ -5428,6 +5607,7 @@ int vine_set_category_mode(struct vine_manager *q, const char *category, vine_ca
 	} else {
 		struct category *c = vine_category_lookup_or_create(q, category);
 		category_specify_allocation_mode(c, (category_mode_t)mode);
+		q->worker_capacity_epoch++;
 		vine_txn_log_write_category(q, c);
 	}
 
@@ -5687,8 +5867,16 @@ const char *vine_fetch_file(struct vine_manager *m, struct vine_file *f)
 		/* If the file has been materialized remotely, go get it from a worker. */
 		{
 			struct vine_worker_info *w = vine_file_replica_table_find_worker(m, f->cached_name);
-			if (w)
-				vine_manager_get_single_file(m, w, f);
+			if (w) {
+				/* The reply would be mixed with the outputs being sent back,
+				   or delayed by the inputs being sent. */
+				if (vine_manager_get_outputs_drain(m, w) == VINE_SUCCESS &&
+						vine_manager_put_drain(m, w) == VINE_SUCCESS) {
+					vine_manager_get_single_file(m, w, f);
+				} else {
+					handle_worker_failure(m, w);
+				}
+			}
 			/* If that succeeded, then f->data is now set, null otherwise. */
 			return f->data;
 		}
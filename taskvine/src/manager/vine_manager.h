@@ -71,6 +71,8 @@ typedef enum {
 } vine_library_state_t;
 
 struct vine_worker_info;
+struct vine_resource_box;
+struct category;
 struct vine_task;
 struct vine_file;
 
@@ -86,7 +88,8 @@ struct vine_manager {
 	char  workingdir[PATH_MAX];         /* Current working dir, for reporting to the catalog server. */
 
 	struct link *manager_link;       /* Listening TCP connection for accepting new workers. */
-	struct link_info *poll_table;    /* Table for polling on all connected workers. */
+	struct link_set *poll_set;       /* Set of the manager link and the links of all connected workers. */
+	struct link_info *poll_table;    /* Links found ready by the last poll of poll_set. */
 	int poll_table_size;             /* Number of entries in poll_table. */
 
 	/* Security configuration */
@@ -110,14 +113,17 @@ struct vine_manager {
 	/* Primary data structures for tracking worker state. */
 
 	struct hash_table *worker_table;     /* Maps link -> vine_worker_info */
+	struct hash_table **worker_index;    /* Workers bucketed by free cores, see vine_worker_index.h */
 	struct hash_table *worker_blocklist; /* Maps hostname -> vine_blocklist_info */
 	struct hash_table *factory_table;    /* Maps factory_name -> vine_factory_info */
 	struct hash_table *workers_with_available_results;  /* Maps link -> vine_worker_info */
+	struct hash_table *workers_retrieving; /* Maps link -> vine_worker_info bringing back outputs of completed tasks. */
 	struct hash_table *current_transfer_table; 	/* Maps uuid -> struct transfer_pair */
 
 	/* Primary data structures for tracking files. */
 
     	struct hash_table *file_table;      /* Maps fileid -> struct vine_file.* */
+	struct hash_table *file_worker_table; /* Maps cachename -> struct set of workers holding a replica. */
 
 	/* Primary scheduling controls. */
 
@@ -129,6 +135,16 @@ struct vine_manager {
 	int next_task_id;       /* Next integer task_id to be assigned to a created task. */
 	int num_tasks_left;    /* Optional: Number of tasks remaining, if given by user.  @ref vine_set_num_tasks */
 	int busy_waiting_flag; /* Set internally in main loop if no messages were processed -> wait longer. */
+	int64_t worker_eligibility_epoch; /* Incremented when blocklist or factories change, to invalidate cached worker eligibility. */
+	int64_t worker_capacity_epoch;    /* Incremented when worker resources may have grown, or the allocations of a category change. */
+
+	struct list *unfit_shapes;                  /* Shapes of ready tasks that do not fit any worker, see vine_task_shape.h */
+	int64_t unfit_shapes_capacity_epoch;        /* worker_capacity_epoch when unfit_shapes was last valid. */
+	int64_t unfit_shapes_eligibility_epoch;     /* worker_eligibility_epoch when unfit_shapes was last valid. */
+
+	struct buffer *task_batch;                  /* Descriptions of tasks to be sent together, see vine_manager_put.h */
+	int task_batch_size;                        /* Number of tasks in task_batch. */
+	struct vine_worker_info *task_batch_worker; /* Worker to which task_batch is sent, or null if no batch is open. */
 
 	/* Accumulation of statistics for reporting to the caller. */
 
@@ -210,6 +226,9 @@ int vine_manager_send( struct vine_manager *q, struct vine_worker_info *w, const
 /* Receive a line-oriented message from a remote worker. */
 vine_msg_code_t vine_manager_recv( struct vine_manager *q, struct vine_worker_info *w, char *line, int length );
 
+/* Receive a single line, which may be an asynchronous update already processed. */
+vine_msg_code_t vine_manager_recv_no_retry( struct vine_manager *q, struct vine_worker_info *w, char *line, size_t length );
+
 /* Compute the expected wait time for a transfer of length bytes. */
 int vine_manager_transfer_time( struct vine_manager *q, struct vine_worker_info *w, int64_t length );
 
@@ -217,6 +236,9 @@ int vine_manager_transfer_time( struct vine_manager *q, struct vine_worker_info
 const struct rmsummary *vine_manager_task_resources_min(struct vine_manager *q, struct vine_task *t);
 const struct rmsummary *vine_manager_task_resources_max(struct vine_manager *q, struct vine_task *t);
 
+/* Internal: Find the category of a given name, creating it if needed. */
+struct category *vine_category_lookup_or_create(struct vine_manager *q, const char *name);
+
 /* Internal: Find a library task running on a specific worker by name. */
 struct vine_task *vine_manager_find_library_on_worker( struct vine_manager *q, struct vine_worker_info *w, const char *library_name);
 
@@ -225,6 +247,11 @@ void vine_manager_enable_process_shortcut(struct vine_manager *q);
 
 struct rmsummary *vine_manager_choose_resources_for_task( struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t );
 
+/* Internal: Compute the cores, memory, disk, and gpus to allocate to a task at a worker, without allocating memory. */
+void vine_manager_choose_resource_box( struct vine_manager *q, struct vine_worker_info *w, const struct vine_resource_box *min, const struct vine_resource_box *max, struct vine_resource_box *box );
+
+void vine_resource_box_from_rmsummary( struct vine_resource_box *box, const struct rmsummary *s );
+
 int64_t overcommitted_resource_total(struct vine_manager *q, int64_t total);
 
 
@@ -15,23 +15,23 @@ See the file COPYING for details.
 
 #include "create_dir.h"
 #include "debug.h"
+#include "full_io.h"
 #include "host_disk_info.h"
+#include "itable.h"
 #include "link.h"
+#include "list.h"
+#include "macros.h"
 #include "path.h"
 #include "rmsummary.h"
 #include "stringtools.h"
 #include "timestamp.h"
 #include "url_encode.h"
+#include "xxmalloc.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 
-static vine_result_code_t vine_manager_get_symlink_contents(struct vine_manager *q, struct vine_worker_info *w,
-		struct vine_task *t, const char *filename, int length);
-static vine_result_code_t vine_manager_get_dir_contents(struct vine_manager *q, struct vine_worker_info *w,
-		struct vine_task *t, const char *dirname, int64_t *totalsize);
-
 /*
 Get an output file from the task and return it as a buffer in memory.
 The buffer is attached to the f->data element and can then be retrieved
@@ -101,409 +101,795 @@ static vine_result_code_t vine_manager_get_buffer(struct vine_manager *q, struct
 }
 
 /*
-Receive the contents of a single file from a worker.
-The "file" header has already been received, just
-bring back the streaming data within various constraints.
+Get a single output file from a worker, independently of any task.
 */
 
-static vine_result_code_t vine_manager_get_file_contents(struct vine_manager *q, struct vine_worker_info *w,
-		struct vine_task *t, const char *local_name, int64_t length, int mode)
+vine_result_code_t vine_manager_get_single_file(struct vine_manager *q, struct vine_worker_info *w, struct vine_file *f)
 {
-	// If a bandwidth limit is in effect, choose the effective stoptime.
-	timestamp_t effective_stoptime = 0;
-	if (q->bandwidth_limit) {
-		effective_stoptime = (length / q->bandwidth_limit) * 1000000 + timestamp_get();
-	}
-
-	// Choose the actual stoptime.
-	time_t stoptime = time(0) + vine_manager_transfer_time(q, w, length);
+	int64_t total_bytes;
+	vine_manager_send(q, w, "getfile %s\n", f->cached_name);
+	return vine_manager_get_buffer(q, w, 0, f, &total_bytes);
+}
 
-	// If necessary, create parent directories of the file.
-	char dirname[VINE_LINE_MAX];
-	path_dirname(local_name, dirname);
-	if (strchr(local_name, '/')) {
-		if (!create_dir(dirname, 0777)) {
-			debug(D_VINE, "Could not create directory - %s (%s)", dirname, strerror(errno));
-			link_soak(w->link, length, stoptime);
-			return VINE_MGR_FAILURE;
-		}
-	}
+/*
+Account for the transfer of an output file once it has been received,
+and record the result in the task and in the replica table.
+*/
 
-	// Create the local file.
-	debug(D_VINE,
-			"Receiving file %s (size: %" PRId64 " bytes) from %s (%s) ...",
-			local_name,
-			length,
-			w->addrport,
-			w->hostname);
+static vine_result_code_t vine_manager_get_output_file_done(struct vine_manager *q, struct vine_worker_info *w,
+		struct vine_task *t, struct vine_mount *m, struct vine_file *f, vine_result_code_t result,
+		int64_t total_bytes, timestamp_t open_time)
+{
+	timestamp_t close_time = timestamp_get();
+	timestamp_t sum_time = close_time - open_time;
 
-	// Check if there is space for incoming file at manager
-	if (!check_disk_space_for_filesize(dirname, length, q->disk_avail_threshold)) {
-		debug(D_VINE,
-				"Could not receive file %s, not enough disk space (%" PRId64 " bytes needed)\n",
-				local_name,
-				length);
-		return VINE_MGR_FAILURE;
-	}
+	if (total_bytes > 0) {
+		q->stats->bytes_received += total_bytes;
 
-	int fd = open(local_name, O_WRONLY | O_TRUNC | O_CREAT, 0777);
-	if (fd < 0) {
-		debug(D_NOTICE, "Cannot open file %s for writing: %s", local_name, strerror(errno));
-		link_soak(w->link, length, stoptime);
-		return VINE_MGR_FAILURE;
-	}
+		t->bytes_received += total_bytes;
+		t->bytes_transferred += total_bytes;
 
-	// Write the data on the link to file.
-	int64_t actual = link_stream_to_fd(w->link, fd, length, stoptime);
+		w->total_bytes_transferred += total_bytes;
+		w->total_transfer_time += sum_time;
 
-	fchmod(fd, mode);
+		debug(D_VINE,
+				"%s (%s) sent %.2lf MB in %.02lfs (%.02lfs MB/s) average %.02lfs MB/s",
+				w->hostname,
+				w->addrport,
+				total_bytes / 1000000.0,
+				sum_time / 1000000.0,
+				(double)total_bytes / sum_time,
+				(double)w->total_bytes_transferred / w->total_transfer_time);
 
-	if (close(fd) < 0) {
-		warn(D_VINE, "Could not write file %s: %s\n", local_name, strerror(errno));
-		unlink(local_name);
-		return VINE_MGR_FAILURE;
+		vine_txn_log_write_transfer(q, w, t, m, f, total_bytes, sum_time, open_time, 0);
 	}
 
-	if (actual != length) {
+	// If we failed to *transfer* the output file, then that is a hard
+	// failure which causes this function to return failure and the task
+	// to be returned to the queue to be attempted elsewhere.
+	// But if we failed to *store* the file, that is a manager failure.
+
+	if (result != VINE_SUCCESS) {
 		debug(D_VINE,
-				"Received item size (%" PRId64 ") does not match the expected size - %" PRId64
-				" bytes.",
-				actual,
-				length);
-		unlink(local_name);
-		return VINE_WORKER_FAILURE;
+				"%s (%s) failed to return output %s to %s",
+				w->addrport,
+				w->hostname,
+				f->cached_name,
+				f->source);
+
+		if (result == VINE_APP_FAILURE) {
+			vine_task_set_result(t, VINE_RESULT_OUTPUT_MISSING);
+		} else if (result == VINE_MGR_FAILURE) {
+			vine_task_set_result(t, VINE_RESULT_OUTPUT_TRANSFER_ERROR);
+		}
 	}
 
-	// If the transfer was too fast, slow things down.
-	timestamp_t current_time = timestamp_get();
-	if (effective_stoptime && effective_stoptime > current_time) {
-		usleep(effective_stoptime - current_time);
+	// If the transfer was successful, make a record of it in the cache.
+	if (result == VINE_SUCCESS && m->flags & VINE_CACHE) {
+		struct stat local_info;
+		if (stat(f->source, &local_info) == 0) {
+			struct vine_file_replica *remote_info =
+					vine_file_replica_create(local_info.st_size, local_info.st_mtime);
+			vine_file_replica_table_insert(q, w, f->cached_name, remote_info);
+		} else {
+			debug(D_NOTICE, "Cannot stat file %s: %s", f->source, strerror(errno));
+		}
 	}
 
-	return VINE_SUCCESS;
+	return result;
 }
 
+
 /*
-Get the contents of a symlink back from the worker,
-after the "symlink" header has already been received.
+Return true if the given output of a task should be brought back,
+given the outcome of the task.
 */
 
-static vine_result_code_t vine_manager_get_symlink_contents(struct vine_manager *q, struct vine_worker_info *w,
-		struct vine_task *t, const char *filename, int length)
+static int vine_manager_get_output_wanted(struct vine_task *t, struct vine_mount *m)
 {
-	char *target = malloc(length);
+	// non-file objects are handled by the worker.
+	if (m->file->type != VINE_FILE && m->file->type != VINE_BUFFER)
+		return 0;
 
-	int actual = link_read(w->link, target, length, time(0) + q->short_timeout);
-	if (actual != length) {
-		free(target);
-		return VINE_WORKER_FAILURE;
+	int task_succeeded = (t->result == VINE_RESULT_SUCCESS && t->exit_code == 0);
+
+	// skip failure-only files on success
+	if (m->flags & VINE_FAILURE_ONLY && task_succeeded)
+		return 0;
+
+	// skip success-only files on failure
+	if (m->flags & VINE_SUCCESS_ONLY && !task_succeeded)
+		return 0;
+
+	return 1;
+}
+
+/* A task whose outputs are being brought back. */
+
+struct vine_get_task {
+	struct vine_task *t;  /* Null if the task was forgotten, and its outputs are discarded. */
+	struct list *mounts;  /* Outputs not yet requested. */
+	int requests;         /* Requests sent and not yet completed. */
+	vine_result_code_t result;
+};
+
+/* An output requested with "get" or "getfile", in the order of the replies. */
+
+struct vine_get_request {
+	struct vine_get_task *task;
+	struct vine_mount *m; /* Null if the task was forgotten. */
+	int is_buffer;
+	int64_t total_bytes;
+	timestamp_t open_time;
+	vine_result_code_t result;
+};
+
+typedef enum {
+	VINE_GET_HEADER = 0, /* Waiting for the header of the next item. */
+	VINE_GET_FILE,       /* Writing the contents of a file to fd. */
+	VINE_GET_SYMLINK,    /* Reading the target of a symlink into data. */
+	VINE_GET_BUFFER,     /* Reading the contents of a buffer into data. */
+} vine_get_state_t;
+
+struct vine_retrieval {
+	struct list *tasks;        /* Tasks with outputs not yet requested, in order. */
+	struct itable *task_table; /* Maps task_id -> vine_get_task of every task not yet taken. */
+	struct list *requests;     /* Requests sent, the head is the one being received. */
+	struct list *completed;    /* Tasks with all outputs received. */
+
+	/* Item being received for the request at the head of requests. */
+	vine_get_state_t state;
+	struct list *dirs; /* Stack of the local names of the enclosing directories. */
+	char *path;
+	int fd;
+	int mode;
+	char *data;
+	int64_t length;
+	int64_t offset;
+	time_t stoptime;
+	timestamp_t effective_stoptime;
+};
+
+static struct vine_retrieval *vine_retrieval_create()
+{
+	struct vine_retrieval *r = calloc(1, sizeof(*r));
+	r->tasks = list_create();
+	r->task_table = itable_create(0);
+	r->requests = list_create();
+	r->completed = list_create();
+	r->dirs = list_create();
+	r->fd = -1;
+	return r;
+}
+
+static void vine_get_task_delete(struct vine_get_task *gt)
+{
+	list_delete(gt->mounts);
+	free(gt);
+}
+
+/* Forget about the item being received, deleting any partial file. */
+
+static void clear_item(struct vine_retrieval *r)
+{
+	if (r->fd >= 0) {
+		close(r->fd);
+		unlink(r->path);
+		r->fd = -1;
 	}
+	free(r->path);
+	r->path = 0;
+	free(r->data);
+	r->data = 0;
+	r->state = VINE_GET_HEADER;
+}
+
+void vine_manager_get_outputs_delete(struct vine_worker_info *w)
+{
+	struct vine_retrieval *r = w->retrieval;
+	if (!r)
+		return;
+
+	clear_item(r);
 
-	int result = symlink(target, filename);
-	if (result < 0) {
-		debug(D_VINE, "could not create symlink %s: %s", filename, strerror(errno));
-		free(target);
-		return VINE_MGR_FAILURE;
+	struct vine_get_request *req;
+	while ((req = list_pop_head(r->requests))) {
+		struct vine_get_task *gt = req->task;
+		if (--gt->requests == 0 && !gt->t) {
+			vine_get_task_delete(gt);
+		}
+		free(req);
 	}
 
-	free(target);
+	struct vine_get_task *gt;
+	uint64_t task_id;
+	ITABLE_ITERATE(r->task_table, task_id, gt)
+	{
+		vine_get_task_delete(gt);
+	}
 
-	return VINE_SUCCESS;
+	list_delete(r->tasks);
+	itable_delete(r->task_table);
+	list_delete(r->requests);
+	list_delete(r->completed);
+	list_clear(r->dirs, free);
+	list_delete(r->dirs);
+	free(r);
+
+	w->retrieval = 0;
+}
+
+static void set_request_result(struct vine_get_request *req, vine_result_code_t result)
+{
+	if (req->result == VINE_SUCCESS) {
+		req->result = result;
+	}
+}
+
+/* Mark the request at the head of the queue as the one being received. */
+
+static void start_request(struct vine_manager *q, struct vine_retrieval *r)
+{
+	struct vine_get_request *req = list_peek_head(r->requests);
+	if (req) {
+		req->open_time = timestamp_get();
+		r->stoptime = time(0) + q->short_timeout;
+	}
 }
 
 /*
-Get a single item (file, dir, symlink, etc) back
-from the worker by observing the header and then
-pulling the appropriate data on the stream.
-Note that if forced_name is non-null, then the item
-is stored under that filename.  Otherwise, it is placed
-in the directory dirname with the filename given by the
-worker.  This allows this function to handle both the
-top-level case of renamed files as well as interior files
-within a directory.
+When all the outputs of a task have been received, tell the worker
+that the sandbox of the task is no longer needed, and make the task
+available to vine_manager_get_outputs_next.
 */
 
-static vine_result_code_t vine_manager_get_any(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t,
-		const char *dirname, const char *forced_name, int64_t *totalsize)
+static void check_task_done(struct vine_manager *q, struct vine_worker_info *w, struct vine_get_task *gt)
 {
-	char line[VINE_LINE_MAX];
-	char name_encoded[VINE_LINE_MAX];
-	char name[VINE_LINE_MAX];
-	int64_t size;
-	int mode;
-	int errornum;
+	if (gt->requests > 0 || list_size(gt->mounts) > 0)
+		return;
 
-	vine_result_code_t r = VINE_WORKER_FAILURE;
+	if (gt->t) {
+		vine_manager_send(q, w, "kill %d\n", gt->t->task_id);
+		list_push_tail(w->retrieval->completed, gt);
+	} else {
+		vine_get_task_delete(gt);
+	}
+}
 
-	vine_msg_code_t mcode = vine_manager_recv(q, w, line, sizeof(line));
-	if (mcode != VINE_MSG_NOT_PROCESSED)
-		return VINE_WORKER_FAILURE;
+/* Send requests for outputs of queued tasks, up to VINE_GET_MAX_REQUESTS outstanding. */
 
-	if (sscanf(line, "file %s %" SCNd64 " 0%o", name_encoded, &size, &mode) == 3) {
+static void send_requests(struct vine_manager *q, struct vine_worker_info *w)
+{
+	struct vine_retrieval *r = w->retrieval;
+	struct vine_get_task *gt;
+
+	while (list_size(r->requests) < VINE_GET_MAX_REQUESTS && (gt = list_peek_head(r->tasks))) {
+		struct vine_mount *m = list_pop_head(gt->mounts);
+		if (!m) {
+			list_pop_head(r->tasks);
+			check_task_done(q, w, gt);
+			continue;
+		}
 
-		url_decode(name_encoded, name, sizeof(name));
+		struct vine_file *f = m->file;
+		debug(D_VINE, "%s (%s) sending back %s to %s", w->hostname, w->addrport, f->cached_name, f->source);
 
-		char *subname;
-		if (forced_name) {
-			subname = strdup(forced_name);
+		struct vine_get_request *req = calloc(1, sizeof(*req));
+		req->task = gt;
+		req->m = m;
+		req->result = VINE_SUCCESS;
+
+		if (f->type == VINE_BUFFER) {
+			req->is_buffer = 1;
+			vine_manager_send(q, w, "getfile %s\n", f->cached_name);
 		} else {
-			subname = string_format("%s/%s", dirname, name);
+			vine_manager_send(q, w, "get %s\n", f->cached_name);
 		}
-		r = vine_manager_get_file_contents(q, w, t, subname, size, mode);
-		free(subname);
 
-		if (r == VINE_SUCCESS)
-			*totalsize += size;
+		gt->requests++;
+		list_push_tail(r->requests, req);
+		if (list_size(r->requests) == 1) {
+			start_request(q, r);
+		}
+	}
+}
 
-	} else if (sscanf(line, "symlink %s %" SCNd64, name_encoded, &size) == 2) {
+/* Complete the request at the head of the queue, once its last item has been received. */
 
-		url_decode(name_encoded, name, sizeof(name));
+static void finish_request(struct vine_manager *q, struct vine_worker_info *w)
+{
+	struct vine_retrieval *r = w->retrieval;
+	struct vine_get_request *req = list_pop_head(r->requests);
+	struct vine_get_task *gt = req->task;
 
-		char *subname;
-		if (forced_name) {
-			subname = strdup(forced_name);
-		} else {
-			subname = string_format("%s/%s", dirname, name);
-		}
-		r = vine_manager_get_symlink_contents(q, w, t, subname, size);
-		free(subname);
+	if (req->m) {
+		gt->result = vine_manager_get_output_file_done(
+				q, w, gt->t, req->m, req->m->file, req->result, req->total_bytes, req->open_time);
+	}
 
-		if (r == VINE_SUCCESS)
-			*totalsize += size;
+	gt->requests--;
+	free(req);
 
-	} else if (sscanf(line, "dir %s", name_encoded) == 1) {
+	start_request(q, r);
+	check_task_done(q, w, gt);
+}
 
-		url_decode(name_encoded, name, sizeof(name));
+/* An item was received: the request is complete unless the item is within a directory. */
+
+static void finish_item(struct vine_manager *q, struct vine_worker_info *w)
+{
+	struct vine_retrieval *r = w->retrieval;
 
-		char *subname;
-		if (forced_name) {
-			subname = strdup(forced_name);
+	free(r->path);
+	r->path = 0;
+	r->state = VINE_GET_HEADER;
+	r->stoptime = time(0) + q->short_timeout;
+
+	if (list_size(r->dirs) == 0) {
+		finish_request(q, w);
+	}
+}
+
+static void finish_file(struct vine_manager *q, struct vine_worker_info *w, struct vine_get_request *req)
+{
+	struct vine_retrieval *r = w->retrieval;
+
+	if (r->fd >= 0) {
+		fchmod(r->fd, r->mode);
+		if (close(r->fd) < 0) {
+			warn(D_VINE, "Could not write file %s: %s\n", r->path, strerror(errno));
+			unlink(r->path);
+			set_request_result(req, VINE_MGR_FAILURE);
 		} else {
-			subname = string_format("%s/%s", dirname, name);
+			req->total_bytes += r->length;
 		}
-		r = vine_manager_get_dir_contents(q, w, t, subname, totalsize);
-		free(subname);
+		r->fd = -1;
+	}
 
-	} else if (sscanf(line, "error %s %d", name_encoded, &errornum) == 2) {
+	// If the transfer was too fast, slow things down.
+	timestamp_t current_time = timestamp_get();
+	if (r->effective_stoptime && r->effective_stoptime > current_time) {
+		usleep(r->effective_stoptime - current_time);
+	}
 
-		// If the output file is missing, we make a note of that in the task result,
-		// but we continue and consider the transfer a 'success' so that other
-		// outputs are transferred and the task is given back to the caller.
-		url_decode(name_encoded, name, sizeof(name));
-		debug(D_VINE,
-				"%s (%s): could not access requested file %s (%s)",
-				w->hostname,
-				w->addrport,
-				name,
-				strerror(errornum));
-		vine_task_set_result(t, VINE_RESULT_OUTPUT_MISSING);
+	finish_item(q, w);
+}
 
-		r = VINE_SUCCESS;
+static void finish_symlink(struct vine_manager *q, struct vine_worker_info *w, struct vine_get_request *req)
+{
+	struct vine_retrieval *r = w->retrieval;
+
+	if (req->m) {
+		r->data[r->length] = 0;
+		if (symlink(r->data, r->path) < 0) {
+			debug(D_VINE, "could not create symlink %s: %s", r->path, strerror(errno));
+			set_request_result(req, VINE_MGR_FAILURE);
+		} else {
+			req->total_bytes += r->length;
+		}
+	}
 
-	} else if (!strcmp(line, "end")) {
-		r = VINE_END_OF_LIST;
+	free(r->data);
+	r->data = 0;
 
+	finish_item(q, w);
+}
+
+static void finish_buffer(struct vine_manager *q, struct vine_worker_info *w, struct vine_get_request *req)
+{
+	struct vine_retrieval *r = w->retrieval;
+
+	if (req->m && r->data) {
+		struct vine_file *f = req->m->file;
+		/* While not strictly necessary, add a null terminator to facilitate printing text data. */
+		r->data[r->length] = 0;
+		free(f->data);
+		f->data = r->data;
+		f->size = r->length;
+		req->total_bytes += r->length;
 	} else {
-		debug(D_VINE, "%s (%s): sent invalid response to get: %s", w->hostname, w->addrport, line);
-		r = VINE_WORKER_FAILURE;
+		free(r->data);
 	}
 
-	return r;
+	r->data = 0;
+
+	finish_item(q, w);
 }
 
-/*
-Retrieve the contents of a directory by creating the local
-dir, then receiving each item in the directory until an "end"
-header is received.
-*/
+static void finish_data(struct vine_manager *q, struct vine_worker_info *w, struct vine_get_request *req)
+{
+	switch (w->retrieval->state) {
+	case VINE_GET_FILE:
+		finish_file(q, w, req);
+		break;
+	case VINE_GET_SYMLINK:
+		finish_symlink(q, w, req);
+		break;
+	case VINE_GET_BUFFER:
+		finish_buffer(q, w, req);
+		break;
+	case VINE_GET_HEADER:
+		break;
+	}
+}
+
+/* Local name of an item: the source of the output itself, or an entry in the enclosing directory. */
 
-static vine_result_code_t vine_manager_get_dir_contents(struct vine_manager *q, struct vine_worker_info *w,
-		struct vine_task *t, const char *dirname, int64_t *totalsize)
+static char *item_path(struct vine_retrieval *r, struct vine_get_request *req, const char *name)
 {
-	int result = mkdir(dirname, 0777);
+	const char *dirname = list_peek_head(r->dirs);
+	if (dirname) {
+		return string_format("%s/%s", dirname, name);
+	} else if (req->m) {
+		return xxstrdup(req->m->file->source);
+	} else {
+		return xxstrdup(name);
+	}
+}
 
-	/* If the directory exists, no error, keep going. */
-	if (result < 0 && errno != EEXIST) {
-		debug(D_VINE, "unable to create %s: %s", dirname, strerror(errno));
-		return VINE_APP_FAILURE;
+static void start_file(struct vine_manager *q, struct vine_worker_info *w, struct vine_get_request *req,
+		char *path, int64_t length, int mode)
+{
+	struct vine_retrieval *r = w->retrieval;
+
+	r->state = VINE_GET_FILE;
+	r->path = path;
+	r->length = length;
+	r->offset = 0;
+	r->mode = mode;
+	r->fd = -1;
+	r->stoptime = time(0) + vine_manager_transfer_time(q, w, length);
+
+	// If a bandwidth limit is in effect, choose the effective stoptime.
+	r->effective_stoptime = 0;
+	if (q->bandwidth_limit) {
+		r->effective_stoptime = (length / q->bandwidth_limit) * 1000000 + timestamp_get();
 	}
 
-	while (1) {
-		int r = vine_manager_get_any(q, w, t, dirname, 0, totalsize);
-		if (r == VINE_SUCCESS) {
-			// Successfully received one item.
-			continue;
-		} else if (r == VINE_END_OF_LIST) {
-			// Sucessfully got end of sequence.
-			return VINE_SUCCESS;
-		} else {
-			// Failed to receive item.
-			return r;
-		}
+	// The contents of forgotten tasks are read and discarded.
+	if (!req->m)
+		return;
+
+	debug(D_VINE,
+			"Receiving file %s (size: %" PRId64 " bytes) from %s (%s) ...",
+			path,
+			length,
+			w->addrport,
+			w->hostname);
+
+	// If necessary, create parent directories of the file.
+	char dirname[VINE_LINE_MAX];
+	path_dirname(path, dirname);
+	if (strchr(path, '/') && !create_dir(dirname, 0777)) {
+		debug(D_VINE, "Could not create directory - %s (%s)", dirname, strerror(errno));
+		set_request_result(req, VINE_MGR_FAILURE);
+		return;
 	}
-}
 
-/*
-Get a single output file from a worker, independently of any task.
-*/
+	// Check if there is space for incoming file at manager
+	if (!check_disk_space_for_filesize(dirname, length, q->disk_avail_threshold)) {
+		debug(D_VINE, "Could not receive file %s, not enough disk space (%" PRId64 " bytes needed)\n", path, length);
+		set_request_result(req, VINE_MGR_FAILURE);
+		return;
+	}
 
-vine_result_code_t vine_manager_get_single_file(struct vine_manager *q, struct vine_worker_info *w, struct vine_file *f)
-{
-	int64_t total_bytes;
-	vine_manager_send(q, w, "getfile %s\n", f->cached_name);
-	return vine_manager_get_buffer(q, w, 0, f, &total_bytes);
+	r->fd = open(path, O_WRONLY | O_TRUNC | O_CREAT, 0777);
+	if (r->fd < 0) {
+		debug(D_NOTICE, "Cannot open file %s for writing: %s", path, strerror(errno));
+		set_request_result(req, VINE_MGR_FAILURE);
+	}
 }
 
 /*
-Get a single output file, located at the worker under 'cached_name'.
+Interpret the header of the next item of the reply to the request at
+the head of the queue, and prepare to receive its contents, if any.
 */
 
-vine_result_code_t vine_manager_get_output_file(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t,
-		struct vine_mount *m, struct vine_file *f)
+static vine_result_code_t handle_header(
+		struct vine_manager *q, struct vine_worker_info *w, struct vine_get_request *req, const char *line)
 {
-	int64_t total_bytes = 0;
-	vine_result_code_t result = VINE_SUCCESS; // return success unless something fails below.
+	struct vine_retrieval *r = w->retrieval;
+	char name_encoded[VINE_LINE_MAX];
+	char name[VINE_LINE_MAX];
+	int64_t size;
+	int mode;
+	int errornum;
 
-	timestamp_t open_time = timestamp_get();
+	if (sscanf(line, "file %s %" SCNd64 " 0%o", name_encoded, &size, &mode) == 3) {
+		if (size < 0)
+			return VINE_WORKER_FAILURE;
+
+		if (req->is_buffer) {
+			if (req->m) {
+				debug(D_VINE,
+						"Receiving buffer %s (size: %" PRId64 " bytes) from %s (%s) ...",
+						req->m->file->source,
+						size,
+						w->addrport,
+						w->hostname);
+			}
+			r->state = VINE_GET_BUFFER;
+			r->length = size;
+			r->offset = 0;
+			r->data = malloc(size + 1);
+			r->stoptime = time(0) + vine_manager_transfer_time(q, w, size);
+			if (!r->data) {
+				set_request_result(req, VINE_APP_FAILURE);
+			}
+		} else {
+			url_decode(name_encoded, name, sizeof(name));
+			start_file(q, w, req, item_path(r, req, name), size, mode);
+		}
+	} else if (!req->is_buffer && sscanf(line, "symlink %s %" SCNd64, name_encoded, &size) == 2) {
+		if (size < 0)
+			return VINE_WORKER_FAILURE;
 
-	debug(D_VINE, "%s (%s) sending back %s to %s", w->hostname, w->addrport, f->cached_name, f->source);
+		url_decode(name_encoded, name, sizeof(name));
+		r->state = VINE_GET_SYMLINK;
+		r->path = item_path(r, req, name);
+		r->length = size;
+		r->offset = 0;
+		r->data = xxmalloc(size + 1);
+		r->stoptime = time(0) + q->short_timeout;
+	} else if (!req->is_buffer && sscanf(line, "dir %s", name_encoded) == 1) {
+		url_decode(name_encoded, name, sizeof(name));
+		char *dirname = item_path(r, req, name);
 
-	if (f->type == VINE_FILE) {
-		vine_manager_send(q, w, "get %s\n", f->cached_name);
-		result = vine_manager_get_any(q, w, t, 0, f->source, &total_bytes);
-	} else if (f->type == VINE_BUFFER) {
-		vine_manager_send(q, w, "getfile %s\n", f->cached_name);
-		result = vine_manager_get_buffer(q, w, t, f, &total_bytes);
+		/* If the directory exists, no error, keep going. */
+		if (req->m && mkdir(dirname, 0777) < 0 && errno != EEXIST) {
+			debug(D_VINE, "unable to create %s: %s", dirname, strerror(errno));
+			set_request_result(req, VINE_APP_FAILURE);
+		}
+
+		list_push_head(r->dirs, dirname);
+		return VINE_SUCCESS;
+	} else if (sscanf(line, "error %s %d", name_encoded, &errornum) == 2) {
+		// If the output file is missing, we make a note of that in the task result,
+		// but we continue and consider the transfer a 'success' so that other
+		// outputs are transferred and the task is given back to the caller.
+		url_decode(name_encoded, name, sizeof(name));
+		debug(D_VINE,
+				"%s (%s): could not access requested file %s (%s)",
+				w->hostname,
+				w->addrport,
+				name,
+				strerror(errornum));
+		if (req->m) {
+			vine_task_set_result(req->task->t, VINE_RESULT_OUTPUT_MISSING);
+		}
+		finish_item(q, w);
+		return VINE_SUCCESS;
+	} else if (!strcmp(line, "end") && list_size(r->dirs) > 0) {
+		free(list_pop_head(r->dirs));
+		finish_item(q, w);
+		return VINE_SUCCESS;
 	} else {
-		result = VINE_APP_FAILURE;
+		debug(D_VINE, "%s (%s): sent invalid response to get: %s", w->hostname, w->addrport, line);
+		return VINE_WORKER_FAILURE;
 	}
 
-	timestamp_t close_time = timestamp_get();
-	timestamp_t sum_time = close_time - open_time;
+	// Items without contents are complete as soon as their header is received.
+	if (r->length == 0) {
+		finish_data(q, w, req);
+	}
 
-	if (total_bytes > 0) {
-		q->stats->bytes_received += total_bytes;
+	return VINE_SUCCESS;
+}
 
-		t->bytes_received += total_bytes;
-		t->bytes_transferred += total_bytes;
+/* Consume the contents of the current item that are already available at the link. */
 
-		w->total_bytes_transferred += total_bytes;
-		w->total_transfer_time += sum_time;
+static vine_result_code_t receive_data(
+		struct vine_manager *q, struct vine_worker_info *w, struct vine_get_request *req, int64_t *budget)
+{
+	struct vine_retrieval *r = w->retrieval;
+	char buffer[65536];
+	char *target = buffer;
+
+	int64_t count = r->length - r->offset;
+	if (r->state == VINE_GET_FILE || !r->data) {
+		count = MIN(count, (int64_t)sizeof(buffer));
+	} else {
+		target = r->data + r->offset;
+	}
 
+	ssize_t actual = link_read_avail(w->link, target, count, time(0) + q->short_timeout);
+	if (actual <= 0) {
 		debug(D_VINE,
-				"%s (%s) sent %.2lf MB in %.02lfs (%.02lfs MB/s) average %.02lfs MB/s",
+				"%s (%s): connection lost while sending back %s",
 				w->hostname,
 				w->addrport,
-				total_bytes / 1000000.0,
-				sum_time / 1000000.0,
-				(double)total_bytes / sum_time,
-				(double)w->total_bytes_transferred / w->total_transfer_time);
+				r->path ? r->path : "a buffer");
+		return VINE_WORKER_FAILURE;
+	}
 
-		vine_txn_log_write_transfer(q, w, t, m, f, total_bytes, sum_time, open_time, 0);
+	if (r->state == VINE_GET_FILE && r->fd >= 0 && full_write(r->fd, buffer, actual) != actual) {
+		debug(D_NOTICE, "Could not write file %s: %s", r->path, strerror(errno));
+		close(r->fd);
+		unlink(r->path);
+		r->fd = -1;
+		set_request_result(req, VINE_MGR_FAILURE);
 	}
 
-	// If we failed to *transfer* the output file, then that is a hard
-	// failure which causes this function to return failure and the task
-	// to be returned to the queue to be attempted elsewhere.
-	// But if we failed to *store* the file, that is a manager failure.
+	r->offset += actual;
+	*budget -= actual;
 
-	if (result != VINE_SUCCESS) {
-		debug(D_VINE,
-				"%s (%s) failed to return output %s to %s",
-				w->addrport,
-				w->hostname,
-				f->cached_name,
-				f->source);
+	// The worker is alive as long as data keeps flowing.
+	w->last_msg_recv_time = timestamp_get();
 
-		if (result == VINE_APP_FAILURE) {
-			vine_task_set_result(t, VINE_RESULT_OUTPUT_MISSING);
-		} else if (result == VINE_MGR_FAILURE) {
-			vine_task_set_result(t, VINE_RESULT_OUTPUT_TRANSFER_ERROR);
-		}
+	if (r->offset == r->length) {
+		finish_data(q, w, req);
 	}
 
-	// If the transfer was successful, make a record of it in the cache.
-	if (result == VINE_SUCCESS && m->flags & VINE_CACHE) {
-		struct stat local_info;
-		if (stat(f->source, &local_info) == 0) {
-			struct vine_file_replica *remote_info =
-					vine_file_replica_create(local_info.st_size, local_info.st_mtime);
-			vine_file_replica_table_insert(w, f->cached_name, remote_info);
-		} else {
-			debug(D_NOTICE, "Cannot stat file %s: %s", f->source, strerror(errno));
-		}
+	return VINE_SUCCESS;
+}
+
+void vine_manager_get_outputs_queue(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t)
+{
+	if (!w->retrieval) {
+		w->retrieval = vine_retrieval_create();
 	}
 
-	return result;
-}
+	struct vine_retrieval *r = w->retrieval;
+	if (itable_lookup(r->task_table, t->task_id))
+		return;
 
-/* Get all output files produced by a given task on this worker. */
+	struct vine_get_task *gt = calloc(1, sizeof(*gt));
+	gt->t = t;
+	gt->mounts = list_create();
+	gt->result = VINE_SUCCESS;
 
-vine_result_code_t vine_manager_get_output_files(
-		struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t)
-{
-	vine_result_code_t result = VINE_SUCCESS;
+	t->time_when_retrieval = timestamp_get();
+
+	// If the task exhausted its resources, only the monitor summary is needed to know why.
+	const char *summary_name = RESOURCE_MONITOR_REMOTE_NAME ".summary";
 
+	struct vine_mount *m;
 	if (t->output_mounts) {
-		struct vine_mount *m;
 		LIST_ITERATE(t->output_mounts, m)
 		{
-			// non-file objects are handled by the worker.
-			if (m->file->type != VINE_FILE && m->file->type != VINE_BUFFER)
+			if (t->result == VINE_RESULT_RESOURCE_EXHAUSTION) {
+				if (strcmp(summary_name, m->remote_name))
+					continue;
+				if (m->file->type != VINE_FILE && m->file->type != VINE_BUFFER) {
+					gt->result = vine_manager_get_output_file_done(
+							q, w, t, m, m->file, VINE_APP_FAILURE, 0, timestamp_get());
+					continue;
+				}
+			} else if (!vine_manager_get_output_wanted(t, m)) {
 				continue;
+			}
 
-			int task_succeeded = (t->result == VINE_RESULT_SUCCESS && t->exit_code == 0);
+			list_push_tail(gt->mounts, m);
+		}
+	}
 
-			// skip failure-only files on success
-			if (m->flags & VINE_FAILURE_ONLY && task_succeeded)
-				continue;
+	itable_insert(r->task_table, t->task_id, gt);
+	list_push_tail(r->tasks, gt);
 
-			// skip success-only files on failure
-			if (m->flags & VINE_SUCCESS_ONLY && !task_succeeded)
-				continue;
+	send_requests(q, w);
+}
 
-			// otherwise, get the file.
-			result = vine_manager_get_output_file(q, w, t, m, m->file);
+vine_result_code_t vine_manager_get_outputs_advance(struct vine_manager *q, struct vine_worker_info *w)
+{
+	struct vine_retrieval *r = w->retrieval;
+	if (!r)
+		return VINE_SUCCESS;
 
-			// if success or app-level failure, continue to get other files.
-			// if worker failure, return.
-			if (result == VINE_WORKER_FAILURE) {
-				break;
+	char line[VINE_LINE_MAX];
+	int64_t budget = VINE_GET_MAX_BYTES;
+
+	while (budget > 0 && list_size(r->requests) > 0 && link_usleep(w->link, 0, 1, 0)) {
+		struct vine_get_request *req = list_peek_head(r->requests);
+		vine_result_code_t result;
+
+		if (r->state == VINE_GET_HEADER) {
+			vine_msg_code_t mcode = vine_manager_recv_no_retry(q, w, line, sizeof(line));
+			if (mcode == VINE_MSG_PROCESSED) {
+				continue;
+			} else if (mcode != VINE_MSG_NOT_PROCESSED) {
+				return VINE_WORKER_FAILURE;
 			}
+			result = handle_header(q, w, req, line);
+		} else {
+			result = receive_data(q, w, req, &budget);
 		}
+
+		if (result != VINE_SUCCESS)
+			return result;
+
+		send_requests(q, w);
 	}
 
-	// tell the worker you no longer need that task's output directory.
-	vine_manager_send(q, w, "kill %d\n", t->task_id);
+	return VINE_SUCCESS;
+}
 
-	return result;
+struct vine_task *vine_manager_get_outputs_next(struct vine_worker_info *w, vine_result_code_t *result)
+{
+	struct vine_retrieval *r = w->retrieval;
+	if (!r)
+		return 0;
+
+	struct vine_get_task *gt = list_pop_head(r->completed);
+	if (!gt)
+		return 0;
+
+	struct vine_task *t = gt->t;
+	*result = gt->result;
+
+	itable_remove(r->task_table, t->task_id);
+	vine_get_task_delete(gt);
+
+	return t;
+}
+
+void vine_manager_get_outputs_forget(struct vine_worker_info *w, struct vine_task *t)
+{
+	struct vine_retrieval *r = w->retrieval;
+	if (!r)
+		return;
+
+	struct vine_get_task *gt = itable_remove(r->task_table, t->task_id);
+	if (!gt)
+		return;
+
+	if (list_remove(r->completed, gt)) {
+		vine_get_task_delete(gt);
+		return;
+	}
+
+	list_remove(r->tasks, gt);
+	list_clear(gt->mounts, 0);
+	gt->t = 0;
+
+	struct vine_get_request *req;
+	LIST_ITERATE(r->requests, req)
+	{
+		if (req->task == gt) {
+			req->m = 0;
+		}
+	}
+
+	// Requests already sent are still answered by the worker, and their replies discarded.
+	if (gt->requests == 0) {
+		vine_get_task_delete(gt);
+	}
 }
 
 /*
-Get only the resource monitor output file for a given task,
-usually because the task has failed, and we want to know why.
+Receive all the outputs requested from the worker, blocking if needed,
+so that the link can be used for other requests.
 */
 
-vine_result_code_t vine_manager_get_monitor_output_file(
-		struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t)
+vine_result_code_t vine_manager_get_outputs_drain(struct vine_manager *q, struct vine_worker_info *w)
 {
-	vine_result_code_t result = VINE_SUCCESS;
+	while (vine_manager_get_outputs_busy(w)) {
+		if (vine_manager_get_outputs_expired(w))
+			return VINE_WORKER_FAILURE;
 
-	const char *summary_name = RESOURCE_MONITOR_REMOTE_NAME ".summary";
+		link_usleep(w->link, 1000000, 1, 0);
 
-	struct vine_mount *m;
-	if (t->output_mounts) {
-		LIST_ITERATE(t->output_mounts, m)
-		{
-			if (!strcmp(summary_name, m->remote_name)) {
-				result = vine_manager_get_output_file(q, w, t, m, m->file);
-				break;
-			}
-		}
+		vine_result_code_t result = vine_manager_get_outputs_advance(q, w);
+		if (result != VINE_SUCCESS)
+			return result;
 	}
 
-	// tell the worker you no longer need that task's output directory.
-	vine_manager_send(q, w, "kill %d\n", t->task_id);
+	return VINE_SUCCESS;
+}
 
-	return result;
+int vine_manager_get_outputs_busy(struct vine_worker_info *w)
+{
+	struct vine_retrieval *r = w->retrieval;
+	return r && (list_size(r->requests) > 0 || list_size(r->tasks) > 0);
+}
+
+int vine_manager_get_outputs_pending(struct vine_worker_info *w)
+{
+	struct vine_retrieval *r = w->retrieval;
+	return vine_manager_get_outputs_busy(w) || (r && list_size(r->completed) > 0);
+}
+
+int vine_manager_get_outputs_expired(struct vine_worker_info *w)
+{
+	struct vine_retrieval *r = w->retrieval;
+	return r && list_size(r->requests) > 0 && time(0) > r->stoptime && !link_usleep(w->link, 0, 1, 0);
 }
@@ -12,6 +12,17 @@ Provides the recursive transfer of files and directories
 from the worker back to the manager at task completion.
 This is the counterpart of worker/vine_transfer.c on the worker side.
 This module is private to the manager and should not be invoked by the end user.
+
+The outputs of completed tasks are retrieved without blocking the manager:
+vine_manager_get_outputs_queue sends the requests for the outputs of a task,
+keeping up to VINE_GET_MAX_REQUESTS outstanding at the worker, and
+vine_manager_get_outputs_advance consumes whatever part of the replies is
+already available at the link, so that the retrieval of large outputs is
+interleaved with the messages of other workers. Tasks with all their outputs
+received are then taken with vine_manager_get_outputs_next.
+
+While a worker is busy sending back outputs it does not read from its link,
+so nothing other than short messages should be sent to it in the meantime.
 */
 
 #include "vine_manager.h"
@@ -19,10 +30,22 @@ This module is private to the manager and should not be invoked by the end user.
 #include "vine_file.h"
 #include "vine_mount.h"
 
+/* Maximum number of output requests outstanding at a worker. */
+#define VINE_GET_MAX_REQUESTS 16
+
+/* Maximum number of bytes received from a worker before servicing other workers. */
+#define VINE_GET_MAX_BYTES (16 * 1024 * 1024)
+
 vine_result_code_t vine_manager_get_single_file( struct vine_manager *q, struct vine_worker_info *w, struct vine_file *f );
-vine_result_code_t vine_manager_get_output_file( struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, struct vine_mount *m, struct vine_file *f );
-vine_result_code_t vine_manager_get_output_files( struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t );
-vine_result_code_t vine_manager_get_monitor_output_file( struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t );
 
-#endif
+void vine_manager_get_outputs_queue( struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t );
+vine_result_code_t vine_manager_get_outputs_advance( struct vine_manager *q, struct vine_worker_info *w );
+struct vine_task *vine_manager_get_outputs_next( struct vine_worker_info *w, vine_result_code_t *result );
+void vine_manager_get_outputs_forget( struct vine_worker_info *w, struct vine_task *t );
+vine_result_code_t vine_manager_get_outputs_drain( struct vine_manager *q, struct vine_worker_info *w );
+int vine_manager_get_outputs_busy( struct vine_worker_info *w );
+int vine_manager_get_outputs_pending( struct vine_worker_info *w );
+int vine_manager_get_outputs_expired( struct vine_worker_info *w );
+void vine_manager_get_outputs_delete( struct vine_worker_info *w );
 
+#endif
@@ -15,10 +15,15 @@ See the file COPYING for details.
 #include "vine_txn_log.h"
 #include "vine_worker_info.h"
 
+#include "buffer.h"
 #include "create_dir.h"
 #include "debug.h"
+#include "full_io.h"
 #include "host_disk_info.h"
+#include "itable.h"
 #include "link.h"
+#include "list.h"
+#include "macros.h"
 #include "path.h"
 #include "rmsummary.h"
 #include "stringtools.h"
@@ -34,6 +39,354 @@ See the file COPYING for details.
 char *vine_monitor_wrap(
 		struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, struct rmsummary *limits);
 
+static void vine_manager_put_input_file_done(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t,
+		struct vine_mount *m, struct vine_file *f, int64_t total_bytes, timestamp_t elapsed_time,
+		timestamp_t open_time);
+
+/*
+The contents of files and buffers sent to a worker are always queued,
+and protocol messages are queued whenever the link to the worker
+cannot take them right away, so that the manager does not block on
+large transfers. Once anything is queued for a worker, all further
+messages to it are queued behind, to preserve their order.
+*/
+
+typedef enum {
+	VINE_UPLOAD_DATA,     /* Bytes in memory. */
+	VINE_UPLOAD_FILE,     /* The contents of a local file. */
+	VINE_UPLOAD_BUFFER,   /* The contents of a buffer object, held by reference. */
+	VINE_UPLOAD_DONE,     /* Marks the end of the transfer of an input file, for accounting. */
+} vine_upload_type_t;
+
+struct vine_upload_item {
+	vine_upload_type_t type;
+	buffer_t data;
+	char *path;
+	struct vine_file *file;
+	int64_t length;
+	int task_id;
+	char *cached_name;
+};
+
+struct vine_upload {
+	struct list *items;
+	int polling_write;  /* True if the link is in the poll set of the manager for writing. */
+
+	/* State of the item at the head of items. */
+	int started;
+	int fd;
+	int64_t offset;
+	time_t stoptime;
+	timestamp_t effective_stoptime;
+	timestamp_t start_time;
+	timestamp_t elapsed; /* Time spent sending items since the last VINE_UPLOAD_DONE. */
+
+	/* Contents of the file being sent, read but not yet written to the link. */
+	char *chunk;
+	int64_t chunk_offset;
+	int64_t chunk_length;
+};
+
+static struct vine_upload_item *vine_upload_item_create(vine_upload_type_t type)
+{
+	struct vine_upload_item *item = calloc(1, sizeof(*item));
+	item->type = type;
+	buffer_init(&item->data);
+	buffer_abortonfailure(&item->data, 1);
+	return item;
+}
+
+static void vine_upload_item_delete(struct vine_upload_item *item)
+{
+	buffer_free(&item->data);
+	free(item->path);
+	vine_file_delete(item->file);
+	free(item->cached_name);
+	free(item);
+}
+
+/* Wait for the link to be writable only while there is something to send. */
+
+static void vine_upload_update_poll(struct vine_manager *q, struct vine_worker_info *w)
+{
+	struct vine_upload *u = w->upload;
+	int busy = list_size(u->items) > 0;
+
+	if (busy != u->polling_write) {
+		link_set_update(q->poll_set, w->link, busy ? (LINK_READ | LINK_WRITE) : LINK_READ);
+		u->polling_write = busy;
+	}
+}
+
+static void vine_upload_push(struct vine_manager *q, struct vine_worker_info *w, struct vine_upload_item *item)
+{
+	if (!w->upload) {
+		struct vine_upload *u = calloc(1, sizeof(*u));
+		u->items = list_create();
+		u->fd = -1;
+		u->chunk = xxmalloc(VINE_PUT_CHUNK_SIZE);
+		w->upload = u;
+	}
+
+	list_push_tail(w->upload->items, item);
+	vine_upload_update_poll(q, w);
+}
+
+int vine_manager_put_busy(struct vine_worker_info *w) { return w->upload && list_size(w->upload->items) > 0; }
+
+/*
+Send a protocol message, written at once if nothing is queued for the worker.
+Only short messages should be sent this way: the contents of files are queued instead.
+*/
+
+int vine_manager_put_bytes(struct vine_manager *q, struct vine_worker_info *w, const char *data, int64_t length)
+{
+	if (!vine_manager_put_busy(w)) {
+		time_t stoptime = time(0) + vine_manager_transfer_time(q, w, length);
+		return link_putlstring(w->link, data, length, stoptime);
+	}
+
+	struct vine_upload_item *item = list_peek_tail(w->upload->items);
+	if (item->type != VINE_UPLOAD_DATA) {
+		item = vine_upload_item_create(VINE_UPLOAD_DATA);
+		vine_upload_push(q, w, item);
+	}
+
+	buffer_putlstring(&item->data, data, length);
+	item->length += length;
+
+	return length;
+}
+
+/*
+Send a message assembled from several pieces, with a single writev
+if the worker is idle, otherwise queue the pieces behind the uploads in progress.
+*/
+
+int vine_manager_put_vector(struct vine_manager *q, struct vine_worker_info *w, const struct iovec *iov, int iovcnt)
+{
+	int64_t length = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		length += iov[i].iov_len;
+
+	if (!vine_manager_put_busy(w)) {
+		time_t stoptime = time(0) + vine_manager_transfer_time(q, w, length);
+		return link_writev(w->link, iov, iovcnt, stoptime);
+	}
+
+	for (i = 0; i < iovcnt; i++)
+		vine_manager_put_bytes(q, w, iov[i].iov_base, iov[i].iov_len);
+
+	return length;
+}
+
+/*
+An input file of a task has been sent completely: mark it as present
+at the worker, so that it can be used as a source by other workers,
+and account for the transfer.
+*/
+
+static void vine_upload_done(struct vine_manager *q, struct vine_worker_info *w, struct vine_upload_item *item)
+{
+	struct vine_upload *u = w->upload;
+
+	struct vine_file_replica *replica = vine_file_replica_table_lookup(w, item->cached_name);
+	if (replica)
+		replica->in_cache = 1;
+
+	struct vine_file *file = vine_manager_lookup_file(q, item->cached_name);
+	if (file)
+		file->created = 1;
+
+	struct vine_task *t = itable_lookup(q->tasks, item->task_id);
+	struct vine_mount *m = 0;
+	struct vine_mount *n;
+
+	if (t && t->input_mounts) {
+		LIST_ITERATE(t->input_mounts, n)
+		{
+			if (!strcmp(n->file->cached_name, item->cached_name)) {
+				m = n;
+				break;
+			}
+		}
+	}
+
+	if (m) {
+		struct vine_file *f = m->substitute ? m->substitute : m->file;
+		vine_manager_put_input_file_done(q, w, t, m, f, item->length, u->elapsed, timestamp_get() - u->elapsed);
+	} else {
+		vine_manager_put_input_file_done(q, w, 0, 0, 0, item->length, u->elapsed, timestamp_get() - u->elapsed);
+	}
+
+	u->elapsed = 0;
+}
+
+static vine_result_code_t vine_upload_start(struct vine_manager *q, struct vine_worker_info *w)
+{
+	struct vine_upload *u = w->upload;
+	struct vine_upload_item *item = list_peek_head(u->items);
+
+	u->started = 1;
+	u->offset = 0;
+	u->start_time = timestamp_get();
+	u->stoptime = time(0) + vine_manager_transfer_time(q, w, item->length);
+
+	if (item->type == VINE_UPLOAD_FILE) {
+		// If a bandwidth limit is in effect, choose the effective stoptime.
+		u->effective_stoptime = 0;
+		if (q->bandwidth_limit) {
+			u->effective_stoptime = (item->length / q->bandwidth_limit) * 1000000 + timestamp_get();
+		}
+
+		u->chunk_offset = u->chunk_length = 0;
+		u->fd = open(item->path, O_RDONLY, 0);
+		if (u->fd < 0) {
+			// The header of the file has already been sent, so the worker cannot continue.
+			debug(D_NOTICE, "Cannot open file %s: %s", item->path, strerror(errno));
+			return VINE_WORKER_FAILURE;
+		}
+	}
+
+	return VINE_SUCCESS;
+}
+
+static void vine_upload_finish(struct vine_manager *q, struct vine_worker_info *w)
+{
+	struct vine_upload *u = w->upload;
+	struct vine_upload_item *item = list_pop_head(u->items);
+
+	if (item->type == VINE_UPLOAD_DONE) {
+		vine_upload_done(q, w, item);
+	} else {
+		u->elapsed += timestamp_get() - u->start_time;
+	}
+
+	if (u->fd >= 0) {
+		close(u->fd);
+		u->fd = -1;
+
+		// If the transfer was too fast, slow things down.
+		timestamp_t current_time = timestamp_get();
+		if (u->effective_stoptime && u->effective_stoptime > current_time) {
+			usleep(u->effective_stoptime - current_time);
+		}
+	}
+
+	u->started = 0;
+	vine_upload_item_delete(item);
+}
+
+vine_result_code_t vine_manager_put_advance(struct vine_manager *q, struct vine_worker_info *w)
+{
+	struct vine_upload *u = w->upload;
+	if (!u)
+		return VINE_SUCCESS;
+
+	struct vine_upload_item *item;
+	int64_t budget = VINE_PUT_MAX_BYTES;
+
+	while (budget > 0 && (item = list_peek_head(u->items))) {
+		if (item->type == VINE_UPLOAD_DONE) {
+			vine_upload_finish(q, w);
+			continue;
+		}
+
+		if (!u->started && vine_upload_start(q, w) != VINE_SUCCESS)
+			return VINE_WORKER_FAILURE;
+
+		ssize_t actual = 0;
+
+		if (item->type == VINE_UPLOAD_DATA) {
+			actual = link_write_avail(w->link, buffer_tostring(&item->data) + u->offset, item->length - u->offset);
+		} else if (item->type == VINE_UPLOAD_BUFFER) {
+			actual = link_write_avail(w->link, item->file->data + u->offset, item->length - u->offset);
+		} else if (item->type == VINE_UPLOAD_FILE) {
+			if (u->chunk_offset == u->chunk_length) {
+				int64_t count = MIN(VINE_PUT_CHUNK_SIZE, item->length - u->offset);
+				ssize_t ractual = full_read(u->fd, u->chunk, count);
+				if (ractual != count) {
+					debug(D_NOTICE, "File %s changed while sending it to %s", item->path, w->addrport);
+					return VINE_WORKER_FAILURE;
+				}
+				u->chunk_offset = 0;
+				u->chunk_length = count;
+			}
+			actual = link_write_avail(w->link, u->chunk + u->chunk_offset, u->chunk_length - u->chunk_offset);
+			if (actual > 0)
+				u->chunk_offset += actual;
+		}
+
+		if (actual < 0) {
+			debug(D_VINE, "Failed to send data to %s (%s): %s", w->hostname, w->addrport, strerror(errno));
+			return VINE_WORKER_FAILURE;
+		}
+
+		u->offset += actual;
+		budget -= actual;
+
+		if (u->offset == item->length) {
+			vine_upload_finish(q, w);
+		} else if (actual == 0) {
+			break;
+		}
+
+		// A worker taking in data is alive, even if it cannot respond to keepalives meanwhile.
+		if (actual > 0)
+			w->last_msg_recv_time = timestamp_get();
+	}
+
+	vine_upload_update_poll(q, w);
+
+	return VINE_SUCCESS;
+}
+
+/*
+Send everything queued for the worker, blocking if needed,
+so that a request can be sent and its reply awaited right away.
+*/
+
+vine_result_code_t vine_manager_put_drain(struct vine_manager *q, struct vine_worker_info *w)
+{
+	while (vine_manager_put_busy(w)) {
+		if (vine_manager_put_expired(w))
+			return VINE_WORKER_FAILURE;
+
+		link_usleep(w->link, 1000000, 0, 1);
+
+		vine_result_code_t result = vine_manager_put_advance(q, w);
+		if (result != VINE_SUCCESS)
+			return result;
+	}
+
+	return VINE_SUCCESS;
+}
+
+int vine_manager_put_expired(struct vine_worker_info *w)
+{
+	struct vine_upload *u = w->upload;
+	return vine_manager_put_busy(w) && u->started && time(0) > u->stoptime;
+}
+
+void vine_manager_put_delete(struct vine_worker_info *w)
+{
+	struct vine_upload *u = w->upload;
+	if (!u)
+		return;
+
+	if (u->fd >= 0)
+		close(u->fd);
+
+	list_clear(u->items, (void *)vine_upload_item_delete);
+	list_delete(u->items);
+	free(u->chunk);
+	free(u);
+
+	w->upload = 0;
+}
+
 /*
 Send a symbolic link to the remote worker.
 Note that the target of the link is sent
@@ -55,7 +408,7 @@ static int vine_manager_put_symlink(struct vine_manager *q, struct vine_worker_i
 
 	vine_manager_send(q, w, "symlink %s %d\n", remotename_encoded, length);
 
-	link_write(w->link, target, length, time(0) + q->long_timeout);
+	vine_manager_put_bytes(q, w, target, length);
 
 	*total_bytes += length;
 
@@ -64,51 +417,39 @@ static int vine_manager_put_symlink(struct vine_manager *q, struct vine_worker_i
 
 /*
 Send a single file to the remote worker.
-The transfer time is controlled by the size of the file.
-If the transfer takes too long, then cancel it.
+The contents of the file are not sent right away, but queued
+to be streamed by @ref vine_manager_put_advance as the link
+to the worker can take them.
 */
 
 static int vine_manager_put_file(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t,
 		const char *localname, const char *remotename, struct stat info, int64_t *total_bytes)
 {
-	time_t stoptime;
-	timestamp_t effective_stoptime = 0;
-	int64_t actual = 0;
-
 	/* normalize the mode so as not to set up invalid permissions */
 	int mode = (info.st_mode | 0x600) & 0777;
 
 	int64_t length = info.st_size;
 
-	int fd = open(localname, O_RDONLY, 0);
-	if (fd < 0) {
+	if (access(localname, R_OK) < 0) {
 		debug(D_NOTICE, "Cannot open file %s: %s", localname, strerror(errno));
 		return VINE_APP_FAILURE;
 	}
 
-	if (q->bandwidth_limit) {
-		effective_stoptime = (length / q->bandwidth_limit) * 1000000 + timestamp_get();
-	}
-
 	/* filenames are url-encoded to avoid problems with spaces, etc */
 	char remotename_encoded[VINE_LINE_MAX];
 	url_encode(remotename, remotename_encoded, sizeof(remotename_encoded));
 
-	stoptime = time(0) + vine_manager_transfer_time(q, w, length);
 	vine_manager_send(q, w, "file %s %" PRId64 " 0%o\n", remotename_encoded, length, mode);
-	actual = link_stream_from_fd(w->link, fd, length, stoptime);
-	close(fd);
-
-	*total_bytes += actual;
 
-	if (actual != length)
-		return VINE_WORKER_FAILURE;
-
-	timestamp_t current_time = timestamp_get();
-	if (effective_stoptime && effective_stoptime > current_time) {
-		usleep(effective_stoptime - current_time);
+	if (length > 0) {
+		struct vine_upload_item *item = vine_upload_item_create(VINE_UPLOAD_FILE);
+		item->path = xxstrdup(localname);
+		item->length = length;
+		vine_upload_push(q, w, item);
 	}
 
+	*total_bytes += length;
+
 	return VINE_SUCCESS;
 }
 
@@ -234,20 +575,68 @@ static vine_result_code_t vine_manager_put_url(
 	return VINE_SUCCESS;
 }
 
-/* Send a buffer object to the remote worker. */
+/*
+Send a buffer object to the remote worker.
+As with a file, the contents are queued to be streamed by
+@ref vine_manager_put_advance, holding a reference to the buffer
+instead of a copy of it until they are sent.
+*/
 
 vine_result_code_t vine_manager_put_buffer(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t,
 		struct vine_file *f, int64_t *total_bytes)
 {
-	time_t stoptime = time(0) + vine_manager_transfer_time(q, w, f->size);
 	vine_manager_send(q, w, "file %s %lld %o\n", f->cached_name, (long long)f->size, 0777);
-	int64_t actual = link_putlstring(w->link, f->data, f->size, stoptime);
-	if (actual >= 0 && (size_t)actual == f->size) {
-		*total_bytes = actual;
-		return VINE_SUCCESS;
-	} else {
-		*total_bytes = 0;
-		return VINE_WORKER_FAILURE;
+
+	if (f->size > 0) {
+		struct vine_upload_item *item = vine_upload_item_create(VINE_UPLOAD_BUFFER);
+		item->file = vine_file_clone(f);
+		item->length = f->size;
+		vine_upload_push(q, w, item);
+	}
+
+	*total_bytes = f->size;
+
+	return VINE_SUCCESS;
+}
+
+/*
+Record the performance of the transfer of an input file.
+The task and mount may be null if the task is gone by the time
+the contents of the file have been sent.
+*/
+
+static void vine_manager_put_input_file_done(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t,
+		struct vine_mount *m, struct vine_file *f, int64_t total_bytes, timestamp_t elapsed_time,
+		timestamp_t open_time)
+{
+	if (t) {
+		t->bytes_sent += total_bytes;
+		t->bytes_transferred += total_bytes;
+	}
+
+	w->total_bytes_transferred += total_bytes;
+	w->total_transfer_time += elapsed_time;
+
+	q->stats->bytes_sent += total_bytes;
+
+	// Write to the transaction log.
+	if (m && (f->type == VINE_FILE || f->type == VINE_BUFFER)) {
+		vine_txn_log_write_transfer(q, w, t, m, f, total_bytes, elapsed_time, open_time, 1);
+	}
+
+	// Avoid division by zero below.
+	if (elapsed_time == 0)
+		elapsed_time = 1;
+
+	if (total_bytes > 0) {
+		debug(D_VINE,
+				"%s (%s) received %.2lf MB in %.02lfs (%.02lfs MB/s) average %.02lfs MB/s",
+				w->hostname,
+				w->addrport,
+				total_bytes / 1000000.0,
+				elapsed_time / 1000000.0,
+				(double)total_bytes / elapsed_time,
+				(double)w->total_bytes_transferred / w->total_transfer_time);
 	}
 }
 
@@ -303,35 +692,16 @@ static vine_result_code_t vine_manager_put_input_file(struct vine_manager *q, st
 	}
 
 	if (result == VINE_SUCCESS) {
-		timestamp_t close_time = timestamp_get();
-		timestamp_t elapsed_time = close_time - open_time;
-
-		t->bytes_sent += total_bytes;
-		t->bytes_transferred += total_bytes;
-
-		w->total_bytes_transferred += total_bytes;
-		w->total_transfer_time += elapsed_time;
-
-		q->stats->bytes_sent += total_bytes;
-
-		// Write to the transaction log.
-		if (f->type == VINE_FILE || f->type == VINE_BUFFER) {
-			vine_txn_log_write_transfer(q, w, t, m, f, total_bytes, elapsed_time, open_time, 1);
-		}
-
-		// Avoid division by zero below.
-		if (elapsed_time == 0)
-			elapsed_time = 1;
-
-		if (total_bytes > 0) {
-			debug(D_VINE,
-					"%s (%s) received %.2lf MB in %.02lfs (%.02lfs MB/s) average %.02lfs MB/s",
-					w->hostname,
-					w->addrport,
-					total_bytes / 1000000.0,
-					elapsed_time / 1000000.0,
-					(double)total_bytes / elapsed_time,
-					(double)w->total_bytes_transferred / w->total_transfer_time);
+		if ((f->type == VINE_FILE || f->type == VINE_BUFFER) && vine_manager_put_busy(w)) {
+			/* Account for the transfer once the contents queued for the worker are sent. */
+			struct vine_upload_item *item = vine_upload_item_create(VINE_UPLOAD_DONE);
+			item->task_id = t->task_id;
+			item->cached_name = xxstrdup(m->file->cached_name);
+			item->length = total_bytes;
+			vine_upload_push(q, w, item);
+		} else {
+			vine_manager_put_input_file_done(
+					q, w, t, m, f, total_bytes, timestamp_get() - open_time, open_time);
 		}
 	} else {
 		debug(D_VINE,
@@ -421,18 +791,21 @@ static vine_result_code_t vine_manager_put_input_file_if_needed(struct vine_mana
 	/* If the send succeeded, then record it in the worker */
 	if (result == VINE_SUCCESS) {
 		struct vine_file_replica *remote_info = vine_file_replica_create(info.st_size, info.st_mtime);
-		vine_file_replica_table_insert(w, f->cached_name, remote_info);
+		vine_file_replica_table_insert(q, w, f->cached_name, remote_info);
 
-		/* If the file came from the manager we already sent it synchronously and we will not receive a cache
-		 * update */
+		/* If the file came from the manager we will not receive a cache update. If its contents
+		 * are still queued, it is marked as present once they are sent. */
 		switch (file_to_send->type) {
 		case VINE_URL:
 		case VINE_TEMP:
 		case VINE_EMPTY_DIR:
 			break;
 		case VINE_FILE:
-		case VINE_MINI_TASK:
 		case VINE_BUFFER:
+			if (vine_manager_put_busy(w))
+				break;
+			/* fall through */
+		case VINE_MINI_TASK:
 			remote_info->in_cache = 1;
 			f->created = 1;
 		}
@@ -459,29 +832,21 @@ vine_result_code_t vine_manager_put_input_files(struct vine_manager *q, struct v
 }
 
 /*
-Send the details of one task to a worker.
-Note that this function just performs serialization of the task definition.
-It does not perform any resource management.
-This allows it to be used for both regular tasks and mini tasks.
+Write the details of one task into a buffer, in the format expected by the worker.
 */
 
-vine_result_code_t vine_manager_put_task(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t,
-		const char *command_line, struct rmsummary *limits, struct vine_file *target)
+static void vine_manager_put_task_description(struct vine_manager *q, struct vine_task *t, const char *command_line,
+		struct rmsummary *limits, struct vine_file *target, buffer_t *B)
 {
-	vine_result_code_t result = vine_manager_put_input_files(q, w, t);
-	if (result != VINE_SUCCESS)
-		return result;
-
 	if (target) {
-		vine_manager_send(q,
-				w,
+		buffer_printf(B,
 				"mini_task %lld %s %lld %o\n",
 				(long long)target->mini_task->task_id,
 				target->cached_name,
 				(long long)target->size,
 				0777);
 	} else {
-		vine_manager_send(q, w, "task %lld\n", (long long)t->task_id);
+		buffer_printf(B, "task %lld\n", (long long)t->task_id);
 	}
 
 	if (!command_line) {
@@ -489,41 +854,34 @@ vine_result_code_t vine_manager_put_task(struct vine_manager *q, struct vine_wor
 	}
 
 	long long cmd_len = strlen(command_line);
-	vine_manager_send(q, w, "cmd %lld\n", (long long)cmd_len);
-	link_putlstring(w->link, command_line, cmd_len, time(0) + q->short_timeout);
-	debug(D_VINE, "%s\n", command_line);
+	buffer_printf(B, "cmd %lld\n", (long long)cmd_len);
+	buffer_putlstring(B, command_line, cmd_len);
 
 	if (t->needs_library) {
-		vine_manager_send(q, w, "needs_library %s\n", t->needs_library);
+		buffer_printf(B, "needs_library %s\n", t->needs_library);
 	}
 
 	if (t->provides_library) {
-		vine_manager_send(q, w, "provides_library %s\n", t->provides_library);
-		vine_manager_send(q, w, "function_slots %d\n", t->function_slots);
+		buffer_printf(B, "provides_library %s\n", t->provides_library);
+		buffer_printf(B, "function_slots %d\n", t->function_slots);
 	}
 
-	vine_manager_send(q, w, "category %s\n", t->category);
+	buffer_printf(B, "category %s\n", t->category);
 
 	if (limits) {
-		vine_manager_send(q, w, "cores %s\n", rmsummary_resource_to_str("cores", limits->cores, 0));
-		vine_manager_send(q, w, "gpus %s\n", rmsummary_resource_to_str("gpus", limits->gpus, 0));
-		vine_manager_send(q, w, "memory %s\n", rmsummary_resource_to_str("memory", limits->memory, 0));
-		vine_manager_send(q, w, "disk %s\n", rmsummary_resource_to_str("disk", limits->disk, 0));
+		buffer_printf(B, "cores %s\n", rmsummary_resource_to_str("cores", limits->cores, 0));
+		buffer_printf(B, "gpus %s\n", rmsummary_resource_to_str("gpus", limits->gpus, 0));
+		buffer_printf(B, "memory %s\n", rmsummary_resource_to_str("memory", limits->memory, 0));
+		buffer_printf(B, "disk %s\n", rmsummary_resource_to_str("disk", limits->disk, 0));
 
 		/* Do not set end, wall_time if running the resource monitor. We let the monitor police these resources.
 		 */
 		if (q->monitor_mode == VINE_MON_DISABLED) {
 			if (limits->end > 0) {
-				vine_manager_send(q,
-						w,
-						"end_time %s\n",
-						rmsummary_resource_to_str("end", limits->end, 0));
+				buffer_printf(B, "end_time %s\n", rmsummary_resource_to_str("end", limits->end, 0));
 			}
 			if (limits->wall_time > 0) {
-				vine_manager_send(q,
-						w,
-						"wall_time %s\n",
-						rmsummary_resource_to_str("wall_time", limits->wall_time, 0));
+				buffer_printf(B, "wall_time %s\n", rmsummary_resource_to_str("wall_time", limits->wall_time, 0));
 			}
 		}
 	}
@@ -532,23 +890,18 @@ vine_result_code_t vine_manager_put_task(struct vine_manager *q, struct vine_wor
 	 * CORES, MEMORY, etc. will be set at the worker to the values of
 	 * set_*, if used. */
 	char *var;
-	LIST_ITERATE(t->env_list, var) { vine_manager_send(q, w, "env %zu\n%s\n", strlen(var), var); }
+	LIST_ITERATE(t->env_list, var) { buffer_printf(B, "env %zu\n%s\n", strlen(var), var); }
 
 	if (t->input_mounts) {
 		struct vine_mount *m;
 		LIST_ITERATE(t->input_mounts, m)
 		{
 			if (m->file->type == VINE_EMPTY_DIR) {
-				vine_manager_send(q, w, "dir %s\n", m->remote_name);
+				buffer_printf(B, "dir %s\n", m->remote_name);
 			} else {
 				char remote_name_encoded[PATH_MAX];
 				url_encode(m->remote_name, remote_name_encoded, PATH_MAX);
-				vine_manager_send(q,
-						w,
-						"infile %s %s %d\n",
-						m->file->cached_name,
-						remote_name_encoded,
-						m->flags);
+				buffer_printf(B, "infile %s %s %d\n", m->file->cached_name, remote_name_encoded, m->flags);
 			}
 		}
 	}
@@ -559,23 +912,128 @@ vine_result_code_t vine_manager_put_task(struct vine_manager *q, struct vine_wor
 		{
 			char remote_name_encoded[PATH_MAX];
 			url_encode(m->remote_name, remote_name_encoded, PATH_MAX);
-			vine_manager_send(q,
-					w,
-					"outfile %s %s %d\n",
-					m->file->cached_name,
-					remote_name_encoded,
-					m->flags);
+			buffer_printf(B, "outfile %s %s %d\n", m->file->cached_name, remote_name_encoded, m->flags);
 		}
 	}
 
-	// vine_manager_send returns the number of bytes sent, or a number less than
-	// zero to indicate errors. We are lazy here, we only check the last
-	// message we sent to the worker (other messages may have failed above).
+	buffer_putliteral(B, "end\n");
+}
+
+/*
+Send the details of one task to a worker.
+Note that this function just performs serialization of the task definition.
+It does not perform any resource management.
+This allows it to be used for both regular tasks and mini tasks.
+If a task batch is open for this worker, the task is appended to the batch,
+and is sent by @ref vine_manager_end_task_batch.
+*/
+
+vine_result_code_t vine_manager_put_task(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t,
+		const char *command_line, struct rmsummary *limits, struct vine_file *target)
+{
+	vine_result_code_t result = vine_manager_put_input_files(q, w, t);
+	if (result != VINE_SUCCESS)
+		return result;
+
+	buffer_t B[1];
+	buffer_init(B);
+	buffer_abortonfailure(B, 1);
+
+	vine_manager_put_task_description(q, t, command_line, limits, target, B);
+
+	int r = 0;
+	if (!target && q->task_batch_worker == w) {
+		buffer_putlstring(q->task_batch, buffer_tostring(B), buffer_pos(B));
+		q->task_batch_size++;
+	} else {
+		debug(D_VINE, "tx to %s (%s): %s", w->hostname, w->addrport, buffer_tostring(B));
+		r = vine_manager_put_bytes(q, w, buffer_tostring(B), buffer_pos(B));
+	}
+
+	buffer_free(B);
+
+	if (r >= 0) {
+		return VINE_SUCCESS;
+	} else {
+		return VINE_WORKER_FAILURE;
+	}
+}
+
+/*
+Return true if none of the inputs of a task need to be sent to the worker,
+that is, if the task can be sent as part of a task batch.
+*/
+
+int vine_manager_task_inputs_cached(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t)
+{
+	struct vine_mount *m;
+
+	if (t->input_mounts) {
+		LIST_ITERATE(t->input_mounts, m)
+		{
+			if (m->file->type == VINE_EMPTY_DIR)
+				continue;
+			if (!m->file->cached_name)
+				return 0;
+			if (!vine_file_replica_table_lookup(w, m->file->cached_name))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+Begin a batch of tasks for a worker. Until the batch is ended, the
+descriptions of the tasks sent to the worker with @ref vine_manager_put_task
+are accumulated, and then sent together in a single tasks message.
+*/
+
+void vine_manager_begin_task_batch(struct vine_manager *q, struct vine_worker_info *w)
+{
+	buffer_rewind(q->task_batch, 0);
+	q->task_batch_size = 0;
+	q->task_batch_worker = w;
+}
+
+/* Send the tasks accumulated in the current task batch. */
+
+vine_result_code_t vine_manager_end_task_batch(struct vine_manager *q)
+{
+	struct vine_worker_info *w = q->task_batch_worker;
+	int n = q->task_batch_size;
+
+	q->task_batch_worker = 0;
+	q->task_batch_size = 0;
+
+	if (!w || n < 1)
+		return VINE_SUCCESS;
+
+	char header[32];
+	struct iovec iov[2];
+
+	iov[0].iov_base = header;
+	iov[0].iov_len = snprintf(header, sizeof(header), "tasks %d\n", n);
+	iov[1].iov_base = (char *)buffer_tostring(q->task_batch);
+	iov[1].iov_len = buffer_pos(q->task_batch);
+
+	debug(D_VINE, "tx to %s (%s): %s%s", w->hostname, w->addrport, header, buffer_tostring(q->task_batch));
+	int r = vine_manager_put_vector(q, w, iov, 2);
+
+	buffer_rewind(q->task_batch, 0);
 
-	int r = vine_manager_send(q, w, "end\n");
 	if (r >= 0) {
 		return VINE_SUCCESS;
 	} else {
 		return VINE_WORKER_FAILURE;
 	}
 }
+
+/* Drop the current task batch without sending it, e.g. because its worker was removed. */
+
+void vine_manager_discard_task_batch(struct vine_manager *q)
+{
+	buffer_rewind(q->task_batch, 0);
+	q->task_batch_size = 0;
+	q->task_batch_worker = 0;
+}
@@ -12,12 +12,40 @@ Provides the recursive transfer of files and directories
 from the manager to the worker prior to task execution.
 This is the counterpart of worker/vine_transfer.c on the worker side.
 This module is private to the manager and should not be invoked by the end user.
+
+The contents of files are not sent right away, but queued for the worker,
+along with every message that follows them, and streamed by
+vine_manager_put_advance whenever the link to the worker can take more data.
+Thus a large input does not stop the manager from serving other workers.
+While a worker is busy, a request that expects an immediate reply
+must first send everything queued with vine_manager_put_drain.
 */
 
 #include "vine_manager.h"
 
+#include <sys/uio.h>
+
+/* Size of the reads of the contents of files being sent. */
+#define VINE_PUT_CHUNK_SIZE (1024 * 1024)
+
+/* Maximum number of bytes sent to a worker before servicing other workers. */
+#define VINE_PUT_MAX_BYTES (16 * 1024 * 1024)
+
 vine_result_code_t vine_manager_put_input_files( struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t );
 vine_result_code_t vine_manager_put_task( struct vine_manager *m, struct vine_worker_info *w, struct vine_task *t, const char *command_line, struct rmsummary *limits, struct vine_file *target );
 
+int vine_manager_put_bytes( struct vine_manager *q, struct vine_worker_info *w, const char *data, int64_t length );
+int vine_manager_put_vector( struct vine_manager *q, struct vine_worker_info *w, const struct iovec *iov, int iovcnt );
+vine_result_code_t vine_manager_put_advance( struct vine_manager *q, struct vine_worker_info *w );
+vine_result_code_t vine_manager_put_drain( struct vine_manager *q, struct vine_worker_info *w );
+int vine_manager_put_busy( struct vine_worker_info *w );
+int vine_manager_put_expired( struct vine_worker_info *w );
+void vine_manager_put_delete( struct vine_worker_info *w );
+
+int vine_manager_task_inputs_cached( struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t );
+void vine_manager_begin_task_batch( struct vine_manager *q, struct vine_worker_info *w );
+vine_result_code_t vine_manager_end_task_batch( struct vine_manager *q );
+void vine_manager_discard_task_batch( struct vine_manager *q );
+
 #endif
 
@@ -13,8 +13,17 @@ worker, and catalog, but should not be visible to the public user API.
 #ifndef VINE_PROTOCOL_H
 #define VINE_PROTOCOL_H
 
-#define VINE_PROTOCOL_VERSION 2
+#define VINE_PROTOCOL_VERSION 3
 
 #define VINE_LINE_MAX 4096       /**< Maximum length of a vine message line. */
 
+/*
+Several tasks may be sent to a worker in a single write with the message
+"tasks <n>" followed by <n> task descriptions, each one in the same format
+as an individual "task <taskid>" message. The inputs of all but the first
+task of a batch are already present in the worker's cache.
+*/
+
+#define VINE_TASK_BATCH_MAX 32   /**< Maximum number of tasks in a single tasks message. */
+
 #endif
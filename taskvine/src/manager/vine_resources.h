@@ -26,6 +26,14 @@ struct vine_resources {
 	struct vine_resource gpus;
 };
 
+/* Quantities of the resources allocated to a task, without the weight of a full rmsummary. */
+struct vine_resource_box {
+	double cores;
+	double memory;
+	double disk;
+	double gpus;
+};
+
 struct vine_resources * vine_resources_create();
 void vine_resources_delete( struct vine_resources *r );
 void vine_resources_debug( struct vine_resources *r );
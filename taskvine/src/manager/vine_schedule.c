@@ -10,10 +10,12 @@ See the file COPYING for details.
 #include "vine_file.h"
 #include "vine_file_replica.h"
 #include "vine_mount.h"
+#include "vine_worker_index.h"
 
 #include "debug.h"
 #include "hash_table.h"
 #include "list.h"
+#include "macros.h"
 #include "rmonitor_types.h"
 #include "rmsummary.h"
 
@@ -62,9 +64,58 @@ static struct vine_task *find_library_on_worker_for_task(
 	return 0;
 }
 
+/*
+Determine whether the worker may receive any task at all: it is not blocked,
+and its factory (if any) does not have too many connected workers.
+These checks require hash table lookups, so the answer is cached at the
+worker and recomputed only when q->worker_eligibility_epoch changes,
+which happens when a host is blocked or unblocked, or a factory changes.
+*/
+
+static int check_worker_eligibility(struct vine_manager *q, struct vine_worker_info *w)
+{
+	if (w->eligibility_epoch == q->worker_eligibility_epoch) {
+		return w->eligible;
+	}
+
+	int eligible = 1;
+
+	/* Don't send tasks if the factory is used and has too many connected workers. */
+	if (w->factory_name) {
+		struct vine_factory_info *f = vine_factory_info_lookup(q, w->factory_name);
+		if (f && f->connected_workers > f->max_workers)
+			eligible = 0;
+	}
+
+	/* Check if worker is blocked from the manager. */
+	if (vine_blocklist_is_blocked(q, w->hostname)) {
+		eligible = 0;
+	}
+
+	w->eligible = eligible;
+	w->eligibility_epoch = q->worker_eligibility_epoch;
+
+	return eligible;
+}
+
+/*
+Compute the resources of the task that do not depend on the worker,
+so that evaluating each candidate worker in check_worker_against_task
+does not need to consult the task category nor allocate any memory.
+Must be called before check_worker_against_task for each scheduling attempt.
+*/
+
+void vine_schedule_prepare_task(struct vine_manager *q, struct vine_task *t)
+{
+	/* Note that min must be computed before max, as both share the category internal state. */
+	vine_resource_box_from_rmsummary(&t->scheduling_min, vine_manager_task_resources_min(q, t));
+	vine_resource_box_from_rmsummary(&t->scheduling_max, vine_manager_task_resources_max(q, t));
+}
+
 /* Check if this task is compatible with this given worker by considering
  * resources availability, features, blocklist, and all other relevant factors.
  * Used by all scheduling methods for basic compatibility.
+ * The task must have been prepared with @ref vine_schedule_prepare_task.
  * @param q The manager structure.
  * @param w The worker info structure.
  * @param t The task structure.
@@ -83,15 +134,8 @@ int check_worker_against_task(struct vine_manager *q, struct vine_worker_info *w
 		return 0;
 	}
 
-	/* Don't send tasks if the factory is used and has too many connected workers. */
-	if (w->factory_name) {
-		struct vine_factory_info *f = vine_factory_info_lookup(q, w->factory_name);
-		if (f && f->connected_workers > f->max_workers)
-			return 0;
-	}
-
-	/* Check if worker is blocked from the manager. */
-	if (vine_blocklist_is_blocked(q, w->hostname)) {
+	/* Blocklist and factory limits. */
+	if (!check_worker_eligibility(q, w)) {
 		return 0;
 	}
 
@@ -108,32 +152,31 @@ int check_worker_against_task(struct vine_manager *q, struct vine_worker_info *w
 	}
 
 	/* Compute the resources to allocate to this task. */
-	struct rmsummary *l = vine_manager_choose_resources_for_task(q, w, t);
+	struct vine_resource_box l;
+	vine_manager_choose_resource_box(q, w, &t->scheduling_min, &t->scheduling_max, &l);
 
 	struct vine_resources *r = w->resources;
 	int ok = 1;
 
 	/* Make sure worker has available resources to run this task. */
-	if (r->disk.inuse + l->disk > r->disk.total) { /* No overcommit disk */
+	if (r->disk.inuse + l.disk > r->disk.total) { /* No overcommit disk */
 		ok = 0;
 	}
 
-	if ((l->cores > r->cores.total) ||
-			(r->cores.inuse + l->cores > overcommitted_resource_total(q, r->cores.total))) {
+	if ((l.cores > r->cores.total) ||
+			(r->cores.inuse + l.cores > overcommitted_resource_total(q, r->cores.total))) {
 		ok = 0;
 	}
 
-	if ((l->memory > r->memory.total) ||
-			(r->memory.inuse + l->memory > overcommitted_resource_total(q, r->memory.total))) {
+	if ((l.memory > r->memory.total) ||
+			(r->memory.inuse + l.memory > overcommitted_resource_total(q, r->memory.total))) {
 		ok = 0;
 	}
 
-	if ((l->gpus > r->gpus.total) || (r->gpus.inuse + l->gpus > overcommitted_resource_total(q, r->gpus.total))) {
+	if ((l.gpus > r->gpus.total) || (r->gpus.inuse + l.gpus > overcommitted_resource_total(q, r->gpus.total))) {
 		ok = 0;
 	}
 
-	rmsummary_delete(l);
-
 	// if worker's end time has not been received
 	if (w->end_time < 0) {
 		ok = 0;
@@ -174,13 +217,56 @@ int check_worker_against_task(struct vine_manager *q, struct vine_worker_info *w
 	return ok;
 }
 
+/*
+Lower bound on the resources that any allocation for a task may take,
+regardless of the worker on which it lands. vine_manager_choose_resource_box
+never assigns less than the specified maximum or minimum of a resource.
+*/
+
+static void compute_resource_floor(struct vine_task *t, struct vine_resource_box *f)
+{
+	f->cores = MAX(0, MAX(t->scheduling_min.cores, t->scheduling_max.cores));
+	f->memory = MAX(0, MAX(t->scheduling_min.memory, t->scheduling_max.memory));
+	f->disk = MAX(0, MAX(t->scheduling_min.disk, t->scheduling_max.disk));
+	f->gpus = MAX(0, MAX(t->scheduling_min.gpus, t->scheduling_max.gpus));
+}
+
+/* First bucket of the worker index with workers that may have enough free cores. */
+
+static int first_bucket_for_floor(struct vine_resource_box *f)
+{
+	return vine_worker_index_bucket_for_cores((int64_t)ceil(f->cores));
+}
+
+/*
+Quick rejection of a worker without enough free resources for the floor of the task,
+without computing the actual allocation. check_worker_against_task makes the final decision.
+*/
+
+static int worker_may_fit_floor(struct vine_manager *q, struct vine_worker_info *w, struct vine_resource_box *f)
+{
+	struct vine_resources *r = w->resources;
+
+	if (r->disk.inuse + f->disk > r->disk.total)
+		return 0;
+	if (r->cores.inuse + f->cores > overcommitted_resource_total(q, r->cores.total))
+		return 0;
+	if (r->memory.inuse + f->memory > overcommitted_resource_total(q, r->memory.total))
+		return 0;
+	if (r->gpus.inuse + f->gpus > overcommitted_resource_total(q, r->gpus.total))
+		return 0;
+
+	return 1;
+}
+
 /*
 Find the worker that has the largest quantity of cached data needed
 by this task, so as to minimize transfer work that must be done
 by the manager.
 */
 
-static struct vine_worker_info *find_worker_by_files(struct vine_manager *q, struct vine_task *t)
+static struct vine_worker_info *find_worker_by_files(
+		struct vine_manager *q, struct vine_task *t, struct vine_resource_box *f)
 {
 	char *key;
 	struct vine_worker_info *w;
@@ -190,10 +276,14 @@ static struct vine_worker_info *find_worker_by_files(struct vine_manager *q, str
 	uint8_t has_all_files;
 	struct vine_file_replica *remote_info;
 	struct vine_mount *m;
+	int b;
+
+	for (b = first_bucket_for_floor(f); b < VINE_WORKER_INDEX_BUCKETS; b++) {
+		HASH_TABLE_ITERATE(q->worker_index[b], key, w)
+		{
+			if (!worker_may_fit_floor(q, w, f) || !check_worker_against_task(q, w, t))
+				continue;
 
-	HASH_TABLE_ITERATE(q->worker_table, key, w)
-	{
-		if (check_worker_against_task(q, w, t)) {
 			task_cached_bytes = 0;
 			has_all_files = 1;
 
@@ -227,16 +317,22 @@ static struct vine_worker_info *find_worker_by_files(struct vine_manager *q, str
 Find the first available worker in first-come, first-served order.
 Since the order of workers in the hashtable is somewhat arbitrary,
 this amounts to simply "find the first available worker".
+Workers with fewer free cores are considered first.
 */
 
-static struct vine_worker_info *find_worker_by_fcfs(struct vine_manager *q, struct vine_task *t)
+static struct vine_worker_info *find_worker_by_fcfs(
+		struct vine_manager *q, struct vine_task *t, struct vine_resource_box *f)
 {
 	char *key;
 	struct vine_worker_info *w;
-	HASH_TABLE_ITERATE(q->worker_table, key, w)
-	{
-		if (check_worker_against_task(q, w, t)) {
-			return w;
+	int b;
+
+	for (b = first_bucket_for_floor(f); b < VINE_WORKER_INDEX_BUCKETS; b++) {
+		HASH_TABLE_ITERATE(q->worker_index[b], key, w)
+		{
+			if (worker_may_fit_floor(q, w, f) && check_worker_against_task(q, w, t)) {
+				return w;
+			}
 		}
 	}
 	return NULL;
@@ -248,17 +344,21 @@ This works by finding all compatible workers,
 putting them in a list, and then choosing from the list at random.
 */
 
-static struct vine_worker_info *find_worker_by_random(struct vine_manager *q, struct vine_task *t)
+static struct vine_worker_info *find_worker_by_random(
+		struct vine_manager *q, struct vine_task *t, struct vine_resource_box *f)
 {
 	char *key;
 	struct vine_worker_info *w = NULL;
 	int random_worker;
 	struct list *valid_workers = list_create();
+	int b;
 
-	HASH_TABLE_ITERATE(q->worker_table, key, w)
-	{
-		if (check_worker_against_task(q, w, t)) {
-			list_push_tail(valid_workers, w);
+	for (b = first_bucket_for_floor(f); b < VINE_WORKER_INDEX_BUCKETS; b++) {
+		HASH_TABLE_ITERATE(q->worker_index[b], key, w)
+		{
+			if (worker_may_fit_floor(q, w, f) && check_worker_against_task(q, w, t)) {
+				list_push_tail(valid_workers, w);
+			}
 		}
 	}
 
@@ -317,11 +417,13 @@ meaning the worker that will have the most resources
 unused once this task is placed there.
 */
 
-static struct vine_worker_info *find_worker_by_worst_fit(struct vine_manager *q, struct vine_task *t)
+static struct vine_worker_info *find_worker_by_worst_fit(
+		struct vine_manager *q, struct vine_task *t, struct vine_resource_box *f)
 {
 	char *key;
 	struct vine_worker_info *w;
 	struct vine_worker_info *best_worker = NULL;
+	int b;
 
 	struct vine_resources bres;
 	struct vine_resources wres;
@@ -329,10 +431,11 @@ static struct vine_worker_info *find_worker_by_worst_fit(struct vine_manager *q,
 	memset(&bres, 0, sizeof(struct vine_resources));
 	memset(&wres, 0, sizeof(struct vine_resources));
 
-	HASH_TABLE_ITERATE(q->worker_table, key, w)
-	{
-
-		if (check_worker_against_task(q, w, t)) {
+	for (b = first_bucket_for_floor(f); b < VINE_WORKER_INDEX_BUCKETS; b++) {
+		HASH_TABLE_ITERATE(q->worker_index[b], key, w)
+		{
+			if (!worker_may_fit_floor(q, w, f) || !check_worker_against_task(q, w, t))
+				continue;
 
 			// Use total field on bres, wres to indicate free resources.
 			wres.cores.total = w->resources->cores.total - w->resources->cores.inuse;
@@ -356,16 +459,21 @@ If there are no workers avialable that have previously run a task,
 then pick one FCFS.
 */
 
-static struct vine_worker_info *find_worker_by_time(struct vine_manager *q, struct vine_task *t)
+static struct vine_worker_info *find_worker_by_time(
+		struct vine_manager *q, struct vine_task *t, struct vine_resource_box *f)
 {
 	char *key;
 	struct vine_worker_info *w;
 	struct vine_worker_info *best_worker = 0;
 	double best_time = HUGE_VAL;
+	int b;
+
+	for (b = first_bucket_for_floor(f); b < VINE_WORKER_INDEX_BUCKETS; b++) {
+		HASH_TABLE_ITERATE(q->worker_index[b], key, w)
+		{
+			if (!worker_may_fit_floor(q, w, f) || !check_worker_against_task(q, w, t))
+				continue;
 
-	HASH_TABLE_ITERATE(q->worker_table, key, w)
-	{
-		if (check_worker_against_task(q, w, t)) {
 			if (w->total_tasks_complete > 0) {
 				double t = (w->total_task_time + w->total_transfer_time) / w->total_tasks_complete;
 				if (!best_worker || t < best_time) {
@@ -379,7 +487,7 @@ static struct vine_worker_info *find_worker_by_time(struct vine_manager *q, stru
 	if (best_worker) {
 		return best_worker;
 	} else {
-		return find_worker_by_fcfs(q, t);
+		return find_worker_by_fcfs(q, t, f);
 	}
 }
 
@@ -395,18 +503,23 @@ struct vine_worker_info *vine_schedule_task_to_worker(struct vine_manager *q, st
 		a = q->worker_selection_algorithm;
 	}
 
+	vine_schedule_prepare_task(q, t);
+
+	struct vine_resource_box f;
+	compute_resource_floor(t, &f);
+
 	switch (a) {
 	case VINE_SCHEDULE_FILES:
-		return find_worker_by_files(q, t);
+		return find_worker_by_files(q, t, &f);
 	case VINE_SCHEDULE_TIME:
-		return find_worker_by_time(q, t);
+		return find_worker_by_time(q, t, &f);
 	case VINE_SCHEDULE_WORST:
-		return find_worker_by_worst_fit(q, t);
+		return find_worker_by_worst_fit(q, t, &f);
 	case VINE_SCHEDULE_FCFS:
-		return find_worker_by_fcfs(q, t);
+		return find_worker_by_fcfs(q, t, &f);
 	case VINE_SCHEDULE_RAND:
 	default:
-		return find_worker_by_random(q, t);
+		return find_worker_by_random(q, t, &f);
 	}
 }
 
@@ -432,26 +545,26 @@ static vine_resource_bitmask_t is_task_larger_than_worker(
 	}
 
 	vine_resource_bitmask_t set = 0;
-	struct rmsummary *l = vine_manager_choose_resources_for_task(q, w, t);
+	struct vine_resource_box l;
+	vine_manager_choose_resource_box(q, w, &t->scheduling_min, &t->scheduling_max, &l);
 
 	// baseline resurce comparison of worker total resources and a task requested resorces
 
-	if ((double)w->resources->cores.total < l->cores) {
+	if ((double)w->resources->cores.total < l.cores) {
 		set = set | CORES_BIT;
 	}
 
-	if ((double)w->resources->memory.total < l->memory) {
+	if ((double)w->resources->memory.total < l.memory) {
 		set = set | MEMORY_BIT;
 	}
 
-	if ((double)w->resources->disk.total < l->disk) {
+	if ((double)w->resources->disk.total < l.disk) {
 		set = set | DISK_BIT;
 	}
 
-	if ((double)w->resources->gpus.total < l->gpus) {
+	if ((double)w->resources->gpus.total < l.gpus) {
 		set = set | GPUS_BIT;
 	}
-	rmsummary_delete(l);
 
 	return set;
 }
@@ -467,6 +580,8 @@ static vine_resource_bitmask_t is_task_larger_than_any_worker(struct vine_manage
 	char *key;
 	struct vine_worker_info *w;
 
+	vine_schedule_prepare_task(q, t);
+
 	int bit_set = 0;
 	HASH_TABLE_ITERATE(q->worker_table, key, w)
 	{
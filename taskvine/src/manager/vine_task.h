@@ -15,6 +15,7 @@ End user may only use the API described in taskvine.h
 */
 
 #include "taskvine.h"
+#include "vine_resources.h"
 
 #include "list.h"
 #include "category.h"
@@ -100,6 +101,9 @@ struct vine_task {
 	struct rmsummary *resources_measured;                  /**< When monitoring is enabled, it points to the measured resources used by the task in its latest attempt. */
 	struct rmsummary *resources_requested;                 /**< Number of cores, disk, memory, time, etc. the task requires. */
 	struct rmsummary *current_resource_box;                /**< Resources allocated to the task on this specific worker. */
+
+	struct vine_resource_box scheduling_min;               /**< Minimum resources of the task, computed once per scheduling attempt. See @ref vine_schedule_prepare_task. */
+	struct vine_resource_box scheduling_max;               /**< Maximum resources of the task, computed once per scheduling attempt. */
 		
 	int has_fixed_locations;                               /**< Whether at least one file was added with the VINE_FIXED_LOCATION flag. Task fails immediately if no
 															 worker can satisfy all the strict inputs of the task. */
@@ -0,0 +1,116 @@
+/*
+Copyright (C) 2023- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_task_shape.h"
+
+#include "category.h"
+#include "debug.h"
+#include "list.h"
+#include "rmsummary.h"
+#include "xxmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct vine_task_shape {
+	char *category;
+	category_allocation_t resource_request;
+	double cores;
+	double memory;
+	double disk;
+	double gpus;
+};
+
+static void vine_task_shape_delete(struct vine_task_shape *s)
+{
+	if (!s)
+		return;
+	free(s->category);
+	free(s);
+}
+
+/* Only tasks whose fit depends exclusively on resources can be classified by shape. */
+
+static int task_has_shape(struct vine_task *t)
+{
+	if (t->needs_library || t->feature_list || t->has_fixed_locations)
+		return 0;
+
+	if (t->min_running_time > 0 || t->resources_requested->end > 0)
+		return 0;
+
+	return 1;
+}
+
+static int task_matches_shape(struct vine_task *t, struct vine_task_shape *s)
+{
+	struct rmsummary *r = t->resources_requested;
+
+	return s->resource_request == t->resource_request && s->cores == r->cores && s->memory == r->memory &&
+	       s->disk == r->disk && s->gpus == r->gpus && !strcmp(s->category, t->category);
+}
+
+/* Discard the unfit shapes if the workers have changed since they were recorded. */
+
+static void check_epochs(struct vine_manager *q)
+{
+	if (q->unfit_shapes_capacity_epoch == q->worker_capacity_epoch &&
+			q->unfit_shapes_eligibility_epoch == q->worker_eligibility_epoch) {
+		return;
+	}
+
+	vine_task_shape_clear(q);
+
+	q->unfit_shapes_capacity_epoch = q->worker_capacity_epoch;
+	q->unfit_shapes_eligibility_epoch = q->worker_eligibility_epoch;
+}
+
+int vine_task_shape_is_unfit(struct vine_manager *q, struct vine_task *t)
+{
+	check_epochs(q);
+
+	if (list_size(q->unfit_shapes) < 1 || !task_has_shape(t))
+		return 0;
+
+	struct vine_task_shape *s;
+	LIST_ITERATE(q->unfit_shapes, s)
+	{
+		if (task_matches_shape(t, s))
+			return 1;
+	}
+
+	return 0;
+}
+
+void vine_task_shape_mark_unfit(struct vine_manager *q, struct vine_task *t)
+{
+	check_epochs(q);
+
+	if (!task_has_shape(t) || list_size(q->unfit_shapes) >= VINE_TASK_SHAPE_MAX_UNFIT)
+		return;
+
+	/* In bucketing modes the allocation depends on each task, not only on its shape. */
+	struct category *c = vine_category_lookup_or_create(q, t->category);
+	if (category_in_bucketing_mode(c))
+		return;
+
+	struct vine_task_shape *s = malloc(sizeof(*s));
+	s->category = xxstrdup(t->category);
+	s->resource_request = t->resource_request;
+	s->cores = t->resources_requested->cores;
+	s->memory = t->resources_requested->memory;
+	s->disk = t->resources_requested->disk;
+	s->gpus = t->resources_requested->gpus;
+
+	list_push_tail(q->unfit_shapes, s);
+
+	debug(D_VINE, "tasks of category %s like task %d do not fit any worker for now", t->category, t->task_id);
+}
+
+void vine_task_shape_clear(struct vine_manager *q)
+{
+	list_clear(q->unfit_shapes, (void *)vine_task_shape_delete);
+}
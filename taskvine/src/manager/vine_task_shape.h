@@ -0,0 +1,39 @@
+/*
+Copyright (C) 2023- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_TASK_SHAPE_H
+#define VINE_TASK_SHAPE_H
+
+/*
+Tasks in the ready list are grouped into classes by their "shape":
+the category, the kind of resource request, and the resources requested.
+Tasks of the same shape have the same allocation at any given worker,
+thus when one of them does not fit any connected worker, the rest
+can be skipped by the scheduler without evaluating them.
+
+The manager keeps the list of shapes known not to fit. The list is
+discarded whenever q->worker_capacity_epoch or q->worker_eligibility_epoch
+change, i.e. whenever a worker may fit more tasks than before (a task is
+reaped, a worker joins, reports new resources or is undrained) or the
+eligibility of any worker changes. Dispatching a task only takes resources
+away, so it keeps the list.
+
+Tasks that can be rejected by a worker for reasons other than resources
+(e.g. features, libraries, fixed locations, or time limits) are never
+classified, and are always evaluated individually.
+*/
+
+#include "vine_manager.h"
+#include "vine_task.h"
+
+/* Maximum number of unfit shapes remembered between changes to the workers. */
+#define VINE_TASK_SHAPE_MAX_UNFIT 64
+
+int vine_task_shape_is_unfit(struct vine_manager *q, struct vine_task *t);
+void vine_task_shape_mark_unfit(struct vine_manager *q, struct vine_task *t);
+void vine_task_shape_clear(struct vine_manager *q);
+
+#endif
@@ -0,0 +1,91 @@
+/*
+Copyright (C) 2023- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_worker_index.h"
+
+#include "debug.h"
+#include "hash_table.h"
+
+#include <stdlib.h>
+
+void vine_worker_index_create(struct vine_manager *q)
+{
+	int b;
+	q->worker_index = calloc(VINE_WORKER_INDEX_BUCKETS, sizeof(struct hash_table *));
+	for (b = 0; b < VINE_WORKER_INDEX_BUCKETS; b++) {
+		q->worker_index[b] = hash_table_create(0, 0);
+	}
+}
+
+void vine_worker_index_delete(struct vine_manager *q)
+{
+	int b;
+	for (b = 0; b < VINE_WORKER_INDEX_BUCKETS; b++) {
+		hash_table_clear(q->worker_index[b], 0);
+		hash_table_delete(q->worker_index[b]);
+	}
+	free(q->worker_index);
+	q->worker_index = 0;
+}
+
+/* Bucket that holds workers with this many free cores. */
+
+int vine_worker_index_bucket_for_cores(int64_t cores)
+{
+	int b = 0;
+
+	while (cores > 0 && b < VINE_WORKER_INDEX_BUCKETS - 1) {
+		cores >>= 1;
+		b++;
+	}
+
+	return b;
+}
+
+void vine_worker_index_remove(struct vine_manager *q, struct vine_worker_info *w)
+{
+	if (w->index_bucket < 0)
+		return;
+
+	hash_table_remove(q->worker_index[w->index_bucket], w->hashkey);
+	w->index_bucket = -1;
+}
+
+/*
+Place the worker in the bucket corresponding to its current free cores.
+Workers that have not yet reported resources are not indexed, as
+they cannot run any task.
+*/
+
+void vine_worker_index_update(struct vine_manager *q, struct vine_worker_info *w)
+{
+	struct vine_resources *r = w->resources;
+
+	if (w->type != VINE_WORKER_TYPE_WORKER || r->tag < 0 || r->workers.total < 1) {
+		vine_worker_index_remove(q, w);
+		return;
+	}
+
+	int64_t free_cores = overcommitted_resource_total(q, r->cores.total) - r->cores.inuse;
+	int b = vine_worker_index_bucket_for_cores(free_cores);
+
+	if (b == w->index_bucket)
+		return;
+
+	vine_worker_index_remove(q, w);
+	hash_table_insert(q->worker_index[b], w->hashkey, w);
+	w->index_bucket = b;
+}
+
+/* Recompute the buckets of all workers, e.g. when the overcommit multiplier changes. */
+
+void vine_worker_index_rebuild(struct vine_manager *q)
+{
+	char *key;
+	struct vine_worker_info *w;
+
+	HASH_TABLE_ITERATE(q->worker_table, key, w) { vine_worker_index_update(q, w); }
+}
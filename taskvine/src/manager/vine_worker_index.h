@@ -0,0 +1,33 @@
+/*
+Copyright (C) 2023- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_WORKER_INDEX_H
+#define VINE_WORKER_INDEX_H
+
+/*
+Index of connected workers, bucketed by the number of cores still available
+at each worker, so that the scheduler only examines workers that could
+possibly fit a task. Bucket zero holds the workers without free cores,
+and bucket k > 0 holds the workers with free cores in [2^(k-1), 2^k).
+Each bucket is a hash table mapping the worker hashkey -> vine_worker_info,
+which is updated every time the resources of a worker are recounted.
+*/
+
+#include "vine_manager.h"
+#include "vine_worker_info.h"
+
+#define VINE_WORKER_INDEX_BUCKETS 32
+
+void vine_worker_index_create(struct vine_manager *q);
+void vine_worker_index_delete(struct vine_manager *q);
+
+void vine_worker_index_update(struct vine_manager *q, struct vine_worker_info *w);
+void vine_worker_index_remove(struct vine_manager *q, struct vine_worker_info *w);
+void vine_worker_index_rebuild(struct vine_manager *q);
+
+int vine_worker_index_bucket_for_cores(int64_t cores);
+
+#endif
@@ -27,6 +27,7 @@ struct vine_worker_info *vine_worker_create(struct link *lnk)
 	w->version = strdup("unknown");
 	w->factory_name = 0;
 	w->workerid = 0;
+	w->index_bucket = -1;
 
 	w->resources = vine_resources_create();
 	w->features = hash_table_create(4, 0);
@@ -38,6 +39,9 @@ struct vine_worker_info *vine_worker_create(struct link *lnk)
 	w->start_time = timestamp_get();
 	w->end_time = -1;
 
+	w->eligible = 0;
+	w->eligibility_epoch = -1;
+
 	w->last_update_msg_time = w->start_time;
 
 	return w;
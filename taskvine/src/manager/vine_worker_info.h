@@ -41,6 +41,9 @@ struct vine_worker_info {
 	/* Hash key used to locally identify this worker. */
 	char *hashkey;
 
+	/* Bucket of the manager's worker index holding this worker, or -1 if not indexed. */
+	int index_bucket;
+
 	/* Address and port where this worker will accept transfers from peers. */
 	char transfer_addr[LINK_ADDRESS_MAX];
 	int  transfer_port;
@@ -52,6 +55,8 @@ struct vine_worker_info {
 	                                        // 0 otherwise. A 2nd task triggering disconnection will cause the worker to disconnect
 	int64_t     end_time;                   // epoch time (in seconds) at which the worker terminates
 	                                        // If -1, means the worker has not reported in. If 0, means no limit.
+	int  eligible;                          // if 0, worker is blocked, or its factory is over quota.
+	int64_t     eligibility_epoch;          // value of q->worker_eligibility_epoch when eligible was computed.
 
 	/* Resources and features that describe this worker. */
 	struct vine_resources *resources;
@@ -62,6 +67,12 @@ struct vine_worker_info {
 	struct hash_table   *current_files;
 	struct itable       *current_tasks;
 
+	/* Outputs of completed tasks being brought back from this worker, see vine_manager_get.h */
+	struct vine_retrieval *retrieval;
+
+	/* Data queued to be sent to this worker, see vine_manager_put.h */
+	struct vine_upload *upload;
+
 	/* Accumulated stats about tasks about this worker. */
 	int         finished_tasks;
 	int64_t     total_tasks_complete;
@@ -0,0 +1,145 @@
+/*
+Copyright (C) 2023- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Exercise the persistent cache of file checksums: a manager loads the
+cache named by VINE_CHECKSUM_CACHE, uses the entries of unchanged
+files, ignores stale entries, and on deletion saves the cache without
+the entries of files that no longer exist.
+*/
+
+#include "taskvine.h"
+#include "vine_checksum.h"
+
+#include "debug.h"
+#include "md5.h"
+#include "stringtools.h"
+#include "xxmalloc.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FAKE_HASH "0123456789abcdef0123456789abcdef"
+
+static char *create_file(const char *dir, const char *name, const char *data)
+{
+	char *path = string_format("%s/%s", dir, name);
+	FILE *file = fopen(path, "w");
+	assert(file);
+	fputs(data, file);
+	fclose(file);
+	return path;
+}
+
+static void write_entry(FILE *file, const char *hash, const char *path, time_t mtime_offset)
+{
+	struct stat info;
+	assert(!lstat(path, &info));
+	fprintf(file,
+			"%s %lld %lld %lld %lld %lld %s\n",
+			hash,
+			(long long)info.st_dev,
+			(long long)info.st_ino,
+			(long long)info.st_size,
+			(long long)info.st_mtime + mtime_offset,
+			(long long)info.st_ctime,
+			path);
+}
+
+static void check_checksum(const char *path, const char *expected)
+{
+	ssize_t size = 0;
+	char *hash = vine_checksum_any(path, &size);
+	assert(hash);
+	assert(!strcmp(hash, expected));
+	free(hash);
+}
+
+/* Return the hash saved for path in the cache file, or null. */
+
+static char *saved_hash(const char *cache, const char *path)
+{
+	FILE *file = fopen(cache, "r");
+	assert(file);
+
+	char line[PATH_MAX + 256];
+	char *result = 0;
+
+	while (fgets(line, sizeof(line), file)) {
+		string_chomp(line);
+		char *name = strrchr(line, ' ');
+		if (name && !strcmp(name + 1, path)) {
+			free(result);
+			result = xxstrdup(strtok(line, " "));
+		}
+	}
+
+	fclose(file);
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	char cwd[PATH_MAX];
+	unsigned char digest[MD5_DIGEST_LENGTH];
+
+	debug_config(argv[0]);
+
+	assert(getcwd(cwd, sizeof(cwd)));
+	char *dir = string_format("%s/vine_checksum_test.dir", cwd);
+	mkdir(dir, 0755);
+
+	char *cache = string_format("%s/checksums", dir);
+	char *unchanged = create_file(dir, "unchanged", "unchanged\n");
+	char *stale = create_file(dir, "stale", "stale\n");
+	char *removed = create_file(dir, "removed", "removed\n");
+	char *missing = string_format("%s/missing", dir);
+
+	/* Files changed in the second they are read are not cached. */
+	sleep(1);
+
+	FILE *file = fopen(cache, "w");
+	assert(file);
+	write_entry(file, FAKE_HASH, unchanged, 0);
+	write_entry(file, FAKE_HASH, stale, -10);
+	write_entry(file, FAKE_HASH, removed, 0);
+	fprintf(file, "%s 1 2 3 4 5 %s\n", FAKE_HASH, missing);
+	fclose(file);
+
+	setenv("VINE_CHECKSUM_CACHE", cache, 1);
+	struct vine_manager *q = vine_create(0);
+	assert(q);
+
+	/* An entry matching the file is used instead of reading it... */
+	check_checksum(unchanged, FAKE_HASH);
+
+	/* ...but a stale one is not. */
+	md5_buffer("stale\n", 6, digest);
+	check_checksum(stale, md5_to_string(digest));
+
+	unlink(removed);
+	vine_delete(q);
+
+	/* The new checksum is saved, and files that are gone are dropped. */
+	char *hash = saved_hash(cache, unchanged);
+	assert(hash && !strcmp(hash, FAKE_HASH));
+	free(hash);
+
+	hash = saved_hash(cache, stale);
+	assert(hash && !strcmp(hash, md5_to_string(digest)));
+	free(hash);
+
+	assert(!saved_hash(cache, removed));
+	assert(!saved_hash(cache, missing));
+
+	printf("vine_checksum tests passed\n");
+	return 0;
+}
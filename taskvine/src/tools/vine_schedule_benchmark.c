@@ -0,0 +1,196 @@
+/*
+Copyright (C) 2023- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Microbenchmark of the manager scheduler: populates a manager with
+synthetic workers (without connections), and measures the time and
+number of memory allocations of each call to vine_schedule_task_to_worker.
+*/
+
+#include "vine_manager.h"
+#include "vine_schedule.h"
+#include "vine_task.h"
+#include "vine_worker_index.h"
+#include "vine_worker_info.h"
+
+#include "cctools.h"
+#include "debug.h"
+#include "hash_table.h"
+#include "path.h"
+#include "stringtools.h"
+#include "timestamp.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+With glibc we can count the allocations by replacing malloc and friends,
+forwarding the calls to the original implementation.
+*/
+
+#if defined(__GLIBC__)
+#define HAS_ALLOCATION_COUNT 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static int64_t allocation_count = 0;
+
+void *malloc(size_t size)
+{
+	allocation_count++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocation_count++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocation_count++;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) { __libc_free(ptr); }
+#else
+static int64_t allocation_count = -1;
+#endif
+
+static struct vine_worker_info *create_worker(struct vine_manager *q, int i, int cores)
+{
+	struct vine_worker_info *w = vine_worker_create(0);
+
+	w->hashkey = string_format("benchmark-worker-%d", i);
+	w->addrport = string_format("127.0.0.1:%d", 10000 + i);
+	free(w->hostname);
+	w->hostname = string_format("benchmark-host-%d", i);
+	w->type = VINE_WORKER_TYPE_WORKER;
+	w->end_time = 0;
+
+	struct vine_resources *r = w->resources;
+	r->tag = 1;
+	r->workers.total = r->workers.largest = 1;
+	r->cores.total = r->cores.largest = cores;
+	r->memory.total = r->memory.largest = 4096 * cores;
+	r->disk.total = r->disk.largest = 100000;
+	r->gpus.total = r->gpus.largest = 0;
+
+	/* Spread the workers across occupancy levels. */
+	r->cores.inuse = i % (cores + 1);
+	r->memory.inuse = 4096 * r->cores.inuse;
+
+	hash_table_insert(q->worker_table, w->hashkey, w);
+	vine_worker_index_update(q, w);
+
+	return w;
+}
+
+static void show_help(const char *cmd)
+{
+	printf("Usage: %s [options]\n", cmd);
+	printf("Where options are:\n");
+	printf("-w <n>     Number of synthetic workers. (default 3000)\n");
+	printf("-t <n>     Number of scheduling decisions. (default 10000)\n");
+	printf("-c <n>     Cores per worker. (default 16)\n");
+	printf("-C <n>     Cores per task. (default 1)\n");
+	printf("-v         Show version information.\n");
+	printf("-h         Show this help screen.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int nworkers = 3000;
+	int ndecisions = 10000;
+	int worker_cores = 16;
+	int task_cores = 1;
+	int c;
+
+	while ((c = getopt(argc, argv, "w:t:c:C:vh")) != -1) {
+		switch (c) {
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+		case 't':
+			ndecisions = atoi(optarg);
+			break;
+		case 'c':
+			worker_cores = atoi(optarg);
+			break;
+		case 'C':
+			task_cores = atoi(optarg);
+			break;
+		case 'v':
+			cctools_version_print(stdout, argv[0]);
+			return 0;
+		case 'h':
+			show_help(path_basename(argv[0]));
+			return 0;
+		default:
+			show_help(path_basename(argv[0]));
+			return 1;
+		}
+	}
+
+	vine_set_runtime_info_path("vine_schedule_benchmark_info");
+
+	struct vine_manager *q = vine_create(0);
+	if (!q)
+		fatal("couldn't create manager!");
+
+	int i;
+	for (i = 0; i < nworkers; i++) {
+		create_worker(q, i, worker_cores);
+	}
+
+	struct vine_task *t = vine_task_create("true");
+	vine_task_set_cores(t, task_cores);
+	vine_task_set_memory(t, 1024 * task_cores);
+	vine_task_set_disk(t, 1000);
+
+	/* Warm up: the first call creates the task category. */
+	vine_schedule_task_to_worker(q, t);
+
+	int found = 0;
+	int64_t allocations_start = allocation_count;
+	timestamp_t start = timestamp_get();
+
+	for (i = 0; i < ndecisions; i++) {
+		if (vine_schedule_task_to_worker(q, t))
+			found++;
+	}
+
+	timestamp_t elapsed = timestamp_get() - start;
+	int64_t allocations = allocation_count - allocations_start;
+
+	printf("workers:                   %d\n", nworkers);
+	printf("decisions:                 %d (%d found a worker)\n", ndecisions, found);
+	printf("usecs per decision:        %.2lf\n", (double)elapsed / ndecisions);
+#ifdef HAS_ALLOCATION_COUNT
+	printf("allocations per decision:  %.2lf\n", (double)allocations / ndecisions);
+#else
+	printf("allocations per decision:  not available on this platform\n");
+#endif
+
+	/* The synthetic workers have no connection, so remove them before deleting the manager. */
+	char *key;
+	struct vine_worker_info *w;
+	HASH_TABLE_ITERATE(q->worker_table, key, w) { vine_worker_index_remove(q, w); }
+	hash_table_clear(q->worker_table, (void *)vine_worker_delete);
+
+	vine_task_delete(t);
+	vine_delete(q);
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -16,8 +16,10 @@ See the file COPYING for details.
 #include "copy_stream.h"
 #include "debug.h"
 #include "hash_table.h"
+#include "list.h"
 #include "link.h"
 #include "link_auth.h"
+#include "macros.h"
 #include "path_disk_size_info.h"
 #include "stringtools.h"
 #include "timestamp.h"
@@ -26,9 +28,12 @@ See the file COPYING for details.
 
 #include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/fcntl.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -36,8 +41,56 @@ See the file COPYING for details.
 struct vine_cache {
 	struct hash_table *table;
 	char *cache_dir;
+
+	int64_t ready_size;           /* Total size of the entries in VINE_CACHE_STATUS_READY. */
+	int64_t ready_count;          /* Number of the entries in VINE_CACHE_STATUS_READY. */
+	int64_t ready_added_size;     /* Total size of all the entries that have become ready... */
+	int64_t ready_added_count;    /* ...and their number, never decremented. */
+	struct hash_table *evicted;   /* Names evicted by the worker and not added or removed since... */
+	struct list *evicted_order;   /* ...the last VINE_CACHE_EVICTED_MAX of them, oldest first. */
+	vine_cache_eviction_t eviction;
+	int high_watermark;           /* Start evicting above this percent of the capacity... */
+	int low_watermark;            /* ...and stop below this percent. */
+	double gdsf_clock;            /* Priority of the last entry evicted by VINE_CACHE_EVICT_GDSF. */
+	timestamp_t evict_stuck_time; /* When the last eviction could not reach the low watermark, or zero... */
+	int64_t evict_stuck_added;    /* ...and ready_added_size at that time. */
+
+	int max_transfers;            /* Maximum number of transfer threads. */
+	int transfer_count;           /* Number of transfers started, to give each a distinct temporary path. */
+	pthread_t main_thread;
+	pthread_t *transfer_threads;
+	int transfer_nthreads;
+	int transfer_idle;            /* Threads waiting for a transfer to start. */
+	int transfer_stop;
+	struct list *transfers_waiting;
+	struct list *transfers_done;
+	pthread_mutex_t transfer_mutex;
+	pthread_cond_t transfer_cond;
+};
+
+/*
+Transfers from peer workers are carried out by a pool of threads
+in the worker process, rather than by a child process per file.
+A thread only receives the item into a temporary path: the cache
+table is changed by the main thread alone, when vine_cache_wait
+collects the finished transfers.
+*/
+
+struct vine_cache_transfer {
+	char *cachename;
+	char *source;
+	char *transfer_path;
+	struct link *link;    /* Connection to the peer, while it is open. */
+	int cancelled;        /* The entry was removed, and the result is discarded. */
+	int result;
+	int64_t size;
+	char *error_message;
 };
 
+/* The authentication of links uses static buffers, so it is done by one thread at a time. */
+
+static pthread_mutex_t transfer_auth_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 struct vine_cache_file {
 	vine_cache_type_t type;
 	timestamp_t start_time;
@@ -49,10 +102,27 @@ struct vine_cache_file {
 	int status;
 	struct vine_task *mini_task;
 	struct vine_process *process;
+	struct vine_cache_transfer *transfer;
+
+	int pins;                     /* Number of tasks at this worker that use this entry. */
+	int64_t hits;                 /* Number of tasks that have used this entry. */
+	timestamp_t last_access;
+	double priority;              /* Eviction priority for VINE_CACHE_EVICT_GDSF. */
+};
+
+/* An entry considered for eviction, sorted by the eviction policy. */
+
+struct vine_cache_candidate {
+	const char *cachename;
+	struct vine_cache_file *file;
 };
 
 static void vine_cache_wait_for_file(
 		struct vine_cache *c, struct vine_cache_file *f, const char *cachename, struct link *manager);
+static void vine_cache_check_outputs(
+		struct vine_cache *c, struct vine_cache_file *f, const char *cachename, struct link *manager);
+static void vine_cache_cancel_transfer(struct vine_cache *c, struct vine_cache_transfer *t);
+static void vine_cache_stop_transfers(struct vine_cache *c);
 
 struct vine_cache_file *vine_cache_file_create(
 		vine_cache_type_t type, const char *source, int64_t actual_size, int mode, struct vine_task *mini_task)
@@ -66,8 +136,13 @@ struct vine_cache_file *vine_cache_file_create(
 	f->status = VINE_CACHE_STATUS_NOT_PRESENT;
 	f->mini_task = mini_task;
 	f->process = 0;
+	f->transfer = 0;
 	f->start_time = 0;
 	f->stop_time = 0;
+	f->pins = 0;
+	f->hits = 0;
+	f->last_access = 0;
+	f->priority = 0;
 	return f;
 }
 
@@ -92,9 +167,129 @@ struct vine_cache *vine_cache_create(const char *cache_dir)
 	struct vine_cache *c = malloc(sizeof(*c));
 	c->cache_dir = strdup(cache_dir);
 	c->table = hash_table_create(0, 0);
+	c->ready_size = 0;
+	c->ready_count = 0;
+	c->ready_added_size = 0;
+	c->ready_added_count = 0;
+	c->evicted = hash_table_create(0, 0);
+	c->evicted_order = list_create();
+	c->eviction = VINE_CACHE_EVICT_LRU;
+	c->high_watermark = VINE_CACHE_HIGH_WATERMARK_DEFAULT;
+	c->low_watermark = VINE_CACHE_LOW_WATERMARK_DEFAULT;
+	c->gdsf_clock = 0;
+	c->evict_stuck_time = 0;
+	c->evict_stuck_added = 0;
+	c->max_transfers = VINE_CACHE_MAX_TRANSFERS_DEFAULT;
+	c->transfer_count = 0;
+	c->main_thread = pthread_self();
+	c->transfer_threads = 0;
+	c->transfer_nthreads = 0;
+	c->transfer_idle = 0;
+	c->transfer_stop = 0;
+	c->transfers_waiting = list_create();
+	c->transfers_done = list_create();
+	pthread_mutex_init(&c->transfer_mutex, 0);
+	pthread_cond_init(&c->transfer_cond, 0);
 	return c;
 }
 
+/*
+Set the maximum number of transfers from peer workers in progress at once.
+Must be called before any transfer is started.
+*/
+
+void vine_cache_set_max_transfers(struct vine_cache *c, int max_transfers)
+{
+	c->max_transfers = MAX(max_transfers, 1);
+}
+
+/*
+Select the eviction policy and the watermarks, as percents of the
+capacity given to vine_cache_evict.
+*/
+
+void vine_cache_set_eviction(struct vine_cache *c, vine_cache_eviction_t eviction, int high, int low)
+{
+	c->eviction = eviction;
+	c->high_watermark = high;
+	c->low_watermark = MIN(low, high);
+}
+
+/*
+Parse the name of an eviction policy, returning -1 if unknown.
+*/
+
+int vine_cache_eviction_from_string(const char *name)
+{
+	if (!strcmp(name, "none")) {
+		return VINE_CACHE_EVICT_NONE;
+	} else if (!strcmp(name, "lru")) {
+		return VINE_CACHE_EVICT_LRU;
+	} else if (!strcmp(name, "lfu")) {
+		return VINE_CACHE_EVICT_LFU;
+	} else if (!strcmp(name, "gdsf")) {
+		return VINE_CACHE_EVICT_GDSF;
+	} else {
+		return -1;
+	}
+}
+
+/* Change the status of an entry, keeping track of the size of the ready entries. */
+
+static void vine_cache_set_status(struct vine_cache *c, struct vine_cache_file *f, vine_cache_status_t status)
+{
+	if (f->status == VINE_CACHE_STATUS_READY) {
+		c->ready_size -= f->actual_size;
+		c->ready_count--;
+	}
+	f->status = status;
+	if (f->status == VINE_CACHE_STATUS_READY) {
+		c->ready_size += f->actual_size;
+		c->ready_count++;
+		c->ready_added_size += f->actual_size;
+		c->ready_added_count++;
+	}
+}
+
+/* Arriving in the cache counts as a use, for the purpose of eviction. */
+
+static void vine_cache_touch(struct vine_cache *c, struct vine_cache_file *f)
+{
+	f->last_access = timestamp_get();
+	f->priority = c->gdsf_clock + (double)(f->hits + 1) / MAX(f->actual_size, 1);
+}
+
+/*
+Remember that a name was evicted, so that a task that arrives needing
+it can be returned to the manager. Only tasks sent before the manager
+received the cache-invalid message need it, so just the most recent
+evictions are remembered. The table refers to the copy of the name in
+the list, which may also hold older copies of names evicted again.
+*/
+
+static void vine_cache_evicted_add(struct vine_cache *c, const char *cachename)
+{
+	char *name = xxstrdup(cachename);
+	list_push_tail(c->evicted_order, name);
+	hash_table_insert(c->evicted, name, name);
+
+	while (list_size(c->evicted_order) > VINE_CACHE_EVICTED_MAX) {
+		char *oldest = list_pop_head(c->evicted_order);
+		if (hash_table_lookup(c->evicted, oldest) == oldest)
+			hash_table_remove(c->evicted, oldest);
+		free(oldest);
+	}
+}
+
+/* Insert a new entry, which is no longer considered evicted. */
+
+static void vine_cache_insert(struct vine_cache *c, const char *cachename, struct vine_cache_file *f)
+{
+	vine_cache_touch(c, f);
+	hash_table_insert(c->table, cachename, f);
+	hash_table_remove(c->evicted, cachename);
+}
+
 /*
 Load existing cache directory into cache structure.
 */
@@ -152,13 +347,20 @@ void vine_cache_scan(struct vine_cache *c, struct link *manager)
 }
 
 /*
-Kill off any process associated with this file object.
+Kill off any process or transfer associated with this file object.
 Used by both vine_cache_remove and vine_cache_delete.
 */
 
 static void vine_cache_kill(
 		struct vine_cache *c, struct vine_cache_file *f, const char *cachename, struct link *manager)
 {
+	if (f->transfer) {
+		vine_cache_cancel_transfer(c, f->transfer);
+		f->transfer = 0;
+		vine_cache_set_status(c, f, VINE_CACHE_STATUS_FAILED);
+		return;
+	}
+
 	while (f->status == VINE_CACHE_STATUS_PROCESSING) {
 		debug(D_VINE, "killing pending transfer process %d...", f->pid);
 		kill(f->pid, SIGKILL);
@@ -175,13 +377,23 @@ Delete the cache manager structure, though not the underlying files.
 */
 void vine_cache_delete(struct vine_cache *c)
 {
-	/* Ensure that all child processes are killed off. */
+	/* Ensure that all child processes and transfers are stopped. */
 	char *cachename;
 	struct vine_cache_file *file;
 	HASH_TABLE_ITERATE(c->table, cachename, file) { vine_cache_kill(c, file, cachename, 0); }
 
+	vine_cache_stop_transfers(c);
+
 	hash_table_clear(c->table, (void *)vine_cache_file_delete);
 	hash_table_delete(c->table);
+	hash_table_delete(c->evicted);
+	list_clear(c->evicted_order, free);
+	list_delete(c->evicted_order);
+	list_delete(c->transfers_waiting);
+	list_delete(c->transfers_done);
+	pthread_mutex_destroy(&c->transfer_mutex);
+	pthread_cond_destroy(&c->transfer_cond);
+	free(c->transfer_threads);
 	free(c->cache_dir);
 	free(c);
 }
@@ -200,18 +412,37 @@ char *vine_cache_full_path(struct vine_cache *c, const char *cachename)
 Add a file to the cache manager (already created in the proper place) and note its size.
 */
 
-int vine_cache_addfile(struct vine_cache *c, int64_t size, int mode, const char *cachename)
+static int vine_cache_add(struct vine_cache *c, vine_cache_type_t type, int64_t size, int mode, const char *cachename)
 {
 	struct vine_cache_file *f = hash_table_lookup(c->table, cachename);
 	if (!f) {
-		f = vine_cache_file_create(VINE_CACHE_FILE, "manager", size, mode, 0);
-		hash_table_insert(c->table, cachename, f);
+		f = vine_cache_file_create(type, type == VINE_CACHE_OUTPUT ? "task" : "manager", size, mode, 0);
+		vine_cache_insert(c, cachename, f);
+	} else {
+		vine_cache_set_status(c, f, VINE_CACHE_STATUS_NOT_PRESENT);
+		f->actual_size = size;
+		vine_cache_touch(c, f);
 	}
 
-	f->status = VINE_CACHE_STATUS_READY;
+	vine_cache_set_status(c, f, VINE_CACHE_STATUS_READY);
 	return 1;
 }
 
+int vine_cache_addfile(struct vine_cache *c, int64_t size, int mode, const char *cachename)
+{
+	return vine_cache_add(c, VINE_CACHE_FILE, size, mode, cachename);
+}
+
+/*
+Add a file created by a task at this worker. It may not exist anywhere
+else, so it is never evicted, only removed on request of the manager.
+*/
+
+int vine_cache_addoutput(struct vine_cache *c, int64_t size, int mode, const char *cachename)
+{
+	return vine_cache_add(c, VINE_CACHE_OUTPUT, size, mode, cachename);
+}
+
 /*
 Return true if the cache contains the requested item.
 */
@@ -229,7 +460,7 @@ This entry will be materialized later in vine_cache_ensure.
 int vine_cache_queue_transfer(struct vine_cache *c, const char *source, const char *cachename, int64_t size, int mode)
 {
 	struct vine_cache_file *f = vine_cache_file_create(VINE_CACHE_TRANSFER, source, size, mode, 0);
-	hash_table_insert(c->table, cachename, f);
+	vine_cache_insert(c, cachename, f);
 	return 1;
 }
 
@@ -242,7 +473,7 @@ int vine_cache_queue_command(
 		struct vine_cache *c, struct vine_task *mini_task, const char *cachename, int64_t size, int mode)
 {
 	struct vine_cache_file *f = vine_cache_file_create(VINE_CACHE_MINI_TASK, "task", size, mode, mini_task);
-	hash_table_insert(c->table, cachename, f);
+	vine_cache_insert(c, cachename, f);
 	return 1;
 }
 
@@ -252,12 +483,16 @@ Remove a named item from the cache, regardless of its type.
 
 int vine_cache_remove(struct vine_cache *c, const char *cachename, struct link *manager)
 {
+	/* Once the manager removes an evicted name, it no longer expects it here. */
+	hash_table_remove(c->evicted, cachename);
+
 	struct vine_cache_file *f = hash_table_remove(c->table, cachename);
 	if (!f)
 		return 0;
 
 	/* Ensure that any child process associated with the entry is stopped. */
 	vine_cache_kill(c, f, cachename, manager);
+	vine_cache_set_status(c, f, VINE_CACHE_STATUS_NOT_PRESENT);
 
 	/* Then remove the disk state associated with the file. */
 	char *cache_path = vine_cache_full_path(c, cachename);
@@ -270,6 +505,234 @@ int vine_cache_remove(struct vine_cache *c, const char *cachename, struct link *
 	return 1;
 }
 
+/*
+Note that a task at this worker uses an entry, which keeps it from
+being evicted until the task is gone and vine_cache_unpin is called.
+*/
+
+int vine_cache_pin(struct vine_cache *c, const char *cachename)
+{
+	struct vine_cache_file *f = hash_table_lookup(c->table, cachename);
+	if (!f)
+		return 0;
+
+	f->pins++;
+	f->hits++;
+	vine_cache_touch(c, f);
+
+	return 1;
+}
+
+void vine_cache_unpin(struct vine_cache *c, const char *cachename)
+{
+	struct vine_cache_file *f = hash_table_lookup(c->table, cachename);
+	if (f && f->pins > 0)
+		f->pins--;
+}
+
+/*
+Pin all the inputs of a task. Returns false if some input was evicted
+by this worker, in which case the manager must send it again, and no
+input is left pinned.
+*/
+
+int vine_cache_pin_task(struct vine_cache *c, struct vine_task *t)
+{
+	if (!t->input_mounts)
+		return 1;
+
+	struct vine_mount *m;
+	LIST_ITERATE(t->input_mounts, m)
+	{
+		const char *cachename = m->file->cached_name;
+		if (!vine_cache_pin(c, cachename) && hash_table_lookup(c->evicted, cachename))
+			break;
+	}
+
+	if (!m)
+		return 1;
+
+	/* Release the pins taken before the evicted input. */
+	struct vine_mount *evicted = m;
+	LIST_ITERATE(t->input_mounts, m)
+	{
+		if (m == evicted)
+			break;
+		vine_cache_unpin(c, m->file->cached_name);
+	}
+
+	return 0;
+}
+
+void vine_cache_unpin_task(struct vine_cache *c, struct vine_task *t)
+{
+	if (t->input_mounts) {
+		struct vine_mount *m;
+		LIST_ITERATE(t->input_mounts, m) { vine_cache_unpin(c, m->file->cached_name); }
+	}
+}
+
+/*
+Only files that can be sent again by the manager may be evicted.
+Outputs of tasks and temporary files may be the only copy.
+Recently used files are kept, since the manager sends the inputs of
+a task before the task itself.
+*/
+
+static int vine_cache_evictable(const char *cachename, struct vine_cache_file *f, timestamp_t now)
+{
+	return f->status == VINE_CACHE_STATUS_READY && f->pins == 0 && f->type != VINE_CACHE_OUTPUT &&
+	       !string_prefix_is(cachename, "temp-") && now - f->last_access > VINE_CACHE_EVICT_MIN_AGE;
+}
+
+static int compare_lru(const void *a, const void *b)
+{
+	const struct vine_cache_file *x = ((const struct vine_cache_candidate *)a)->file;
+	const struct vine_cache_file *y = ((const struct vine_cache_candidate *)b)->file;
+
+	return (x->last_access > y->last_access) - (x->last_access < y->last_access);
+}
+
+static int compare_lfu(const void *a, const void *b)
+{
+	const struct vine_cache_file *x = ((const struct vine_cache_candidate *)a)->file;
+	const struct vine_cache_file *y = ((const struct vine_cache_candidate *)b)->file;
+
+	if (x->hits != y->hits)
+		return x->hits < y->hits ? -1 : 1;
+
+	return compare_lru(a, b);
+}
+
+static int compare_gdsf(const void *a, const void *b)
+{
+	const struct vine_cache_file *x = ((const struct vine_cache_candidate *)a)->file;
+	const struct vine_cache_file *y = ((const struct vine_cache_candidate *)b)->file;
+
+	if (x->priority != y->priority)
+		return x->priority < y->priority ? -1 : 1;
+
+	return compare_lru(a, b);
+}
+
+/*
+Return the number of bytes taken by the entries ready in the cache,
+as recorded when each entry was added, without looking at the disk.
+*/
+
+int64_t vine_cache_size(struct vine_cache *c)
+{
+	return c->ready_size;
+}
+
+/* Return the number of entries ready in the cache. */
+
+int64_t vine_cache_count(struct vine_cache *c)
+{
+	return c->ready_count;
+}
+
+/*
+Return the total size and number of the entries that have become ready
+since the cache was created, whether or not they are still in the cache.
+The worker uses the difference between two calls to tell how much of
+what it found on disk has since been accounted by the cache.
+*/
+
+void vine_cache_added(struct vine_cache *c, int64_t *size, int64_t *count)
+{
+	*size = c->ready_added_size;
+	*count = c->ready_added_count;
+}
+
+/*
+If the ready entries take more than the high watermark of capacity
+bytes, evict unpinned entries in the order of the eviction policy
+until they take less than the low watermark. The manager is told of
+each eviction with a cache-invalid message. Returns the number of
+entries evicted.
+
+This is called on every pass of the worker loop. If the last attempt
+could not reach the low watermark because the remaining entries were
+in use, it is not tried again until the cache grows, or until
+VINE_CACHE_EVICT_INTERVAL has passed for entries to become evictable.
+*/
+
+int vine_cache_evict(struct vine_cache *c, int64_t capacity, struct link *manager)
+{
+	if (c->eviction == VINE_CACHE_EVICT_NONE || capacity <= 0)
+		return 0;
+
+	if (c->ready_size <= capacity / 100 * c->high_watermark)
+		return 0;
+
+	timestamp_t now = timestamp_get();
+
+	if (c->evict_stuck_time && c->evict_stuck_added == c->ready_added_size &&
+			now - c->evict_stuck_time < VINE_CACHE_EVICT_INTERVAL)
+		return 0;
+
+	int64_t target = capacity / 100 * c->low_watermark;
+
+	struct vine_cache_candidate *candidates = xxmalloc(MAX(hash_table_size(c->table), 1) * sizeof(*candidates));
+	int ncandidates = 0;
+
+	char *cachename;
+	struct vine_cache_file *f;
+	HASH_TABLE_ITERATE(c->table, cachename, f)
+	{
+		if (vine_cache_evictable(cachename, f, now)) {
+			candidates[ncandidates].cachename = cachename;
+			candidates[ncandidates].file = f;
+			ncandidates++;
+		}
+	}
+
+	switch (c->eviction) {
+	case VINE_CACHE_EVICT_LFU:
+		qsort(candidates, ncandidates, sizeof(*candidates), compare_lfu);
+		break;
+	case VINE_CACHE_EVICT_GDSF:
+		qsort(candidates, ncandidates, sizeof(*candidates), compare_gdsf);
+		break;
+	default:
+		qsort(candidates, ncandidates, sizeof(*candidates), compare_lru);
+		break;
+	}
+
+	int i;
+	for (i = 0; i < ncandidates && c->ready_size > target; i++) {
+		/* The name is owned by the table, and goes away with the entry. */
+		char *name = xxstrdup(candidates[i].cachename);
+		f = candidates[i].file;
+
+		if (c->eviction == VINE_CACHE_EVICT_GDSF)
+			c->gdsf_clock = f->priority;
+
+		debug(D_VINE, "cache: evicting %s with size %lld", name, (long long)f->actual_size);
+
+		vine_cache_remove(c, name, manager);
+		vine_cache_evicted_add(c, name);
+
+		if (manager)
+			vine_worker_send_cache_invalid(manager, name, "evicted to free space in the cache");
+
+		free(name);
+	}
+
+	if (c->ready_size > target) {
+		debug(D_VINE, "cache: %lld bytes remain, other entries are in use", (long long)c->ready_size);
+		c->evict_stuck_time = now;
+		c->evict_stuck_added = c->ready_added_size;
+	} else {
+		c->evict_stuck_time = 0;
+	}
+
+	free(candidates);
+
+	return i;
+}
+
 /*
 Execute a shell command via popen and capture its output.
 On success, return true.
@@ -344,12 +807,20 @@ static int do_mini_task(struct vine_cache *c, struct vine_cache_file *f, char **
 	}
 }
 
-/*
-Transfer a single input file from a worker url to a local file name.
+static int vine_cache_transfer_auth(struct link *worker_link)
+{
+	pthread_mutex_lock(&transfer_auth_mutex);
+	int result = link_auth_password(worker_link, vine_worker_password, time(0) + 5);
+	pthread_mutex_unlock(&transfer_auth_mutex);
+	return result;
+}
 
+/*
+Transfer a single input file from a worker url to the temporary path of the transfer.
+This runs in a transfer thread, and so must not modify the cache table.
 */
-static int do_worker_transfer(
-		struct vine_cache *c, const char *source_url, const char *cache_path, char **error_message)
+
+static int do_worker_transfer(struct vine_cache *c, struct vine_cache_transfer *t)
 {
 	int port_num;
 	char addr[VINE_LINE_MAX], path[VINE_LINE_MAX];
@@ -357,42 +828,236 @@ static int do_worker_transfer(
 	struct link *worker_link;
 
 	// expect the form: worker://addr:port/path/to/file
-	sscanf(source_url, "worker://%99[^:]:%d/%s", addr, &port_num, path);
-	debug(D_VINE, "Setting up worker transfer file %s", source_url);
+	sscanf(t->source, "worker://%99[^:]:%d/%s", addr, &port_num, path);
+	debug(D_VINE, "Setting up worker transfer file %s", t->source);
 
 	stoptime = time(0) + 15;
 	worker_link = link_connect(addr, port_num, stoptime);
 
 	if (worker_link == NULL) {
-		*error_message = string_format("Could not establish connection with worker at: %s:%d", addr, port_num);
+		t->error_message = string_format("Could not establish connection with worker at: %s:%d", addr, port_num);
 		return 0;
 	}
 
-	if (vine_worker_password) {
-		if (!link_auth_password(worker_link, vine_worker_password, time(0) + 5)) {
-			*error_message =
-					string_format("Could not authenticate to peer worker at %s:%d", addr, port_num);
-			link_close(worker_link);
-			return 0;
+	/* From now on, vine_cache_cancel_transfer may shut down the connection. */
+	pthread_mutex_lock(&c->transfer_mutex);
+	t->link = worker_link;
+	int cancelled = t->cancelled;
+	pthread_mutex_unlock(&c->transfer_mutex);
+
+	int result = 0;
+
+	if (cancelled) {
+		t->error_message = xxstrdup("transfer cancelled");
+	} else if (vine_worker_password && !vine_cache_transfer_auth(worker_link)) {
+		t->error_message = string_format("Could not authenticate to peer worker at %s:%d", addr, port_num);
+	} else if (!vine_transfer_get_any_to_path(worker_link, path, t->transfer_path, &t->size, time(0) + 900)) {
+		/* XXX A fixed timeout of 900 certainly can't be right! */
+		t->error_message = string_format("Could not transfer file %s from worker %s:%d", path, addr, port_num);
+	} else {
+		result = 1;
+	}
+
+	pthread_mutex_lock(&c->transfer_mutex);
+	t->link = 0;
+	pthread_mutex_unlock(&c->transfer_mutex);
+
+	link_close(worker_link);
+
+	return result;
+}
+
+static void vine_cache_transfer_delete(struct vine_cache_transfer *t)
+{
+	free(t->cachename);
+	free(t->source);
+	free(t->transfer_path);
+	free(t->error_message);
+	free(t);
+}
+
+/*
+Transfer threads take transfers in the order they were started,
+and hand them back to the main thread through transfers_done.
+*/
+
+static void *vine_cache_transfer_thread(void *arg)
+{
+	struct vine_cache *c = arg;
+
+	pthread_mutex_lock(&c->transfer_mutex);
+
+	while (1) {
+		struct vine_cache_transfer *t = list_pop_head(c->transfers_waiting);
+		if (!t) {
+			if (c->transfer_stop)
+				break;
+			c->transfer_idle++;
+			pthread_cond_wait(&c->transfer_cond, &c->transfer_mutex);
+			c->transfer_idle--;
+			continue;
+		}
+
+		pthread_mutex_unlock(&c->transfer_mutex);
+		t->result = do_worker_transfer(c, t);
+		pthread_mutex_lock(&c->transfer_mutex);
+
+		list_push_tail(c->transfers_done, t);
+
+		/* Interrupt the wait of the main loop, just as the exit of a transfer process does. */
+		pthread_kill(c->main_thread, SIGCHLD);
+	}
+
+	pthread_mutex_unlock(&c->transfer_mutex);
+
+	return 0;
+}
+
+/*
+Queue a transfer from a peer worker, and start another thread
+if every thread is busy and the limit has not been reached.
+The threads block all signals, which are left to the main thread.
+*/
+
+static void vine_cache_start_transfer(struct vine_cache *c, struct vine_cache_file *f, const char *cachename)
+{
+	struct vine_cache_transfer *t = calloc(1, sizeof(*t));
+	t->cachename = xxstrdup(cachename);
+	t->source = xxstrdup(f->source);
+	char *cache_path = vine_cache_full_path(c, cachename);
+	t->transfer_path = string_format("%s.transfer.%d", cache_path, ++c->transfer_count);
+	free(cache_path);
+
+	f->transfer = t;
+
+	pthread_mutex_lock(&c->transfer_mutex);
+
+	list_push_tail(c->transfers_waiting, t);
+
+	if (list_size(c->transfers_waiting) > c->transfer_idle && c->transfer_nthreads < c->max_transfers) {
+		if (!c->transfer_threads)
+			c->transfer_threads = xxmalloc(c->max_transfers * sizeof(*c->transfer_threads));
+
+		sigset_t all, saved;
+		sigfillset(&all);
+		pthread_sigmask(SIG_BLOCK, &all, &saved);
+		if (pthread_create(&c->transfer_threads[c->transfer_nthreads], 0, vine_cache_transfer_thread, c) == 0) {
+			c->transfer_nthreads++;
+			debug(D_VINE, "cache: started transfer thread %d", c->transfer_nthreads);
+		} else {
+			debug(D_VINE, "cache: could not start a transfer thread: %s", strerror(errno));
 		}
+		pthread_sigmask(SIG_SETMASK, &saved, 0);
 	}
 
-	/* XXX A fixed timeout of 900 certainly can't be right! */
+	pthread_cond_signal(&c->transfer_cond);
 
-	if (!vine_transfer_get_any(worker_link, c, path, time(0) + 900)) {
-		*error_message = string_format("Could not transfer file %s from worker %s:%d", path, addr, port_num);
-		link_close(worker_link);
-		return 0;
+	/* If no thread could be started, carry out the transfer here. */
+	if (c->transfer_nthreads == 0) {
+		list_remove(c->transfers_waiting, t);
+		pthread_mutex_unlock(&c->transfer_mutex);
+		t->result = do_worker_transfer(c, t);
+		pthread_mutex_lock(&c->transfer_mutex);
+		list_push_tail(c->transfers_done, t);
 	}
 
-	link_close(worker_link);
+	pthread_mutex_unlock(&c->transfer_mutex);
+}
 
-	return 1;
+/*
+Cancel the transfer of a removed entry. A transfer not yet taken by a
+thread is simply dropped, otherwise the connection to the peer is shut
+down so that the thread gives up promptly, and the partial result is
+discarded by vine_cache_finish_transfers.
+*/
+
+static void vine_cache_cancel_transfer(struct vine_cache *c, struct vine_cache_transfer *t)
+{
+	pthread_mutex_lock(&c->transfer_mutex);
+
+	if (list_remove(c->transfers_waiting, t)) {
+		vine_cache_transfer_delete(t);
+	} else {
+		debug(D_VINE, "cache: cancelling transfer of %s", t->cachename);
+		t->cancelled = 1;
+		if (t->link)
+			shutdown(link_fd(t->link), SHUT_RDWR);
+	}
+
+	pthread_mutex_unlock(&c->transfer_mutex);
 }
 
 /*
-Transfer a single obejct into the cache,
-whether by worker or via curl.
+Take the transfers finished by the threads, move the items received
+into the cache, and report them like the results of transfer processes.
+*/
+
+static void vine_cache_finish_transfers(struct vine_cache *c, struct link *manager)
+{
+	while (1) {
+		pthread_mutex_lock(&c->transfer_mutex);
+		struct vine_cache_transfer *t = list_pop_head(c->transfers_done);
+		pthread_mutex_unlock(&c->transfer_mutex);
+
+		if (!t)
+			break;
+
+		struct vine_cache_file *f = hash_table_lookup(c->table, t->cachename);
+		if (t->cancelled || !f || f->transfer != t) {
+			trash_file(t->transfer_path);
+			vine_cache_transfer_delete(t);
+			continue;
+		}
+
+		f->transfer = 0;
+		f->stop_time = timestamp_get();
+
+		char *cache_path = vine_cache_full_path(c, t->cachename);
+
+		if (!t->result) {
+			debug(D_VINE, "cache: unable to transfer %s: %s", t->cachename, t->error_message);
+			vine_cache_set_status(c, f, VINE_CACHE_STATUS_FAILED);
+		} else if (rename(t->transfer_path, cache_path) == 0) {
+			debug(D_VINE, "cache: renamed %s to %s", t->transfer_path, cache_path);
+			vine_cache_set_status(c, f, VINE_CACHE_STATUS_READY);
+		} else {
+			debug(D_VINE,
+					"cache: failed to rename %s to %s: %s",
+					t->transfer_path,
+					cache_path,
+					strerror(errno));
+			trash_file(t->transfer_path);
+			vine_cache_set_status(c, f, VINE_CACHE_STATUS_FAILED);
+		}
+
+		free(cache_path);
+
+		vine_cache_check_outputs(c, f, t->cachename, manager);
+		vine_cache_transfer_delete(t);
+	}
+}
+
+/*
+Stop the transfer threads, once every transfer has been cancelled.
+*/
+
+static void vine_cache_stop_transfers(struct vine_cache *c)
+{
+	pthread_mutex_lock(&c->transfer_mutex);
+	c->transfer_stop = 1;
+	pthread_cond_broadcast(&c->transfer_cond);
+	pthread_mutex_unlock(&c->transfer_mutex);
+
+	int i;
+	for (i = 0; i < c->transfer_nthreads; i++)
+		pthread_join(c->transfer_threads[i], 0);
+	c->transfer_nthreads = 0;
+
+	vine_cache_finish_transfers(c, 0);
+}
+
+/*
+Transfer a single object into the cache via curl.
 Use a temporary transfer path while downloading,
 and then rename it into the proper place.
 */
@@ -400,17 +1065,8 @@ and then rename it into the proper place.
 static int do_transfer(struct vine_cache *c, const char *source_url, const char *cache_path, char **error_message)
 {
 	char *transfer_path = string_format("%s.transfer", cache_path);
-	int result = 0;
 
-	if (strncmp(source_url, "worker://", 9) == 0) {
-		result = do_worker_transfer(c, source_url, transfer_path, error_message);
-		if (result) {
-			debug(D_VINE, "received file from worker");
-			rename(cache_path, transfer_path);
-		}
-	} else {
-		result = do_curl_transfer(c, source_url, transfer_path, error_message);
-	}
+	int result = do_curl_transfer(c, source_url, transfer_path, error_message);
 
 	if (result) {
 		if (rename(transfer_path, cache_path) == 0) {
@@ -445,6 +1101,7 @@ static void vine_cache_worker_process(struct vine_cache_file *f, struct vine_cac
 
 	switch (f->type) {
 	case VINE_CACHE_FILE:
+	case VINE_CACHE_OUTPUT:
 		result = 1;
 		break;
 	case VINE_CACHE_TRANSFER:
@@ -509,6 +1166,13 @@ vine_cache_status_t vine_cache_ensure(struct vine_cache *c, const char *cachenam
 
 	f->start_time = timestamp_get();
 
+	if (f->type == VINE_CACHE_TRANSFER && !strncmp(f->source, "worker://", 9)) {
+		debug(D_VINE, "cache: transferring %s to %s", f->source, cachename);
+		vine_cache_set_status(c, f, VINE_CACHE_STATUS_PROCESSING);
+		vine_cache_start_transfer(c, f, cachename);
+		return f->status;
+	}
+
 	debug(D_VINE, "forking transfer process to create %s", cachename);
 
 	if (f->type == VINE_CACHE_MINI_TASK) {
@@ -517,7 +1181,14 @@ vine_cache_status_t vine_cache_ensure(struct vine_cache *c, const char *cachenam
 			debug(D_VINE, "Can't stage input files for task %d.", p->task->task_id);
 			p->task = 0;
 			vine_process_delete(p);
-			f->status = VINE_CACHE_STATUS_FAILED;
+			vine_cache_set_status(c, f, VINE_CACHE_STATUS_FAILED);
+			return f->status;
+		}
+		if (!vine_cache_pin_task(c, f->mini_task)) {
+			debug(D_VINE, "An input of task %d was evicted.", p->task->task_id);
+			p->task = 0;
+			vine_process_delete(p);
+			vine_cache_set_status(c, f, VINE_CACHE_STATUS_FAILED);
 			return f->status;
 		}
 		f->process = p;
@@ -527,10 +1198,10 @@ vine_cache_status_t vine_cache_ensure(struct vine_cache *c, const char *cachenam
 
 	if (f->pid < 0) {
 		debug(D_VINE, "failed to fork transfer process");
-		f->status = VINE_CACHE_STATUS_FAILED;
+		vine_cache_set_status(c, f, VINE_CACHE_STATUS_FAILED);
 		return f->status;
 	} else if (f->pid > 0) {
-		f->status = VINE_CACHE_STATUS_PROCESSING;
+		vine_cache_set_status(c, f, VINE_CACHE_STATUS_PROCESSING);
 		switch (f->type) {
 		case VINE_CACHE_TRANSFER:
 			debug(D_VINE, "cache: transferring %s to %s", f->source, cachename);
@@ -539,6 +1210,7 @@ vine_cache_status_t vine_cache_ensure(struct vine_cache *c, const char *cachenam
 			debug(D_VINE, "cache: creating %s via mini task", cachename);
 			break;
 		case VINE_CACHE_FILE:
+		case VINE_CACHE_OUTPUT:
 			debug(D_VINE, "cache: checking if %s is present in cache", cachename);
 			break;
 		}
@@ -563,15 +1235,14 @@ static void vine_cache_check_outputs(
 	if (f->type == VINE_CACHE_MINI_TASK) {
 
 		if (f->status == VINE_CACHE_STATUS_READY) {
-			if (vine_sandbox_stageout(f->process, c, manager)) {
-				f->status = VINE_CACHE_STATUS_READY;
-			} else {
-				f->status = VINE_CACHE_STATUS_FAILED;
+			if (!vine_sandbox_stageout(f->process, c, manager)) {
+				vine_cache_set_status(c, f, VINE_CACHE_STATUS_FAILED);
 			}
 		}
 
 		/* Clean up the minitask process, but keep the defining task. */
 
+		vine_cache_unpin_task(c, f->mini_task);
 		f->process->task = 0;
 		vine_process_delete(f->process);
 		f->process = 0;
@@ -583,7 +1254,9 @@ static void vine_cache_check_outputs(
 		int64_t nbytes, nfiles;
 		chmod(cache_path, f->mode);
 		if (path_disk_size_info_get(cache_path, &nbytes, &nfiles) == 0) {
+			vine_cache_set_status(c, f, VINE_CACHE_STATUS_NOT_PRESENT);
 			f->actual_size = nbytes;
+			vine_cache_set_status(c, f, VINE_CACHE_STATUS_READY);
 			debug(D_VINE,
 					"cache: created %s with size %lld in %lld usec",
 					cachename,
@@ -591,7 +1264,7 @@ static void vine_cache_check_outputs(
 					(long long)transfer_time);
 		} else {
 			debug(D_VINE, "cache: command succeeded but did not create %s", cachename);
-			f->status = VINE_CACHE_STATUS_FAILED;
+			vine_cache_set_status(c, f, VINE_CACHE_STATUS_FAILED);
 		}
 
 	} else {
@@ -625,7 +1298,7 @@ static void vine_cache_handle_exit_status(struct vine_cache *c, struct vine_cach
 	if (!WIFEXITED(status)) {
 		int sig = WTERMSIG(status);
 		debug(D_VINE, "transfer process (pid %d) exited abnormally with signal %d", f->pid, sig);
-		f->status = VINE_CACHE_STATUS_FAILED;
+		vine_cache_set_status(c, f, VINE_CACHE_STATUS_FAILED);
 	} else {
 		int exit_code = WEXITSTATUS(status);
 		debug(D_VINE,
@@ -635,10 +1308,10 @@ static void vine_cache_handle_exit_status(struct vine_cache *c, struct vine_cach
 				exit_code);
 		if (exit_code == 0) {
 			debug(D_VINE, "transfer process for %s completed", cachename);
-			f->status = VINE_CACHE_STATUS_READY;
+			vine_cache_set_status(c, f, VINE_CACHE_STATUS_READY);
 		} else {
 			debug(D_VINE, "transfer process for %s failed", cachename);
-			f->status = VINE_CACHE_STATUS_FAILED;
+			vine_cache_set_status(c, f, VINE_CACHE_STATUS_FAILED);
 		}
 	}
 
@@ -654,7 +1327,7 @@ static void vine_cache_wait_for_file(
 		struct vine_cache *c, struct vine_cache_file *f, const char *cachename, struct link *manager)
 {
 	int status;
-	if (f->status == VINE_CACHE_STATUS_PROCESSING) {
+	if (f->status == VINE_CACHE_STATUS_PROCESSING && f->pid > 0) {
 		int result = waitpid(f->pid, &status, WNOHANG);
 		if (result == 0) {
 			// process still executing
@@ -668,11 +1341,14 @@ static void vine_cache_wait_for_file(
 }
 
 /*
-Search the cache table to determine if any transfer processes have completed.
+Collect the transfers finished by the threads, and search the cache
+table to determine if any transfer processes have completed.
 */
 
 int vine_cache_wait(struct vine_cache *c, struct link *manager)
 {
+	vine_cache_finish_transfers(c, manager);
+
 	struct vine_cache_file *f;
 	char *cachename;
 	HASH_TABLE_ITERATE(c->table, cachename, f) { vine_cache_wait_for_file(c, f, cachename, manager); }
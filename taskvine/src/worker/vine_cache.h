@@ -16,6 +16,10 @@ transfers or commands are queued and not executed immediately.
 When a task is about to be executed, each input file is checked
 via vine_cache_ensure and downloaded if needed.  This allow
 for file transfers to occur asynchronously of the manager.
+Transfers from peer workers are carried out by threads of the
+worker, up to a maximum number at once, while other transfers
+and commands are carried out by child processes.  Either way,
+the entries created are reported by vine_cache_wait.
 */
 
 #include <stdint.h>
@@ -28,6 +32,7 @@ typedef enum {
 	VINE_CACHE_FILE,
 	VINE_CACHE_TRANSFER,
 	VINE_CACHE_MINI_TASK,
+	VINE_CACHE_OUTPUT,
 } vine_cache_type_t;
 
 typedef enum {
@@ -37,14 +42,52 @@ typedef enum {
 	VINE_CACHE_STATUS_FAILED,       
 } vine_cache_status_t;
 
+/*
+When the cache takes more than a high watermark of the disk, the
+worker evicts files not used by any of its tasks, in the order given
+by the policy, until the cache takes less than a low watermark.
+The manager is told of each eviction with a cache-invalid message.
+*/
+
+typedef enum {
+	VINE_CACHE_EVICT_NONE,
+	VINE_CACHE_EVICT_LRU,  /* Least recently used first. */
+	VINE_CACHE_EVICT_LFU,  /* Least frequently used first. */
+	VINE_CACHE_EVICT_GDSF, /* Greedy dual size frequency: least used per byte first, aged by past evictions. */
+} vine_cache_eviction_t;
+
+#define VINE_CACHE_HIGH_WATERMARK_DEFAULT 90
+#define VINE_CACHE_LOW_WATERMARK_DEFAULT 75
+
+/* Maximum number of transfers from peer workers in progress at once. */
+#define VINE_CACHE_MAX_TRANSFERS_DEFAULT 16
+
+/* Files used in the last few seconds are not evicted (in usecs). */
+#define VINE_CACHE_EVICT_MIN_AGE (5 * 1000000)
+
+/* An eviction that could not free enough space is retried this often, unless the cache grows (in usecs). */
+#define VINE_CACHE_EVICT_INTERVAL (5 * 1000000)
+
+/* Number of evicted names remembered, to return tasks sent before the manager learned of the evictions. */
+#define VINE_CACHE_EVICTED_MAX 10000
+
 struct vine_cache * vine_cache_create( const char *cachedir );
 void vine_cache_delete( struct vine_cache *c );
 void vine_cache_load( struct vine_cache *c );
 void vine_cache_scan( struct vine_cache *c, struct link *manager );
 
+void vine_cache_set_eviction( struct vine_cache *c, vine_cache_eviction_t eviction, int high_watermark, int low_watermark );
+int vine_cache_eviction_from_string( const char *name );
+int vine_cache_evict( struct vine_cache *c, int64_t capacity, struct link *manager );
+void vine_cache_set_max_transfers( struct vine_cache *c, int max_transfers );
+int64_t vine_cache_size( struct vine_cache *c );
+int64_t vine_cache_count( struct vine_cache *c );
+void vine_cache_added( struct vine_cache *c, int64_t *size, int64_t *count );
+
 char *vine_cache_full_path( struct vine_cache *c, const char *cachename );
 
 int vine_cache_addfile( struct vine_cache *c, int64_t size, int mode, const char *cachename );
+int vine_cache_addoutput( struct vine_cache *c, int64_t size, int mode, const char *cachename );
 int vine_cache_queue_transfer( struct vine_cache *c, const char *source, const char *cachename, int64_t size, int mode );
 int vine_cache_queue_command( struct vine_cache *c, struct vine_task *minitask, const char *cachename, int64_t size, int mode );
 vine_cache_status_t vine_cache_ensure( struct vine_cache *c, const char *cachename);
@@ -52,4 +95,9 @@ int vine_cache_remove( struct vine_cache *c, const char *cachename, struct link
 int vine_cache_contains( struct vine_cache *c, const char *cachename );
 int vine_cache_wait( struct vine_cache *c, struct link *manager );
 
+int vine_cache_pin( struct vine_cache *c, const char *cachename );
+void vine_cache_unpin( struct vine_cache *c, const char *cachename );
+int vine_cache_pin_task( struct vine_cache *c, struct vine_task *t );
+void vine_cache_unpin_task( struct vine_cache *c, struct vine_task *t );
+
 #endif
@@ -0,0 +1,190 @@
+/*
+Copyright (C) 2022- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Exercise the eviction of entries from the worker cache: the order of
+each policy, the high and low watermarks, pinned entries, the retry
+of a stuck eviction, a task whose input was evicted, and the bound on
+the evicted names remembered.
+Entries are added without files, as only their recorded size matters.
+*/
+
+#include "vine_cache.h"
+#include "vine_task.h"
+
+#include "debug.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+extern int vine_hack_do_not_compute_cached_name;
+
+static struct vine_cache *create_cache(vine_cache_eviction_t eviction, int n, int64_t size)
+{
+	struct vine_cache *c = vine_cache_create("vine_cache_test.dir");
+	vine_cache_set_eviction(c, eviction, VINE_CACHE_HIGH_WATERMARK_DEFAULT, VINE_CACHE_LOW_WATERMARK_DEFAULT);
+
+	int i;
+	for (i = 0; i < n; i++) {
+		char name[16];
+		snprintf(name, sizeof(name), "e%d", i);
+		vine_cache_addfile(c, size, 0644, name);
+		/* Each entry is added at a distinct time, for a definite LRU order. */
+		usleep(10);
+	}
+
+	return c;
+}
+
+static void use(struct vine_cache *c, const char *name, int times)
+{
+	while (times-- > 0) {
+		assert(vine_cache_pin(c, name));
+		vine_cache_unpin(c, name);
+	}
+}
+
+static void check_present(struct vine_cache *c, const char *present, const char *absent)
+{
+	char name[16];
+	const char *s;
+
+	for (s = present; *s; s++) {
+		snprintf(name, sizeof(name), "e%c", *s);
+		assert(vine_cache_contains(c, name));
+	}
+
+	for (s = absent; *s; s++) {
+		snprintf(name, sizeof(name), "e%c", *s);
+		assert(!vine_cache_contains(c, name));
+	}
+}
+
+/* Pin a task with a single input, as the worker does when the task arrives. */
+
+static int pin_input(struct vine_cache *c, const char *name)
+{
+	struct vine_task *t = vine_task_create("true");
+	vine_task_add_input_file(t, name, "a", 0);
+	int result = vine_cache_pin_task(c, t);
+	if (result)
+		vine_cache_unpin_task(c, t);
+	vine_task_delete(t);
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	debug_config(argv[0]);
+
+	/* Ten entries of 100 bytes each. */
+	struct vine_cache *lru = create_cache(VINE_CACHE_EVICT_LRU, 10, 100);
+	struct vine_cache *lfu = create_cache(VINE_CACHE_EVICT_LFU, 10, 100);
+	struct vine_cache *pinned = create_cache(VINE_CACHE_EVICT_LRU, 10, 100);
+	struct vine_cache *forsaken = create_cache(VINE_CACHE_EVICT_LRU, 10, 100);
+
+	/* More single bytes than evicted names are remembered. */
+	struct vine_cache *bounded = create_cache(VINE_CACHE_EVICT_LRU, VINE_CACHE_EVICTED_MAX + 1000, 1);
+
+	/* Six small entries, and a large one added last. */
+	struct vine_cache *gdsf = create_cache(VINE_CACHE_EVICT_GDSF, 6, 100);
+	vine_cache_addfile(gdsf, 400, 0644, "e6");
+
+	/* The least frequently used are the most recently added. */
+	use(lfu, "e0", 2);
+	use(lfu, "e1", 1);
+	use(lfu, "e2", 1);
+	use(lfu, "e3", 1);
+	use(lfu, "e4", 1);
+
+	assert(vine_cache_pin(pinned, "e0"));
+	int i;
+	for (i = 4; i < 10; i++) {
+		char name[16];
+		snprintf(name, sizeof(name), "e%d", i);
+		assert(vine_cache_pin(pinned, name));
+	}
+
+	/* Recently used entries are not evicted. */
+	assert(vine_cache_evict(lru, 1000, 0) == 0);
+	check_present(lru, "0123456789", "");
+
+	sleep(VINE_CACHE_EVICT_MIN_AGE / 1000000 + 1);
+
+	/* Nothing is evicted up to the high watermark, 90% of 1200 bytes. */
+	assert(vine_cache_evict(lru, 1200, 0) == 0);
+
+	/* Above it, entries are evicted down to the low watermark, 75% of 1100 bytes. */
+	assert(vine_cache_evict(lru, 1100, 0) == 2);
+	assert(vine_cache_size(lru) == 800);
+	check_present(lru, "23456789", "01");
+
+	/* The oldest are evicted first. */
+	assert(vine_cache_evict(lru, 800, 0) == 2);
+	check_present(lru, "456789", "0123");
+
+	/* The least used are evicted first, the oldest of those first. */
+	assert(vine_cache_evict(lfu, 1000, 0) == 3);
+	check_present(lfu, "0123489", "567");
+
+	/* The large entry has the least uses per byte. */
+	assert(vine_cache_evict(gdsf, 1000, 0) == 1);
+	check_present(gdsf, "012345", "6");
+
+	/* Pinned entries are kept. */
+	assert(vine_cache_evict(pinned, 1000, 0) == 3);
+	check_present(pinned, "0456789", "123");
+
+	/* When everything left is in use, the eviction is not retried... */
+	vine_cache_addfile(pinned, 250, 0644, "f0");
+	assert(vine_cache_evict(pinned, 1000, 0) == 0);
+	vine_cache_unpin(pinned, "e9");
+	assert(vine_cache_evict(pinned, 1000, 0) == 0);
+	check_present(pinned, "9", "");
+
+	/* ...until the cache grows. */
+	vine_cache_addfile(pinned, 10, 0644, "f1");
+	assert(vine_cache_evict(pinned, 1000, 0) == 1);
+	check_present(pinned, "08", "9");
+
+	/* A task whose input was evicted is forsaken without holding any pins. */
+	assert(vine_cache_evict(forsaken, 1000, 0) == 3);
+
+	vine_hack_do_not_compute_cached_name = 1;
+	struct vine_task *t = vine_task_create("true");
+	vine_task_add_input_file(t, "e5", "a", 0);
+	vine_task_add_input_file(t, "e6", "b", 0);
+	vine_task_add_input_file(t, "e1", "c", 0);
+	vine_task_add_input_file(t, "e7", "d", 0);
+	assert(!vine_cache_pin_task(forsaken, t));
+	vine_task_delete(t);
+
+	/* An evicted input the manager has removed is no longer expected. */
+	assert(!pin_input(forsaken, "e1"));
+	assert(!vine_cache_remove(forsaken, "e1", 0));
+	assert(pin_input(forsaken, "e1"));
+
+	/* Only the most recent evictions are remembered. */
+	assert(vine_cache_evict(bounded, 100, 0) == VINE_CACHE_EVICTED_MAX + 925);
+	assert(pin_input(bounded, "e0"));
+	assert(!pin_input(bounded, "e10924"));
+
+	/* Once old enough, e5 and e6 can be evicted as everything else. */
+	sleep(VINE_CACHE_EVICT_MIN_AGE / 1000000 + 1);
+	assert(vine_cache_evict(forsaken, 100, 0) == 7);
+	assert(vine_cache_size(forsaken) == 0);
+
+	vine_cache_delete(lru);
+	vine_cache_delete(lfu);
+	vine_cache_delete(gdsf);
+	vine_cache_delete(pinned);
+	vine_cache_delete(forsaken);
+	vine_cache_delete(bounded);
+
+	printf("vine_cache tests passed\n");
+	return 0;
+}
@@ -0,0 +1,308 @@
+/*
+Copyright (C) 2022- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Exercise the invocation of functions in a library: the binary framing
+of requests and results, many calls in flight on one library answered
+out of order, requests larger than the pipe written while the library
+is busy, the result of an abandoned call discarded, and a library that
+exits while calls are in flight. The library is this same program,
+started with the argument "library", which answers according to the
+name of each function:
+
+now:   answer at once, then answer the calls held so far.
+later: hold the call until a "now" call arrives.
+sleep: sleep two seconds before reading on, then answer as "now".
+exit:  exit at once.
+
+Each answer is the input of the call.
+*/
+
+#include "vine_process.h"
+#include "vine_task.h"
+
+#include "debug.h"
+#include "full_io.h"
+#include "link.h"
+#include "list.h"
+#include "stringtools.h"
+#include "timestamp.h"
+#include "trash.h"
+#include "xxmalloc.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEST_DIR "vine_library_test.dir"
+
+/* Larger than the buffer of a pipe, so that a request cannot be written at once. */
+#define LARGE_SIZE (4 * 1024 * 1024)
+
+extern char *workspace;
+
+static unsigned char *put_uint(unsigned char *buf, uint64_t value, int nbytes)
+{
+	int i;
+	for (i = nbytes - 1; i >= 0; i--) {
+		buf[i] = value & 0xff;
+		value >>= 8;
+	}
+	return buf + nbytes;
+}
+
+static uint64_t get_uint(const unsigned char *buf, int nbytes)
+{
+	uint64_t value = 0;
+	int i;
+	for (i = 0; i < nbytes; i++)
+		value = (value << 8) | buf[i];
+	return value;
+}
+
+static void library_respond(int fd, uint64_t id, const char *data, int64_t length)
+{
+	unsigned char header[16];
+	put_uint(put_uint(header, id, 8), length, 8);
+	assert(full_write(fd, header, sizeof(header)) == sizeof(header));
+	assert(full_write(fd, data, length) == length);
+}
+
+static int library_main(int input_fd, int output_fd)
+{
+	const char *startup = "{\"name\":\"stub\"}";
+	library_respond(output_fd, 0, startup, strlen(startup));
+
+	struct held {
+		uint64_t id;
+		char *data;
+		int64_t length;
+	} held[16];
+	int nheld = 0;
+
+	while (1) {
+		unsigned char header[24];
+		if (full_read(input_fd, header, sizeof(header)) != sizeof(header))
+			return 0;
+
+		uint64_t id = get_uint(header, 8);
+		int64_t name_length = get_uint(header + 8, 4);
+		int64_t sandbox_length = get_uint(header + 12, 4);
+		int64_t length = get_uint(header + 16, 8);
+
+		char *name = xxmalloc(name_length + 1);
+		char *sandbox = xxmalloc(sandbox_length + 1);
+		char *data = xxmalloc(length + 1);
+		assert(full_read(input_fd, name, name_length) == name_length);
+		assert(full_read(input_fd, sandbox, sandbox_length) == sandbox_length);
+		assert(full_read(input_fd, data, length) == length);
+		name[name_length] = 0;
+
+		if (!strcmp(name, "exit"))
+			_exit(0);
+
+		if (!strcmp(name, "later")) {
+			assert(nheld < 16);
+			held[nheld].id = id;
+			held[nheld].data = data;
+			held[nheld].length = length;
+			nheld++;
+		} else {
+			if (!strcmp(name, "sleep"))
+				sleep(2);
+			library_respond(output_fd, id, data, length);
+			free(data);
+			while (nheld > 0) {
+				nheld--;
+				library_respond(output_fd, held[nheld].id, held[nheld].data, held[nheld].length);
+				free(held[nheld].data);
+			}
+		}
+
+		free(name);
+		free(sandbox);
+	}
+}
+
+static struct vine_process *library;
+static int next_task_id = 1;
+
+static struct vine_process *invoke(const char *function, const char *data, int64_t length)
+{
+	struct vine_task *t = vine_task_create(function);
+	t->task_id = next_task_id++;
+
+	struct vine_process *p = vine_process_create(t, VINE_PROCESS_TYPE_FUNCTION);
+	assert(p);
+
+	char *path = string_format("%s/infile", p->sandbox);
+	FILE *file = fopen(path, "w");
+	assert(file);
+	assert(fwrite(data, 1, length, file) == (size_t)length);
+	fclose(file);
+	free(path);
+
+	p->library_process = library;
+	vine_process_execute(p);
+
+	return p;
+}
+
+/* Move requests and results as the worker does, until the call is complete. */
+
+static void wait_for(struct vine_process *p)
+{
+	while (!p->function_complete) {
+		struct link_info links[2];
+		int n = 0;
+
+		if (library->functions_running > 0) {
+			links[n].link = library->library_read_link;
+			links[n].events = LINK_READ;
+			n++;
+		}
+		if (list_size(library->library_requests) > 0) {
+			links[n].link = library->library_write_link;
+			links[n].events = LINK_WRITE;
+			n++;
+		}
+		assert(n > 0);
+
+		if (link_poll(links, n, 1000) > 0) {
+			int i;
+			for (i = 0; i < n; i++) {
+				if ((links[i].revents & LINK_READ) && library->functions_running > 0)
+					vine_process_library_receive(library);
+				if ((links[i].revents & LINK_WRITE) && list_size(library->library_requests) > 0)
+					vine_process_library_send(library);
+			}
+		}
+	}
+}
+
+static void check_result(struct vine_process *p, const char *data, int64_t length)
+{
+	struct stat info;
+	assert(p->function_complete && p->exit_code == 0);
+	assert(stat(p->output_file_name, &info) == 0 && info.st_size == length);
+
+	char *result = xxmalloc(length + 1);
+	FILE *file = fopen(p->output_file_name, "r");
+	assert(file);
+	assert(fread(result, 1, length, file) == (size_t)length);
+	fclose(file);
+	assert(!memcmp(result, data, length));
+	free(result);
+}
+
+static void check_failed(struct vine_process *p)
+{
+	struct stat info;
+	assert(p->function_complete && p->exit_code != 0);
+	assert(stat(p->output_file_name, &info) != 0 || info.st_size == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	char self[PATH_MAX];
+
+	if (argc == 6 && !strcmp(argv[1], "library"))
+		return library_main(atoi(argv[3]), atoi(argv[5]));
+
+	debug_config(argv[0]);
+	alarm(60);
+
+	assert(realpath(argv[0], self));
+	workspace = TEST_DIR;
+	mkdir(TEST_DIR, 0755);
+	trash_setup(TEST_DIR "/trash");
+
+	char *large = xxmalloc(LARGE_SIZE);
+	int i;
+	for (i = 0; i < LARGE_SIZE; i++)
+		large[i] = 'a' + i % 26;
+
+	char *command = string_format("%s library", self);
+	struct vine_task *t = vine_task_create(command);
+	free(command);
+	t->task_id = next_task_id++;
+	vine_task_provides_library(t, "stub");
+	vine_task_set_function_slots(t, 16);
+
+	library = vine_process_create(t, VINE_PROCESS_TYPE_LIBRARY);
+	assert(vine_process_execute(library) > 0);
+
+	/* Calls in flight together are answered out of order. */
+	struct vine_process *a = invoke("later", "a", 1);
+	struct vine_process *b = invoke("now", "bb", 2);
+	assert(library->functions_running == 2);
+	wait_for(b);
+	wait_for(a);
+	check_result(a, "a", 1);
+	check_result(b, "bb", 2);
+	assert(library->functions_running == 0);
+
+	/* A request larger than the pipe does not block while the library is busy. */
+	struct vine_process *s = invoke("sleep", "s", 1);
+	timestamp_t start = timestamp_get();
+	struct vine_process *g = invoke("now", large, LARGE_SIZE);
+	assert(timestamp_get() - start < 1000000);
+	assert(list_size(library->library_requests) > 0);
+	wait_for(s);
+	wait_for(g);
+	check_result(s, "s", 1);
+	check_result(g, large, LARGE_SIZE);
+
+	/* The result of an abandoned call is discarded, and a deleted call is forgotten. */
+	struct vine_process *c = invoke("later", "c", 1);
+	struct vine_process *k = invoke("later", "k", 1);
+	vine_process_kill(c);
+	check_failed(c);
+	vine_process_delete(k);
+	assert(library->functions_running == 0);
+
+	/* So is a call abandoned while its request is partly written, which is still completed. */
+	struct vine_process *e = invoke("now", large, LARGE_SIZE);
+	assert(list_size(library->library_requests) > 0);
+	vine_process_kill(e);
+	assert(list_size(library->library_requests) > 0);
+
+	struct vine_process *d = invoke("now", "d", 1);
+	wait_for(d);
+	check_result(d, "d", 1);
+	check_failed(e);
+
+	/* A library that exits fails the calls in flight. */
+	struct vine_process *h = invoke("later", "h", 1);
+	struct vine_process *x = invoke("exit", "x", 1);
+	wait_for(h);
+	wait_for(x);
+	check_failed(h);
+	check_failed(x);
+	assert(library->functions_running == 0);
+	assert(list_size(library->library_requests) == 0);
+
+	assert(vine_process_wait(library));
+
+	vine_process_delete(a);
+	vine_process_delete(b);
+	vine_process_delete(s);
+	vine_process_delete(g);
+	vine_process_delete(c);
+	vine_process_delete(e);
+	vine_process_delete(d);
+	vine_process_delete(h);
+	vine_process_delete(x);
+	vine_process_delete(library);
+	free(large);
+
+	printf("vine_library tests passed\n");
+	return 0;
+}
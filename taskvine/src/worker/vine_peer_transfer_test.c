@@ -0,0 +1,137 @@
+/*
+Copyright (C) 2022- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Exercise the threads that fetch files from peer workers: a file is
+fetched from a transfer server, a transfer stuck on a peer that never
+answers is cancelled and gives its thread back, a transfer waiting
+for a thread is dropped, and deleting the cache stops the threads
+while a transfer is still stuck. A stuck transfer would otherwise hold
+its thread for fifteen minutes, so an alarm fails the test instead.
+*/
+
+#include "vine_cache.h"
+#include "vine_transfer_server.h"
+
+#include "debug.h"
+#include "link.h"
+#include "stringtools.h"
+#include "trash.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEST_DIR "vine_peer_transfer_test.dir"
+#define TEST_DATA "data sent from one worker to another\n"
+
+static void queue(struct vine_cache *c, const char *addr, int port, const char *path, const char *cachename)
+{
+	char *source = string_format("worker://%s:%d/%s", addr, port, path);
+	vine_cache_queue_transfer(c, source, cachename, 0, 0644);
+	assert(vine_cache_ensure(c, cachename) == VINE_CACHE_STATUS_PROCESSING);
+	free(source);
+}
+
+static vine_cache_status_t wait_for(struct vine_cache *c, const char *cachename)
+{
+	vine_cache_status_t status;
+	while ((status = vine_cache_ensure(c, cachename)) == VINE_CACHE_STATUS_PROCESSING) {
+		usleep(10000);
+		vine_cache_wait(c, 0);
+	}
+	return status;
+}
+
+static void check_data(struct vine_cache *c, const char *cachename)
+{
+	char buffer[256];
+	char *path = vine_cache_full_path(c, cachename);
+	FILE *file = fopen(path, "r");
+	assert(file);
+	assert(fgets(buffer, sizeof(buffer), file));
+	assert(!strcmp(buffer, TEST_DATA));
+	fclose(file);
+	free(path);
+}
+
+/* Partial transfers must not be left behind in the cache directory. */
+
+static void check_no_partial(const char *dirname)
+{
+	DIR *dir = opendir(dirname);
+	struct dirent *d;
+	assert(dir);
+	while ((d = readdir(dir)))
+		assert(!strstr(d->d_name, ".transfer."));
+	closedir(dir);
+}
+
+int main(int argc, char *argv[])
+{
+	char addr[LINK_ADDRESS_MAX];
+	int port, stuck_port;
+
+	debug_config(argv[0]);
+	alarm(60);
+
+	mkdir(TEST_DIR, 0755);
+	mkdir(TEST_DIR "/source", 0755);
+	mkdir(TEST_DIR "/cache", 0755);
+	trash_setup(TEST_DIR "/trash");
+
+	struct vine_cache *source = vine_cache_create(TEST_DIR "/source");
+	FILE *file = fopen(TEST_DIR "/source/data", "w");
+	assert(file);
+	fputs(TEST_DATA, file);
+	fclose(file);
+	vine_cache_addfile(source, strlen(TEST_DATA), 0644, "data");
+
+	vine_transfer_server_start(source);
+	vine_transfer_server_address(addr, &port);
+
+	/* A peer that accepts connections but never answers. */
+	struct link *stuck = link_serve_address("127.0.0.1", 0);
+	assert(stuck);
+	link_address_local(stuck, addr, &stuck_port);
+
+	struct vine_cache *c = vine_cache_create(TEST_DIR "/cache");
+	vine_cache_set_max_transfers(c, 2);
+
+	queue(c, addr, port, "data", "copy");
+	assert(wait_for(c, "copy") == VINE_CACHE_STATUS_READY);
+	check_data(c, "copy");
+
+	/* Both threads are stuck on the first two, and the third waits for one. */
+	queue(c, addr, stuck_port, "data", "stuck1");
+	queue(c, addr, stuck_port, "data", "stuck2");
+	queue(c, addr, stuck_port, "data", "stuck3");
+
+	/* Cancelling gives a thread back to the next transfer. */
+	assert(vine_cache_remove(c, "stuck1", 0));
+	assert(vine_cache_remove(c, "stuck3", 0));
+	assert(!vine_cache_contains(c, "stuck1"));
+	assert(!vine_cache_contains(c, "stuck3"));
+
+	queue(c, addr, port, "data", "copy2");
+	assert(wait_for(c, "copy2") == VINE_CACHE_STATUS_READY);
+	check_data(c, "copy2");
+
+	/* The last stuck transfer is cancelled when the cache is deleted. */
+	vine_cache_delete(c);
+	check_no_partial(TEST_DIR "/cache");
+
+	link_close(stuck);
+	vine_transfer_server_stop();
+	vine_cache_delete(source);
+
+	printf("vine_peer_transfer tests passed\n");
+	return 0;
+}
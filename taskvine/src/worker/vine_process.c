@@ -13,13 +13,13 @@ See the file COPYING for details.
 #include "vine_file.h"
 #include "vine_mount.h"
 
-#include "change_process_title.h"
 #include "create_dir.h"
 #include "debug.h"
 #include "domain_name.h"
 #include "errno.h"
 #include "full_io.h"
 #include "hash_table.h"
+#include "itable.h"
 #include "link.h"
 #include "list.h"
 #include "macros.h"
@@ -34,6 +34,7 @@ See the file COPYING for details.
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <math.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -49,9 +50,56 @@ See the file COPYING for details.
 
 extern char *workspace;
 
+/*
+Messages between the worker and a library are framed in binary,
+with integers in network byte order. A request carries an invocation id,
+the lengths of the function name, the sandbox directory, and the event,
+followed by those three fields. A response carries the invocation id
+and the length of the result, followed by the result itself.
+The startup message of the library is a response with invocation id zero.
+*/
+
+#define VINE_LIBRARY_REQUEST_HEADER_SIZE 24
+#define VINE_LIBRARY_RESPONSE_HEADER_SIZE 16
+
+/* Largest startup message accepted from a library. */
+#define VINE_LIBRARY_STARTUP_MAX (1 << 20)
+
+/* Largest piece of a request or a result moved through the pipes of a library at once. */
+#define VINE_LIBRARY_CHUNK_SIZE (64 * 1024)
+
+/*
+A request waiting to be written to a library. The header is kept in
+memory, while the input of the call is read from its file as the pipe
+accepts more, so that a library slow to read its requests never holds
+up the worker.
+*/
+
+struct vine_library_request {
+	struct vine_process *p; /* The function call, or null once abandoned. */
+	char *header;
+	size_t header_length;
+	int input_fd;
+	int64_t input_length;
+	int64_t sent; /* Bytes of the header and then of the input written so far. */
+};
+
+/* The result being read from a library, which is moved into the output file of its call. */
+
+struct vine_library_response {
+	unsigned char header[VINE_LIBRARY_RESPONSE_HEADER_SIZE];
+	size_t header_read;
+	int64_t length;
+	int64_t received;
+	struct vine_process *p; /* The function call, or null if the result is discarded. */
+	int output_fd;
+};
+
 static int vine_process_wait_for_library_startup(struct vine_process *p, time_t stoptime);
-static char *vine_process_invoke_function(struct vine_process *library_process, const char *function_name,
-		const char *function_input, const char *sandbox_path);
+static int vine_process_invoke_function(struct vine_process *p);
+static void vine_process_finish_function(struct vine_process *p, int exit_code);
+static void vine_process_abandon_functions(struct vine_process *library_process);
+static void vine_process_release_function(struct vine_process *library_process, struct vine_process *p);
 
 /*
 Give the letter code used for the process sandbox dir.
@@ -97,6 +145,12 @@ struct vine_process *vine_process_create(struct vine_task *task, vine_process_ty
 	p->output_file_name = string_format("%s/.taskvine.stdout", p->sandbox);
 
 	p->functions_running = 0;
+	if (p->type == VINE_PROCESS_TYPE_LIBRARY) {
+		p->invocations = itable_create(0);
+		p->library_requests = list_create();
+		p->library_response = calloc(1, sizeof(*p->library_response));
+		p->library_response->output_fd = -1;
+	}
 
 	/* Note that create_dir recursively creates parents, so a single one is sufficient. */
 
@@ -110,6 +164,17 @@ struct vine_process *vine_process_create(struct vine_task *task, vine_process_ty
 
 void vine_process_delete(struct vine_process *p)
 {
+	/* Release the function call or the library first, as both look up invocations by task id. */
+	if (p->type == VINE_PROCESS_TYPE_FUNCTION && !p->function_complete)
+		vine_process_finish_function(p, 1);
+
+	if (p->invocations) {
+		vine_process_abandon_functions(p);
+		itable_delete(p->invocations);
+		list_delete(p->library_requests);
+		free(p->library_response);
+	}
+
 	if (p->task)
 		vine_task_delete(p->task);
 
@@ -203,29 +268,6 @@ static void set_resources_vars(struct vine_process *p)
 	}
 }
 
-static char *load_input_file(struct vine_task *t)
-{
-	FILE *fp = fopen("infile", "r");
-	if (!fp) {
-		fatal("coprocess could not open file 'infile' for reading: %s", strerror(errno));
-	}
-
-	fseek(fp, 0L, SEEK_END);
-	size_t fsize = ftell(fp);
-	fseek(fp, 0L, SEEK_SET);
-	// using calloc solves problem of garbage appended to buffer
-	char *buf = calloc(fsize + 1, sizeof(*buf));
-
-	int bytes_read = full_fread(fp, buf, fsize);
-	if (bytes_read < 0) {
-		fatal("error reading file: %s", strerror(errno));
-	}
-
-	fclose(fp);
-
-	return buf;
-}
-
 /*
 After a process exit has been observed, record the completion in the process structure.
 */
@@ -248,10 +290,10 @@ static void vine_process_complete(struct vine_process *p, int status)
 				p->exit_code);
 	}
 
-	/* If this is a completed function, then decrease the number of funcs on that library. */
+	/* If this is a library, the functions still running in it will not return. */
 
-	if (p->type == VINE_PROCESS_TYPE_FUNCTION) {
-		p->library_process->functions_running--;
+	if (p->type == VINE_PROCESS_TYPE_LIBRARY) {
+		vine_process_abandon_functions(p);
 	}
 }
 
@@ -278,6 +320,12 @@ On failure, return negative value.
 
 pid_t vine_process_execute(struct vine_process *p)
 {
+	/* A function call runs inside of its library, so there is no process to start. */
+	if (p->type == VINE_PROCESS_TYPE_FUNCTION) {
+		vine_process_invoke_function(p);
+		return 0;
+	}
+
 	/* Flush pending stdio buffers prior to forking process, to avoid stale output in child. */
 	fflush(NULL);
 
@@ -329,11 +377,6 @@ pid_t vine_process_execute(struct vine_process *p)
 
 		debug(D_VINE, "started task %d pid %d: %s", p->task->task_id, p->pid, p->task->command_line);
 
-		/* If we just started a function, increase the number assigned to this library. */
-		if (p->type == VINE_PROCESS_TYPE_FUNCTION) {
-			p->library_process->functions_running++;
-		}
-
 		/* If we just started a library, then retain links to communicate with it. */
 		if (p->type == VINE_PROCESS_TYPE_LIBRARY) {
 
@@ -357,6 +400,10 @@ pid_t vine_process_execute(struct vine_process *p)
 				/* If it did not, then send kill signal and reap library in main loop. */
 				vine_process_kill(p);
 			}
+
+			/* From now on, requests and results move only as far as the pipes allow. */
+			link_nonblocking(p->library_read_link, 1);
+			link_nonblocking(p->library_write_link, 1);
 		} else {
 			/* For any other task type, drop the fds unused by the parent. */
 			close(input_fd);
@@ -386,25 +433,6 @@ pid_t vine_process_execute(struct vine_process *p)
 			fatal("could not change directory into %s: %s", p->sandbox, strerror(errno));
 		}
 
-		/* In the special case of a function-call-task, just load data, communicate with the library, and exit.
-		 */
-
-		if (p->type == VINE_PROCESS_TYPE_FUNCTION) {
-
-			change_process_title("vine_worker [function]");
-
-			// load data from input file
-			char *input = load_input_file(p->task);
-
-			// communicate with library to invoke the function
-			char *output = vine_process_invoke_function(
-					p->library_process, p->task->command_line, input, p->sandbox);
-
-			// write data to output file
-			full_write(output_fd, output, strlen(output));
-
-			_exit(0);
-		}
 		/* For process types other than library, set up file desciptors.
 		 * The library will use the input_fd and output_fd to talk to the manager instead. */
 		if (p->type != VINE_PROCESS_TYPE_LIBRARY) {
@@ -461,6 +489,45 @@ pid_t vine_process_execute(struct vine_process *p)
 	return 0;
 }
 
+static unsigned char *put_uint(unsigned char *buf, uint64_t value, int nbytes)
+{
+	int i;
+	for (i = nbytes - 1; i >= 0; i--) {
+		buf[i] = value & 0xff;
+		value >>= 8;
+	}
+	return buf + nbytes;
+}
+
+static uint64_t get_uint(const unsigned char *buf, int nbytes)
+{
+	uint64_t value = 0;
+	int i;
+	for (i = 0; i < nbytes; i++) {
+		value = (value << 8) | buf[i];
+	}
+	return value;
+}
+
+/*
+Read the header of a response from a library, giving back the
+invocation id and the length of the result that follows.
+*/
+
+static int vine_process_read_library_response(
+		struct link *l, uint64_t *invocation_id, int64_t *length, time_t stoptime)
+{
+	unsigned char header[VINE_LIBRARY_RESPONSE_HEADER_SIZE];
+
+	if (link_read(l, (char *)header, sizeof(header), stoptime) != sizeof(header))
+		return 0;
+
+	*invocation_id = get_uint(header, 8);
+	*length = get_uint(header + 8, 8);
+
+	return *length >= 0;
+}
+
 /*
 Given a freshly started process, wait for it to initialize and send
 back the library startup message with JSON containing the name of
@@ -469,60 +536,335 @@ the library, which should match the task's provides_library label.
 
 static int vine_process_wait_for_library_startup(struct vine_process *p, time_t stoptime)
 {
-	char buffer[VINE_LINE_MAX];
-	int length = 0;
+	uint64_t invocation_id;
+	int64_t length;
 
-	/* Read a line that gives the length of the response message. */
-	link_readline(p->library_read_link, buffer, VINE_LINE_MAX, stoptime);
-	sscanf(buffer, "%d", &length);
+	if (!vine_process_read_library_response(p->library_read_link, &invocation_id, &length, stoptime))
+		return 0;
+
+	if (invocation_id != 0 || length > VINE_LIBRARY_STARTUP_MAX) {
+		debug(D_VINE, "library pid %d sent an invalid startup message", p->pid);
+		return 0;
+	}
 
 	/* Now read that length of message and null-terminate it. */
-	link_read(p->library_read_link, buffer, length, stoptime);
-	buffer[length + 1] = 0;
+	char *buffer = xxmalloc(length + 1);
+	if (link_read(p->library_read_link, buffer, length, stoptime) != length) {
+		free(buffer);
+		return 0;
+	}
+	buffer[length] = 0;
 
 	/* Check that the response is JX and contains the expected name. */
 	struct jx *response = jx_parse_string(buffer);
+	free(buffer);
 
 	const char *name = jx_lookup_string(response, "name");
 
-	if (!strcmp(name, p->task->provides_library)) {
-		return 1;
+	int ok = name && !strcmp(name, p->task->provides_library);
+
+	jx_delete(response);
+
+	return ok;
+}
+
+static void vine_library_request_delete(struct vine_library_request *r)
+{
+	if (r->input_fd >= 0)
+		close(r->input_fd);
+	free(r->header);
+	free(r);
+}
+
+/*
+Invoke a function against a library by queueing the invocation message
+with the contents of the input file, which are written as the library
+reads them. The task id serves as the invocation id, and the result is
+collected later by vine_process_library_receive, so that many invocations
+may be in flight on the same library. Returns true if the invocation
+was queued.
+*/
+
+static int vine_process_invoke_function(struct vine_process *p)
+{
+	struct vine_process *library_process = p->library_process;
+
+	p->execution_start = timestamp_get();
+
+	itable_insert(library_process->invocations, p->task->task_id, p);
+	library_process->functions_running++;
+
+	char *input_path = string_format("%s/infile", p->sandbox);
+	int input_fd = open(input_path, O_RDONLY);
+	free(input_path);
+
+	struct stat info;
+	if (input_fd < 0 || fstat(input_fd, &info) < 0) {
+		debug(D_VINE, "function could not open file 'infile' for reading: %s", strerror(errno));
+		if (input_fd >= 0)
+			close(input_fd);
+		vine_process_finish_function(p, 1);
+		return 0;
+	}
+
+	const char *function_name = p->task->command_line;
+	size_t name_length = strlen(function_name);
+	size_t sandbox_length = strlen(p->sandbox);
+
+	/* The header, the function name, and the sandbox directory are sent together. */
+	struct vine_library_request *r = calloc(1, sizeof(*r));
+	r->p = p;
+	r->header_length = VINE_LIBRARY_REQUEST_HEADER_SIZE + name_length + sandbox_length;
+	r->header = xxmalloc(r->header_length);
+	r->input_fd = input_fd;
+	r->input_length = info.st_size;
+
+	unsigned char *h = (unsigned char *)r->header;
+	h = put_uint(h, p->task->task_id, 8);
+	h = put_uint(h, name_length, 4);
+	h = put_uint(h, sandbox_length, 4);
+	h = put_uint(h, info.st_size, 8);
+	memcpy(h, function_name, name_length);
+	memcpy(h + name_length, p->sandbox, sandbox_length);
+
+	list_push_tail(library_process->library_requests, r);
+
+	debug(D_VINE,
+			"task %d invoked function %s on library task %d",
+			p->task->task_id,
+			function_name,
+			library_process->task->task_id);
+
+	/* Write as much as the pipe takes now, and the rest when the worker finds it writable. */
+	vine_process_library_send(library_process);
+
+	return 1;
+}
+
+/*
+Write the queued requests to a library, as far as its pipe accepts
+them without blocking. Returns true if the library can still be used.
+A request is written in full even if its call was abandoned, so that
+the library does not lose its place in the stream. If a request cannot
+be written at all, the library is killed.
+*/
+
+int vine_process_library_send(struct vine_process *library_process)
+{
+	struct link *l = library_process->library_write_link;
+	struct vine_library_request *r;
+	char chunk[VINE_LIBRARY_CHUNK_SIZE];
+
+	while ((r = list_peek_head(library_process->library_requests))) {
+		ssize_t actual;
+
+		if (r->sent < r->header_length) {
+			actual = link_write_avail(l, r->header + r->sent, r->header_length - r->sent);
+		} else if (r->sent < r->header_length + r->input_length) {
+			int64_t offset = r->sent - r->header_length;
+			ssize_t length = pread(r->input_fd, chunk, MIN((int64_t)sizeof(chunk), r->input_length - offset), offset);
+			if (length <= 0) {
+				debug(D_VINE, "could not read the input of an invocation: %s", strerror(errno));
+				goto failure;
+			}
+			/* Whatever the pipe does not take now is read again from the file next time. */
+			actual = link_write_avail(l, chunk, length);
+		} else {
+			list_pop_head(library_process->library_requests);
+			vine_library_request_delete(r);
+			continue;
+		}
+
+		if (actual < 0)
+			goto failure;
+		if (actual == 0)
+			break;
+
+		r->sent += actual;
 	}
 
+	return 1;
+
+failure:
+	debug(D_VINE, "could not send invocation to library task %d", library_process->task->task_id);
+	vine_process_kill(library_process);
+	vine_process_abandon_functions(library_process);
 	return 0;
 }
 
 /*
-Invoke a function against a library by sending the invocation message,
-and then reading back the result from the necessary pipe.
+Detach a function call from the requests and the result of its library.
+A request not yet started is dropped, but one partly written must still
+be completed. The rest of a result being read is discarded.
+*/
+
+static void vine_process_release_function(struct vine_process *library_process, struct vine_process *p)
+{
+	struct vine_library_request *r;
+
+	LIST_ITERATE(library_process->library_requests, r)
+	{
+		if (r->p == p) {
+			if (r->sent == 0) {
+				list_remove(library_process->library_requests, r);
+				vine_library_request_delete(r);
+			} else {
+				r->p = 0;
+			}
+			break;
+		}
+	}
+
+	struct vine_library_response *response = library_process->library_response;
+	if (response->p == p) {
+		if (response->output_fd >= 0)
+			close(response->output_fd);
+		response->output_fd = -1;
+		response->p = 0;
+	}
+}
+
+/*
+Mark a function call as complete, and release its slot in the library.
+The library is only known to be alive while it holds the call among
+its invocations, so a call that was never invoked leaves it alone.
 */
 
-static char *vine_process_invoke_function(struct vine_process *library_process, const char *function_name,
-		const char *function_input, const char *sandbox_path)
+static void vine_process_finish_function(struct vine_process *p, int exit_code)
 {
-	/* Set a five minute timeout.  XXX This should be changeable. */
-	time_t stoptime = time(0) + 300;
+	struct vine_process *library_process = p->library_process;
 
-	/* This assumes function input is a text string, reconsider? */
-	int length = strlen(function_input);
+	if (library_process && itable_lookup(library_process->invocations, p->task->task_id) == p) {
+		itable_remove(library_process->invocations, p->task->task_id);
+		library_process->functions_running--;
+		vine_process_release_function(library_process, p);
+	}
+
+	p->library_process = 0;
+	p->exit_code = exit_code;
+	p->function_complete = 1;
+}
 
-	/* Send the function name, length of data, and sandbox directory. */
-	link_printf(library_process->library_write_link, stoptime, "%s %d %s\n", function_name, length, sandbox_path);
+/*
+Fail all the function calls waiting for results from this library,
+which is no longer in a state to be sent requests or read from.
+*/
 
-	/* Then send the function data itself. */
-	/* XXX the library code expects a newline after this, yikes. */
-	link_write(library_process->library_write_link, function_input, length, stoptime);
-	link_write(library_process->library_write_link, "\n", 1, stoptime);
+static void vine_process_abandon_functions(struct vine_process *library_process)
+{
+	struct vine_process *p;
+	struct vine_library_request *r;
+
+	while ((p = itable_pop(library_process->invocations))) {
+		library_process->functions_running--;
+		vine_process_release_function(library_process, p);
+		p->library_process = 0;
+		vine_process_finish_function(p, 1);
+	}
 
-	/* XXX The response should be returned as a variable-length buffer, not a line! */
+	while ((r = list_pop_head(library_process->library_requests)))
+		vine_library_request_delete(r);
+}
 
-	/* Now read back the response as a single line and give it back. */
-	char line[VINE_LINE_MAX];
-	if (link_readline(library_process->library_read_link, line, VINE_LINE_MAX, stoptime)) {
-		return strdup(line);
-	} else {
+/*
+Having read the header of a result, find the function call it belongs
+to and open its output file. Results of calls no longer waited for are
+discarded.
+*/
+
+static int vine_process_start_result(struct vine_process *library_process, struct vine_library_response *r)
+{
+	uint64_t invocation_id = get_uint(r->header, 8);
+	r->length = get_uint(r->header + 8, 8);
+	r->received = 0;
+
+	if (r->length < 0)
 		return 0;
+
+	r->p = itable_lookup(library_process->invocations, invocation_id);
+	if (!r->p) {
+		debug(D_VINE, "discarding result of invocation %" PRIu64 " from library", invocation_id);
+		return 1;
+	}
+
+	r->output_fd = open(r->p->output_file_name, O_WRONLY | O_TRUNC | O_CREAT, 0777);
+	if (r->output_fd < 0) {
+		debug(D_VINE, "could not open %s: %s", r->p->output_file_name, strerror(errno));
+		vine_process_finish_function(r->p, 1);
+	}
+
+	return 1;
+}
+
+/* Once a result has been read in full, its function call is complete. */
+
+static void vine_process_finish_result(struct vine_library_response *r)
+{
+	if (r->p) {
+		debug(D_VINE, "task %d received %" PRId64 " bytes of result from library", r->p->task->task_id, r->length);
+		vine_process_finish_function(r->p, 0);
+	}
+
+	r->header_read = 0;
+	r->length = 0;
+	r->received = 0;
+}
+
+/*
+Read what a library has sent without blocking, moving each result
+directly into the output file of the function call it belongs to,
+which is complete once the whole result has arrived. If the library
+closes its pipe or sends an invalid result, it is killed and false
+is returned.
+*/
+
+int vine_process_library_receive(struct vine_process *library_process)
+{
+	struct link *l = library_process->library_read_link;
+	struct vine_library_response *r = library_process->library_response;
+	char chunk[VINE_LIBRARY_CHUNK_SIZE];
+
+	while (1) {
+		ssize_t actual;
+
+		if (r->header_read < sizeof(r->header)) {
+			actual = link_read_avail(l,
+					(char *)r->header + r->header_read,
+					sizeof(r->header) - r->header_read,
+					LINK_NOWAIT);
+			if (actual > 0) {
+				r->header_read += actual;
+				if (r->header_read == sizeof(r->header) && !vine_process_start_result(library_process, r))
+					goto failure;
+			}
+		} else {
+			actual = link_read_avail(l, chunk, MIN((int64_t)sizeof(chunk), r->length - r->received), LINK_NOWAIT);
+			if (actual > 0) {
+				r->received += actual;
+				if (r->output_fd >= 0 && full_write(r->output_fd, chunk, actual) != actual) {
+					debug(D_VINE, "could not write %s: %s", r->p->output_file_name, strerror(errno));
+					vine_process_finish_function(r->p, 1);
+				}
+			}
+		}
+
+		if (actual == 0)
+			goto failure;
+		if (actual < 0) {
+			if (errno_is_temporary(errno))
+				return 1;
+			goto failure;
+		}
+
+		if (r->header_read == sizeof(r->header) && r->received == r->length)
+			vine_process_finish_result(r);
 	}
+
+failure:
+	debug(D_VINE, "could not read result from library task %d", library_process->task->task_id);
+	vine_process_kill(library_process);
+	vine_process_abandon_functions(library_process);
+	return 0;
 }
 
 /*
@@ -532,6 +874,9 @@ Returns true if complete, false otherwise.
 
 int vine_process_is_complete(struct vine_process *p)
 {
+	if (p->type == VINE_PROCESS_TYPE_FUNCTION)
+		return p->function_complete;
+
 	int status;
 	int result = wait4(p->pid, &status, WNOHANG, &p->rusage);
 	if (result == p->pid) {
@@ -549,6 +894,9 @@ Return true if the process was found, false otherwise,
 
 int vine_process_wait(struct vine_process *p)
 {
+	if (p->type == VINE_PROCESS_TYPE_FUNCTION)
+		return p->function_complete;
+
 	while (1) {
 		int status;
 		pid_t pid = waitpid(p->pid, &status, 0);
@@ -570,6 +918,15 @@ Note that the process must still be waited-for to collect its final disposition.
 
 void vine_process_kill(struct vine_process *p)
 {
+	/* A function call cannot be stopped inside of its library, so just stop waiting for its result. */
+	if (p->type == VINE_PROCESS_TYPE_FUNCTION) {
+		if (!p->function_complete) {
+			debug(D_VINE, "abandoning function call task %d", p->task->task_id);
+			vine_process_finish_function(p, 1);
+		}
+		return;
+	}
+
 	// make sure a few seconds have passed since child process was created to avoid sending a signal
 	// before it has been fully initialized. Else, the signal sent to that process gets lost.
 	timestamp_t elapsed_time_execution_start = timestamp_get() - p->execution_start;
@@ -57,6 +57,21 @@ struct vine_process {
 
 	/* If this is a library process, the number of functions it is currently running. */
 	int functions_running;
+
+	/* If this is a library process, the function calls waiting for results, indexed by invocation id. */
+	struct itable *invocations;
+
+	/* If this is a library process, the requests not yet fully written to it, oldest first. */
+	struct list *library_requests;
+
+	/* If this is a library process, the result being read from it. */
+	struct vine_library_response *library_response;
+
+	/* If a function-call task, true once its result has arrived or it was abandoned. */
+	int function_complete;
+
+	/* True while the cache entries of the task inputs are pinned for this process. */
+	int inputs_pinned;
 	
 	/* expected disk usage by the process. If no cache is used, it is the same as in task. */
 	int64_t disk;
@@ -77,6 +92,9 @@ void  vine_process_kill( struct vine_process *p );
 int   vine_process_kill_and_wait( struct vine_process *p );
 void  vine_process_delete( struct vine_process *p );
 
+int   vine_process_library_send( struct vine_process *library_process );
+int   vine_process_library_receive( struct vine_process *library_process );
+
 int   vine_process_execute_and_wait( struct vine_process *p );
 
 void  vine_process_compute_disk_needed( struct vine_process *p );
@@ -12,10 +12,13 @@ See the file COPYING for details.
 #include "vine_worker.h"
 
 #include "copy_stream.h"
+#include "copy_tree.h"
 #include "create_dir.h"
 #include "debug.h"
 #include "file_link_recursive.h"
+#include "path.h"
 #include "stringtools.h"
+#include "xxmalloc.h"
 
 #include <errno.h>
 #include <stdlib.h>
@@ -55,6 +58,42 @@ vine_cache_status_t vine_sandbox_ensure(struct vine_process *p, struct vine_cach
 	return VINE_CACHE_STATUS_READY;
 }
 
+/*
+Place a cached object into the sandbox, in the cheapest way allowed by
+the flags of the mount. By default, files are hard linked one by one,
+falling back to symlinks. A read-only input is linked with a single
+symlink, however large the tree. A writable input is copied, sharing
+blocks with the cache where the filesystem supports it, so that the
+task cannot modify the cache.
+*/
+
+static int stage_input_link(const char *cache_path, const char *sandbox_path, vine_mount_flags_t flags)
+{
+	int result;
+
+	if ((flags & VINE_READ_ONLY) && vine_worker_symlinks_enabled) {
+		char *target;
+		if (cache_path[0] == '/') {
+			target = xxstrdup(cache_path);
+		} else {
+			char *cwd = path_getcwd();
+			target = string_format("%s/%s", cwd, cache_path);
+			free(cwd);
+		}
+		debug(D_VINE, "input: symlink %s -> %s", target, sandbox_path);
+		result = symlink(target, sandbox_path) == 0;
+		free(target);
+	} else if (flags & VINE_WRITABLE) {
+		debug(D_VINE, "input: copy %s -> %s", cache_path, sandbox_path);
+		result = copy_direntry(cache_path, sandbox_path) != -1;
+	} else {
+		debug(D_VINE, "input: link %s -> %s", cache_path, sandbox_path);
+		result = file_link_recursive(cache_path, sandbox_path, vine_worker_symlinks_enabled);
+	}
+
+	return result;
+}
+
 /*
 Ensure that a given input file/dir/object is present in the cache,
 (which should have occurred from a prior transfer)
@@ -80,8 +119,7 @@ static int stage_input_file(struct vine_process *p, struct vine_mount *m, struct
 		status = vine_cache_ensure(cache, f->cached_name);
 		if (status == VINE_CACHE_STATUS_READY) {
 			create_dir_parents(sandbox_path, 0777);
-			debug(D_VINE, "input: link %s -> %s", cache_path, sandbox_path);
-			result = file_link_recursive(cache_path, sandbox_path, vine_worker_symlinks_enabled);
+			result = stage_input_link(cache_path, sandbox_path, m->flags);
 			if (!result)
 				debug(D_VINE,
 						"couldn't link %s into sandbox as %s: %s",
@@ -163,7 +201,7 @@ static int stage_output_file(struct vine_process *p, struct vine_mount *m, struc
 	if (result) {
 		struct stat info;
 		if (stat(cache_path, &info) == 0) {
-			vine_cache_addfile(cache, info.st_size, info.st_mode, f->cached_name);
+			vine_cache_addoutput(cache, info.st_size, info.st_mode, f->cached_name);
 			vine_worker_send_cache_update(manager, f->cached_name, info.st_size, 0, 0);
 		} else {
 			// This seems implausible given that the rename/copy succeded, but we still have to check...
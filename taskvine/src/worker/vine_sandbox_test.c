@@ -0,0 +1,181 @@
+/*
+Copyright (C) 2022- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Exercise the staging of inputs into a sandbox according to the flags
+of each mount: a read-only input is a single symlink to the cache, a
+writable input is a private copy, and other inputs are hard linked.
+Where the filesystem cannot share blocks, as most cannot, the copy
+falls back from a reflink to reading and writing the data.
+*/
+
+#include "vine_cache.h"
+#include "vine_process.h"
+#include "vine_sandbox.h"
+#include "vine_task.h"
+#include "vine_worker.h"
+
+#include "debug.h"
+#include "stringtools.h"
+#include "trash.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEST_DIR "vine_sandbox_test.dir"
+
+extern int vine_hack_do_not_compute_cached_name;
+extern char *workspace;
+
+static void write_file(const char *path, const char *data)
+{
+	FILE *file = fopen(path, "w");
+	assert(file);
+	fputs(data, file);
+	fclose(file);
+}
+
+static void check_data(const char *path, const char *data)
+{
+	char buffer[256];
+	FILE *file = fopen(path, "r");
+	assert(file);
+	assert(fgets(buffer, sizeof(buffer), file));
+	assert(!strcmp(buffer, data));
+	fclose(file);
+}
+
+static struct stat check_stat(struct vine_process *p, const char *name, int lstat_only)
+{
+	struct stat info;
+	char *path = string_format("%s/%s", p->sandbox, name);
+	assert((lstat_only ? lstat(path, &info) : stat(path, &info)) == 0);
+	free(path);
+	return info;
+}
+
+/* A staged input is the cached object itself, not a copy. */
+
+static void check_same(struct vine_process *p, const char *name, const char *cache_path)
+{
+	struct stat info, cache_info;
+	assert(stat(cache_path, &cache_info) == 0);
+	info = check_stat(p, name, 0);
+	assert(info.st_dev == cache_info.st_dev && info.st_ino == cache_info.st_ino);
+}
+
+static struct vine_process *stagein(struct vine_cache *c, int task_id)
+{
+	struct vine_task *t = vine_task_create("true");
+	t->task_id = task_id;
+	vine_task_add_input_file(t, "file", "ro_file", VINE_READ_ONLY);
+	vine_task_add_input_file(t, "tree", "ro_tree", VINE_READ_ONLY);
+	vine_task_add_input_file(t, "file", "rw_file", VINE_WRITABLE);
+	vine_task_add_input_file(t, "tree", "rw_tree", VINE_WRITABLE);
+	vine_task_add_input_file(t, "file", "sub/file", 0);
+	vine_task_add_input_file(t, "tree", "sub/tree", 0);
+
+	struct vine_process *p = vine_process_create(t, VINE_PROCESS_TYPE_STANDARD);
+	assert(p);
+	assert(vine_sandbox_stagein(p, c));
+	return p;
+}
+
+int main(int argc, char *argv[])
+{
+	char cwd[PATH_MAX];
+	char target[PATH_MAX];
+
+	debug_config(argv[0]);
+	vine_hack_do_not_compute_cached_name = 1;
+
+	assert(getcwd(cwd, sizeof(cwd)));
+	workspace = TEST_DIR;
+	mkdir(TEST_DIR, 0755);
+	mkdir(TEST_DIR "/cache", 0755);
+	mkdir(TEST_DIR "/cache/tree", 0755);
+	mkdir(TEST_DIR "/cache/tree/dir", 0755);
+	trash_setup(TEST_DIR "/trash");
+
+	write_file(TEST_DIR "/cache/file", "file\n");
+	write_file(TEST_DIR "/cache/tree/dir/leaf", "leaf\n");
+
+	struct vine_cache *c = vine_cache_create(TEST_DIR "/cache");
+	vine_cache_addfile(c, 5, 0644, "file");
+	vine_cache_addfile(c, 5, 0755, "tree");
+
+	struct vine_process *p = stagein(c, 1);
+
+	/* Read-only inputs are absolute symlinks, even to a relative cache. */
+	struct stat info = check_stat(p, "ro_file", 1);
+	assert(S_ISLNK(info.st_mode));
+	char *path = string_format("%s/ro_file", p->sandbox);
+	ssize_t length = readlink(path, target, sizeof(target) - 1);
+	assert(length > 0);
+	target[length] = 0;
+	free(path);
+	path = string_format("%s/" TEST_DIR "/cache/file", cwd);
+	assert(!strcmp(target, path));
+	free(path);
+
+	info = check_stat(p, "ro_tree", 1);
+	assert(S_ISLNK(info.st_mode));
+	check_same(p, "ro_tree/dir/leaf", TEST_DIR "/cache/tree/dir/leaf");
+
+	/* Writable inputs are copies, which the task may modify freely. */
+	info = check_stat(p, "rw_file", 1);
+	assert(S_ISREG(info.st_mode));
+	info = check_stat(p, "rw_tree", 1);
+	assert(S_ISDIR(info.st_mode));
+
+	path = string_format("%s/rw_file", p->sandbox);
+	check_data(path, "file\n");
+	write_file(path, "modified\n");
+	free(path);
+
+	path = string_format("%s/rw_tree/dir/leaf", p->sandbox);
+	check_data(path, "leaf\n");
+	write_file(path, "modified\n");
+	free(path);
+
+	check_data(TEST_DIR "/cache/file", "file\n");
+	check_data(TEST_DIR "/cache/tree/dir/leaf", "leaf\n");
+
+	/* Other inputs are hard linked, file by file. */
+	check_same(p, "sub/file", TEST_DIR "/cache/file");
+	info = check_stat(p, "sub/tree", 1);
+	assert(S_ISDIR(info.st_mode));
+	check_same(p, "sub/tree/dir/leaf", TEST_DIR "/cache/tree/dir/leaf");
+
+	vine_process_delete(p);
+
+	/* Without symlinks, read-only inputs are hard linked as well. */
+	vine_worker_symlinks_enabled = 0;
+	p = stagein(c, 2);
+
+	info = check_stat(p, "ro_file", 1);
+	assert(S_ISREG(info.st_mode));
+	check_same(p, "ro_file", TEST_DIR "/cache/file");
+	info = check_stat(p, "ro_tree", 1);
+	assert(S_ISDIR(info.st_mode));
+	check_same(p, "ro_tree/dir/leaf", TEST_DIR "/cache/tree/dir/leaf");
+
+	vine_process_delete(p);
+
+	/* Removing the sandboxes leaves the cache intact. */
+	check_data(TEST_DIR "/cache/file", "file\n");
+	check_data(TEST_DIR "/cache/tree/dir/leaf", "leaf\n");
+
+	vine_cache_delete(c);
+
+	printf("vine_sandbox tests passed\n");
+	return 0;
+}
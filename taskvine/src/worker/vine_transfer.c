@@ -14,6 +14,7 @@ See the file COPYING for details.
 #include "stringtools.h"
 #include "unlink_recursive.h"
 #include "url_encode.h"
+#include "xxmalloc.h"
 
 #include <dirent.h>
 #include <errno.h>
@@ -250,13 +251,29 @@ static int vine_transfer_get_file_internal(
 static int vine_transfer_get_dir_internal(struct link *lnk, const char *dirname, int64_t *totalsize, time_t stoptime);
 
 /*
-Receive a single item of unknown type into the directory "dirname".
+Receive a single item of unknown type into the directory "dirname",
+or at "itempath" if given.
 Returns 0 on failure to transfer.
 Returns 1 on successful transfer of one item.
 Returns 2 on successful receipt of "end" of list.
 */
 
-static int vine_transfer_get_any_internal(struct link *lnk, const char *dirname, int64_t *totalsize, time_t stoptime)
+/*
+Local path of an item named on the wire: either its name within the
+enclosing directory, or the path given for the item received at the top.
+*/
+
+static char *vine_transfer_item_path(const char *dirname, const char *itempath, const char *name)
+{
+	if (itempath) {
+		return xxstrdup(itempath);
+	} else {
+		return string_format("%s/%s", dirname, name);
+	}
+}
+
+static int vine_transfer_get_any_internal(
+		struct link *lnk, const char *dirname, const char *itempath, int64_t *totalsize, time_t stoptime)
 {
 	char line[VINE_LINE_MAX];
 	char name_encoded[VINE_LINE_MAX];
@@ -274,7 +291,7 @@ static int vine_transfer_get_any_internal(struct link *lnk, const char *dirname,
 
 		url_decode(name_encoded, name, sizeof(name));
 
-		char *subname = string_format("%s/%s", dirname, name);
+		char *subname = vine_transfer_item_path(dirname, itempath, name);
 		r = vine_transfer_get_file_internal(lnk, subname, size, mode, stoptime);
 		free(subname);
 
@@ -284,7 +301,7 @@ static int vine_transfer_get_any_internal(struct link *lnk, const char *dirname,
 
 		url_decode(name_encoded, name, sizeof(name));
 
-		char *subname = string_format("%s/%s", dirname, name);
+		char *subname = vine_transfer_item_path(dirname, itempath, name);
 		r = vine_transfer_get_symlink_internal(lnk, subname, size, stoptime);
 		free(subname);
 
@@ -294,7 +311,7 @@ static int vine_transfer_get_any_internal(struct link *lnk, const char *dirname,
 
 		url_decode(name_encoded, name, sizeof(name));
 
-		char *subname = string_format("%s/%s", dirname, name);
+		char *subname = vine_transfer_item_path(dirname, itempath, name);
 		r = vine_transfer_get_dir_internal(lnk, subname, totalsize, stoptime);
 		free(subname);
 
@@ -326,7 +343,7 @@ static int vine_transfer_get_dir_internal(struct link *lnk, const char *dirname,
 	}
 
 	while (1) {
-		int r = vine_transfer_get_any_internal(lnk, dirname, totalsize, stoptime);
+		int r = vine_transfer_get_any_internal(lnk, dirname, 0, totalsize, stoptime);
 		if (r == 1) {
 			// Successfully received one item.
 			continue;
@@ -376,22 +393,28 @@ int vine_transfer_get_file(struct link *lnk, struct vine_cache *cache, const cha
 	return r;
 }
 
+int vine_transfer_get_any_to_path(
+		struct link *lnk, const char *filename, const char *path, int64_t *totalsize, time_t stoptime)
+{
+	send_message(lnk, "get %s\n", filename);
+	int r = vine_transfer_get_any_internal(lnk, 0, path, totalsize, stoptime);
+	if (!r) {
+		// Remove the file or directory if there's any problem with getting it.
+		if (unlink_recursive(path) < 0) {
+			debug(D_VINE, "Can't remove invalid any %s: (%s)", path, strerror(errno));
+		}
+	}
+	return r;
+}
+
 int vine_transfer_get_any(struct link *lnk, struct vine_cache *cache, const char *filename, time_t stoptime)
 {
 	int64_t totalsize = 0;
-	send_message(lnk, "get %s\n", filename);
-	char *cache_root = vine_cache_full_path(cache, "");
-	int r = vine_transfer_get_any_internal(lnk, cache_root, &totalsize, stoptime);
+	char *cached_path = vine_cache_full_path(cache, filename);
+	int r = vine_transfer_get_any_to_path(lnk, filename, cached_path, &totalsize, stoptime);
 	if (r) {
 		vine_cache_addfile(cache, totalsize, 0755, filename);
-	} else {
-		// Remove the file or directory if there's any problem with getting it.
-		char *cached_path = string_format("%s/%s", cache_root, filename);
-		if (unlink_recursive(cached_path) < 0) {
-			debug(D_VINE, "Can't remove invalid any %s: (%s)", cached_path, strerror(errno));
-		}
-		free(cached_path);
 	}
-	free(cache_root);
+	free(cached_path);
 	return r;
 }
@@ -36,6 +36,18 @@ int vine_transfer_put_any( struct link *lnk, struct vine_cache *cache, const cha
 
 int vine_transfer_get_any( struct link *lnk, struct vine_cache *cache, const char *filename, time_t stoptime );
 
+/** Get any named filesystem item from a peer into a given path, without adding it to the cache.
+This may be called from a thread other than the main thread of the worker.
+@param lnk The network link to use.
+@param filename The name of the item at the peer.
+@param path The local path where the item is created.
+@param totalsize Incremented by the number of bytes received.
+@param stoptime The absolute Unix time at which to stop and accept failure.
+@return Non-zero on success, zero on failure.
+*/
+
+int vine_transfer_get_any_to_path( struct link *lnk, const char *filename, const char *path, int64_t *totalsize, time_t stoptime );
+
 /** Get a directory using the recursive transfer protocol.
 This presumes that the directory header message has already
 been read off the wire by the caller.
@@ -11,12 +11,17 @@ See the file COPYING for details.
 
 #include "change_process_title.h"
 #include "debug.h"
+#include "hash_table.h"
 #include "link.h"
 #include "link_auth.h"
-#include "process.h"
+#include "list.h"
+#include "timestamp.h"
 #include "url_encode.h"
 
 #include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -27,6 +32,9 @@ static int command_timeout = 5;
 /* The timeout to handle a valid transfer is much higher, to avoid false failures. */
 static int transfer_timeout = 3600;
 
+/* How often the bytes sent to each peer are summarized in the debug log. */
+static int report_interval = 60;
+
 /* The server link from which connections are accepted */
 static struct link *transfer_link = 0;
 
@@ -36,6 +44,91 @@ pid_t transfer_server_pid = 0;
 /* Specific port for the transfer server to listen on.  Zero means choose any available. */
 int vine_transfer_server_port = 0;
 
+/* Maximum number of peers served at once, each by a thread of the transfer server. */
+int vine_transfer_server_threads = VINE_TRANSFER_SERVER_MAX_THREADS;
+
+/*
+The transfer server is a single long-lived process. Its main thread
+accepts connections and queues them, and a pool of threads, started as
+needed up to vine_transfer_server_threads, serves one connection at a
+time each. Files are sent with link_stream_from_fd, and so with
+sendfile where possible. The state below is shared by the threads.
+*/
+
+struct vine_transfer_peer {
+	int64_t transfers;
+	int64_t bytes;
+	timestamp_t time;
+};
+
+static struct vine_cache *server_cache = 0;
+static struct list *connections = 0;
+static struct hash_table *peers = 0;
+static int nthreads = 0;
+static int idle_threads = 0;
+static pthread_mutex_t server_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t server_cond = PTHREAD_COND_INITIALIZER;
+
+/* The authentication of links uses static buffers, so it is done by one thread at a time. */
+static pthread_mutex_t auth_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Add a completed transfer to the account of the peer at addr. */
+
+static void vine_transfer_account(const char *addr, const char *filename, int64_t bytes, timestamp_t elapsed)
+{
+	pthread_mutex_lock(&server_mutex);
+
+	struct vine_transfer_peer *peer = hash_table_lookup(peers, addr);
+	if (!peer) {
+		peer = calloc(1, sizeof(*peer));
+		hash_table_insert(peers, addr, peer);
+	}
+
+	peer->transfers++;
+	peer->bytes += bytes;
+	peer->time += elapsed;
+
+	debug(D_VINE,
+			"transfer server: sent %s (%" PRId64 " bytes) to %s in %.3lfs, %" PRId64 " bytes in %" PRId64
+			" transfers to this peer",
+			filename,
+			bytes,
+			addr,
+			elapsed / 1000000.0,
+			peer->bytes,
+			peer->transfers);
+
+	pthread_mutex_unlock(&server_mutex);
+}
+
+/* Summarize the bytes sent to each peer since the transfer server started. */
+
+static void vine_transfer_report()
+{
+	char *addr;
+	struct vine_transfer_peer *peer;
+
+	pthread_mutex_lock(&server_mutex);
+
+	HASH_TABLE_ITERATE(peers, addr, peer)
+	{
+		debug(D_VINE,
+				"transfer server: peer %s: %" PRId64 " transfers, %" PRId64 " bytes, %.2lf MB/s",
+				addr,
+				peer->transfers,
+				peer->bytes,
+				peer->time > 0 ? (double)peer->bytes / peer->time : 0);
+	}
+
+	debug(D_VINE,
+			"transfer server: %d threads, %d idle, %d connections waiting",
+			nthreads,
+			idle_threads,
+			list_size(connections));
+
+	pthread_mutex_unlock(&server_mutex);
+}
+
 /* Handle a single request for a transfer request from a peer. */
 
 static void vine_transfer_handler(struct link *lnk, struct vine_cache *cache)
@@ -44,10 +137,11 @@ static void vine_transfer_handler(struct link *lnk, struct vine_cache *cache)
 	char filename_encoded[VINE_LINE_MAX];
 	char filename[VINE_LINE_MAX];
 
-	change_process_title("vine_worker [transfer]");
-
 	if (vine_worker_password) {
-		if (!link_auth_password(lnk, vine_worker_password, time(0) + command_timeout)) {
+		pthread_mutex_lock(&auth_mutex);
+		int ok = link_auth_password(lnk, vine_worker_password, time(0) + command_timeout);
+		pthread_mutex_unlock(&auth_mutex);
+		if (!ok) {
 			debug(D_VINE, "transfer server: could not authenticate peer worker via password!");
 			return;
 		}
@@ -56,46 +150,96 @@ static void vine_transfer_handler(struct link *lnk, struct vine_cache *cache)
 	if (link_readline(lnk, line, sizeof(line), time(0) + command_timeout)) {
 		if (sscanf(line, "get %s", filename_encoded) == 1) {
 			url_decode(filename_encoded, filename, sizeof(filename));
+
+			char addr[LINK_ADDRESS_MAX];
+			int port;
+			if (!link_address_remote(lnk, addr, &port))
+				strcpy(addr, "unknown");
+
+			timestamp_t start = timestamp_get();
+			int64_t written = link_bytes_written(lnk);
 			vine_transfer_put_any(lnk, cache, filename, VINE_TRANSFER_MODE_ANY, time(0) + transfer_timeout);
+			vine_transfer_account(addr, filename, link_bytes_written(lnk) - written, timestamp_get() - start);
 		} else {
 			debug(D_VINE, "invalid peer transfer message: %s\n", line);
 		}
 	}
 }
 
-static void vine_transfer_process(struct vine_cache *cache)
+static void *vine_transfer_thread(void *arg)
 {
-	static int child_count = 0;
-
-	/*
-	If link is real, fork. Check if we are at the max
-	child count. If we are over, or link_accept timed out,
-	do a blocking wait on an exited child. If we are under
-	the limit, collect all exited tasks and return to recv
-	*/
+	pthread_mutex_lock(&server_mutex);
+
 	while (1) {
-		struct link *lnk = link_accept(transfer_link, time(0) + 10);
+		struct link *lnk = list_pop_head(connections);
+		if (!lnk) {
+			idle_threads++;
+			pthread_cond_wait(&server_cond, &server_mutex);
+			idle_threads--;
+			continue;
+		}
+
+		pthread_mutex_unlock(&server_mutex);
+		vine_transfer_handler(lnk, server_cache);
+		link_close(lnk);
+		pthread_mutex_lock(&server_mutex);
+	}
+
+	return 0;
+}
+
+/*
+Queue an accepted connection, and start another thread if every
+thread is busy and the limit has not been reached. Beyond the limit,
+connections wait in the queue for a thread to become available.
+*/
+
+static void vine_transfer_queue(struct link *lnk)
+{
+	pthread_mutex_lock(&server_mutex);
 
-		child_count++;
-		pid_t p = fork();
-		if (p == 0) {
-			if (lnk) {
-				vine_transfer_handler(lnk, cache);
-				link_close(lnk);
-			}
-			_exit(0);
+	list_push_tail(connections, lnk);
+
+	if (list_size(connections) > idle_threads && nthreads < vine_transfer_server_threads) {
+		pthread_t thread;
+		if (pthread_create(&thread, 0, vine_transfer_thread, 0) == 0) {
+			pthread_detach(thread);
+			nthreads++;
 		} else {
-			if (child_count < VINE_TRANSFER_PROC_MAX_CHILD) {
-				while (waitpid(-1, NULL, WNOHANG) > 0) {
-					child_count--;
-				}
-				continue;
-			}
+			debug(D_VINE, "transfer server: could not start a thread: %s", strerror(errno));
 		}
+	}
+
+	pthread_cond_signal(&server_cond);
+
+	/* If no thread could be started, serve the connection here. */
+	if (nthreads == 0) {
+		list_remove(connections, lnk);
+		pthread_mutex_unlock(&server_mutex);
+		vine_transfer_handler(lnk, server_cache);
+		link_close(lnk);
+		return;
+	}
+
+	pthread_mutex_unlock(&server_mutex);
+}
+
+static void vine_transfer_process(struct vine_cache *cache)
+{
+	server_cache = cache;
+	connections = list_create();
+	peers = hash_table_create(0, 0);
+
+	time_t next_report = time(0) + report_interval;
+
+	while (1) {
+		struct link *lnk = link_accept(transfer_link, time(0) + 10);
+		if (lnk)
+			vine_transfer_queue(lnk);
 
-		debug(D_VINE, "Transfer Server: waiting on exited child. Reached %d", child_count);
-		if (waitpid(-1, NULL, 0) > 0) {
-			child_count--;
+		if (time(0) >= next_report) {
+			vine_transfer_report();
+			next_report = time(0) + report_interval;
 		}
 	}
 }
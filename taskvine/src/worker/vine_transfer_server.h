@@ -10,12 +10,14 @@ See the file COPYING for details.
 #include "vine_cache.h"
 #include "link.h"
 
-#define VINE_TRANSFER_PROC_MAX_CHILD 8
+/* Default maximum number of peers served at once. */
+#define VINE_TRANSFER_SERVER_MAX_THREADS 64
 
 void vine_transfer_server_start( struct vine_cache *cache );
 void vine_transfer_server_stop();
 void vine_transfer_server_address( char *addr, int *port );
 
 extern int vine_transfer_server_port;
+extern int vine_transfer_server_threads;
 
 #endif
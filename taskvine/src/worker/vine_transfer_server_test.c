@@ -0,0 +1,132 @@
+/*
+Copyright (C) 2022- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Exercise the thread pool of the transfer server: peers are served at
+once by several threads, a peer that connects and says nothing does
+not hold up the others, and beyond the limit of threads connections
+wait for a thread instead of being refused.
+*/
+
+#include "vine_cache.h"
+#include "vine_transfer.h"
+#include "vine_transfer_server.h"
+
+#include "debug.h"
+#include "link.h"
+#include "stringtools.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_DIR "vine_transfer_server_test.dir"
+#define TEST_DATA "data sent from one worker to another\n"
+
+#define MAX_THREADS 3
+#define CLIENTS 8
+
+static char addr[LINK_ADDRESS_MAX];
+static int port;
+
+/* Fetch the test file into a path named by n, as a peer worker would. */
+
+static int fetch(int n)
+{
+	char buffer[256];
+	int64_t size = 0;
+	int result = 0;
+
+	struct link *l = link_connect(addr, port, time(0) + 10);
+	if (!l)
+		return 0;
+
+	char *path = string_format(TEST_DIR "/fetched.%d", n);
+
+	if (vine_transfer_get_any_to_path(l, "data", path, &size, time(0) + 30)) {
+		FILE *file = fopen(path, "r");
+		if (file) {
+			result = size == strlen(TEST_DATA) && fgets(buffer, sizeof(buffer), file) &&
+				 !strcmp(buffer, TEST_DATA);
+			fclose(file);
+		}
+	}
+
+	link_close(l);
+	free(path);
+	return result;
+}
+
+static void *fetch_thread(void *arg)
+{
+	return (void *)(long)fetch((int)(long)arg);
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	debug_config(argv[0]);
+	alarm(60);
+
+	mkdir(TEST_DIR, 0755);
+	mkdir(TEST_DIR "/source", 0755);
+
+	struct vine_cache *source = vine_cache_create(TEST_DIR "/source");
+	FILE *file = fopen(TEST_DIR "/source/data", "w");
+	assert(file);
+	fputs(TEST_DATA, file);
+	fclose(file);
+	vine_cache_addfile(source, strlen(TEST_DATA), 0644, "data");
+
+	vine_transfer_server_threads = MAX_THREADS;
+	vine_transfer_server_start(source);
+	vine_transfer_server_address(addr, &port);
+
+	/* More peers than threads are all served. */
+	pthread_t threads[CLIENTS];
+	for (i = 0; i < CLIENTS; i++)
+		assert(pthread_create(&threads[i], 0, fetch_thread, (void *)(long)i) == 0);
+	for (i = 0; i < CLIENTS; i++) {
+		void *result;
+		pthread_join(threads[i], &result);
+		assert(result);
+	}
+
+	/* Peers that say nothing hold a thread each until their command times out... */
+	struct link *silent[MAX_THREADS];
+	for (i = 0; i < MAX_THREADS - 1; i++) {
+		silent[i] = link_connect(addr, port, time(0) + 10);
+		assert(silent[i]);
+	}
+
+	/* ...but do not hold up another peer while a thread is left... */
+	time_t start = time(0);
+	assert(fetch(CLIENTS));
+	assert(time(0) - start < 2);
+
+	/* ...and once every thread is taken, the next peer waits for one. */
+	silent[i] = link_connect(addr, port, time(0) + 10);
+	assert(silent[i]);
+
+	start = time(0);
+	assert(fetch(CLIENTS + 1));
+	assert(time(0) - start >= 2);
+
+	for (i = 0; i < MAX_THREADS; i++)
+		link_close(silent[i]);
+
+	vine_transfer_server_stop();
+	vine_cache_delete(source);
+
+	printf("vine_transfer_server tests passed\n");
+	return 0;
+}
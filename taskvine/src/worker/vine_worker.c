@@ -176,8 +176,15 @@ static int64_t gpus_allocated = 0;
 
 static int64_t files_counted = 0;
 
+/* Eviction policy of the cache, and watermarks as percents of the disk. */
+static vine_cache_eviction_t cache_eviction = VINE_CACHE_EVICT_LRU;
+static int cache_high_watermark = VINE_CACHE_HIGH_WATERMARK_DEFAULT;
+static int cache_low_watermark = VINE_CACHE_LOW_WATERMARK_DEFAULT;
+static int cache_max_transfers = VINE_CACHE_MAX_TRANSFERS_DEFAULT;
+
 static int check_resources_interval = 5;
 static int max_time_on_measurement = 3;
+static int disk_reconcile_interval = 300;
 
 // Table of all processes in any state, indexed by task_id.
 // Processes should be created/deleted when added/removed from this table.
@@ -255,40 +262,60 @@ If time(0) > idle_stoptime, then the worker will disconnect.
 static void reset_idle_timer() { idle_stoptime = time(0) + idle_timeout; }
 
 /*
-Measure the disk used by the worker. We only manually measure the cache directory, as processes measure themselves.
+Measure the disk used by the worker. The cache keeps track of the size of
+its entries as they are added and removed, and processes measure their
+own sandboxes, so the cache directory is walked only once every
+disk_reconcile_interval seconds to account for anything the cache does
+not know about, such as transfers in progress. As those transfers become
+ready entries they are counted by the cache, so whatever the cache has
+added since the walk is taken off what the walk found unaccounted.
 */
 
 static int64_t measure_worker_disk()
 {
 	static struct path_disk_size_info *state = NULL;
+	static time_t last_reconcile = 0;
+	static int64_t unaccounted_size = 0;
+	static int64_t unaccounted_files = 0;
+	static int64_t added_size_at_reconcile = 0;
+	static int64_t added_count_at_reconcile = 0;
 
 	if (!global_cache)
 		return 0;
 
-	char *cache_dir = vine_cache_full_path(global_cache, ".");
-	path_disk_size_info_get_r(cache_dir, max_time_on_measurement, &state);
-	free(cache_dir);
+	int64_t added_size, added_count;
+
+	if (!state || !state->complete_measurement || time(0) >= last_reconcile + disk_reconcile_interval) {
+		char *cache_dir = vine_cache_full_path(global_cache, ".");
+		path_disk_size_info_get_r(cache_dir, max_time_on_measurement, &state);
+		free(cache_dir);
 
-	int64_t disk_measured = 0;
-	if (state->last_byte_size_complete >= 0) {
-		disk_measured = (int64_t)ceil(state->last_byte_size_complete / (1.0 * MEGA));
+		if (state->complete_measurement) {
+			unaccounted_size = MAX(0, state->last_byte_size_complete - vine_cache_size(global_cache));
+			unaccounted_files = MAX(0, state->last_file_count_complete - vine_cache_count(global_cache));
+			vine_cache_added(global_cache, &added_size_at_reconcile, &added_count_at_reconcile);
+			last_reconcile = time(0);
+			debug(D_VINE,
+					"cache directory measured: %" PRId64 " bytes not accounted by the cache",
+					unaccounted_size);
+		}
 	}
 
-	files_counted = state->last_file_count_complete;
+	vine_cache_added(global_cache, &added_size, &added_count);
+	int64_t pending_size = MAX(0, unaccounted_size - (added_size - added_size_at_reconcile));
+	int64_t pending_files = MAX(0, unaccounted_files - (added_count - added_count_at_reconcile));
 
-	if (state->complete_measurement) {
-		/* if a complete measurement has been done, then update
-		 * for the found value, and add the known values of the processes. */
+	int64_t disk_measured = (int64_t)ceil((vine_cache_size(global_cache) + pending_size) / (1.0 * MEGA));
+	files_counted = vine_cache_count(global_cache) + pending_files;
 
-		struct vine_process *p;
-		uint64_t task_id;
+	struct vine_process *p;
+	uint64_t task_id;
 
-		ITABLE_ITERATE(procs_table, task_id, p)
-		{
-			if (p->sandbox_size > 0) {
-				disk_measured += p->sandbox_size;
-				files_counted += p->sandbox_file_count;
-			}
+	ITABLE_ITERATE(procs_table, task_id, p)
+	{
+		if (p->sandbox_size > 0) {
+			disk_measured += p->sandbox_size;
+			files_counted += p->sandbox_file_count;
 		}
 	}
 
@@ -509,6 +536,7 @@ static int start_process(struct vine_process *p, struct link *manager)
 
 	/* Create the sandbox environment for the task. */
 	if (!vine_sandbox_stagein(p, global_cache)) {
+		p->library_process = 0;
 		p->execution_start = p->execution_end = timestamp_get();
 		p->result = VINE_RESULT_INPUT_MISSING;
 		p->exit_code = 1;
@@ -776,6 +804,18 @@ static struct vine_task *do_task_body(struct link *manager, int task_id, time_t
 	return task;
 }
 
+void forsake_waiting_process(struct link *manager, struct vine_process *p)
+{
+	/* the task cannot run in this worker */
+	p->result = VINE_RESULT_FORSAKEN;
+	itable_insert(procs_complete, p->task->task_id, p);
+
+	debug(D_VINE, "Waiting task %d has been forsaken.", p->task->task_id);
+
+	/* we also send updated resources to the manager. */
+	send_keepalive(manager, 1);
+}
+
 static int do_task(struct link *manager, int task_id, time_t stoptime)
 {
 	struct vine_task *task = do_task_body(manager, task_id, stoptime);
@@ -802,12 +842,47 @@ static int do_task(struct link *manager, int task_id, time_t stoptime)
 
 	normalize_resources(p);
 
+	/* If an input was evicted before the task arrived, let the manager send it again. */
+	if (!vine_cache_pin_task(global_cache, task)) {
+		debug(D_VINE, "an input of task %d was evicted from the cache", task->task_id);
+		forsake_waiting_process(manager, p);
+		return 1;
+	}
+	p->inputs_pinned = 1;
+
 	list_push_tail(procs_waiting, p);
 	vine_watcher_add_process(watcher, p);
 
 	return 1;
 }
 
+/*
+Handle a batch of tasks from the manager, sent as a single message
+consisting of a sequence of individual task messages.
+*/
+
+static int do_tasks(struct link *manager, int ntasks, time_t stoptime)
+{
+	char line[VINE_LINE_MAX];
+	int64_t task_id;
+	int i;
+
+	for (i = 0; i < ntasks; i++) {
+		if (!recv_message(manager, line, sizeof(line), stoptime))
+			return 0;
+
+		if (sscanf(line, "task %" SCNd64, &task_id) != 1) {
+			debug(D_VINE | D_NOTICE, "invalid task in batch from manager: %s", line);
+			return 0;
+		}
+
+		if (!do_task(manager, task_id, stoptime))
+			return 0;
+	}
+
+	return 1;
+}
+
 /*
 Accept a url specification and queue it for later transfer.
 */
@@ -894,6 +969,9 @@ static int do_kill(int task_id)
 
 	vine_watcher_remove_process(watcher, p);
 
+	if (p->inputs_pinned)
+		vine_cache_unpin_task(global_cache, p->task);
+
 	vine_process_delete(p);
 
 	return 1;
@@ -1061,6 +1139,8 @@ static int handle_manager(struct link *manager)
 	if (recv_message(manager, line, sizeof(line), idle_stoptime)) {
 		if (sscanf(line, "task %" SCNd64, &task_id) == 1) {
 			r = do_task(manager, task_id, time(0) + active_timeout);
+		} else if (sscanf(line, "tasks %d", &n) == 1) {
+			r = do_tasks(manager, n, time(0) + active_timeout);
 		} else if (sscanf(line, "file %s %" SCNd64 " %o", filename_encoded, &length, &mode) == 3) {
 			url_decode(filename_encoded, filename, sizeof(filename));
 			r = vine_transfer_get_file(
@@ -1202,9 +1282,10 @@ static int process_ready_to_run_now(struct vine_process *p, struct vine_cache *c
 	if (!task_resources_fit_now(p->task))
 		return 0;
 
+	struct vine_process *library_process = 0;
 	if (p->task->needs_library) {
-		p->library_process = find_library_for_function(p->task->needs_library);
-		if (!p->library_process)
+		library_process = find_library_for_function(p->task->needs_library);
+		if (!library_process)
 			return 0;
 	}
 
@@ -1212,6 +1293,9 @@ static int process_ready_to_run_now(struct vine_process *p, struct vine_cache *c
 	if (status == VINE_CACHE_STATUS_PROCESSING)
 		return 0;
 
+	/* The library may be gone by the next attempt, so it is only kept once the call can start. */
+	p->library_process = library_process;
+
 	return 1;
 }
 
@@ -1221,18 +1305,6 @@ Return true if this process can run eventually, supposing that other processes w
 
 static int process_can_run_eventually(struct vine_process *p) { return task_resources_fit_eventually(p->task); }
 
-void forsake_waiting_process(struct link *manager, struct vine_process *p)
-{
-	/* the task cannot run in this worker */
-	p->result = VINE_RESULT_FORSAKEN;
-	itable_insert(procs_complete, p->task->task_id, p);
-
-	debug(D_VINE, "Waiting task %d has been forsaken.", p->task->task_id);
-
-	/* we also send updated resources to the manager. */
-	send_keepalive(manager, 1);
-}
-
 /*
 If 0, the worker is using more resources than promised. 1 if resource usage holds that promise.
 */
@@ -1306,6 +1378,80 @@ static int enforce_worker_promises(struct link *manager)
 	return 1;
 }
 
+/*
+Wait for a message from the manager, and for the results of any function
+calls in progress, which are received from their libraries as they arrive.
+Requests to libraries are written as their pipes have room for them.
+Returns true if the manager link is ready to read.
+*/
+
+static int wait_for_activity(struct link *manager, int wait_msec, sigset_t *mask)
+{
+	struct vine_process *p;
+	uint64_t task_id;
+	int nlinks = 0;
+
+	ITABLE_ITERATE(procs_running, task_id, p)
+	{
+		if (p->type == VINE_PROCESS_TYPE_LIBRARY) {
+			if (p->functions_running > 0)
+				nlinks++;
+			if (list_size(p->library_requests) > 0)
+				nlinks++;
+		}
+	}
+
+	if (nlinks == 0)
+		return link_usleep_mask(manager, wait_msec * 1000, mask, 1, 0);
+
+	struct link_info *links = malloc((nlinks + 1) * sizeof(*links));
+	struct vine_process **libraries = malloc((nlinks + 1) * sizeof(*libraries));
+	int n = 0;
+
+	links[n].link = manager;
+	links[n].events = LINK_READ;
+	libraries[n] = 0;
+	n++;
+
+	ITABLE_ITERATE(procs_running, task_id, p)
+	{
+		if (p->type != VINE_PROCESS_TYPE_LIBRARY)
+			continue;
+		if (p->functions_running > 0) {
+			links[n].link = p->library_read_link;
+			links[n].events = LINK_READ;
+			libraries[n] = p;
+			n++;
+		}
+		if (list_size(p->library_requests) > 0) {
+			links[n].link = p->library_write_link;
+			links[n].events = LINK_WRITE;
+			libraries[n] = p;
+			n++;
+		}
+	}
+
+	int manager_activity = 0;
+
+	if (link_poll(links, n, wait_msec) > 0) {
+		manager_activity = (links[0].revents & LINK_READ) ? 1 : 0;
+
+		/* A library that fails is killed and its calls abandoned, so the other link is not used after. */
+		int i;
+		for (i = 1; i < n; i++) {
+			if ((links[i].revents & LINK_READ) && libraries[i]->functions_running > 0)
+				vine_process_library_receive(libraries[i]);
+			if ((links[i].revents & LINK_WRITE) && list_size(libraries[i]->library_requests) > 0)
+				vine_process_library_send(libraries[i]);
+		}
+	}
+
+	free(links);
+	free(libraries);
+
+	return manager_activity;
+}
+
 static void work_for_manager(struct link *manager)
 {
 	sigset_t mask;
@@ -1359,7 +1505,7 @@ static void work_for_manager(struct link *manager)
 			sigchld_received_flag = 0;
 		}
 
-		int manager_activity = link_usleep_mask(manager, wait_msec * 1000, &mask, 1, 0);
+		int manager_activity = wait_for_activity(manager, wait_msec, &mask);
 		if (manager_activity < 0)
 			break;
 
@@ -1375,6 +1521,8 @@ static void work_for_manager(struct link *manager)
 
 		measure_worker_resources();
 
+		vine_cache_evict(global_cache, local_resources->disk.total * MEGA, manager);
+
 		if (!enforce_worker_promises(manager)) {
 			finish_running_tasks(VINE_RESULT_FORSAKEN);
 			abort_flag = 1;
@@ -1545,6 +1693,8 @@ static int workspace_prepare()
 		debug(D_VINE, "cache directory already exists!");
 	}
 	global_cache = vine_cache_create(cachedir);
+	vine_cache_set_eviction(global_cache, cache_eviction, cache_high_watermark, cache_low_watermark);
+	vine_cache_set_max_transfers(global_cache, cache_max_transfers);
 	free(cachedir);
 
 	char *tmp_name = string_format("%s/temp", workspace);
@@ -2033,8 +2183,21 @@ static void show_help(const char *cmd)
 	printf(" %-30s One of by_ip, by_hostname, or by_apparent_ip. Default is set by manager.\n", "");
 
 	printf(" %-30s Forbid the use of symlinks for cache management.\n", "--disable-symlinks");
+	printf(" %-30s Policy to evict files when the cache fills the disk: lru, lfu, gdsf or none.\n",
+			"--cache-eviction=<policy>");
+	printf(" %-30s (default=lru)\n", "");
+	printf(" %-30s Percents of the disk at which eviction starts and stops. (default=%d,%d)\n",
+			"--cache-watermarks=<high>,<low>",
+			VINE_CACHE_HIGH_WATERMARK_DEFAULT,
+			VINE_CACHE_LOW_WATERMARK_DEFAULT);
+	printf(" %-30s Maximum number of files fetched from other workers at once. (default=%d)\n",
+			"--cache-transfers=<n>",
+			VINE_CACHE_MAX_TRANSFERS_DEFAULT);
 	printf(" %-30s Single-shot mode -- quit immediately after disconnection.\n", "--single-shot");
 	printf(" %-30s Listening port for worker-worker transfers. (default: any)\n", "--transfer-port");
+	printf(" %-30s Maximum number of workers served at once by worker-worker transfers. (default: %d)\n",
+			"--transfer-threads=<n>",
+			VINE_TRANSFER_SERVER_MAX_THREADS);
 }
 
 enum {
@@ -2057,7 +2220,11 @@ enum {
 	LONG_OPT_USE_SSL,
 	LONG_OPT_PYTHON_FUNCTION,
 	LONG_OPT_FROM_FACTORY,
-	LONG_OPT_TRANSFER_PORT
+	LONG_OPT_TRANSFER_PORT,
+	LONG_OPT_CACHE_EVICTION,
+	LONG_OPT_CACHE_WATERMARKS,
+	LONG_OPT_CACHE_TRANSFERS,
+	LONG_OPT_TRANSFER_THREADS
 };
 
 static const struct option long_options[] = {{"advertise", no_argument, 0, 'a'},
@@ -2095,6 +2262,10 @@ static const struct option long_options[] = {{"advertise", no_argument, 0, 'a'},
 		{"ssl", no_argument, 0, LONG_OPT_USE_SSL},
 		{"from-factory", required_argument, 0, LONG_OPT_FROM_FACTORY},
 		{"transfer-port", required_argument, 0, LONG_OPT_TRANSFER_PORT},
+		{"transfer-threads", required_argument, 0, LONG_OPT_TRANSFER_THREADS},
+		{"cache-eviction", required_argument, 0, LONG_OPT_CACHE_EVICTION},
+		{"cache-watermarks", required_argument, 0, LONG_OPT_CACHE_WATERMARKS},
+		{"cache-transfers", required_argument, 0, LONG_OPT_CACHE_TRANSFERS},
 		{0, 0, 0, 0}};
 
 int main(int argc, char *argv[])
@@ -2279,6 +2450,37 @@ int main(int argc, char *argv[])
 		case LONG_OPT_TRANSFER_PORT:
 			vine_transfer_server_port = atoi(optarg);
 			break;
+		case LONG_OPT_TRANSFER_THREADS:
+			vine_transfer_server_threads = atoi(optarg);
+			if (vine_transfer_server_threads < 1) {
+				fprintf(stderr, "vine_worker: invalid number of transfer threads: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case LONG_OPT_CACHE_EVICTION: {
+			int eviction = vine_cache_eviction_from_string(optarg);
+			if (eviction < 0) {
+				fprintf(stderr, "vine_worker: unknown cache eviction policy: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			cache_eviction = eviction;
+			break;
+		}
+		case LONG_OPT_CACHE_WATERMARKS:
+			if (sscanf(optarg, "%d,%d", &cache_high_watermark, &cache_low_watermark) != 2 ||
+					cache_low_watermark < 0 || cache_high_watermark > 100 ||
+					cache_low_watermark > cache_high_watermark) {
+				fprintf(stderr, "vine_worker: invalid cache watermarks: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case LONG_OPT_CACHE_TRANSFERS:
+			cache_max_transfers = atoi(optarg);
+			if (cache_max_transfers < 1) {
+				fprintf(stderr, "vine_worker: invalid number of cache transfers: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
 		default:
 			show_help(argv[0]);
 			return 1;
@@ -0,0 +1,46 @@
+/*
+Copyright (C) 2022- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Stand-ins for the parts of vine_worker.c used by the other worker
+modules, so that the modules can be linked into test programs
+without the worker itself. Messages are exchanged with peers as the
+worker does, but updates to the manager are discarded.
+*/
+
+#include "vine_resources.h"
+#include "vine_worker.h"
+
+#include "link.h"
+#include "timestamp.h"
+
+#include <stdarg.h>
+
+char *workspace = 0;
+struct vine_resources *total_resources = 0;
+
+int vine_worker_symlinks_enabled = 1;
+char *vine_worker_password = 0;
+
+void send_message(struct link *l, const char *fmt, ...)
+{
+	va_list va;
+	va_start(va, fmt);
+	link_vprintf(l, time(0) + 60, fmt, va);
+	va_end(va);
+}
+
+int recv_message(struct link *l, char *line, int length, time_t stoptime)
+{
+	return link_readline(l, line, length, stoptime);
+}
+
+void vine_worker_send_cache_update(
+		struct link *manager, const char *cachename, int64_t size, timestamp_t transfer_time, timestamp_t transfer_start)
+{
+}
+
+void vine_worker_send_cache_invalid(struct link *manager, const char *cachename, const char *message) {}
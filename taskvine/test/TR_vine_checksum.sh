@@ -0,0 +1,24 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+prepare()
+{
+	return 0
+}
+
+run()
+{
+	../src/tools/vine_checksum_test
+	return $?
+}
+
+clean()
+{
+	rm -rf vine_checksum_test.dir vine-run-info
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,24 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+prepare()
+{
+	return 0
+}
+
+run()
+{
+	../src/worker/vine_transfer_server_test
+	return $?
+}
+
+clean()
+{
+	rm -rf vine_transfer_server_test.dir
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -624,6 +624,23 @@ static int send_worker_msg( struct work_queue *q, struct work_queue_worker *w, c
 	return result;
 }
 
+/*
+Send a message assembled from several pieces to a worker, with a single writev.
+Returns the number of bytes sent, or a number less than zero on error.
+*/
+
+static int send_worker_vector( struct work_queue *q, struct work_queue_worker *w, const struct iovec *iov, int iovcnt )
+{
+	time_t stoptime;
+
+	if(w->type == WORKER_TYPE_FOREMAN)
+		stoptime = time(0) + q->long_timeout;
+	else
+		stoptime = time(0) + q->short_timeout;
+
+	return link_writev(w->link, iov, iovcnt, stoptime);
+}
+
 void work_queue_broadcast_message(struct work_queue *q, const char *msg) {
 	if(!q)
 		return;
@@ -3869,35 +3886,59 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 		return result;
 	}
 
-	send_worker_msg(q,w, "task %lld\n",  (long long) t->taskid);
+	/*
+	The description of the task is accumulated in memory and sent
+	with a single writev, rather than with one write per line.
+	The command line and coprocess are sent in place, without copying.
+	*/
+	buffer_t head[1];
+	buffer_t coprocess[1];
+	buffer_t tail[1];
+	buffer_init(head);
+	buffer_init(coprocess);
+	buffer_init(tail);
+	buffer_abortonfailure(head, 1);
+	buffer_abortonfailure(coprocess, 1);
+	buffer_abortonfailure(tail, 1);
+
+	struct iovec iov[5];
+	int iovcnt = 0;
+
+	buffer_printf(head, "task %lld\n",  (long long) t->taskid);
 
 	long long cmd_len = strlen(command_line);
-	send_worker_msg(q,w, "cmd %lld\n", (long long) cmd_len);
-	link_putlstring(w->link, command_line, cmd_len, /* stoptime */ time(0) + (w->type == WORKER_TYPE_FOREMAN ? q->long_timeout : q->short_timeout));
+	buffer_printf(head, "cmd %lld\n", (long long) cmd_len);
+	debug(D_WQ, "tx to %s (%s): %s", w->hostname, w->addrport, buffer_tostring(head));
 	debug(D_WQ, "%s\n", command_line);
-	free(command_line);
 
+	iov[iovcnt].iov_base = (char *) buffer_tostring(head);
+	iov[iovcnt++].iov_len = buffer_pos(head);
+	iov[iovcnt].iov_base = command_line;
+	iov[iovcnt++].iov_len = cmd_len;
 
 	if(t->coprocess) {
-		cmd_len = strlen(t->coprocess);
-		send_worker_msg(q,w, "coprocess %lld\n", (long long) cmd_len);
-		link_putlstring(w->link, t->coprocess, cmd_len, /* stoptime */ time(0) + (w->type == WORKER_TYPE_FOREMAN ? q->long_timeout : q->short_timeout));
+		long long coprocess_len = strlen(t->coprocess);
+		buffer_printf(coprocess, "coprocess %lld\n", coprocess_len);
+		iov[iovcnt].iov_base = (char *) buffer_tostring(coprocess);
+		iov[iovcnt++].iov_len = buffer_pos(coprocess);
+		iov[iovcnt].iov_base = t->coprocess;
+		iov[iovcnt++].iov_len = coprocess_len;
 	}
 
-	send_worker_msg(q,w, "category %s\n", t->category);
+	buffer_printf(tail, "category %s\n", t->category);
 
-	send_worker_msg(q,w, "cores %s\n",  rmsummary_resource_to_str("cores", limits->cores, 0));
-	send_worker_msg(q,w, "gpus %s\n",   rmsummary_resource_to_str("gpus", limits->gpus, 0));
-	send_worker_msg(q,w, "memory %s\n", rmsummary_resource_to_str("memory", limits->memory, 0));
-	send_worker_msg(q,w, "disk %s\n",   rmsummary_resource_to_str("disk", limits->disk, 0));
+	buffer_printf(tail, "cores %s\n",  rmsummary_resource_to_str("cores", limits->cores, 0));
+	buffer_printf(tail, "gpus %s\n",   rmsummary_resource_to_str("gpus", limits->gpus, 0));
+	buffer_printf(tail, "memory %s\n", rmsummary_resource_to_str("memory", limits->memory, 0));
+	buffer_printf(tail, "disk %s\n",   rmsummary_resource_to_str("disk", limits->disk, 0));
 
 	/* Do not specify end, wall_time if running the resource monitor. We let the monitor police these resources. */
 	if(q->monitor_mode == MON_DISABLED) {
 		if(limits->end > 0) {
-			send_worker_msg(q,w, "end_time %s\n",  rmsummary_resource_to_str("end", limits->end, 0));
+			buffer_printf(tail, "end_time %s\n",  rmsummary_resource_to_str("end", limits->end, 0));
 		}
 		if(limits->wall_time > 0) {
-			send_worker_msg(q,w, "wall_time %s\n", rmsummary_resource_to_str("wall_time", limits->wall_time, 0));
+			buffer_printf(tail, "wall_time %s\n", rmsummary_resource_to_str("wall_time", limits->wall_time, 0));
 		}
 	}
 
@@ -3910,7 +3951,7 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 	char *var;
 	list_first_item(t->env_list);
 	while((var=list_next_item(t->env_list))) {
-		send_worker_msg(q, w,"env %zu\n%s\n", strlen(var), var);
+		buffer_printf(tail, "env %zu\n%s\n", strlen(var), var);
 	}
 
 	if(t->input_files) {
@@ -3918,11 +3959,11 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 		list_first_item(t->input_files);
 		while((tf = list_next_item(t->input_files))) {
 			if(tf->type == WORK_QUEUE_DIRECTORY) {
-				send_worker_msg(q,w, "dir %s\n", tf->remote_name);
+				buffer_printf(tail, "dir %s\n", tf->remote_name);
 			} else {
 				char remote_name_encoded[PATH_MAX];
 				url_encode(tf->remote_name, remote_name_encoded, PATH_MAX);
-				send_worker_msg(q,w, "infile %s %s %d\n", tf->cached_name, remote_name_encoded, tf->flags);
+				buffer_printf(tail, "infile %s %s %d\n", tf->cached_name, remote_name_encoded, tf->flags);
 			}
 		}
 	}
@@ -3933,14 +3974,22 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 		while((tf = list_next_item(t->output_files))) {
 			char remote_name_encoded[PATH_MAX];
 			url_encode(tf->remote_name, remote_name_encoded, PATH_MAX);
-			send_worker_msg(q,w, "outfile %s %s %d\n", tf->cached_name, remote_name_encoded, tf->flags);
+			buffer_printf(tail, "outfile %s %s %d\n", tf->cached_name, remote_name_encoded, tf->flags);
 		}
 	}
 
-	// send_worker_msg returns the number of bytes sent, or a number less than
-	// zero to indicate errors. We are lazy here, we only check the last
-	// message we sent to the worker (other messages may have failed above).
-	int result_msg = send_worker_msg(q,w,"end\n");
+	buffer_putliteral(tail, "end\n");
+	debug(D_WQ, "tx to %s (%s): %s", w->hostname, w->addrport, buffer_tostring(tail));
+
+	iov[iovcnt].iov_base = (char *) buffer_tostring(tail);
+	iov[iovcnt++].iov_len = buffer_pos(tail);
+
+	int result_msg = send_worker_vector(q, w, iov, iovcnt);
+
+	buffer_free(head);
+	buffer_free(coprocess);
+	buffer_free(tail);
+	free(command_line);
 
 	if(result_msg > -1)
 	{